@@ -0,0 +1,113 @@
+/*
+ * ACPI tables, found through the RSDP the bootloader takes from the UEFI configuration table.
+ * Only the MADT is read, for the local APIC ids of the cpus to start. Everything has to be
+ * in the 1:1 mapped bottom 4gb.
+ */
+
+#include <types.h>
+#include <acpi.h>
+
+#define ACPI_MAX_ADDRESS 0x100000000ULL
+
+static int acpi_checksum(const void *table, uint32_t length)
+{
+	uint8_t sum = 0;
+	for (uint32_t i = 0; i < length; i++)
+		sum += ((const uint8_t *)table)[i];
+	return sum == 0;
+}
+
+static int acpi_signature_equal(const char *a, const char *b, int n)
+{
+	for (int i = 0; i < n; i++)
+	{
+		if (a[i] != b[i])
+			return 0;
+	}
+	return 1;
+}
+
+static struct acpi_header *acpi_table(uint64_t address)
+{
+	if (address == 0x0ULL || address >= ACPI_MAX_ADDRESS)
+		return NULL;
+	struct acpi_header *table = (struct acpi_header *)address;
+	if (address + table->length > ACPI_MAX_ADDRESS || !acpi_checksum(table, table->length))
+		return NULL;
+	return table;
+}
+
+/*
+ * Looks signature up in the XSDT, or in the RSDT for ACPI 1.0. Returns NULL if it is not there.
+ */
+struct acpi_header *acpi_find_table(uintptr_t rsdp_address, const char *signature)
+{
+	if (rsdp_address == 0x0ULL || rsdp_address >= ACPI_MAX_ADDRESS)
+		return NULL;
+	struct acpi_rsdp *rsdp = (struct acpi_rsdp *)rsdp_address;
+	if (!acpi_signature_equal(rsdp->signature, "RSD PTR ", 8) || !acpi_checksum(rsdp, 20))
+		return NULL;
+
+	int xsdt = rsdp->revision >= 2 && rsdp->xsdt_address != 0x0ULL;
+	struct acpi_header *root = acpi_table(xsdt ? rsdp->xsdt_address : rsdp->rsdt_address);
+	if (root == NULL)
+		return NULL;
+	uint32_t entry_size = xsdt ? 8 : 4;
+	uint32_t entries = (root->length - sizeof(struct acpi_header)) / entry_size;
+	uint8_t *entry = (uint8_t *)(root + 1);
+
+	for (uint32_t i = 0; i < entries; i++, entry += entry_size)
+	{
+		uint64_t address = 0; // XSDT entries are only 4 byte aligned.
+		__builtin_memcpy(&address, entry, entry_size);
+		struct acpi_header *table = acpi_table(address);
+		if (table != NULL && acpi_signature_equal(table->signature, signature, 4))
+			return table;
+	}
+	return NULL;
+}
+
+/*
+ * Fills apic_ids with the local APIC ids of the enabled cpus, the boot cpu included.
+ * Returns how many there are (at most max), 0 if there is no MADT.
+ */
+int acpi_madt_cpus(uintptr_t rsdp, uint32_t *apic_ids, int max)
+{
+	struct acpi_madt *madt = (struct acpi_madt *)acpi_find_table(rsdp, "APIC");
+	if (madt == NULL)
+		return 0;
+
+	int count = 0;
+	uint8_t *entry = (uint8_t *)(madt + 1);
+	uint8_t *end = (uint8_t *)madt + madt->header.length;
+	while (entry + sizeof(struct acpi_madt_entry) <= end && count < max)
+	{
+		struct acpi_madt_entry *header = (struct acpi_madt_entry *)entry;
+		if (header->length < sizeof(struct acpi_madt_entry) || entry + header->length > end)
+			break;
+
+		uint32_t apic_id = ~0x0U;
+		if (header->type == ACPI_MADT_LAPIC && header->length >= sizeof(struct acpi_madt_lapic))
+		{
+			struct acpi_madt_lapic *lapic = (struct acpi_madt_lapic *)entry;
+			if (lapic->flags & ACPI_MADT_ENABLED)
+				apic_id = lapic->apic_id;
+		}
+		else if (header->type == ACPI_MADT_X2APIC && header->length >= sizeof(struct acpi_madt_x2apic))
+		{
+			struct acpi_madt_x2apic *x2apic = (struct acpi_madt_x2apic *)entry;
+			if (x2apic->flags & ACPI_MADT_ENABLED)
+				apic_id = x2apic->x2apic_id;
+		}
+		entry += header->length;
+		if (apic_id == ~0x0U)
+			continue;
+
+		int seen = 0; // Firmware may list a cpu both ways.
+		for (int i = 0; i < count; i++)
+			seen |= apic_ids[i] == apic_id;
+		if (!seen)
+			apic_ids[count++] = apic_id;
+	}
+	return count;
+}
@@ -7,11 +7,12 @@
 #include <msr.h>
 #include <apic.h>
 #include <printf.h>
+#include <thread.h>
+#include <timer.h>
+#include <interrupts.h>
 
 static void *lapic_base = NULL;
 
-void *apic_handler_ptr;
-
 static inline void
 cpuid(uint32_t level, uint32_t *eax_out, uint32_t *ebx_out,
 		uint32_t *ecx_out, uint32_t *edx_out)
@@ -136,13 +137,71 @@ x86_lapic_enable(void)
 	/* Reset the task priority register */
 	x86_lapic_write(X86_LAPIC_TPR, 0x00U);
 
-	x86_lapic_write(X86_LAPIC_TIMER_INIT, 0x400000U); // Set counter value.
-	x86_lapic_write(X86_LAPIC_TIMER_DIVIDE, 0x2 | (0x1U << 3)); // Set timer divisor.
-	x86_lapic_write(X86_LAPIC_TIMER, APIC_INTERRUPT_ENTRY | (0x2U << 16)); // Set the timer to correct interrupt vector entry.
+	/* The timer stays masked until timer_init() has calibrated it. */
+	x86_lapic_write(X86_LAPIC_TIMER_DIVIDE, X86_LAPIC_TIMER_DIV16);
+	x86_lapic_write(X86_LAPIC_TIMER, APIC_INTERRUPT_ENTRY | X86_LAPIC_TIMER_MASKED);
 }
 
-void apic_handler()
+/*
+ * (Re)starts the timer with an initial count, lvt holds the mode and mask bits.
+ */
+void
+x86_lapic_timer_start(uint32_t count, uint32_t lvt)
+{
+	x86_lapic_write(X86_LAPIC_TIMER, APIC_INTERRUPT_ENTRY | lvt);
+	x86_lapic_write(X86_LAPIC_TIMER_INIT, count);
+}
+
+/* Acknowledges the interrupt being handled. */
+void
+x86_lapic_eoi(void)
 {
-	printf("Timer!\n");
 	x86_lapic_write(X86_LAPIC_EOI, 0x0U);
+}
+
+/* Sends a fixed interrupt with the given vector to this cpu. */
+void
+x86_lapic_self_ipi(uint8_t vector)
+{
+	x86_lapic_write_icr(X86_LAPIC_ICR_SELF | X86_LAPIC_ICR_ASSERT | vector);
+}
+
+/*
+ * Sends an IPI to the cpu with the given local APIC id, cmd is the low half of
+ * the ICR (delivery mode, vector).
+ */
+void
+x86_lapic_send_ipi(uint32_t apic_id, uint32_t cmd)
+{
+	uint64_t flags = irq_save(); /* ICR high and low belong together. */
+	if (lapic_base == X86_LAPIC_X2APIC) {
+		x86_x2apic_write_icr(cmd, apic_id);
+	} else {
+		*(volatile uint32_t *) (lapic_base + (X86_LAPIC_ICR_HIGH << 4)) = apic_id << 24;
+		x86_lapic_write_icr(cmd);
+	}
+	irq_restore(flags);
+}
+
+uint32_t
+x86_lapic_id(void)
+{
+	return x86_lapic_read_id();
+}
+
+uint32_t
+x86_lapic_timer_count(void)
+{
+	return x86_lapic_read(X86_LAPIC_TIMER_CUR);
+}
+
+/*
+ * Timer interrupt, frame is the full register state of the interrupted thread.
+ * EOI goes first: timer_interrupt() may switch away and only come back much later.
+ */
+void
+apic_handler(trap_frame_t *frame)
+{
+	x86_lapic_eoi();
+	timer_interrupt();
 }
\ No newline at end of file
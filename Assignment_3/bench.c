@@ -0,0 +1,627 @@
+/*
+ * Latency benchmarks for the kernel entry paths, all in rdtsc cycles. The user app measures
+ * the round trips that start in user mode and hands the samples in, the kernel measures
+ * interrupt delivery itself. Results are reported as min, median, p99 and max with a
+ * power of 2 histogram, so runs on different hypervisors (or none) can be compared.
+ */
+
+#include <types.h>
+#include <bench.h>
+#include <irq.h>
+#include <apic.h>
+#include <timer.h>
+#include <thread.h>
+#include <vm.h>
+#include <palloc.h>
+#include <tlb.h>
+#include <work.h>
+#include <smp.h>
+#include <rdtsc.h>
+#include <gnttab.h>
+#include <xring.h>
+#include <hpet.h>
+#include <string.h>
+#include <errno.h>
+#include <printf.h>
+
+#define BENCH_SAMPLE_PAGES (BENCH_MAX_SAMPLES * sizeof(uint64_t) / PAGE_SIZE)
+#define BENCH_TIMER_NS 20000 // 20us ahead, well past the cost of arming it.
+#define BENCH_FANOUT_ITEMS 64
+#define BENCH_WORK_CYCLES 100000
+#define BENCH_GNTTAB_ROUNDS 100
+#define BENCH_GNTTAB_MAX_REFS 64 // Per allocation, item j takes 1 + j % 64.
+#define BENCH_GNTTAB_MAP_PAGES (GNTTAB_MAX_REFS / 8 / PAGE_SIZE)
+#define BENCH_CLOCK_READS 16		// Per sample.
+#define BENCH_CLOCK_WARP_READS 1000 // Per work item.
+#define BENCH_XRING_MSGS 10000		// Per run.
+#define BENCH_XRING_MAX_MSG 300
+#define BENCH_XRING_BATCH 8				// Messages per xring_push().
+#define BENCH_XRING_TIMEOUT_NS 1000000000ULL // A side waiting this long missed a notification.
+
+/* Clock sources bench(BENCH_CLOCK) compares */
+#define BENCH_CLOCK_PVCLOCK 0
+#define BENCH_CLOCK_TSC 1
+#define BENCH_CLOCK_TSC_ORDERED 2
+#define BENCH_CLOCK_HPET 3
+#define BENCH_CLOCKS 4
+
+static uint64_t *bench_samples;
+static volatile uint64_t bench_ipi_tsc; // When the self-IPI handler ran, 0 until then.
+static volatile uint64_t bench_timer_latency;
+static volatile int bench_timer_done;
+static work_t bench_work[BENCH_FANOUT_ITEMS];
+static volatile uint32_t bench_work_done;
+static uint64_t *bench_gnttab_owned; // A bit per grant ref handed out by the allocator.
+static volatile uint64_t bench_gnttab_dups;
+static volatile uint64_t bench_gnttab_failed;
+static uint32_t bench_clock; // Source the warp test reads.
+static volatile uint32_t bench_clock_lock;
+static volatile uint64_t bench_clock_last;
+static uint64_t bench_clock_warps;
+static xring_t bench_xring_tx;
+static xring_t bench_xring_rx;
+static work_t bench_xring_work;
+static volatile uint32_t bench_xring_kick[2]; // Stands in for an event channel to each side.
+static volatile int bench_xring_started;
+static volatile int bench_xring_result; // Of the consumer, 1 while it runs.
+static uint64_t bench_xring_notifies[2];
+static uint64_t bench_xring_bad;
+
+/* kernel.c */
+uint64_t pvclock_monotonic_read();
+extern volatile pvclock_vcpu_time_info_t *pvclock_ti;
+
+static void sort_samples(uint64_t *samples, uint32_t n)
+{
+	for (uint32_t gap = n / 2; gap > 0; gap /= 2) // Shell sort, n is small.
+	{
+		for (uint32_t i = gap; i < n; i++)
+		{
+			uint64_t value = samples[i];
+			uint32_t j = i;
+			for (; j >= gap && samples[j - gap] > value; j -= gap)
+				samples[j] = samples[j - gap];
+			samples[j] = value;
+		}
+	}
+}
+
+static inline uint32_t log2_floor(uint64_t value)
+{
+	return value == 0 ? 0 : 63 - __builtin_clzll(value);
+}
+
+/*
+ * Prints the distribution of samples, which is sorted in place.
+ */
+void bench_report(const char *name, uint64_t *samples, uint32_t n)
+{
+	if (n == 0)
+		return;
+	sort_samples(samples, n);
+	printf("%s: min %ld, median %ld, p99 %ld, max %ld cycles (%d samples)\n", name,
+		   samples[0], samples[n / 2], samples[(uint64_t)n * 99 / 100], samples[n - 1], n);
+
+	uint32_t i = 0;
+	while (i < n)
+	{
+		uint32_t bucket = log2_floor(samples[i]);
+		uint32_t count = 0;
+		for (; i < n && log2_floor(samples[i]) == bucket; i++)
+			count++;
+		printf("  %ld-%ld: %d\n", bucket == 0 ? 0 : 1ULL << bucket, (2ULL << bucket) - 1, count);
+	}
+}
+
+static void bench_ipi_handler(trap_frame_t *frame)
+{
+	bench_ipi_tsc = rdtsc();
+	x86_lapic_eoi();
+}
+
+static void bench_timer_fn(void *arg)
+{
+	bench_timer_latency = timer_irq_latency;
+	bench_timer_done = 1;
+}
+
+/* Interrupts are enabled while waiting, system calls otherwise run with them off. */
+static void bench_self_ipi(uint32_t n)
+{
+	irq_register(BENCH_IPI_VECTOR, bench_ipi_handler);
+	for (uint32_t i = 0; i < n; i++)
+	{
+		bench_ipi_tsc = 0;
+		uint64_t start = rdtsc();
+		x86_lapic_self_ipi(BENCH_IPI_VECTOR);
+		while (bench_ipi_tsc == 0)
+			__asm__ __volatile__("sti; pause; cli" ::: "memory");
+		bench_samples[i] = rdtscp() - start;
+	}
+	irq_unregister(BENCH_IPI_VECTOR);
+}
+
+/*
+ * Returns the average cycles of arming the timer, timer_add() included.
+ */
+static uint64_t bench_timer_irq(uint32_t n)
+{
+	timer_t timer;
+	uint64_t arm_cycles = 0;
+	for (uint32_t i = 0; i < n; i++)
+	{
+		bench_timer_done = 0;
+		uint64_t start = rdtsc();
+		timer_add(&timer, clock_ns() + BENCH_TIMER_NS, bench_timer_fn, NULL);
+		arm_cycles += rdtscp() - start;
+		while (!bench_timer_done)
+			__asm__ __volatile__("sti; pause; cli" ::: "memory");
+		bench_samples[i] = bench_timer_latency;
+	}
+	return arm_cycles / n;
+}
+
+/*
+ * Under Xen both ways of getting a timer interrupt on this cpu, the one in use first.
+ */
+static void bench_timer_paths(uint32_t n)
+{
+	int xen = timer_is_xen();
+	for (int pass = 0; pass < (timer_xen_available() ? 2 : 1); pass++)
+	{
+		int path = pass == 0 ? xen : !xen;
+		if (path != timer_is_xen())
+			timer_set_xen(path);
+		uint64_t arm_cycles = bench_timer_irq(n);
+		bench_report(path ? "Timer deadline to handler, Xen VIRQ_TIMER" : "Timer deadline to handler, LAPIC",
+					 bench_samples, n);
+		printf("  arming: %ld cycles\n", arm_cycles);
+	}
+	if (xen != timer_is_xen())
+		timer_set_xen(xen);
+}
+
+static void bench_work_fn(void *arg)
+{
+	uint64_t end = rdtsc() + BENCH_WORK_CYCLES;
+	while (rdtsc() < end)
+		__asm__ __volatile__("pause");
+	__atomic_fetch_add(&bench_work_done, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Queues BENCH_FANOUT_ITEMS work items on this cpu and helps run them, idle cpus steal the rest.
+ * The kernel lock is dropped meanwhile, neither the work nor stealing it needs it.
+ */
+static void bench_fanout(uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++)
+	{
+		bench_work_done = 0;
+		uint64_t start = rdtsc();
+		for (uint32_t j = 0; j < BENCH_FANOUT_ITEMS; j++)
+		{
+			bench_work[j].fn = bench_work_fn;
+			bench_work[j].arg = NULL;
+			work_queue(&bench_work[j]);
+		}
+		kernel_unlock();
+		while (bench_work_done != BENCH_FANOUT_ITEMS)
+		{
+			if (!work_run())
+				__asm__ __volatile__("pause");
+		}
+		kernel_lock();
+		bench_samples[i] = rdtscp() - start;
+	}
+}
+
+/*
+ * Allocates and frees refs BENCH_GNTTAB_ROUNDS times and checks that no other item holds any
+ * of them meanwhile.
+ */
+static void bench_gnttab_fn(void *arg)
+{
+	grant_ref_t refs[BENCH_GNTTAB_MAX_REFS];
+	uint32_t count = 1 + (uint32_t)(uintptr_t)arg % BENCH_GNTTAB_MAX_REFS;
+	for (uint32_t round = 0; round < BENCH_GNTTAB_ROUNDS; round++)
+	{
+		if (gnttab_alloc_refs(refs, count) != 0)
+		{
+			__atomic_fetch_add(&bench_gnttab_failed, 1, __ATOMIC_RELAXED);
+			continue;
+		}
+		for (uint32_t i = 0; i < count; i++)
+		{
+			uint64_t bit = 1ULL << (refs[i] % 64);
+			if (__atomic_fetch_or(&bench_gnttab_owned[refs[i] / 64], bit, __ATOMIC_RELAXED) & bit)
+				__atomic_fetch_add(&bench_gnttab_dups, 1, __ATOMIC_RELAXED);
+		}
+		for (uint32_t i = 0; i < count; i++)
+			__atomic_fetch_and(&bench_gnttab_owned[refs[i] / 64], ~(1ULL << (refs[i] % 64)), __ATOMIC_RELAXED);
+		gnttab_free_refs(refs, count);
+	}
+	__atomic_fetch_add(&bench_work_done, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Like bench_fanout(), with every item hammering the grant ref allocator from whichever cpu
+ * runs it.
+ */
+static int bench_gnttab(uint32_t n)
+{
+	gnttab_stats_t stats;
+	gnttab_get_stats(&stats);
+	if (stats.frames == 0)
+		return -ENOSYS; // Not on Xen.
+	if (bench_gnttab_owned == NULL)
+	{
+		bench_gnttab_owned = (uint64_t *)page_alloc_contig(BENCH_GNTTAB_MAP_PAGES, 1);
+		if (bench_gnttab_owned == NULL)
+			return -ENOMEM;
+		memset(bench_gnttab_owned, 0x0, BENCH_GNTTAB_MAP_PAGES * PAGE_SIZE);
+	}
+
+	bench_gnttab_dups = bench_gnttab_failed = 0;
+	for (uint32_t i = 0; i < n; i++)
+	{
+		bench_work_done = 0;
+		uint64_t start = rdtsc();
+		for (uint32_t j = 0; j < BENCH_FANOUT_ITEMS; j++)
+		{
+			bench_work[j].fn = bench_gnttab_fn;
+			bench_work[j].arg = (void *)(uintptr_t)j;
+			work_queue(&bench_work[j]);
+		}
+		kernel_unlock();
+		while (bench_work_done != BENCH_FANOUT_ITEMS)
+		{
+			if (!work_run())
+				__asm__ __volatile__("pause");
+		}
+		kernel_lock();
+		bench_samples[i] = rdtscp() - start;
+	}
+	return 0;
+}
+
+static inline uint64_t bench_clock_read(uint32_t clock)
+{
+	switch (clock)
+	{
+	case BENCH_CLOCK_PVCLOCK:
+		return pvclock_monotonic_read();
+	case BENCH_CLOCK_TSC:
+		return rdtsc();
+	case BENCH_CLOCK_TSC_ORDERED:
+		return rdtsc_ordered();
+	default:
+		return hpet_read();
+	}
+}
+
+static const char *bench_clock_name(uint32_t clock)
+{
+	switch (clock)
+	{
+	case BENCH_CLOCK_PVCLOCK:
+		return "pvclock";
+	case BENCH_CLOCK_TSC:
+		return "rdtsc";
+	case BENCH_CLOCK_TSC_ORDERED:
+		return "lfence; rdtsc";
+	default:
+		return "HPET";
+	}
+}
+
+/*
+ * Reads the clock under a lock, so consecutive reads are ordered in time whichever cpus they ran
+ * on, and counts the ones that went backwards.
+ */
+static void bench_clock_warp_fn(void *arg)
+{
+	for (uint32_t i = 0; i < BENCH_CLOCK_WARP_READS; i++)
+	{
+		while (__atomic_exchange_n(&bench_clock_lock, 1, __ATOMIC_ACQUIRE) != 0)
+			__asm__ __volatile__("pause");
+		uint64_t now = bench_clock_read(bench_clock);
+		if (now < bench_clock_last)
+			bench_clock_warps++;
+		bench_clock_last = now;
+		__atomic_store_n(&bench_clock_lock, 0, __ATOMIC_RELEASE);
+	}
+	__atomic_fetch_add(&bench_work_done, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Cycles per BENCH_CLOCK_READS reads of every clock source there is, then the warp test on all
+ * cpus at once. Plain rdtsc may run before the lock is taken, so it can warp where the others
+ * do not.
+ */
+static void bench_clocks(uint32_t n)
+{
+	for (uint32_t clock = 0; clock < BENCH_CLOCKS; clock++)
+	{
+		if ((clock == BENCH_CLOCK_PVCLOCK && pvclock_ti == NULL) || (clock == BENCH_CLOCK_HPET && hpet_hz == 0))
+			continue;
+		volatile uint64_t sink;
+		for (uint32_t i = 0; i < n; i++)
+		{
+			uint64_t start = rdtsc_ordered();
+			for (uint32_t j = 0; j < BENCH_CLOCK_READS; j++)
+				sink = bench_clock_read(clock);
+			bench_samples[i] = rdtscp() - start;
+		}
+		(void)sink;
+		bench_report(bench_clock_name(clock), bench_samples, n);
+		uint64_t ps = bench_samples[n / 2] * 1000000000ULL / (tsc_hz / 1000) / BENCH_CLOCK_READS;
+
+		bench_clock = clock;
+		bench_clock_last = 0;
+		bench_clock_warps = 0;
+		bench_work_done = 0;
+		for (uint32_t j = 0; j < BENCH_FANOUT_ITEMS; j++)
+		{
+			bench_work[j].fn = bench_clock_warp_fn;
+			bench_work[j].arg = NULL;
+			work_queue(&bench_work[j]);
+		}
+		kernel_unlock();
+		while (bench_work_done != BENCH_FANOUT_ITEMS)
+		{
+			if (!work_run())
+				__asm__ __volatile__("pause");
+		}
+		kernel_lock();
+		printf("%s: %ld.%02ld ns per read (median), went backwards %ld times in %d reads on %d cpus\n",
+			   bench_clock_name(clock), ps / 1000, ps / 10 % 100, bench_clock_warps,
+			   BENCH_FANOUT_ITEMS * BENCH_CLOCK_WARP_READS, num_cpus);
+	}
+}
+
+static int bench_copy_samples(uintptr_t user_samples, uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++)
+	{
+		uintptr_t pa = vm_user_to_phys(current_mm, user_samples + i * sizeof(uint64_t), 0);
+		if (pa == 0x0ULL || (pa & (sizeof(uint64_t) - 1)))
+			return -EFAULT;
+		bench_samples[i] = *(uint64_t *)pa;
+	}
+	return 0;
+}
+
+/* Sides of the ring in bench(BENCH_XRING), the index into bench_xring_kick. */
+#define BENCH_XRING_PRODUCER 0
+#define BENCH_XRING_CONSUMER 1
+
+static void bench_xring_notify(uint32_t side)
+{
+	bench_xring_notifies[side]++;
+	__atomic_store_n(&bench_xring_kick[side], 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * What an event channel wait would be. A notification the ring logic wrongly left out shows up
+ * as -ETIMEDOUT instead of a hang.
+ */
+static int bench_xring_wait(uint32_t side)
+{
+	uint64_t deadline = clock_ns() + BENCH_XRING_TIMEOUT_NS;
+	while (!__atomic_exchange_n(&bench_xring_kick[side], 0, __ATOMIC_ACQUIRE))
+	{
+		if (clock_ns() > deadline)
+			return -ETIMEDOUT;
+		__asm__ __volatile__("pause");
+	}
+	return 0;
+}
+
+/*
+ * Message seq: its number, then bytes counting up from it. Lengths vary so records wrap around
+ * the end of the ring at every offset.
+ */
+static uint32_t bench_xring_fill(uint8_t *msg, uint32_t seq)
+{
+	uint32_t len = 4 + seq * 37 % (BENCH_XRING_MAX_MSG - 4);
+	*(uint32_t *)msg = seq;
+	for (uint32_t i = 4; i < len; i++)
+		msg[i] = (uint8_t)(seq + i);
+	return len;
+}
+
+static void bench_xring_consumer(void *arg)
+{
+	uint8_t msg[BENCH_XRING_MAX_MSG], want[BENCH_XRING_MAX_MSG];
+	xring_t *ring = &bench_xring_rx;
+	uint32_t seq = 0;
+	int ret = 0;
+	bench_xring_started = 1;
+	while (seq < BENCH_XRING_MSGS)
+	{
+		int len = xring_read(ring, msg, sizeof(msg));
+		if (len == -EAGAIN)
+		{
+			if (xring_release(ring))
+				bench_xring_notify(BENCH_XRING_PRODUCER);
+			if (!xring_prepare_read(ring) && (ret = bench_xring_wait(BENCH_XRING_CONSUMER)) != 0)
+				break;
+			continue;
+		}
+		if (len < 0)
+		{
+			ret = len;
+			break;
+		}
+		if ((uint32_t)len != bench_xring_fill(want, seq) || memcmp(msg, want, len) != 0)
+			bench_xring_bad++;
+		seq++;
+		if (ring->cons_pvt - ring->shared->cons >= ring->size / 4 && xring_release(ring)) // Batched.
+			bench_xring_notify(BENCH_XRING_PRODUCER);
+	}
+	if (xring_release(ring))
+		bench_xring_notify(BENCH_XRING_PRODUCER);
+	__atomic_store_n(&bench_xring_result, ret, __ATOMIC_RELEASE);
+}
+
+static int bench_xring_producer(void)
+{
+	uint8_t msg[BENCH_XRING_MAX_MSG];
+	xring_t *ring = &bench_xring_tx;
+	for (uint32_t seq = 0; seq < BENCH_XRING_MSGS; seq++)
+	{
+		uint32_t len = bench_xring_fill(msg, seq);
+		while (xring_write(ring, msg, len) == -EAGAIN)
+		{
+			if (xring_push(ring))
+				bench_xring_notify(BENCH_XRING_CONSUMER);
+			if (!xring_prepare_write(ring, xring_need(ring, len)) && bench_xring_wait(BENCH_XRING_PRODUCER) != 0)
+				return -ETIMEDOUT;
+		}
+		if (seq % BENCH_XRING_BATCH == BENCH_XRING_BATCH - 1 && xring_push(ring))
+			bench_xring_notify(BENCH_XRING_CONSUMER);
+	}
+	if (xring_push(ring))
+		bench_xring_notify(BENCH_XRING_CONSUMER);
+	return 0;
+}
+
+/*
+ * Passes BENCH_XRING_MSGS messages through a one page xring (xring.c) from this cpu to a work
+ * item another cpu steals, and checks every one. The shared indices start just below 2^32, so
+ * they wrap in every run. Each side only spins on its kick flag after xring_prepare_*() said to
+ * wait, so the event index logic is what keeps both going.
+ */
+static int bench_xring(uint32_t n)
+{
+	if (num_cpus < 2)
+		return -ENOSYS;
+	uintptr_t pages = page_alloc_contig(2, 1);
+	if (pages == 0x0ULL)
+		return -ENOMEM;
+	xring_shared_t *shared = (xring_shared_t *)pages;
+	bench_xring_bad = bench_xring_notifies[0] = bench_xring_notifies[1] = 0;
+	int ret = 0;
+	for (uint32_t i = 0; i < n && ret == 0; i++)
+	{
+		xring_init(&bench_xring_tx, shared, (void *)(pages + PAGE_SIZE), PAGE_SIZE);
+		shared->prod = shared->cons = 0xFFFFF000U + i * 24; // Start at a different offset each run.
+		shared->prod_event = shared->cons_event = shared->prod;
+		xring_attach(&bench_xring_tx, shared, (void *)(pages + PAGE_SIZE), PAGE_SIZE);
+		xring_attach(&bench_xring_rx, shared, (void *)(pages + PAGE_SIZE), PAGE_SIZE);
+		bench_xring_kick[0] = bench_xring_kick[1] = 0;
+		bench_xring_started = 0;
+		bench_xring_result = 1;
+		bench_xring_work.fn = bench_xring_consumer;
+		bench_xring_work.arg = NULL;
+		work_queue(&bench_xring_work);
+
+		kernel_unlock();
+		uint64_t deadline = clock_ns() + BENCH_XRING_TIMEOUT_NS;
+		while (!bench_xring_started && clock_ns() < deadline)
+			__asm__ __volatile__("pause");
+		uint64_t start = rdtsc();
+		ret = bench_xring_started ? bench_xring_producer() : -EBUSY;
+		while (__atomic_load_n(&bench_xring_result, __ATOMIC_ACQUIRE) == 1)
+		{
+			if (!work_run()) // Runs the consumer here if no other cpu took it.
+				__asm__ __volatile__("pause");
+		}
+		bench_samples[i] = rdtscp() - start;
+		kernel_lock();
+		if (ret == 0)
+			ret = bench_xring_result;
+	}
+	page_free_contig(pages, 2);
+	return ret;
+}
+
+/*
+ * Runs or reports benchmark op with n samples. For the user mode benchmarks user_samples
+ * points to the measurements.
+ */
+long sys_bench(long op, uintptr_t user_samples, uint32_t n)
+{
+	if (n == 0 || n > BENCH_MAX_SAMPLES)
+		return -EINVAL;
+	if (bench_samples == NULL)
+	{
+		bench_samples = (uint64_t *)page_alloc_contig(BENCH_SAMPLE_PAGES, 1);
+		if (bench_samples == NULL)
+			return -ENOMEM;
+	}
+
+	const char *name;
+	switch (op)
+	{
+	case BENCH_SYSCALL:
+	case BENCH_PAGE_FAULT:
+	{
+		int ret = bench_copy_samples(user_samples, n);
+		if (ret != 0)
+			return ret;
+		name = op == BENCH_SYSCALL ? "Null syscall" : "Minor page fault";
+		break;
+	}
+	case BENCH_MUNMAP:
+	{
+		int ret = bench_copy_samples(user_samples, n);
+		if (ret != 0)
+			return ret;
+		uint32_t sharing = 0; // Cpus a shootdown has to reach, the caller's included.
+		for (uint32_t i = 0; i < num_cpus; i++)
+			sharing += cpus[i].mm == current_mm;
+		printf("Address space loaded on %d cpus\n", sharing);
+		bench_report("munmap", bench_samples, n);
+		tlb_stats_print();
+		return 0;
+	}
+	case BENCH_SELF_IPI:
+		bench_self_ipi(n);
+		name = "Self-IPI round trip";
+		break;
+	case BENCH_TIMER_IRQ:
+		bench_timer_paths(n);
+		return 0;
+	case BENCH_FANOUT:
+	{
+		bench_fanout(n);
+		bench_report("Kernel work fan-out, 64 items of 100000 cycles", bench_samples, n);
+		uint64_t speedup = BENCH_FANOUT_ITEMS * BENCH_WORK_CYCLES * 100ULL / bench_samples[n / 2];
+		printf("Median speedup over one cpu: %ld.%02ld with %d cpus\n", speedup / 100, speedup % 100, num_cpus);
+		return 0;
+	}
+	case BENCH_GNTTAB:
+	{
+		int ret = bench_gnttab(n);
+		if (ret != 0)
+			return ret;
+		bench_report("Grant ref fan-out, 64 items of 100 allocations and frees", bench_samples, n);
+		printf("Grant refs held twice: %ld, allocations failed: %ld on %d cpus\n", bench_gnttab_dups,
+			   bench_gnttab_failed, num_cpus);
+		gnttab_stats_print();
+		return 0;
+	}
+	case BENCH_CLOCK:
+		bench_clocks(n);
+		return 0;
+	case BENCH_XRING:
+	{
+		int ret = bench_xring(n);
+		if (ret != 0)
+		{
+			printf("Ring between two cpus failed: %d\n", ret);
+			return ret;
+		}
+		bench_report("Ring between two cpus, 10000 messages of 4 to 299 bytes", bench_samples, n);
+		printf("Ring messages corrupted: %ld, notifications: %ld to the consumer, %ld to the producer\n",
+			   bench_xring_bad, bench_xring_notifies[BENCH_XRING_CONSUMER], bench_xring_notifies[BENCH_XRING_PRODUCER]);
+		return 0;
+	}
+	default:
+		return -EINVAL;
+	}
+	bench_report(name, bench_samples, n);
+	return 0;
+}
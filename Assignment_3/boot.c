@@ -9,39 +9,47 @@
 #include <Protocol/SimpleFileSystem.h>
 #include <Protocol/GraphicsOutput.h>
 #include <Guid/FileInfo.h>
+#include <Guid/Acpi.h>
 
 /* Use GUID names 'gEfi...' that are already declared in Protocol headers. */
 EFI_GUID gEfiLoadedImageProtocolGuid = EFI_LOADED_IMAGE_PROTOCOL_GUID;
 EFI_GUID gEfiSimpleFileSystemProtocolGuid = EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_GUID;
 EFI_GUID gEfiGraphicsOutputProtocolGuid = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
 EFI_GUID gEfiFileInfoGuid = EFI_FILE_INFO_ID;
+EFI_GUID gEfiAcpi20TableGuid = EFI_ACPI_20_TABLE_GUID;
+EFI_GUID gEfiAcpi10TableGuid = ACPI_10_TABLE_GUID;
 
 /* Keep these variables global. */
 static EFI_HANDLE ImageHandle;
 static EFI_SYSTEM_TABLE *SystemTable;
 static EFI_BOOT_SERVICES *BootServices;
 
+#define MAX_BOOT_MODULES 8
+
+/* A file loaded for the kernel, see kerninc/types.h */
+typedef struct boot_module
+{
+	CHAR8 name[16];
+	UINT64 base;
+	UINT64 size;
+} boot_module;
+
 /* This struct holds info passed to the kernel*/
 typedef struct information
 {
 	UINT64 kernel_stack_buffer;
-	UINT64 user_stack_buffer;
 	UINT64 kernel_pt_base;
-	UINT64 user_pt_base;
-	UINT64 user_app_buffer;
+	UINT64 modules;
 	UINT64 tss_stack_buffer;
 	UINT64 tss_segment_buffer;
-	UINT64 extra_page_for_exception;
-	UINT64 tls_buffer;
 	UINT64 shared_page;
 	UINT64 gnttab_table;
-	UINT32 num_user_ptes;
-	UINT32 num_user_pdes;
-	UINT32 num_user_pdpes;
-	UINT32 num_user_pml4es;
+	UINT64 page_pool_base;
+	UINT64 rsdp;
+	UINT64 trampoline_page;
+	UINT32 num_page_pool_pages;
 	UINT32 num_kernel_stack_pages;
-	UINT32 num_user_stack_pages;
-	UINT32 num_user_binary_pages;
+	UINT32 num_modules;
 } information;
 
 // Wrapper method to allocate memory.
@@ -83,6 +91,32 @@ static EFI_STATUS AllocatePages(EFI_ALLOCATE_TYPE type, EFI_MEMORY_TYPE memory_t
 	return efi_status;
 }
 
+static BOOLEAN GuidEqual(EFI_GUID *a, EFI_GUID *b)
+{
+	UINT8 *pa = (UINT8 *)a, *pb = (UINT8 *)b;
+	for (UINTN i = 0; i < sizeof(EFI_GUID); i++)
+	{
+		if (pa[i] != pb[i])
+			return FALSE;
+	}
+	return TRUE;
+}
+
+// Finds the ACPI RSDP in the firmware's configuration table, the 2.0 one if there is one.
+static UINT64 FindRsdp(VOID)
+{
+	UINT64 rsdp = 0x0ULL;
+	for (UINTN i = 0; i < SystemTable->NumberOfTableEntries; i++)
+	{
+		EFI_CONFIGURATION_TABLE *table = &SystemTable->ConfigurationTable[i];
+		if (GuidEqual(&table->VendorGuid, &gEfiAcpi20TableGuid))
+			return (UINT64)table->VendorTable;
+		if (GuidEqual(&table->VendorGuid, &gEfiAcpi10TableGuid))
+			rsdp = (UINT64)table->VendorTable;
+	}
+	return rsdp;
+}
+
 // Opens the kernel file.
 static EFI_STATUS OpenFile(EFI_FILE_PROTOCOL **pvh, EFI_FILE_PROTOCOL **pfh, CHAR16 *full_file_path)
 {
@@ -189,6 +223,63 @@ static EFI_STATUS LoadBinaryFileInBuffer(EFI_FILE_PROTOCOL *fh, UINTN file_size,
 	return efi_status;
 }
 
+// Loads a file into page aligned memory and records it as a boot module.
+static EFI_STATUS LoadModule(EFI_FILE_PROTOCOL *fh, UINTN file_size, CHAR16 *name, boot_module *module)
+{
+	EFI_PHYSICAL_ADDRESS base = 0x0ULL;
+	EFI_STATUS efi_status;
+	UINTN i;
+
+	efi_status = AllocatePages(AllocateAnyPages, EfiBootServicesCode, EFI_SIZE_TO_PAGES(file_size), &base);
+	if (EFI_ERROR(efi_status))
+		return efi_status;
+	efi_status = LoadBinaryFileInBuffer(fh, file_size, (void *)base);
+	if (EFI_ERROR(efi_status))
+		return efi_status;
+
+	for (i = 0; i < sizeof(module->name) - 1 && name[i] != L'\0'; i++)
+		module->name[i] = (CHAR8)name[i];
+	module->name[i] = '\0';
+	module->base = (UINT64)base;
+	module->size = (UINT64)file_size;
+	return EFI_SUCCESS;
+}
+
+// Loads every file in \EFI\BOOT\BIN as a boot module, the kernel can spawn them by name.
+static VOID LoadBinModules(boot_module *modules, UINT32 *num_modules)
+{
+	EFI_FILE_PROTOCOL *vh, *dh, *fh;
+	EFI_FILE_INFO *file_info;
+	EFI_STATUS efi_status;
+	UINTN info_size;
+	UINTN info_buffer_size = SIZE_OF_EFI_FILE_INFO + 256 * sizeof(CHAR16);
+
+	efi_status = OpenFile(&vh, &dh, L"\\EFI\\BOOT\\BIN");
+	if (EFI_ERROR(efi_status))
+		return; // No extra binaries.
+
+	file_info = AllocatePool(info_buffer_size, EfiBootServicesData);
+	while (file_info != NULL && *num_modules < MAX_BOOT_MODULES)
+	{
+		info_size = info_buffer_size;
+		efi_status = dh->Read(dh, &info_size, file_info); // Reading a directory returns the next entry.
+		if (EFI_ERROR(efi_status) || info_size == 0)
+			break;
+		if (file_info->Attribute & EFI_FILE_DIRECTORY)
+			continue;
+
+		efi_status = dh->Open(dh, &fh, file_info->FileName, EFI_FILE_MODE_READ, 0);
+		if (EFI_ERROR(efi_status))
+			continue;
+		if (!EFI_ERROR(LoadModule(fh, file_info->FileSize, file_info->FileName, &modules[*num_modules])))
+			(*num_modules)++;
+		fh->Close(fh);
+	}
+	if (file_info != NULL)
+		FreePool(file_info);
+	CloseFile(vh, dh);
+}
+
 // Method to set the graphics mode as BGRA.
 static UINT32 *SetGraphicsMode(UINT32 width, UINT32 height)
 {
@@ -303,23 +394,6 @@ static EFI_STATUS ExitBootServicesHook(EFI_HANDLE imageHandle)
 	return efi_status;
 }
 
-// Calculate the number of pages required for user page table based on the user_binary and user_stack size.
-static UINTN CalculateNumPagesUserPageTable(UINTN pages_for_user_binary, UINTN user_stack_pages, information *info)
-{
-	UINTN num_ptes, num_pdes, num_pdpes, num_pml4es, num_pages;
-	num_ptes = pages_for_user_binary + user_stack_pages;
-	num_pdes = num_ptes / 512 + 1;
-	num_pdpes = num_pdes / 512 + 1;
-	num_pml4es = num_pdpes / 512 + 1;
-	info->num_user_ptes = num_ptes;
-	info->num_user_pdes = num_pdes;
-	info->num_user_pdpes = num_pdpes;
-	info->num_user_pml4es = num_pml4es;
-
-	num_pages = EFI_SIZE_TO_PAGES(8 * num_ptes) + EFI_SIZE_TO_PAGES(8 * num_pdes) + EFI_SIZE_TO_PAGES(8 * num_pdpes) + EFI_SIZE_TO_PAGES(8 * num_pml4es);
-	return num_pages;
-}
-
 /* Use System V ABI rather than EFI/Microsoft ABI. */
 typedef void (*kernel_entry_t)(void *, unsigned int *, unsigned int, unsigned int, information *) __attribute__((sysv_abi));
 
@@ -332,26 +406,22 @@ efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE *systemTable)
 	EFI_STATUS efi_status;
 	UINT32 *fb;
 	void *kernel_buffer;
-	void *user_buffer;
+	boot_module *modules;
+	UINT32 num_modules = 0;
 	EFI_PHYSICAL_ADDRESS kernel_page_table_base = 0x0ULL;
-	EFI_PHYSICAL_ADDRESS user_page_table_base = 0x0ULL;
 	EFI_PHYSICAL_ADDRESS kernel_base = 0x0ULL;
-	EFI_PHYSICAL_ADDRESS user_base = 0x0ULL;
 	EFI_PHYSICAL_ADDRESS kernel_stack_base = 0x0ULL;
-	EFI_PHYSICAL_ADDRESS user_stack_base = 0x0ULL;
 	EFI_PHYSICAL_ADDRESS tss_segment_base = 0x0ULL;
 	EFI_PHYSICAL_ADDRESS tss_stack_base = 0x0ULL;
-	EFI_PHYSICAL_ADDRESS exception_page_base = 0x0ULL;
-	EFI_PHYSICAL_ADDRESS tls_base = 0x0ULL;
+	EFI_PHYSICAL_ADDRESS page_pool_base = 0xFFFFFFFFULL; // The kernel only maps the bottom 4gb 1:1.
 	EFI_PHYSICAL_ADDRESS gnt_table_base = 0x0ULL;
 	EFI_PHYSICAL_ADDRESS shared_page_base = 0x0ULL;
+	EFI_PHYSICAL_ADDRESS trampoline_base = 0x9EFFFULL; // Real mode code for the other cpus, below 1mb and the EBDA.
 	UINTN kernel_page_table_pages = EFI_SIZE_TO_PAGES(SIZE_8MB + SIZE_16KB + SIZE_8KB);
-	UINTN user_page_table_pages = 0;
+	UINTN page_pool_pages = EFI_SIZE_TO_PAGES(SIZE_64MB);
 	UINTN kernel_file_size = 0;
 	UINTN user_file_size = 0;
-	UINTN pages_for_user_binary = 0;
 	UINTN kernel_stack_pages = 1;
-	UINTN user_stack_pages = 1;
 	information* info;
 
 	// Set global variables.
@@ -360,8 +430,8 @@ efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE *systemTable)
 	BootServices = systemTable->BootServices;
 
 	info = (information *)AllocatePool(sizeof(information), EfiBootServicesData);
-	info->num_user_stack_pages = user_stack_pages;
 	info->num_kernel_stack_pages = kernel_stack_pages;
+	modules = (boot_module *)AllocatePool(MAX_BOOT_MODULES * sizeof(boot_module), EfiBootServicesData);
 
 	efi_status = OpenFile(&kvh, &kfh, L"\\EFI\\BOOT\\KERNEL"); // Open the kernel file for reading.
 	if (EFI_ERROR(efi_status))
@@ -408,25 +478,18 @@ efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE *systemTable)
 		return efi_status;
 	}
 
-	pages_for_user_binary = EFI_SIZE_TO_PAGES(user_file_size); // Number of pages to fit the user app binary.
-	info->num_user_binary_pages = pages_for_user_binary;
-	efi_status = AllocatePages(AllocateAnyPages, EfiBootServicesCode, pages_for_user_binary, &user_base); // Page aligned memory for user app.
-	if (EFI_ERROR(efi_status))
-	{
-		BootServices->Stall(5 * 1000000); // 5 seconds
-		return efi_status;
-	}
-	user_buffer = (void *)user_base;
-
-	efi_status = LoadBinaryFileInBuffer(ufh, user_file_size, user_buffer); // Load the user binary into memory.
+	efi_status = LoadModule(ufh, user_file_size, L"user", &modules[num_modules]); // The user app is module 0.
 	if (EFI_ERROR(efi_status))
 	{
 		BootServices->Stall(5 * 1000000); // 5 seconds
 		return efi_status;
 	}
+	num_modules++;
 
 	CloseFile(uvh, ufh); // Close the user file.
 
+	LoadBinModules(modules, &num_modules); // Further user binaries for spawn().
+
 	// Allocate pages for the kernel to initialize page table.
 	efi_status = AllocatePages(AllocateAnyPages, EfiBootServicesData, kernel_page_table_pages, &kernel_page_table_base);
 	if (EFI_ERROR(efi_status))
@@ -435,13 +498,13 @@ efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE *systemTable)
 		return efi_status;
 	}
 
-	user_page_table_pages = CalculateNumPagesUserPageTable(pages_for_user_binary, user_stack_pages, info);	   // Calc the pages req for user page table setup.
-	efi_status = AllocatePages(AllocateAnyPages, EfiBootServicesData, user_page_table_pages, &user_page_table_base); // Allocate 4kb aligned memory for the user page table.
+	efi_status = AllocatePages(AllocateMaxAddress, EfiBootServicesData, page_pool_pages, &page_pool_base); // Page pool for user page tables and demand paging.
 	if (EFI_ERROR(efi_status))
 	{
 		BootServices->Stall(5 * 1000000); // 5 seconds
 		return efi_status;
 	}
+	info->num_page_pool_pages = page_pool_pages;
 
 	efi_status = AllocatePages(AllocateAnyPages, EfiBootServicesData, 2, &tss_stack_base); // Allocate 4kb alignmed memory for tss_segment and tss_stack
 	if (EFI_ERROR(efi_status))
@@ -452,13 +515,6 @@ efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE *systemTable)
 	tss_stack_base += 4096; //Stack moves downwards
 	tss_segment_base = tss_stack_base; // Same base location as stack but moves upwards
 
-	efi_status = AllocatePages(AllocateAnyPages, EfiBootServicesData, 1, &tls_base); // Allocate 4kb alignmed memory for tls_base
-	if (EFI_ERROR(efi_status))
-	{
-		BootServices->Stall(5 * 1000000); // 5 seconds
-		return efi_status;
-	}
-
 	efi_status = AllocatePages(AllocateAnyPages, EfiBootServicesData, 1, &shared_page_base); // Allocate 4kb alignmed memory for shared page.
 	if (EFI_ERROR(efi_status))
 	{
@@ -473,21 +529,18 @@ efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE *systemTable)
 		return efi_status;
 	}
 
-	efi_status = AllocatePages(AllocateAnyPages, EfiBootServicesData, 1, &exception_page_base); // Allocate 4kb alignmed memory for handling page fault exception.
+	efi_status = AllocatePages(AllocateAnyPages, EfiBootServicesData, kernel_stack_pages, &kernel_stack_base); // Allocate 4kb aligned memory for the kernel stack.
 	if (EFI_ERROR(efi_status))
 	{
 		BootServices->Stall(5 * 1000000); // 5 seconds
 		return efi_status;
 	}
+	kernel_stack_base += 4096 * kernel_stack_pages; //Point to the end of the page as stack moves downwards.
 
-	efi_status = AllocatePages(AllocateAnyPages, EfiBootServicesData, kernel_stack_pages + user_stack_pages, &kernel_stack_base); // Allocate 4kb aligned memory for user and kernel stack.
+	efi_status = AllocatePages(AllocateMaxAddress, EfiBootServicesData, 1, &trampoline_base); // Startup IPIs can only point below 1mb.
 	if (EFI_ERROR(efi_status))
-	{
-		BootServices->Stall(5 * 1000000); // 5 seconds
-		return efi_status;
-	}
-	kernel_stack_base += 4096 * kernel_stack_pages;				   //Point to the end of the page as stack moves downwards.
-	user_stack_base = kernel_stack_base + 4096 * user_stack_pages; //Next buffer is user stack.
+		trampoline_base = 0x0ULL; // The kernel then runs on the boot cpu alone.
+	info->rsdp = FindRsdp();
 
 	fb = SetGraphicsMode(800, 600); // Set the graphics mode to 800x600 BGRA.
 
@@ -499,16 +552,15 @@ efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE *systemTable)
 	}
 
 	info->kernel_stack_buffer = (UINT64)kernel_stack_base;
-	info->user_stack_buffer = (UINT64)user_stack_base;
 	info->kernel_pt_base = (UINT64)kernel_page_table_base;
-	info->user_pt_base = (UINT64)user_page_table_base;
-	info->user_app_buffer = (UINT64)user_buffer;
+	info->modules = (UINT64)modules;
+	info->num_modules = num_modules;
 	info->tss_segment_buffer = (UINT64)tss_segment_base;
 	info->tss_stack_buffer = (UINT64)tss_stack_base;
-	info->extra_page_for_exception = (UINT64)exception_page_base;
-	info->tls_buffer = (UINT64)tls_base;
 	info->gnttab_table = (UINT64)gnt_table_base;
+	info->page_pool_base = (UINT64)page_pool_base;
 	info->shared_page = (UINT64)shared_page_base;
+	info->trampoline_page = (UINT64)trampoline_base;
 
 	// kernel's _start() is at base #0 (pure binary format)
 	// cast the function pointer appropriately and call the function
@@ -0,0 +1,101 @@
+/*
+ * ELF64 loader for the user app.
+ * The bootloader reads the file into memory as is. Every PT_LOAD segment becomes a file backed VMA
+ * with the permissions of the segment, so nothing is copied here: read-only pages map the loaded file
+ * directly (and are shared by everything running the same image), writable pages are copied and bss
+ * is zero filled when first touched.
+ */
+
+#include <types.h>
+#include <elf.h>
+#include <vm.h>
+#include <errno.h>
+#include <printf.h>
+
+static int elf_check_header(elf64_ehdr_t *ehdr, size_t image_size)
+{
+	if (image_size < sizeof(elf64_ehdr_t))
+		return -ENOEXEC;
+	if (ehdr->e_ident[0] != ELFMAG0 || ehdr->e_ident[1] != ELFMAG1 ||
+		ehdr->e_ident[2] != ELFMAG2 || ehdr->e_ident[3] != ELFMAG3)
+		return -ENOEXEC;
+	if (ehdr->e_ident[4] != ELFCLASS64 || ehdr->e_ident[5] != ELFDATA2LSB)
+		return -ENOEXEC;
+	if (ehdr->e_type != ET_EXEC || ehdr->e_machine != EM_X86_64)
+		return -ENOEXEC;
+	if (ehdr->e_phentsize != sizeof(elf64_phdr_t) ||
+		ehdr->e_phoff + (uint64_t)ehdr->e_phnum * sizeof(elf64_phdr_t) > image_size)
+		return -ENOEXEC;
+	return 0;
+}
+
+static uint32_t elf_vma_flags(uint32_t p_flags)
+{
+	uint32_t flags = VMA_FILE;
+	if (p_flags & PF_R)
+		flags |= VMA_READ;
+	if (p_flags & PF_W)
+		flags |= VMA_WRITE;
+	if (p_flags & PF_X)
+		flags |= VMA_EXEC;
+	return flags;
+}
+
+/*
+ * Sets up the VMAs for image (a kernel address, page aligned) in mm and records the entry point
+ * and the TLS template. Returns 0 or a negative error number.
+ */
+int elf_load(mm_t *mm, uintptr_t image, size_t image_size)
+{
+	elf64_ehdr_t *ehdr = (elf64_ehdr_t *)image;
+	int ret = elf_check_header(ehdr, image_size);
+	if (ret != 0)
+	{
+		printf("User app is not a valid x86-64 ELF executable!\n");
+		return ret;
+	}
+
+	elf64_phdr_t *phdr = (elf64_phdr_t *)(image + ehdr->e_phoff);
+	mm->tls_image = 0x0ULL;
+	mm->tls_filesz = 0;
+	mm->tls_memsz = 0;
+	mm->tls_align = 1;
+
+	for (unsigned int i = 0; i < ehdr->e_phnum; i++)
+	{
+		elf64_phdr_t *ph = &phdr[i];
+		if (ph->p_offset + ph->p_filesz > image_size || ph->p_filesz > ph->p_memsz)
+			return -ENOEXEC;
+
+		if (ph->p_type == PT_TLS)
+		{
+			mm->tls_image = image + ph->p_offset;
+			mm->tls_filesz = ph->p_filesz;
+			mm->tls_memsz = ph->p_memsz;
+			mm->tls_align = ph->p_align ? ph->p_align : 1;
+			continue;
+		}
+		if (ph->p_type != PT_LOAD || ph->p_memsz == 0)
+			continue;
+
+		if ((ph->p_vaddr & (PAGE_SIZE - 1)) != (ph->p_offset & (PAGE_SIZE - 1)))
+			return -ENOEXEC; // Pages of the file could not be mapped as they are.
+		uintptr_t start = PAGE_ALIGN_DOWN(ph->p_vaddr);
+		uintptr_t end = PAGE_ALIGN_UP(ph->p_vaddr + ph->p_memsz);
+		uint64_t lead = ph->p_vaddr - start;
+		if (start < USER_IMAGE_BASE || end > USER_TLS_BASE)
+			return -ENOEXEC;
+
+		// Without bss the whole last page may come from the file (the load buffer is page granular),
+		// which lets read-only segments be mapped without any copy.
+		uint64_t file_size = lead + ph->p_filesz;
+		if (ph->p_filesz == ph->p_memsz)
+			file_size = end - start;
+		ret = vma_insert_file(mm, start, end, elf_vma_flags(ph->p_flags), image + ph->p_offset - lead, file_size);
+		if (ret != 0)
+			return ret;
+	}
+
+	mm->entry = ehdr->e_entry;
+	return 0;
+}
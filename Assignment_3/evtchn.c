@@ -0,0 +1,371 @@
+/*
+ * Xen event channels. Xen marks a port pending in the shared info page, sets its word in the
+ * vcpu's evtchn_pending_sel and raises EVTCHN_VECTOR, registered with HVM_PARAM_CALLBACK_IRQ.
+ * The handler walks the two levels, selector bits then pending & ~mask words, and calls the
+ * handler bound to each port, under the kernel lock like every other interrupt.
+ *
+ * evtchn_scan() only reads the page it is given and the handler table, so it also runs against
+ * a shared_info_t in ordinary memory, with the bits set by hand.
+ */
+
+#include <types.h>
+#include <evtchn.h>
+#include <hvm/params.h>
+#include <hvm/hvm_op.h>
+#include <cpu.h>
+#include <irq.h>
+#include <interrupts.h>
+#include <multicall.h>
+#include <rdtsc.h>
+#include <timer.h>
+#include <palloc.h>
+#include <string.h>
+#include <errno.h>
+#include <printf.h>
+
+#define EVTCHN_CALLBACK_TYPE_SHIFT 56 // HVM_PARAM_CALLBACK_IRQ: type in bits 63:56, vector below.
+#define EVTCHN_LOOPBACK_TIMEOUT_NS 1000000ULL
+#define EVTCHN_SCAN_TEST_RERAISE 130 // Its handler raises EVTCHN_SCAN_TEST_LATE in a word scanned already.
+#define EVTCHN_SCAN_TEST_LATE 5
+#define EVTCHN_SCAN_TEST_MASKED 65
+#define EVTCHN_SCAN_TEST_NO_SEL 3000 // Pending, but its word is not in the selector.
+
+struct evtchn_binding
+{
+	evtchn_handler_t handler;
+	void *arg;
+};
+
+static struct evtchn_binding evtchn_bindings[EVTCHN_MAX_PORTS];
+
+static inline xen_ulong_t evtchn_bit(evtchn_port_t port)
+{
+	return (xen_ulong_t)1 << (port % EVTCHN_WORD_BITS);
+}
+
+/*
+ * Handles every pending and unmasked port of the page, clearing each before its handler runs so
+ * an event sent meanwhile is seen again. Xen may set more bits while this runs, the loop goes on
+ * until evtchn_upcall_pending stays clear. Returns the number of events handled.
+ */
+uint32_t evtchn_scan(shared_info_t *shared, vcpu_info_t *vcpu)
+{
+	uint32_t handled = 0;
+	while (__atomic_exchange_n(&vcpu->evtchn_upcall_pending, 0, __ATOMIC_SEQ_CST) != 0)
+	{
+		xen_ulong_t sel = __atomic_exchange_n(&vcpu->evtchn_pending_sel, 0, __ATOMIC_SEQ_CST);
+		while (sel != 0)
+		{
+			uint32_t word = __builtin_ctzl(sel);
+			sel &= sel - 1;
+			xen_ulong_t pending = __atomic_load_n(&shared->evtchn_pending[word], __ATOMIC_ACQUIRE) &
+								  ~__atomic_load_n(&shared->evtchn_mask[word], __ATOMIC_RELAXED);
+			while (pending != 0)
+			{
+				evtchn_port_t port = word * EVTCHN_WORD_BITS + __builtin_ctzl(pending);
+				pending &= pending - 1;
+				__atomic_fetch_and(&shared->evtchn_pending[word], ~evtchn_bit(port), __ATOMIC_SEQ_CST);
+				if (port < EVTCHN_MAX_PORTS && evtchn_bindings[port].handler != NULL)
+					evtchn_bindings[port].handler(port, evtchn_bindings[port].arg);
+				handled++;
+			}
+		}
+	}
+	return handled;
+}
+
+/*
+ * The vector comes straight from Xen rather than through the LAPIC, there is nothing to EOI.
+ * Every port is bound to vcpu 0 unless moved, the pending selector is in this cpu's vcpu_info.
+ */
+static void evtchn_interrupt(trap_frame_t *frame)
+{
+	cpu_t *cpu = this_cpu();
+	if (cpu->vcpu_info != NULL)
+		evtchn_scan(xen_shared_info, cpu->vcpu_info);
+	timer_xen_interrupt(); // Last, it may switch threads.
+}
+
+/*
+ * Masks every port and has Xen raise EVTCHN_VECTOR for events. Called once the shared info page
+ * is mapped.
+ */
+int evtchn_init(void)
+{
+	for (uint32_t i = 0; i < sizeof(xen_shared_info->evtchn_mask) / sizeof(xen_ulong_t); i++)
+		__atomic_store_n(&xen_shared_info->evtchn_mask[i], ~(xen_ulong_t)0, __ATOMIC_SEQ_CST);
+	irq_register(EVTCHN_VECTOR, evtchn_interrupt);
+
+	struct xen_hvm_param param;
+	param.domid = DOMID_SELF;
+	param.index = HVM_PARAM_CALLBACK_IRQ;
+	param.value = ((uint64_t)HVM_PARAM_CALLBACK_TYPE_VECTOR << EVTCHN_CALLBACK_TYPE_SHIFT) | EVTCHN_VECTOR;
+	int ret = (int)HYPERVISOR_hvm_op(HVMOP_set_param, &param);
+	if (ret != 0)
+	{
+		irq_unregister(EVTCHN_VECTOR);
+		printf("Could not set the event channel callback vector: %d\n", ret);
+		return ret;
+	}
+	printf("Event channels on vector 0x%x\n", EVTCHN_VECTOR);
+	return 0;
+}
+
+/*
+ * Allocates a port remote_dom can bind to with EVTCHNOP_bind_interdomain.
+ */
+int evtchn_alloc_unbound(domid_t remote_dom, evtchn_port_t *port)
+{
+	evtchn_alloc_unbound_t op;
+	op.dom = DOMID_SELF;
+	op.remote_dom = remote_dom;
+	int ret = HYPERVISOR_event_channel_op(EVTCHNOP_alloc_unbound, &op);
+	if (ret == 0)
+		*port = op.port;
+	return ret;
+}
+
+/*
+ * Connects a new local port to the unbound remote_port of remote_dom.
+ */
+int evtchn_bind_interdomain(domid_t remote_dom, evtchn_port_t remote_port, evtchn_port_t *local_port)
+{
+	evtchn_bind_interdomain_t op;
+	op.remote_dom = remote_dom;
+	op.remote_port = remote_port;
+	int ret = HYPERVISOR_event_channel_op(EVTCHNOP_bind_interdomain, &op);
+	if (ret == 0)
+		*local_port = op.local_port;
+	return ret;
+}
+
+/*
+ * Binds virq of vcpu to a new port, its events are raised on that vcpu.
+ */
+int evtchn_bind_virq(uint32_t virq, uint32_t vcpu, evtchn_port_t *port)
+{
+	evtchn_bind_virq_t op;
+	op.virq = virq;
+	op.vcpu = vcpu;
+	int ret = HYPERVISOR_event_channel_op(EVTCHNOP_bind_virq, &op);
+	if (ret == 0)
+		*port = op.port;
+	return ret;
+}
+
+int evtchn_send(evtchn_port_t port)
+{
+	evtchn_send_t op;
+	op.port = port;
+	return HYPERVISOR_event_channel_op(EVTCHNOP_send, &op);
+}
+
+int evtchn_close(evtchn_port_t port)
+{
+	evtchn_unbind(port);
+	evtchn_close_t op;
+	op.port = port;
+	return HYPERVISOR_event_channel_op(EVTCHNOP_close, &op);
+}
+
+/*
+ * Closes count ports with one multicall. Returns the first error.
+ */
+int evtchn_close_ports(const evtchn_port_t *ports, uint32_t count)
+{
+	evtchn_close_t ops[MC_BATCH];
+	int ret = 0;
+	for (uint32_t done = 0; done < count; done += MC_BATCH)
+	{
+		uint32_t n = count - done < MC_BATCH ? count - done : MC_BATCH;
+		uint64_t flags = mc_batch();
+		for (uint32_t i = 0; i < n; i++)
+		{
+			evtchn_unbind(ports[done + i]);
+			ops[i].port = ports[done + i];
+			mc_queue(__HYPERVISOR_event_channel_op, EVTCHNOP_close, (unsigned long)&ops[i], 0, NULL);
+		}
+		int error = mc_issue(flags);
+		if (ret == 0)
+			ret = error;
+	}
+	return ret;
+}
+
+/*
+ * Calls handler(port, arg) for every event on port from now on, in interrupt context.
+ */
+int evtchn_bind(evtchn_port_t port, evtchn_handler_t handler, void *arg)
+{
+	if (port >= EVTCHN_MAX_PORTS || handler == NULL)
+		return -EINVAL;
+	if (evtchn_bindings[port].handler != NULL)
+		return -EBUSY;
+	evtchn_bindings[port].handler = handler;
+	evtchn_bindings[port].arg = arg;
+	return evtchn_unmask(port);
+}
+
+void evtchn_unbind(evtchn_port_t port)
+{
+	if (port >= EVTCHN_MAX_PORTS)
+		return;
+	evtchn_mask(port);
+	evtchn_bindings[port].handler = NULL;
+	evtchn_bindings[port].arg = NULL;
+}
+
+void evtchn_mask(evtchn_port_t port)
+{
+	__atomic_fetch_or(&xen_shared_info->evtchn_mask[port / EVTCHN_WORD_BITS], evtchn_bit(port), __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Through Xen rather than clearing the bit here: it raises the vector again if an event came in
+ * while the port was masked.
+ */
+int evtchn_unmask(evtchn_port_t port)
+{
+	evtchn_unmask_t op;
+	op.port = port;
+	return HYPERVISOR_event_channel_op(EVTCHNOP_unmask, &op);
+}
+
+static void evtchn_loopback_handler(evtchn_port_t port, void *arg)
+{
+	*(volatile uint64_t *)arg = rdtsc();
+}
+
+/*
+ * Connects two ports of this domain and sends an event from one to the other. Returns the cycles
+ * from EVTCHNOP_send to the handler, or a negative error.
+ */
+int64_t evtchn_loopback(void)
+{
+	evtchn_port_t port, peer;
+	int ret = evtchn_alloc_unbound(DOMID_SELF, &port);
+	if (ret != 0)
+		return ret;
+	ret = evtchn_bind_interdomain(DOMID_SELF, port, &peer);
+	if (ret != 0)
+	{
+		evtchn_close(port);
+		return ret;
+	}
+
+	volatile uint64_t received = 0;
+	ret = evtchn_bind(port, evtchn_loopback_handler, (void *)&received);
+	uint64_t flags = irq_save();
+	uint64_t start = rdtsc();
+	if (ret == 0)
+		ret = evtchn_send(peer);
+	uint64_t deadline = clock_ns() + EVTCHN_LOOPBACK_TIMEOUT_NS;
+	while (ret == 0 && received == 0 && clock_ns() < deadline)
+		__asm__ __volatile__("sti; pause; cli" ::: "memory");
+	irq_restore(flags);
+	evtchn_port_t ports[2] = {peer, port};
+	evtchn_close_ports(ports, 2);
+	if (ret != 0)
+		return ret;
+	if (received == 0)
+		return -ETIMEDOUT;
+	return (int64_t)(received - start);
+}
+
+/* Ports evtchn_scan_test() binds, in the order they must be handled, and those it only sets. */
+static const evtchn_port_t evtchn_scan_test_bound[] = {1, 63, 64, EVTCHN_SCAN_TEST_RERAISE, 700, 1023, EVTCHN_SCAN_TEST_LATE};
+static const evtchn_port_t evtchn_scan_test_unbound[] = {200, 2000}; // Cleared and counted, no handler.
+
+#define EVTCHN_SCAN_TEST_BOUND (sizeof(evtchn_scan_test_bound) / sizeof(evtchn_scan_test_bound[0]))
+#define EVTCHN_SCAN_TEST_UNBOUND (sizeof(evtchn_scan_test_unbound) / sizeof(evtchn_scan_test_unbound[0]))
+
+struct evtchn_scan_test
+{
+	shared_info_t *shared;
+	evtchn_port_t order[EVTCHN_SCAN_TEST_BOUND + 1]; // One more, to catch a port handled twice.
+	uint32_t count;
+	int pending_in_handler; // A handler found its own bit still set.
+};
+
+static void evtchn_scan_test_set(shared_info_t *shared, evtchn_port_t port)
+{
+	shared->evtchn_pending[port / EVTCHN_WORD_BITS] |= evtchn_bit(port);
+	shared->vcpu_info[0].evtchn_pending_sel |= (xen_ulong_t)1 << (port / EVTCHN_WORD_BITS);
+	shared->vcpu_info[0].evtchn_upcall_pending = 1;
+}
+
+static int evtchn_scan_test_pending(shared_info_t *shared, evtchn_port_t port)
+{
+	return (shared->evtchn_pending[port / EVTCHN_WORD_BITS] & evtchn_bit(port)) != 0;
+}
+
+static void evtchn_scan_test_handler(evtchn_port_t port, void *arg)
+{
+	struct evtchn_scan_test *test = (struct evtchn_scan_test *)arg;
+	if (evtchn_scan_test_pending(test->shared, port))
+		test->pending_in_handler = 1;
+	if (test->count < EVTCHN_SCAN_TEST_BOUND + 1)
+		test->order[test->count] = port;
+	test->count++;
+	if (port == EVTCHN_SCAN_TEST_RERAISE)
+		evtchn_scan_test_set(test->shared, EVTCHN_SCAN_TEST_LATE); // As Xen would during a scan.
+}
+
+/*
+ * Runs evtchn_scan() on a shared info page in ordinary memory: ports in several words with one
+ * masked, one pending without its selector bit, ports with no handler and one raised by a handler
+ * in a word that was scanned already. Checks the order of the handlers, the bits left set and
+ * the count returned. The bindings of the ports used are put back afterwards, and interrupts are
+ * off meanwhile, so real events only wait. Returns 0 or -EIO, and prints what went wrong.
+ */
+int evtchn_scan_test(void)
+{
+	uintptr_t page = page_alloc_zeroed();
+	if (page == 0x0ULL)
+		return -ENOMEM;
+	shared_info_t *shared = (shared_info_t *)page;
+	struct evtchn_scan_test test;
+	memset(&test, 0x0, sizeof(test));
+	test.shared = shared;
+
+	struct evtchn_binding saved[EVTCHN_SCAN_TEST_BOUND];
+	uint64_t flags = irq_save();
+	for (uint32_t i = 0; i < EVTCHN_SCAN_TEST_BOUND; i++)
+	{
+		saved[i] = evtchn_bindings[evtchn_scan_test_bound[i]];
+		evtchn_bindings[evtchn_scan_test_bound[i]].handler = evtchn_scan_test_handler;
+		evtchn_bindings[evtchn_scan_test_bound[i]].arg = &test;
+		if (evtchn_scan_test_bound[i] != EVTCHN_SCAN_TEST_LATE)
+			evtchn_scan_test_set(shared, evtchn_scan_test_bound[i]);
+	}
+	for (uint32_t i = 0; i < EVTCHN_SCAN_TEST_UNBOUND; i++)
+		evtchn_scan_test_set(shared, evtchn_scan_test_unbound[i]);
+	evtchn_scan_test_set(shared, EVTCHN_SCAN_TEST_MASKED);
+	shared->evtchn_mask[EVTCHN_SCAN_TEST_MASKED / EVTCHN_WORD_BITS] = evtchn_bit(EVTCHN_SCAN_TEST_MASKED);
+	shared->evtchn_pending[EVTCHN_SCAN_TEST_NO_SEL / EVTCHN_WORD_BITS] = evtchn_bit(EVTCHN_SCAN_TEST_NO_SEL);
+
+	uint32_t handled = evtchn_scan(shared, &shared->vcpu_info[0]);
+
+	for (uint32_t i = 0; i < EVTCHN_SCAN_TEST_BOUND; i++)
+		evtchn_bindings[evtchn_scan_test_bound[i]] = saved[i];
+	irq_restore(flags);
+
+	int ok = handled == EVTCHN_SCAN_TEST_BOUND + EVTCHN_SCAN_TEST_UNBOUND && test.count == EVTCHN_SCAN_TEST_BOUND;
+	for (uint32_t i = 0; ok && i < EVTCHN_SCAN_TEST_BOUND; i++)
+		ok = test.order[i] == evtchn_scan_test_bound[i] && !evtchn_scan_test_pending(shared, evtchn_scan_test_bound[i]);
+	for (uint32_t i = 0; ok && i < EVTCHN_SCAN_TEST_UNBOUND; i++)
+		ok = !evtchn_scan_test_pending(shared, evtchn_scan_test_unbound[i]);
+	ok = ok && !test.pending_in_handler;
+	ok = ok && evtchn_scan_test_pending(shared, EVTCHN_SCAN_TEST_MASKED) && evtchn_scan_test_pending(shared, EVTCHN_SCAN_TEST_NO_SEL);
+	ok = ok && shared->evtchn_mask[EVTCHN_SCAN_TEST_MASKED / EVTCHN_WORD_BITS] == evtchn_bit(EVTCHN_SCAN_TEST_MASKED);
+	ok = ok && shared->vcpu_info[0].evtchn_pending_sel == 0 && shared->vcpu_info[0].evtchn_upcall_pending == 0;
+	if (!ok)
+	{
+		printf("Event channel scan: %d handled, %d handlers called:", handled, test.count);
+		for (uint32_t i = 0; i < test.count && i < EVTCHN_SCAN_TEST_BOUND + 1; i++)
+			printf(" %d", test.order[i]);
+		printf("\n");
+	}
+	page_free(page);
+	return ok ? 0 : -EIO;
+}
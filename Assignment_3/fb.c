@@ -5,6 +5,7 @@
 
 #include <fb.h>
 #include <types.h>
+#include <fpu.h>
 
 extern unsigned char __ascii_font[2048]; /* ascii_font.c */
 
@@ -42,13 +43,11 @@ void fb_init(unsigned int *fb, unsigned int width, unsigned int height)
 
 static void fb_scrollup(void)
 {
-	/* Move the text up one row */
-	size_t cur = 0, count = Width * ((MaxY - 1) * FONT_HEIGHT);
+	/* Move the text up one row, SSE moves are much faster on framebuffer memory */
+	size_t count = Width * ((MaxY - 1) * FONT_HEIGHT);
 	size_t row = Width * FONT_HEIGHT;
-	do {
-		Fb[cur] = Fb[cur+row];
-		cur++;
-	} while (--count != 0);
+	size_t cur = count;
+	fpu_memcpy(Fb, Fb + row, count * sizeof(unsigned int));
 
 	/* Clean up the last row */
 	do {
@@ -0,0 +1,281 @@
+/*
+ * FPU/SSE/AVX state. Threads get an XSAVE area the first time they use the vector registers,
+ * and the registers are switched lazily: a context switch only sets CR0.TS, and the #NM fault
+ * raised by the next FPU instruction saves the previous owner's state and loads the current
+ * thread's. XSAVEOPT skips state components that are unmodified or in their initial state,
+ * so threads that barely touch the FPU cost little even when they do own it.
+ * Without XSAVE the same is done with FXSAVE (x87 and SSE only).
+ *
+ * Every cpu has its own owner. A thread that used the FPU during its time slice has its registers
+ * saved when it is switched out, so it can be resumed on any cpu; they are only reloaded if another
+ * thread (or another cpu) used the FPU in between.
+ */
+
+#include <types.h>
+#include <fpu.h>
+#include <thread.h>
+#include <irq.h>
+#include <palloc.h>
+#include <cpuid.h>
+#include <string.h>
+#include <printf.h>
+
+#define FPU_MEMCPY_MIN 256 // Smaller copies are not worth saving the owner's state for.
+
+#define FPU_NONE 0
+#define FPU_FXSAVE 1
+#define FPU_XSAVE 2
+#define FPU_XSAVEOPT 3
+
+static int fpu_mode;
+static uint64_t fpu_xcr0;
+static uint32_t fpu_area_size;
+
+static inline void xsetbv(uint32_t index, uint64_t value)
+{
+	__asm__ __volatile__("xsetbv" : : "c"(index), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static inline void clts(void)
+{
+	__asm__ __volatile__("clts" ::: "memory");
+}
+
+static inline void stts(void)
+{
+	write_cr0(read_cr0() | CR0_TS);
+}
+
+static void fpu_save(struct thread *thread)
+{
+	void *area = (void *)thread->fpu_area;
+	uint32_t lo = (uint32_t)fpu_xcr0, hi = (uint32_t)(fpu_xcr0 >> 32);
+	if (fpu_mode == FPU_XSAVEOPT)
+		__asm__ __volatile__("xsaveopt64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+	else if (fpu_mode == FPU_XSAVE)
+		__asm__ __volatile__("xsave64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+	else
+		__asm__ __volatile__("fxsave64 (%0)" : : "r"(area) : "memory");
+}
+
+static void fpu_restore(struct thread *thread)
+{
+	void *area = (void *)thread->fpu_area;
+	uint32_t lo = (uint32_t)fpu_xcr0, hi = (uint32_t)(fpu_xcr0 >> 32);
+	if (fpu_mode == FPU_FXSAVE)
+		__asm__ __volatile__("fxrstor64 (%0)" : : "r"(area) : "memory");
+	else
+		__asm__ __volatile__("xrstor64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+}
+
+/*
+ * A fresh area holds the initial state: an empty XSAVE header resets every component,
+ * but the control words are always loaded from the legacy region.
+ */
+static int fpu_alloc(struct thread *thread)
+{
+	uintptr_t area = page_alloc_zeroed();
+	if (area == 0x0ULL)
+		return -1;
+	*(uint16_t *)area = 0x37F;			// FCW, all x87 exceptions masked.
+	*(uint32_t *)(area + 24) = 0x1F80; // MXCSR, all SSE exceptions masked.
+	thread->fpu_area = area;
+	return 0;
+}
+
+/*
+ * #NM: the current thread uses the FPU for the first time since it was switched in.
+ */
+static void fpu_trap(trap_frame_t *frame)
+{
+	cpu_t *cpu = this_cpu();
+	thread_t *thread = cpu->thread;
+	clts();
+	if (cpu->fpu_owner == thread)
+	{
+		cpu->fpu_live = 1;
+		return;
+	}
+	if (thread->fpu_area == 0x0ULL && fpu_alloc(thread) != 0)
+	{
+		printf("Out of memory for the FPU state of thread %d!\n", thread->tid);
+		if ((frame->cs & 0x3) && thread->mm != NULL)
+			thread_exit();
+		while (1)
+		{
+			__asm__ __volatile__("cli; hlt");
+		}
+	}
+	// The previous owner's registers were saved when it was switched out.
+	fpu_restore(thread);
+	cpu->fpu_owner = thread;
+	cpu->fpu_live = 1;
+	for (uint32_t i = 0; i < num_cpus; i++) // Registers elsewhere are out of date from now on.
+	{
+		if (&cpus[i] != cpu && cpus[i].fpu_owner == thread)
+			cpus[i].fpu_owner = NULL;
+	}
+}
+
+/*
+ * Control registers, for the boot cpu from fpu_init() and for the others from fpu_cpu_init().
+ */
+static void fpu_cpu_setup(void)
+{
+	write_cr0((read_cr0() & ~CR0_EM) | CR0_MP | CR0_NE);
+	uint64_t cr4 = read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+	if (fpu_mode == FPU_FXSAVE)
+	{
+		write_cr4(cr4);
+	}
+	else
+	{
+		write_cr4(cr4 | CR4_OSXSAVE);
+		xsetbv(0, fpu_xcr0);
+	}
+	this_cpu()->fpu_owner = NULL;
+	this_cpu()->fpu_live = 0;
+	stts();
+}
+
+void fpu_init(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+	x86_cpuid(0x1, &eax, &ebx, &ecx, &edx);
+	if (!(edx & (1 << 24)) || !(edx & (1 << 25))) // FXSR, SSE
+	{
+		printf("No SSE, the FPU is not used\n");
+		return;
+	}
+
+	fpu_mode = FPU_FXSAVE;
+	fpu_xcr0 = XSTATE_X87 | XSTATE_SSE;
+	fpu_area_size = 512;
+
+	if (ecx & (1 << 26)) // XSAVE
+	{
+		write_cr4(read_cr4() | CR4_OSXSAVE); // Needed for xsetbv, and for the size cpuid reports.
+		uint32_t supported;
+		x86_cpuid_count(0xD, 0, &supported, &ebx, &ecx, &edx);
+		fpu_xcr0 |= supported & XSTATE_AVX;
+		xsetbv(0, fpu_xcr0);
+		x86_cpuid_count(0xD, 0, &eax, &ebx, &ecx, &edx); // ebx: area size for what XCR0 enables.
+		fpu_area_size = ebx;
+		x86_cpuid_count(0xD, 1, &eax, &ebx, &ecx, &edx);
+		fpu_mode = (eax & 0x1) ? FPU_XSAVEOPT : FPU_XSAVE;
+	}
+
+	fpu_cpu_setup();
+	irq_register(DEVICE_NOT_AVAILABLE_VECTOR, fpu_trap);
+	printf("FPU: %s, state %s, %d bytes\n",
+		   fpu_mode == FPU_XSAVEOPT ? "XSAVEOPT" : fpu_mode == FPU_XSAVE ? "XSAVE" : "FXSAVE",
+		   (fpu_xcr0 & XSTATE_AVX) ? "x87/SSE/AVX" : "x87/SSE", fpu_area_size);
+}
+
+void fpu_cpu_init(void)
+{
+	if (fpu_mode != FPU_NONE)
+		fpu_cpu_setup();
+}
+
+/*
+ * Called by switch_to(): prev's registers are saved if it may have changed them, and only
+ * the owner may use the registers without faulting first.
+ */
+void fpu_switch(struct thread *prev, struct thread *next)
+{
+	if (fpu_mode == FPU_NONE)
+		return;
+	cpu_t *cpu = this_cpu();
+	if (cpu->fpu_live)
+		fpu_save(prev);
+	cpu->fpu_live = next == cpu->fpu_owner;
+	if (cpu->fpu_live)
+		clts();
+	else
+		stts();
+}
+
+/*
+ * The child of fork() starts with a copy of the parent's registers.
+ */
+void fpu_fork(struct thread *child, struct thread *parent)
+{
+	if (parent->fpu_area == 0x0ULL || fpu_alloc(child) != 0)
+		return;
+	uint64_t flags = irq_save();
+	if (this_cpu()->fpu_live) // The parent is running, and the owner.
+		fpu_save(parent);
+	memcpy((void *)child->fpu_area, (void *)parent->fpu_area, fpu_area_size);
+	irq_restore(flags);
+}
+
+void fpu_thread_release(struct thread *thread)
+{
+	for (uint32_t i = 0; i < num_cpus; i++)
+	{
+		if (cpus[i].fpu_owner == thread)
+			cpus[i].fpu_owner = NULL;
+	}
+	if (thread->fpu_area != 0x0ULL)
+	{
+		page_free(thread->fpu_area);
+		thread->fpu_area = 0x0ULL;
+	}
+}
+
+int kernel_fpu_usable(void)
+{
+	return fpu_mode != FPU_NONE;
+}
+
+uint64_t kernel_fpu_begin(void)
+{
+	uint64_t flags = irq_save();
+	cpu_t *cpu = this_cpu();
+	clts();
+	if (cpu->fpu_live)
+		fpu_save(cpu->fpu_owner);
+	cpu->fpu_owner = NULL; // Reloaded on its next #NM.
+	cpu->fpu_live = 0;
+	return flags;
+}
+
+void kernel_fpu_end(uint64_t flags)
+{
+	stts();
+	irq_restore(flags);
+}
+
+/*
+ * memcpy() with SSE, 64 bytes at a time. Mostly for the framebuffer, which is slow to
+ * access in small units. The compiler never uses the vector registers in the kernel,
+ * so they need not be listed as clobbered (it does not even allow that).
+ */
+void *fpu_memcpy(void *dst, const void *src, size_t n)
+{
+	if (n < FPU_MEMCPY_MIN || !kernel_fpu_usable())
+		return memcpy(dst, src, n);
+
+	uint64_t flags = kernel_fpu_begin();
+	char *d = dst;
+	const char *s = src;
+	for (; n >= 64; n -= 64, d += 64, s += 64)
+	{
+		__asm__ __volatile__("movdqu 0(%1), %%xmm0\n\t"
+							 "movdqu 16(%1), %%xmm1\n\t"
+							 "movdqu 32(%1), %%xmm2\n\t"
+							 "movdqu 48(%1), %%xmm3\n\t"
+							 "movdqu %%xmm0, 0(%0)\n\t"
+							 "movdqu %%xmm1, 16(%0)\n\t"
+							 "movdqu %%xmm2, 32(%0)\n\t"
+							 "movdqu %%xmm3, 48(%0)"
+							 :
+							 : "r"(d), "r"(s)
+							 : "memory");
+	}
+	kernel_fpu_end(flags);
+	if (n != 0)
+		memcpy(d, s, n);
+	return dst;
+}
@@ -0,0 +1,111 @@
+/*
+ * Futexes: user space keeps the lock word and only calls in here on contention.
+ * Waiters are queued in a small hash table keyed by (address space, user address).
+ * System calls run with interrupts disabled on a single cpu, so checking the word and
+ * queueing the waiter cannot race with a wake.
+ */
+
+#include <types.h>
+#include <thread.h>
+#include <vm.h>
+#include <errno.h>
+
+#define FUTEX_HASH_SIZE 64
+
+struct futex_bucket
+{
+	thread_t *head;
+	thread_t *tail;
+};
+
+static struct futex_bucket futex_hash[FUTEX_HASH_SIZE];
+
+static inline struct futex_bucket *futex_bucket(mm_t *mm, uintptr_t addr)
+{
+	uintptr_t key = (addr >> 2) ^ ((uintptr_t)mm >> 6);
+	return &futex_hash[key % FUTEX_HASH_SIZE];
+}
+
+/*
+ * Blocks until woken if *addr still holds val. Returns -EAGAIN if it does not.
+ */
+long futex_wait(mm_t *mm, uintptr_t addr, uint32_t val)
+{
+	if (addr & 0x3)
+		return -EINVAL;
+	uintptr_t word = vm_user_to_phys(mm, addr, 0);
+	if (word == 0x0ULL)
+		return -EFAULT;
+	if (*(volatile uint32_t *)word != val)
+		return -EAGAIN;
+
+	struct futex_bucket *bucket = futex_bucket(mm, addr);
+	thread_t *thread = current_thread;
+	thread->futex_addr = addr;
+	thread->next = NULL;
+	if (bucket->tail != NULL)
+		bucket->tail->next = thread;
+	else
+		bucket->head = thread;
+	bucket->tail = thread;
+
+	thread_block();
+	return 0;
+}
+
+/*
+ * Wakes up to count threads waiting on addr, in FIFO order. Returns the number woken.
+ */
+long futex_wake(mm_t *mm, uintptr_t addr, uint32_t count)
+{
+	struct futex_bucket *bucket = futex_bucket(mm, addr);
+	thread_t **link = &bucket->head;
+	thread_t *prev = NULL;
+	long woken = 0;
+
+	while (*link != NULL && woken < count)
+	{
+		thread_t *thread = *link;
+		if (thread->mm != mm || thread->futex_addr != addr)
+		{
+			prev = thread;
+			link = &thread->next;
+			continue;
+		}
+		*link = thread->next;
+		if (bucket->tail == thread)
+			bucket->tail = prev;
+		thread->futex_addr = 0x0ULL;
+		thread_wakeup(thread);
+		woken++;
+	}
+	return woken;
+}
+
+/*
+ * Wakes every thread of mm, for exit().
+ */
+void futex_wake_all(mm_t *mm)
+{
+	for (int i = 0; i < FUTEX_HASH_SIZE; i++)
+	{
+		struct futex_bucket *bucket = &futex_hash[i];
+		thread_t **link = &bucket->head;
+		thread_t *prev = NULL;
+		while (*link != NULL)
+		{
+			thread_t *thread = *link;
+			if (thread->mm != mm)
+			{
+				prev = thread;
+				link = &thread->next;
+				continue;
+			}
+			*link = thread->next;
+			if (bucket->tail == thread)
+				bucket->tail = prev;
+			thread->futex_addr = 0x0ULL;
+			thread_wakeup(thread);
+		}
+	}
+}
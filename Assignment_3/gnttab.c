@@ -20,42 +20,278 @@
 #include <memory.h>
 #include <printf.h>
 #include <os.h>
+#include <string.h>
+#include <palloc.h>
+#include <errno.h>
+#include <cpu.h>
+#include <interrupts.h>
+#include <multicall.h>
 
 #define GNTTAB_PAGE_SIZE 4096U
 #define GNTTAB_PAGE_SHIFT 12U
 
 #define NR_RESERVED_ENTRIES 8
 
-/* NR_GRANT_FRAMES must be less than or equal to that configured in Xen */
-#define NR_GRANT_FRAMES 1
-#define NR_GRANT_ENTRIES (NR_GRANT_FRAMES * GNTTAB_PAGE_SIZE / sizeof(grant_entry_v1_t))
+/*
+ * The table starts with the frames Xen has set up and grows a frame at a time when it runs out
+ * of entries, up to what GNTTABOP_query_size allows. Room for all of them is set aside at init,
+ * as the frames have to be mapped at consecutive addresses, GNTTAB_MAX_FRAMES at most.
+ */
+#define NR_ENTRIES_PER_FRAME (GNTTAB_PAGE_SIZE / sizeof(grant_entry_v1_t))
+
+/*
+ * Free refs are on a lock-free stack linked through gnttab_list. Its head holds the top ref in
+ * the low 32 bits and a tag in the high 32 that every push and pop bumps, so a pop that read a
+ * stale link (its top was taken and put back meanwhile) fails its cmpxchg instead of breaking
+ * the list. In front of it every cpu keeps up to GNTTAB_CACHE_SIZE refs of its own, used with
+ * interrupts off, and moves GNTTAB_CACHE_BATCH at a time to or from the stack. A cpu only
+ * takes from its own cache, so a full table can leave some refs stranded in the others.
+ */
+#define GNTTAB_CACHE_SIZE 32
+#define GNTTAB_CACHE_BATCH 16
+#define GNTTAB_HEAD(tag, ref) (((uint64_t) (tag) << 32) | (ref))
+
+struct gnttab_cache {
+    unsigned int count;
+    grant_ref_t refs[GNTTAB_CACHE_SIZE]; /* refs[count - 1] goes next */
+} __attribute__((aligned(64)));
 
 grant_entry_v1_t *gnttab_table;
 
-static grant_ref_t gnttab_list[NR_GRANT_ENTRIES];
+static grant_ref_t *gnttab_list; /* next free ref after each free one, 0 ends the stack */
+static volatile uint64_t gnttab_free_head;
+static struct gnttab_cache gnttab_caches[MAX_CPUS];
+static volatile int gnttab_growing;
+static struct xen_add_to_physmap gnttab_xatp[GNTTAB_MAX_FRAMES]; /* for gnttab_grow(), one at a time */
+static unsigned int gnttab_frames;
+static unsigned int gnttab_max_frames;
+
+static volatile unsigned long gnttab_in_use;
+static volatile unsigned long gnttab_peak;
+static volatile unsigned long gnttab_failed;
+
+/*
+ * Puts the chain top, ..., bottom, already linked in gnttab_list, on the stack.
+ */
+static void
+gnttab_push_chain(grant_ref_t top, grant_ref_t bottom)
+{
+    uint64_t head = __atomic_load_n(&gnttab_free_head, __ATOMIC_RELAXED);
+
+    do {
+        __atomic_store_n(&gnttab_list[bottom], (grant_ref_t) head, __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&gnttab_free_head, &head, GNTTAB_HEAD((head >> 32) + 1, top),
+                                          1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* refs[0] ends up on top. */
+static void
+gnttab_push(const grant_ref_t *refs, unsigned int count)
+{
+    unsigned int i;
+
+    for (i = 0; i + 1 < count; i++)
+        __atomic_store_n(&gnttab_list[refs[i]], refs[i + 1], __ATOMIC_RELAXED);
+    gnttab_push_chain(refs[0], refs[count - 1]);
+}
+
+/*
+ * Takes up to count refs off the stack with one cmpxchg, top first. The links are read before
+ * the cmpxchg and may be stale then, but any change to the stack also changes the tag. Returns
+ * how many it took.
+ */
+static unsigned int
+gnttab_pop(grant_ref_t *refs, unsigned int count)
+{
+    uint64_t head = __atomic_load_n(&gnttab_free_head, __ATOMIC_ACQUIRE);
+    grant_ref_t next;
+    unsigned int n;
+
+    do {
+        next = (grant_ref_t) head;
+        for (n = 0; n < count && next != 0; n++) {
+            refs[n] = next;
+            next = __atomic_load_n(&gnttab_list[next], __ATOMIC_RELAXED);
+        }
+        if (n == 0)
+            return 0;
+    } while (!__atomic_compare_exchange_n(&gnttab_free_head, &head, GNTTAB_HEAD((head >> 32) + 1, next),
+                                          1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+    return n;
+}
+
+/*
+ * Maps count more frames with one multicall and puts their entries on the stack, the highest on
+ * top. Runs at init or with gnttab_growing held.
+ */
+static int
+gnttab_grow(unsigned int count)
+{
+    unsigned int first, i;
+    uint64_t flags;
+
+    if (count > gnttab_max_frames - gnttab_frames)
+        return -ENOSPC;
+    flags = mc_batch();
+    for (i = 0; i < count; i++) {
+        gnttab_xatp[i].domid = DOMID_SELF;
+        gnttab_xatp[i].idx = gnttab_frames + i;
+        gnttab_xatp[i].space = XENMAPSPACE_grant_table;
+        gnttab_xatp[i].gpfn = ((unsigned long) gnttab_table >> GNTTAB_PAGE_SHIFT) + gnttab_frames + i;
+        mc_queue(__HYPERVISOR_memory_op, XENMEM_add_to_physmap, (unsigned long) &gnttab_xatp[i], 0, NULL);
+    }
+    if (mc_issue(flags) != 0)
+        return -ENOMEM;
+
+    first = gnttab_frames * NR_ENTRIES_PER_FRAME;
+    if (first < NR_RESERVED_ENTRIES)
+        first = NR_RESERVED_ENTRIES;
+    for (i = first + 1; i < (gnttab_frames + count) * NR_ENTRIES_PER_FRAME; i++)
+        gnttab_list[i] = i - 1;
+    gnttab_push_chain(i - 1, first);
+    __atomic_store_n(&gnttab_frames, gnttab_frames + count, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * Fills an empty cache from the stack, growing the table when that is empty too. One cpu grows
+ * it at a time, the others wait and take from the new frame. Returns the refs now cached.
+ */
+static unsigned int
+gnttab_refill(struct gnttab_cache *cache)
+{
+    grant_ref_t refs[GNTTAB_CACHE_BATCH];
+    unsigned int i, n;
+    int rc;
+
+    while ((n = gnttab_pop(refs, GNTTAB_CACHE_BATCH)) == 0) {
+        if (__atomic_exchange_n(&gnttab_growing, 1, __ATOMIC_ACQUIRE) != 0) {
+            while (gnttab_growing)
+                __asm__ __volatile__("pause");
+            continue;
+        }
+        rc = gnttab_grow(1);
+        __atomic_store_n(&gnttab_growing, 0, __ATOMIC_RELEASE);
+        if (rc != 0) {
+            n = gnttab_pop(refs, GNTTAB_CACHE_BATCH); /* freed by another cpu meanwhile */
+            break;
+        }
+    }
+    for (i = 0; i < n; i++)
+        cache->refs[i] = refs[n - 1 - i]; /* handed out in stack order */
+    cache->count = n;
+    return n;
+}
+
+static void
+gnttab_stats_add(unsigned long count)
+{
+    unsigned long in_use = __atomic_add_fetch(&gnttab_in_use, count, __ATOMIC_RELAXED);
+    unsigned long peak = __atomic_load_n(&gnttab_peak, __ATOMIC_RELAXED);
+
+    while (in_use > peak &&
+           !__atomic_compare_exchange_n(&gnttab_peak, &peak, in_use, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/*
+ * Allocates count refs, all or none. Returns -ENOSPC if the table cannot grow to hold them.
+ */
+int
+gnttab_alloc_refs(grant_ref_t *refs, unsigned int count)
+{
+    struct gnttab_cache *cache;
+    uint64_t flags;
+    unsigned int i;
+
+    flags = irq_save();
+    cache = &gnttab_caches[this_cpu()->id];
+    for (i = 0; i < count; i++) {
+        if (cache->count == 0 && gnttab_refill(cache) == 0)
+            break;
+        refs[i] = cache->refs[--cache->count];
+    }
+    irq_restore(flags);
+    if (i < count) {
+        if (i > 0)
+            gnttab_push(refs, i);
+        __atomic_fetch_add(&gnttab_failed, 1, __ATOMIC_RELAXED);
+        return -ENOSPC;
+    }
+    gnttab_stats_add(count);
+    return 0;
+}
+
+/*
+ * Returns refs to this cpu's cache. Once it is full, the GNTTAB_CACHE_BATCH freed longest ago go
+ * back to the stack.
+ */
+void
+gnttab_free_refs(const grant_ref_t *refs, unsigned int count)
+{
+    struct gnttab_cache *cache;
+    uint64_t flags;
+    unsigned int i, j;
+
+    flags = irq_save();
+    cache = &gnttab_caches[this_cpu()->id];
+    for (i = 0; i < count; i++) {
+        if (cache->count == GNTTAB_CACHE_SIZE) {
+            gnttab_push(cache->refs, GNTTAB_CACHE_BATCH);
+            for (j = GNTTAB_CACHE_BATCH; j < GNTTAB_CACHE_SIZE; j++)
+                cache->refs[j - GNTTAB_CACHE_BATCH] = cache->refs[j];
+            cache->count -= GNTTAB_CACHE_BATCH;
+        }
+        cache->refs[cache->count++] = refs[i];
+    }
+    irq_restore(flags);
+    __atomic_fetch_sub(&gnttab_in_use, count, __ATOMIC_RELAXED);
+}
 
 static void
 put_free_entry(grant_ref_t ref)
 {
-    gnttab_list[ref] = gnttab_list[0];
-    gnttab_list[0]  = ref;
+    gnttab_free_refs(&ref, 1);
 }
 
+/* Returns 0, a reserved entry, if the table is full and cannot grow. */
 static grant_ref_t
 get_free_entry(void)
 {
-    unsigned int ref;
-    ref = gnttab_list[0];
-    gnttab_list[0] = gnttab_list[ref];
+    grant_ref_t ref;
+
+    if (gnttab_alloc_refs(&ref, 1) != 0)
+        return 0;
     return ref;
 }
 
+void
+gnttab_get_stats(gnttab_stats_t *stats)
+{
+    stats->in_use = __atomic_load_n(&gnttab_in_use, __ATOMIC_RELAXED);
+    stats->peak = __atomic_load_n(&gnttab_peak, __ATOMIC_RELAXED);
+    stats->failed = __atomic_load_n(&gnttab_failed, __ATOMIC_RELAXED);
+    stats->frames = __atomic_load_n(&gnttab_frames, __ATOMIC_ACQUIRE);
+}
+
+void
+gnttab_stats_print(void)
+{
+    gnttab_stats_t stats;
+
+    gnttab_get_stats(&stats);
+    printf("Grant refs: %ld in use, peak %ld, %ld failed allocations, %d of up to %d frames\n",
+           stats.in_use, stats.peak, stats.failed, stats.frames, gnttab_max_frames);
+}
+
 grant_ref_t
 gnttab_grant_access(domid_t domid, unsigned long frame, int readonly)
 {
     grant_ref_t ref;
 
     ref = get_free_entry();
+    if (ref == 0)
+        return 0;
     gnttab_table[ref].frame = frame;
     gnttab_table[ref].domid = domid;
     wmb();
@@ -71,6 +307,8 @@ gnttab_grant_transfer(domid_t domid, unsigned long pfn)
     grant_ref_t ref;
 
     ref = get_free_entry();
+    if (ref == 0)
+        return 0;
     gnttab_table[ref].frame = pfn;
     gnttab_table[ref].domid = domid;
     wmb();
@@ -125,30 +363,69 @@ gnttab_end_transfer(grant_ref_t ref)
     return frame;
 }
 
-void
+/*
+ * Grants domid the count pages from frame on, refs[i] for frame + i. Returns -ENOSPC, with
+ * nothing granted, if the table cannot hold them all.
+ */
+int
+gnttab_grant_pages(domid_t domid, unsigned long frame, unsigned int count, int readonly,
+                   grant_ref_t *refs)
+{
+    unsigned int i;
+
+    if (gnttab_alloc_refs(refs, count) != 0)
+        return -ENOSPC;
+    for (i = 0; i < count; i++) {
+        gnttab_table[refs[i]].frame = frame + i;
+        gnttab_table[refs[i]].domid = domid;
+    }
+    wmb();
+    for (i = 0; i < count; i++)
+        gnttab_table[refs[i]].flags = GTF_permit_access | (readonly ? GTF_readonly : 0);
+    return 0;
+}
+
+/*
+ * Sets the table up with the frames Xen already has, more are mapped as needed. Returns 0, or
+ * an error with no grants possible.
+ */
+int
 init_gnttab(void)
 {
-    struct xen_add_to_physmap xatp;
-    unsigned long page = (unsigned long) gnttab_table >> GNTTAB_PAGE_SHIFT;
-    int i;
+    struct gnttab_query_size query;
+    unsigned int list_pages, frames;
+    int rc;
 
-    for (i = NR_RESERVED_ENTRIES; i < NR_GRANT_ENTRIES; i++)
-        put_free_entry(i);
+    query.dom = DOMID_SELF;
+    rc = HYPERVISOR_grant_table_op(GNTTABOP_query_size, &query, 1);
+    if (rc != 0 || query.status != GNTST_okay) {
+        printf("cannot query the grant table size: %d, status %d\n", rc, query.status);
+        return rc != 0 ? rc : query.status;
+    }
+    gnttab_max_frames = query.max_nr_frames < GNTTAB_MAX_FRAMES ? query.max_nr_frames : GNTTAB_MAX_FRAMES;
+    list_pages = PAGE_ALIGN_UP(gnttab_max_frames * NR_ENTRIES_PER_FRAME * sizeof(grant_ref_t)) / PAGE_SIZE;
+    gnttab_table = (grant_entry_v1_t *) page_alloc_contig(gnttab_max_frames, 1);
+    gnttab_list = (grant_ref_t *) page_alloc_contig(list_pages, 1);
+    if (gnttab_table == NULL || gnttab_list == NULL) {
+        if (gnttab_table != NULL)
+            page_free_contig((uintptr_t) gnttab_table, gnttab_max_frames);
+        if (gnttab_list != NULL)
+            page_free_contig((uintptr_t) gnttab_list, list_pages);
+        printf("cannot allocate the grant table!\n");
+        return -ENOMEM;
+    }
+    gnttab_free_head = 0;
 
-    i = NR_GRANT_FRAMES;
-    do {
-        i--;
-        xatp.domid = DOMID_SELF;
-        xatp.idx = i;
-        xatp.space = XENMAPSPACE_grant_table;
-        xatp.gpfn = page + i;
-        if (HYPERVISOR_memory_op(XENMEM_add_to_physmap, &xatp)) {
-            printf("cannot map gnttab_table!");
-			while (1) {} // halt the system
-		}
-    } while (i != 0);
-
-    printf("gnttab_table mapped at %p.\n", gnttab_table);
+    frames = query.nr_frames < gnttab_max_frames ? query.nr_frames : gnttab_max_frames;
+    rc = gnttab_grow(frames > 1 ? frames : 1); /* one multicall for all of them */
+    if (rc != 0) {
+        printf("cannot map gnttab_table!\n");
+        return rc;
+    }
+
+    printf("gnttab_table mapped at %p, %d of up to %d frames.\n", gnttab_table, gnttab_frames,
+           gnttab_max_frames);
+    return 0;
 }
 
 void
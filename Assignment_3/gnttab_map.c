@@ -0,0 +1,189 @@
+/*
+ * Mapping and copying grants of another domain, shared by both kernels: Assignment_3 and guest2
+ * each build this file with their own headers. Every call keeps its batch of ops on its own
+ * stack, so any number of cpus can map, unmap and copy at once.
+ */
+#include <types.h>
+#include <gnttab_map.h>
+#include <string.h>
+#include <errno.h>
+
+#define GNTTAB_PAGE_SIZE 4096U
+#define GNTTAB_PAGE_SHIFT 12U
+
+/*
+ * Maps count grants of domid at addr and up, with one hypercall per GNTTAB_BATCH pages. handles
+ * are for gnttab_unmap_pages(). On error nothing stays mapped and the GNTST_ status of the
+ * first failed page or the hypercall error is returned.
+ */
+int
+gnttab_map_pages(domid_t domid, const grant_ref_t *refs, unsigned int count, unsigned long addr,
+                 int readonly, grant_handle_t *handles)
+{
+    gnttab_map_grant_ref_t ops[GNTTAB_BATCH];
+    unsigned int done, i, n;
+    int rc = 0;
+
+    for (done = 0; done < count && rc == 0; done += n) {
+        n = count - done < GNTTAB_BATCH ? count - done : GNTTAB_BATCH;
+        for (i = 0; i < n; i++) {
+            ops[i].host_addr = addr + (unsigned long) (done + i) * GNTTAB_PAGE_SIZE;
+            ops[i].flags = GNTMAP_host_map | (readonly ? GNTMAP_readonly : 0);
+            ops[i].ref = refs[done + i];
+            ops[i].dom = domid;
+        }
+        rc = HYPERVISOR_grant_table_op(GNTTABOP_map_grant_ref, ops, n);
+        for (i = 0; i < n; i++) {
+            if (rc == 0 && ops[i].status == GNTST_okay) {
+                handles[done + i] = ops[i].handle;
+            } else {
+                handles[done + i] = GNTTAB_NO_HANDLE;
+                if (rc == 0)
+                    rc = ops[i].status;
+            }
+        }
+    }
+    if (rc != 0)
+        gnttab_unmap_pages(addr, handles, done);
+    return rc;
+}
+
+/*
+ * Unmaps what gnttab_map_pages() mapped at addr, one hypercall per GNTTAB_BATCH pages. Pages
+ * with GNTTAB_NO_HANDLE are skipped.
+ */
+int
+gnttab_unmap_pages(unsigned long addr, const grant_handle_t *handles, unsigned int count)
+{
+    gnttab_unmap_grant_ref_t ops[GNTTAB_BATCH];
+    unsigned int done = 0, i, n;
+    int rc = 0, ret;
+
+    while (done < count) {
+        for (n = 0; done < count && n < GNTTAB_BATCH; done++) {
+            if (handles[done] == GNTTAB_NO_HANDLE)
+                continue;
+            ops[n].host_addr = addr + (unsigned long) done * GNTTAB_PAGE_SIZE;
+            ops[n].dev_bus_addr = 0;
+            ops[n].handle = handles[done];
+            n++;
+        }
+        if (n == 0)
+            continue;
+        ret = HYPERVISOR_grant_table_op(GNTTABOP_unmap_grant_ref, ops, n);
+        for (i = 0; ret == 0 && i < n; i++) {
+            if (ops[i].status != GNTST_okay)
+                ret = ops[i].status;
+        }
+        if (rc == 0)
+            rc = ret;
+    }
+    return rc;
+}
+
+/*
+ * Runs count copy segments in one hypercall. Returns 0, the hypercall error or the GNTST_ status
+ * of the first segment that failed.
+ */
+int
+gnttab_copy(gnttab_copy_t *ops, unsigned int count)
+{
+    unsigned int i;
+    int rc;
+
+    rc = HYPERVISOR_grant_table_op(GNTTABOP_copy, ops, count);
+    for (i = 0; rc == 0 && i < count; i++) {
+        if (ops[i].status != GNTST_okay)
+            rc = ops[i].status;
+    }
+    return rc;
+}
+
+/*
+ * Has Xen copy len bytes granted by domid, from the start of refs[0] on, to dst. A segment cannot
+ * cross a page on either side, so there are up to two per page, and GNTTAB_BATCH of them go in
+ * one hypercall. Nothing is mapped, so there is no TLB flush either.
+ *
+ * Xen wants the frame dst is in. Both kernels map their first GNTTAB_DIRECT_MAP_END bytes 1:1,
+ * so there the frame is the address shifted, and -EINVAL is returned for a dst outside of them.
+ */
+int
+gnttab_copy_from(domid_t domid, const grant_ref_t *refs, unsigned long len, void *dst)
+{
+    gnttab_copy_t ops[GNTTAB_BATCH];
+    unsigned long done = 0, addr, n;
+    unsigned int count = 0;
+    gnttab_copy_t *op;
+    int rc;
+
+    if ((unsigned long) dst >= GNTTAB_DIRECT_MAP_END || len > GNTTAB_DIRECT_MAP_END - (unsigned long) dst)
+        return -EINVAL;
+
+    while (done < len) {
+        addr = (unsigned long) dst + done;
+        n = GNTTAB_PAGE_SIZE - done % GNTTAB_PAGE_SIZE;
+        if (n > GNTTAB_PAGE_SIZE - addr % GNTTAB_PAGE_SIZE)
+            n = GNTTAB_PAGE_SIZE - addr % GNTTAB_PAGE_SIZE;
+        if (n > len - done)
+            n = len - done;
+
+        op = &ops[count++];
+        op->source.u.ref = refs[done / GNTTAB_PAGE_SIZE];
+        op->source.domid = domid;
+        op->source.offset = done % GNTTAB_PAGE_SIZE;
+        op->dest.u.gmfn = addr >> GNTTAB_PAGE_SHIFT; /* 1:1, checked above */
+        op->dest.domid = DOMID_SELF;
+        op->dest.offset = addr % GNTTAB_PAGE_SIZE;
+        op->len = n;
+        op->flags = GNTCOPY_source_gref;
+        done += n;
+
+        if (count == GNTTAB_BATCH || done == len) {
+            rc = gnttab_copy(ops, count);
+            if (rc != 0)
+                return rc;
+            count = 0;
+        }
+    }
+    return 0;
+}
+
+unsigned long gnttab_copy_threshold = GNTTAB_COPY_THRESHOLD;
+
+/*
+ * Reads len bytes granted by domid into dst the cheaper way: gnttab_copy_from() below
+ * gnttab_copy_threshold, otherwise map the pages at window, copy them out and unmap them again,
+ * window_pages at a time. No memory of ours may be at window, a page there is gone once a grant
+ * was mapped over it.
+ */
+int
+gnttab_read(domid_t domid, const grant_ref_t *refs, unsigned long len, void *dst,
+            unsigned long window, unsigned int window_pages)
+{
+    grant_handle_t handles[GNTTAB_BATCH];
+    unsigned long done, n;
+    unsigned int pages;
+    int rc;
+
+    if (len < gnttab_copy_threshold)
+        return gnttab_copy_from(domid, refs, len, dst);
+
+    if (window_pages > GNTTAB_BATCH)
+        window_pages = GNTTAB_BATCH;
+    for (done = 0; done < len; done += n) {
+        pages = (len - done + GNTTAB_PAGE_SIZE - 1) / GNTTAB_PAGE_SIZE;
+        if (pages > window_pages)
+            pages = window_pages;
+        rc = gnttab_map_pages(domid, refs + done / GNTTAB_PAGE_SIZE, pages, window, 1, handles);
+        if (rc != 0)
+            return rc;
+        n = (unsigned long) pages * GNTTAB_PAGE_SIZE;
+        if (n > len - done)
+            n = len - done;
+        memcpy((char *) dst + done, (void *) window, n);
+        rc = gnttab_unmap_pages(window, handles, pages);
+        if (rc != 0)
+            return rc;
+    }
+    return 0;
+}
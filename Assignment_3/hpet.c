@@ -0,0 +1,57 @@
+/*
+ * The HPET main counter, only read to compare clock sources (see bench.c), the kernel keeps time
+ * with pvclock or the TSC. The ACPI "HPET" table gives the address of the registers, which are
+ * below 4gb and so in the kernel's 1:1 mapping. Under Xen every read traps to the emulated HPET.
+ */
+
+#include <types.h>
+#include <hpet.h>
+#include <acpi.h>
+#include <errno.h>
+#include <printf.h>
+
+#define HPET_CAPABILITIES 0x000 // Bits 63:32: counter period in femtoseconds.
+#define HPET_CONFIG 0x010		// Bit 0: the main counter runs.
+#define HPET_COUNTER 0x0F0
+#define HPET_REGS_SIZE 0x400
+#define HPET_ENABLE 0x1ULL
+#define HPET_MAX_PERIOD_FS 100000000ULL // 100ns, the slowest the specification allows.
+#define FSEC_PER_SEC 1000000000000000ULL
+
+uint64_t hpet_hz;
+static volatile uint64_t *hpet_regs;
+
+static inline uint64_t hpet_reg(uint32_t offset)
+{
+	return hpet_regs[offset / sizeof(uint64_t)];
+}
+
+/*
+ * Finds the HPET and starts its counter if the firmware has not. Returns -ENOENT without one.
+ */
+int hpet_init(uintptr_t rsdp)
+{
+	struct acpi_hpet *table = (struct acpi_hpet *)acpi_find_table(rsdp, "HPET");
+	if (table == NULL || table->header.length < sizeof(*table) || table->base.space_id != ACPI_GAS_MEMORY ||
+		table->base.address == 0x0ULL || table->base.address + HPET_REGS_SIZE > 0x100000000ULL)
+		return -ENOENT;
+	hpet_regs = (volatile uint64_t *)table->base.address;
+	uint64_t period = hpet_reg(HPET_CAPABILITIES) >> 32;
+	if (period == 0 || period > HPET_MAX_PERIOD_FS)
+	{
+		hpet_regs = NULL;
+		return -ENOENT;
+	}
+	hpet_regs[HPET_CONFIG / sizeof(uint64_t)] = hpet_reg(HPET_CONFIG) | HPET_ENABLE;
+	hpet_hz = FSEC_PER_SEC / period;
+	printf("HPET: %ld kHz\n", hpet_hz / 1000);
+	return 0;
+}
+
+/*
+ * The main counter, which may only be 32 bits wide and wrap.
+ */
+uint64_t hpet_read(void)
+{
+	return hpet_reg(HPET_COUNTER);
+}
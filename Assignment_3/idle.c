@@ -0,0 +1,87 @@
+/*
+ * The idle instruction. Under Xen HLT blocks the vCPU in the hypervisor, on hardware with
+ * MONITOR/MWAIT the cpu waits in the deepest C-state CPUID lists, otherwise it halts. Each of them
+ * gives the physical core back until an interrupt arrives, where a spin would keep it busy.
+ */
+
+#include <types.h>
+#include <idle.h>
+#include <cpuid.h>
+#include <printf.h>
+
+#define CPUID_1_ECX_MONITOR (1U << 3)
+#define CPUID_5_ECX_EMX (1U << 0)	// EDX lists the C-states MWAIT supports.
+#define CPUID_6_EAX_ARAT (1U << 2)	// The LAPIC timer keeps running in deep C-states.
+
+static int idle_mode;
+static uint32_t idle_mwait_hint; // eax of mwait: target C-state - 1 in bits 7:4, sub-state in 3:0.
+
+static uint32_t idle_mwait_cstate(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+	x86_cpuid(0x0, &eax, &ebx, &ecx, &edx);
+	if (eax < 0x6)
+		return 0x0; // C1
+	x86_cpuid(0x6, &eax, &ebx, &ecx, &edx);
+	if (!(eax & CPUID_6_EAX_ARAT))
+		return 0x0; // Deeper C-states could stop the timer that wakes us.
+	x86_cpuid(0x5, &eax, &ebx, &ecx, &edx);
+	if (!(ecx & CPUID_5_ECX_EMX))
+		return 0x0;
+	uint32_t hint = 0x0;
+	for (uint32_t cstate = 1; cstate < 8; cstate++)
+	{
+		if ((edx >> (cstate * 4)) & 0xF) // It has sub-states, use the first.
+			hint = (cstate - 1) << 4;
+	}
+	return hint;
+}
+
+/*
+ * Picks the idle instruction for every cpu. xen is set when the hypercall page is usable.
+ */
+void idle_init(int xen)
+{
+	uint32_t eax, ebx, ecx, edx;
+	x86_cpuid(0x1, &eax, &ebx, &ecx, &edx);
+	if (xen)
+	{
+		idle_mode = IDLE_XEN;
+		printf("Idle: HLT, blocks the vCPU in Xen\n");
+	}
+	else if (ecx & CPUID_1_ECX_MONITOR)
+	{
+		idle_mode = IDLE_MWAIT;
+		idle_mwait_hint = idle_mwait_cstate();
+		printf("Idle: MWAIT, C%d\n", (idle_mwait_hint >> 4) + 1);
+	}
+	else
+	{
+		idle_mode = IDLE_HLT;
+		printf("Idle: HLT\n");
+	}
+}
+
+/*
+ * Waits for an interrupt unless *wait is 0 already, the interrupt is handled before it returns.
+ * Called with interrupts disabled, so a wakeup between checking *wait and waiting stays pending,
+ * and sti only enables interrupts after the next instruction: the wait starts with IF=1 and ends
+ * at once. With MWAIT a store to *wait wakes the cpu too.
+ */
+void cpu_idle(volatile uint32_t *wait)
+{
+	switch (idle_mode)
+	{
+	case IDLE_MWAIT:
+		__asm__ __volatile__("monitor" : : "a"(wait), "c"(0), "d"(0));
+		if (*wait)
+			__asm__ __volatile__("sti; mwait; cli" : : "a"(idle_mwait_hint), "c"(0) : "memory");
+		break;
+	default:
+		// IDLE_XEN too: SCHEDOP_block with IF=0 would not see an interrupt that came in after
+		// the check of *wait as a reason to wake, Xen's HLT handler blocks with IF=1 atomically.
+		if (*wait)
+			__asm__ __volatile__("sti; hlt; cli" ::: "memory");
+		break;
+	}
+}
@@ -0,0 +1,10 @@
+#!/bin/sh
+# Host side: samples the cpu usage of the guest from code-hvm.cfg with xentop, once a second.
+# Once the user app has exited every vCPU is blocked in Xen and usage should be close to 0%.
+# usage: sudo ./idle_cpu.sh [seconds]
+domain=code-hvm
+seconds=${1:-10}
+
+xentop -b -d 1 -i "$seconds" | awk -v domain="$domain" '
+	$1 == domain { n++; sum += $4; printf "%s cpu: %s%%\n", domain, $4 }
+	END { if (n) printf "average: %.1f%% over %d samples\n", sum / n, n; else print "domain not running" }'
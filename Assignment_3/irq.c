@@ -0,0 +1,170 @@
+/*
+ * Interrupt and exception dispatch. All vectors enter through the same path (irq_common in
+ * kernel_asm.S) with a full trap frame, then go to the handler registered for the vector.
+ * Exceptions without a handler kill the thread that caused them in user mode and halt in the kernel.
+ * Handlers run under the kernel lock (see smp.h) unless registered with irq_register_nolock().
+ */
+
+#include <types.h>
+#include <irq.h>
+#include <thread.h>
+#include <process.h>
+#include <smp.h>
+#include <apic.h>
+#include <msr.h>
+#include <palloc.h>
+#include <errno.h>
+#include <printf.h>
+
+void *irq_stubs_ptr;
+
+static irq_handler_t irq_handlers[IDT_TABLE_SIZE];
+static uint8_t irq_nolock[IDT_TABLE_SIZE];
+
+static int ist_stack_init(tss_segment_t *tss, int ist)
+{
+	uintptr_t stack = page_alloc_contig(IST_STACK_PAGES, 1);
+	if (stack == 0x0ULL)
+	{
+		printf("Could not allocate IST stack %d!\n", ist);
+		return -ENOMEM;
+	}
+	tss->ist[ist - 1] = stack + IST_STACK_PAGES * PAGE_SIZE;
+	return 0;
+}
+
+void irq_init(void)
+{
+	for (int i = 0; i < IDT_TABLE_SIZE; i++)
+	{
+		irq_handlers[i] = NULL;
+		irq_nolock[i] = 0;
+	}
+}
+
+/*
+ * Sets up the interrupt counters of cpu and the IST stacks in its TSS, idt_init() points
+ * the IDT entries at them.
+ */
+int irq_cpu_init(cpu_t *cpu)
+{
+	cpu->irq_counts = (uint64_t *)page_alloc_zeroed(); // IDT_TABLE_SIZE * 8 bytes
+	if (cpu->irq_counts == NULL)
+		return -ENOMEM;
+	if (ist_stack_init(cpu->tss, IST_NMI) != 0 ||
+		ist_stack_init(cpu->tss, IST_DOUBLE_FAULT) != 0 ||
+		ist_stack_init(cpu->tss, IST_MACHINE_CHECK) != 0)
+		return -ENOMEM;
+	return 0;
+}
+
+/*
+ * Returns -EBUSY if the vector already has a handler.
+ */
+int irq_register(uint8_t vector, irq_handler_t handler)
+{
+	uint64_t flags = irq_save();
+	int ret = -EBUSY;
+	if (irq_handlers[vector] == NULL)
+	{
+		irq_handlers[vector] = handler;
+		ret = 0;
+	}
+	irq_restore(flags);
+	return ret;
+}
+
+/*
+ * For handlers that must run while another cpu holds the kernel lock and waits for them.
+ * They may only touch per-cpu state.
+ */
+int irq_register_nolock(uint8_t vector, irq_handler_t handler)
+{
+	int ret = irq_register(vector, handler);
+	if (ret == 0)
+		irq_nolock[vector] = 1;
+	return ret;
+}
+
+void irq_unregister(uint8_t vector)
+{
+	irq_handlers[vector] = NULL;
+	irq_nolock[vector] = 0;
+}
+
+static void exception_handler(trap_frame_t *frame)
+{
+	printf("Exception %ld, error code: %lx, at %p\n", frame->vector, frame->error_code, (void *)frame->rip);
+	if ((frame->cs & 0x3) && current_thread->mm != NULL)
+		thread_exit(); // Kill the faulting thread, the others keep running.
+	while (1) // A kernel bug, halt.
+	{
+		__asm__ __volatile__("cli; hlt");
+	}
+}
+
+/*
+ * An NMI can come in right after syscall entered the kernel or right before sysret leaves it,
+ * where %gs still or already has the user base and this_cpu() would read user memory. Then the
+ * kernel one is in MSR_KERNEL_GSBASE.
+ */
+static cpu_t *irq_nmi_cpu(void)
+{
+	cpu_t *cpu = (cpu_t *)rdmsr(MSR_GSBASE);
+	if (cpu < &cpus[0] || cpu >= &cpus[MAX_CPUS])
+		cpu = (cpu_t *)rdmsr(MSR_KERNEL_GSBASE);
+	return cpu;
+}
+
+/*
+ * Called from irq_common with the trap frame of the interrupted context.
+ */
+void irq_dispatch(trap_frame_t *frame)
+{
+	uint64_t vector = frame->vector;
+	if (vector == NMI_VECTOR) // May hit anywhere, even inside the kernel lock or printf().
+	{
+		irq_nmi_cpu()->irq_counts[NMI_VECTOR]++; // Only counted, irq_stats_print() shows it.
+		return;
+	}
+	this_cpu()->irq_counts[vector]++;
+
+	// Interrupts from user mode or the idle loop take the lock, those nested in the kernel
+	// already have it.
+	int locked = !irq_nolock[vector] && !kernel_lock_held();
+	if (locked)
+		kernel_lock();
+
+	irq_handler_t handler = irq_handlers[vector];
+	if (handler != NULL)
+		handler(frame);
+	else if (vector < NUM_CPU_EXCEPTIONS)
+		exception_handler(frame);
+	else if (vector != SPURIOUS_VECTOR) // The spurious vector is not in service and takes no EOI.
+		x86_lapic_eoi(); // Otherwise a stray interrupt holds off every lower priority vector.
+
+	if (locked && (frame->cs & 0x3)) // Back to user mode.
+		process_check_exit();
+	if (locked)
+		kernel_unlock();
+}
+
+void irq_stats_print(void)
+{
+	for (int i = 0; i < IDT_TABLE_SIZE; i++)
+	{
+		uint64_t total = 0;
+		for (uint32_t c = 0; c < num_cpus; c++)
+			total += cpus[c].irq_counts[i];
+		if (total == 0)
+			continue;
+		printf("Vector %d: %ld interrupts", i, total);
+		if (num_cpus > 1)
+		{
+			for (uint32_t c = 0; c < num_cpus; c++)
+				printf(" %s%ld", c == 0 ? "(per cpu: " : "", cpus[c].irq_counts[i]);
+			printf(")");
+		}
+		printf("\n");
+	}
+}
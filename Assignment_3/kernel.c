@@ -17,24 +17,41 @@
 #include <version.h>
 #include <rdtsc.h>
 #include <xen.h>
+#include <palloc.h>
+#include <vm.h>
+#include <elf.h>
+#include <thread.h>
+#include <process.h>
+#include <timer.h>
+#include <irq.h>
+#include <fpu.h>
+#include <cpu.h>
+#include <smp.h>
+#include <tlb.h>
+#include <idle.h>
+#include <evtchn.h>
+#include <hpet.h>
+#include <multicall.h>
+#include <vcpu.h>
+#include <xring_bench.h>
+#include <xenstore.h>
 
 // Declare the methods.
 uintptr_t page_table_init_kernel(information);
-uintptr_t page_table_init_user(information, uintptr_t, uint8_t);
-void write_cr3(uintptr_t);
 void tss_segment_init(information);
-void tls_init(information);
+void page_fault_handler(trap_frame_t *);
 uint32_t xen_detect();
 void xen_hypercalls_init();
 uint32_t xen_base_detect();
-uint32_t xen_shared_init();
+uint32_t xen_shared_init(long *version);
+void xen_vcpu_init(cpu_t *cpu);
 void pvclock_init();
 uint64_t pvclock_monotonic_read();
 uint64_t pvclock_wc_read();
 void wait(uint32_t);
 
-void *default_interrupt_handler_ptr;
-void *page_fault_handler_ptr;
+idt_entry_t idt[IDT_TABLE_SIZE] __attribute__((aligned(16)));
+idt_pointer_t idt_ptr;
 
 information global_info;
 uintptr_t global_k_pml4e_base;
@@ -47,39 +64,53 @@ uint64_t wall_clock_offset;
 
 hypervisor_entry_t hyperv_signature_xen;
 
+#define XEN_CPUID_VCPU_ID_PRESENT (1U << 3) // Leaf base + 4: EBX holds the vCPU id.
+
+/* A vcpu_info in a cache line of its own, see xen_vcpu_init(). */
+struct xen_vcpu_slot
+{
+	vcpu_info_t info;
+} __attribute__((aligned(64)));
+
+static struct xen_vcpu_slot *xen_vcpu_area; // One per cpu id.
+static int xen_vcpu_enabled; // The shared info page is mapped.
+static volatile uint64_t pvclock_last; // Latest time handed out while the TSCs may disagree.
+
 // Kernel entry point.
 void kernel_start(void *kernel_stack_buffer, unsigned int *framebuffer, unsigned int width, unsigned int height, information *info)
 {
 	global_info = *info;
+	smp_boot_cpu_init(); // This is cpu 0, running under the kernel lock until sched_start().
 
 	fb_init(framebuffer, width, height);
 
-	uintptr_t user_app_virt_addr = 0xFFFFFFFFC0001000;	 // Calculated manually according to the page table setup.
-	uintptr_t user_stack_virt_addr = 0xFFFFFFFFC0001000; // Same as above because stack is mapped before user_app in virtual mem. As stack moves downwards we shift by 4096.
-	user_stack = (void *)user_stack_virt_addr;			 // Initialize user stack.
-
-	printf("Kernel Stack: %p\n", kernel_stack);
-	printf("User Stack: %p\n", user_stack);
+	printf("Kernel Stack: %p\n", kernel_stack_buffer);
+	printf("User Stack: %p\n", (void *)USER_STACK_TOP); // Right below the user app in every process, moves downwards.
 
 	printf("Initializing page tables for kernel and user space!\n");
 	uintptr_t k_pml4e_base = page_table_init_kernel(*info); // Initialize kernel page tables.
 	global_k_pml4e_base = k_pml4e_base;
-	uintptr_t u_pml4e_base = page_table_init_user(*info, k_pml4e_base, 0); // Initialize user page tables.
-	write_cr3(u_pml4e_base);											   // Pass the base pml4e to cr3.
+	write_cr3(k_pml4e_base); // Every process gets its own pml4 sharing this 1:1 mapping.
+	palloc_init(info->page_pool_base, info->num_page_pool_pages); // User page tables and pages come from the pool.
+	vm_init((uint64_t *)k_pml4e_base);
+	thread_init((uintptr_t)kernel_stack_buffer); // The boot context is the first (idle) thread.
+	process_init((boot_module_t *)info->modules, info->num_modules);
 
 	printf("Initializing system calls!\n");
 	syscall_init(); // Initialize system calls (syscall/sysret).
 
 	printf("Initialize task state segment for cpu 0!\n");
 	tss_segment_init(*info); // Initialize task state segment.
+	irq_init(); // Interrupt handlers.
+	irq_cpu_init(this_cpu()); // Interrupt counters and the IST stacks.
 	printf("TSS Stack: %p\n", (void *)info->tss_stack_buffer);
 
-	printf("Initializing TLS!\n");
-	tls_init(*info);
-
 	printf("Initializing Interrupt Desciptor Table!\n");
 	idt_init();
+	fpu_init(); // FPU/SSE/AVX, switched lazily between threads.
 
+	int xen_ready = 0; // Hypercalls and the shared info page work.
+	int evtchn_ready = 0;
 	uint32_t hyperv = xen_detect();
 	if (hyperv == HYPERVISOR_XEN)
 	{
@@ -87,34 +118,27 @@ void kernel_start(void *kernel_stack_buffer, unsigned int *framebuffer, unsigned
 		xen_base = xen_base_detect();
 		xen_hypercalls_init();
 		printf("Initialized Xen hypercalls!\n");
-		if (xen_shared_init() == 0)
+		long version = 0;
+		if (mc_init() == 0 && xen_shared_init(&version) == 0)
 		{
-			uint32_t version;
-			version = (uint32_t)HYPERVISOR_xen_version(XENVER_version, NULL);
-			printf("Major version: %d\n", version >> 16);
-			printf("Minor version: %d\n", version & 0xFFFF);
+			printf("Major version: %d\n", (uint32_t)version >> 16);
+			printf("Minor version: %d\n", (uint32_t)version & 0xFFFF);
+			xen_ready = xen_base != 0;
 
+			xen_vcpu_area = (struct xen_vcpu_slot *)page_alloc_zeroed();
+			xen_vcpu_enabled = 1;
+			xen_vcpu_init(this_cpu()); // The other cpus as they start, see smp.c.
 			pvclock_init();
 			uint64_t time_now = pvclock_monotonic_read();
 			wall_clock_offset = pvclock_wc_read();
 			printf("PV Clock Monotonic: %ldns\n", time_now);
 			printf("PV Clock Wall Clock: %ldns\n", wall_clock_offset + time_now);
-			wait(1);
-			time_now = pvclock_monotonic_read();
-			printf("PV Clock Monotonic after busy wait: %ldns\n", time_now);
-			printf("PV Clock Wall Clock after busy wait: %ldns\n", wall_clock_offset + time_now);
-			gnttab_table = (grant_entry_v1_t *)info->gnt_table;
-			init_gnttab();
-			char *msg = (char *)info->shared_page;
-			msg[0] = 'H';
-			msg[1] = 'i';
-			msg[2] = '\0';
-			unsigned long shared_page_frame = (unsigned long)msg;
-			grant_ref_t ref;
-			shared_page_frame /= 0x1000;
-			ref = gnttab_grant_access((domid_t)6, shared_page_frame, 0);
-			printf("The shared message is : %s\n", msg);
-			printf("The grant reference number: %d\n", ref);
+			int gnttab_ready = init_gnttab() == 0; // Sized from GNTTABOP_query_size, grows on demand.
+			evtchn_ready = xen_ready && evtchn_init() == 0; // Events arrive as interrupts, nothing polls.
+			if (evtchn_ready && xs_loopback() == 0) // Before xring_bench_start() connects the client for real.
+				printf("XenStore loopback: ok\n");
+			if (gnttab_ready && evtchn_ready && xring_bench_start(info->shared_page) != 0)
+				printf("No ring for guest2!\n");
 		}
 		else
 		{
@@ -122,15 +146,39 @@ void kernel_start(void *kernel_stack_buffer, unsigned int *framebuffer, unsigned
 		}
 	}
 
-	//x86_lapic_enable();
-
-	printf("Jumping to user app!\n\n");
-	user_jump((void *)user_app_virt_addr); // Just to user app in virtual space.
-
-	/* Never exit! */
-	while (1)
+	x86_lapic_enable();
+	timer_init(pvclock_ti != NULL); // Measure the LAPIC timer rate against pvclock or the TSC, then go tickless.
+	if (evtchn_ready)
+		timer_xen_init(); // Deadlines by hypercall, interrupts as VIRQ_TIMER events instead of LAPIC emulation.
+	idle_init(xen_ready); // Waiting gives the core back: MWAIT or HLT, which blocks the vCPU under Xen.
+	timer_bench();
+	hpet_init(info->rsdp); // Only a clock to compare the others with, see bench(BENCH_CLOCK).
+	if (evtchn_scan_test() == 0) // Ordinary memory only, so also without Xen.
+		printf("Event channel scan: ok\n");
+	if (evtchn_ready)
+	{
+		int64_t cycles = evtchn_loopback();
+		if (cycles < 0)
+			printf("Event channel loopback failed: %ld\n", cycles);
+		else
+			printf("Event channel loopback: %ld cycles from send to handler\n", cycles);
+	}
+	if (xen_ready)
+		mc_stats_print(); // Boot's hypercalls, the batched ones counted once.
+	if (pvclock_ti != NULL)
 	{
-	};
+		wait(1);
+		uint64_t time_now = pvclock_monotonic_read();
+		printf("PV Clock Monotonic after wait: %ldns\n", time_now);
+		printf("PV Clock Wall Clock after wait: %ldns\n", pvclock_wc_read() + time_now);
+	}
+	tlb_init(); // TLB shootdown IPIs.
+	smp_init(info->rsdp, info->trampoline_page); // Start the other cpus, they wait for the kernel lock.
+
+	printf("Starting the user app!\n\n");
+	if (process_spawn("user") < 0)
+		printf("Could not start the user app!\n");
+	sched_start(); // The boot context becomes the idle thread, never returns.
 }
 
 uint32_t xen_detect()
@@ -196,7 +244,10 @@ uint32_t xen_base_detect()
 	return 0;
 }
 
-uint32_t xen_shared_init()
+/*
+ * Maps the shared info page and asks for the Xen version, in one multicall.
+ */
+uint32_t xen_shared_init(long *version)
 {
 	struct xen_add_to_physmap xatp;
 
@@ -205,76 +256,161 @@ uint32_t xen_shared_init()
 	xatp.idx = 0;
 	xatp.space = XENMAPSPACE_shared_info;
 	xatp.gpfn = (unsigned long)xen_shared_info >> 12;
-	return (uint32_t)HYPERVISOR_memory_op(XENMEM_add_to_physmap, &xatp);
+	uint64_t flags = mc_batch();
+	mc_queue(__HYPERVISOR_memory_op, XENMEM_add_to_physmap, (unsigned long)&xatp, 0, NULL);
+	mc_queue(__HYPERVISOR_xen_version, XENVER_version, 0, 0, version);
+	return (uint32_t)mc_issue(flags);
+}
+
+/*
+ * Moves this cpu's vcpu_info out of the shared info page, which only has XEN_LEGACY_MAX_VCPUS
+ * slots packed next to each other, into its own cache line of xen_vcpu_area. Xen copies the state
+ * over and from then on only updates the new one. Called on every cpu as it starts, the boot
+ * cpu first. A cpu that cannot register keeps its legacy slot, if it has one.
+ */
+void xen_vcpu_init(cpu_t *cpu)
+{
+	if (!xen_vcpu_enabled)
+		return;
+	uint32_t eax, ebx, ecx, edx;
+	x86_cpuid(xen_base + 4, &eax, &ebx, &ecx, &edx);
+	cpu->xen_vcpu_id = (eax & XEN_CPUID_VCPU_ID_PRESENT) ? ebx : cpu->id;
+
+	cpu->vcpu_info = NULL;
+	if (xen_vcpu_area != NULL)
+	{
+		vcpu_info_t *info = &xen_vcpu_area[cpu->id].info;
+		struct vcpu_register_vcpu_info reg;
+		reg.mfn = (uintptr_t)info >> PAGE_SHIFT;
+		reg.offset = (uintptr_t)info & (PAGE_SIZE - 1);
+		reg.rsvd = 0;
+		int ret = HYPERVISOR_vcpu_op(VCPUOP_register_vcpu_info, cpu->xen_vcpu_id, &reg);
+		if (ret == 0)
+			cpu->vcpu_info = info;
+		else
+			printf("vCPU %d: VCPUOP_register_vcpu_info failed: %d\n", cpu->xen_vcpu_id, ret);
+	}
+	if (cpu->vcpu_info == NULL && cpu->xen_vcpu_id < XEN_LEGACY_MAX_VCPUS)
+		cpu->vcpu_info = &xen_shared_info->vcpu_info[cpu->xen_vcpu_id];
+	cpu->pvclock = cpu->vcpu_info != NULL ? (pvclock_vcpu_time_info_t *)&cpu->vcpu_info->time : pvclock_ti;
 }
 
+/*
+ * pvclock_ti is the boot cpu's time info, the TSC rate comes from it.
+ */
 void pvclock_init()
 {
-	pvclock_ti = (pvclock_vcpu_time_info_t *)&xen_shared_info->vcpu_info[0].time;
+	pvclock_ti = this_cpu()->pvclock;
 	pvclock_wc = (pvclock_wall_clock_t *)&xen_shared_info->wc_version;
 }
 
+/*
+ * Xen system time: the TSC, scaled by tsc_to_system_mul and tsc_shift, since tsc_timestamp, from
+ * this cpu's time info. Xen makes version odd while it updates the fields, so they are copied out
+ * between two reads of the same even version. x86 does not reorder loads with other loads, a
+ * compiler barrier keeps the copy between the version reads and lfence keeps rdtsc from running
+ * ahead of it.
+ *
+ * With PVCLOCK_TSC_STABLE_BIT every vCPU's time agrees and that is all. Otherwise two cpus can be
+ * a little apart, and the time never goes below the latest one handed out on any cpu. The same
+ * covers a thread that moved to another cpu between reading the time info and the TSC.
+ */
 uint64_t pvclock_monotonic_read()
 {
-	uint32_t version;
-	uint64_t delta, time_now;
+	volatile pvclock_vcpu_time_info_t *ti = this_cpu()->pvclock;
+	uint32_t version, mul;
+	uint64_t tsc, tsc_timestamp, system_time;
+	int8_t shift;
+	uint8_t flags;
 	do
 	{
-		version = pvclock_ti->version;
-		__asm__("mfence" ::
-					: "memory");
-		delta = rdtsc() - pvclock_ti->tsc_timestamp;
-		if (pvclock_ti->tsc_shift < 0)
-			delta >>= -pvclock_ti->tsc_shift;
-		else
-			delta <<= pvclock_ti->tsc_shift;
-		time_now = mul64_32(delta, pvclock_ti->tsc_to_system_mul) +
-				   pvclock_ti->system_time;
-		__asm__("mfence" ::
-					: "memory");
-	} while ((pvclock_ti->version & 1) || (pvclock_ti->version != version));
-
-	return (uint64_t)time_now; // current time in nano seconds.
+		version = ti->version;
+		__asm__ __volatile__("" ::: "memory");
+		tsc_timestamp = ti->tsc_timestamp;
+		system_time = ti->system_time;
+		mul = ti->tsc_to_system_mul;
+		shift = ti->tsc_shift;
+		flags = ti->flags;
+		tsc = rdtsc_ordered();
+		__asm__ __volatile__("" ::: "memory");
+	} while ((version & 1) || ti->version != version);
+
+	uint64_t delta = tsc - tsc_timestamp;
+	if (shift < 0)
+		delta >>= -shift;
+	else
+		delta <<= shift;
+	uint64_t now = mul64_32(delta, mul) + system_time; // current time in nano seconds.
+	if (flags & PVCLOCK_TSC_STABLE_BIT)
+		return now;
+
+	uint64_t last = __atomic_load_n(&pvclock_last, __ATOMIC_RELAXED);
+	do
+	{
+		if (now <= last)
+			return last;
+	} while (!__atomic_compare_exchange_n(&pvclock_last, &last, now, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	return now;
 }
 
+static volatile uint32_t pvclock_wc_cached_version = 1; // Odd while nothing valid is cached.
+static volatile uint64_t pvclock_wc_cached;
+static volatile uint32_t pvclock_wc_updating;
+
+/*
+ * Wall clock time of boot in nanoseconds. Xen only changes it when the host clock is set, so
+ * the last value is kept and only worked out again once wc_version moves on.
+ */
 uint64_t pvclock_wc_read()
 {
-	uint32_t version;
-	uint64_t wc_boot;
+	uint32_t version = pvclock_wc->version;
+	__asm__ __volatile__("" ::: "memory");
+	if (pvclock_wc_cached_version == version)
+	{
+		uint64_t wc_boot = pvclock_wc_cached;
+		__asm__ __volatile__("" ::: "memory");
+		if (pvclock_wc_cached_version == version)
+			return wc_boot;
+	}
 
+	uint64_t wc_boot;
 	do
 	{
 		version = pvclock_wc->version;
-		__asm__("mfence" ::
-					: "memory");
-		wc_boot = pvclock_wc->sec * NSEC_PER_SEC;
-		wc_boot += pvclock_wc->nsec;
-		__asm__("mfence" ::
-					: "memory");
-	} while ((pvclock_wc->version & 1) || (pvclock_wc->version != version));
+		__asm__ __volatile__("" ::: "memory");
+		wc_boot = (((uint64_t)pvclock_wc->sec_hi << 32) | pvclock_wc->sec) * NSEC_PER_SEC + pvclock_wc->nsec;
+		__asm__ __volatile__("" ::: "memory");
+	} while ((version & 1) || pvclock_wc->version != version);
 
+	if (__atomic_exchange_n(&pvclock_wc_updating, 1, __ATOMIC_ACQUIRE) == 0) // Other cpus just don't cache theirs.
+	{
+		pvclock_wc_cached_version = 1;
+		__asm__ __volatile__("" ::: "memory");
+		pvclock_wc_cached = wc_boot;
+		__asm__ __volatile__("" ::: "memory");
+		pvclock_wc_cached_version = version;
+		__atomic_store_n(&pvclock_wc_updating, 0, __ATOMIC_RELEASE);
+	}
 	return wc_boot;
 }
 
-void wait(uint32_t secs)
+static void wait_done(void *arg)
 {
-	uint64_t time_now, time = pvclock_monotonic_read();
-	do
-	{
-		time_now = pvclock_monotonic_read();
-	} while (((time_now - time)/NSEC_PER_SEC) < secs);
+	*(volatile uint32_t *)arg = 0;
 }
 
 /*
- * Initializes TLS for the user app.
+ * Idles on a timer, only for boot before there is a scheduler to sleep with (see sleep_ns()).
  */
-void tls_init(information info)
+void wait(uint32_t secs)
 {
-	__builtin_memset((void *)info.tls_buffer, 0x0, sizeof(tls_block_t));
-	uintptr_t tls_virt_addr = 0xFFFFFFFFC01FE000ULL; // Virtual address from the user space where the tls struct is mapped. 510th user pte.
-	tls_block_t *tls = (tls_block_t *)tls_virt_addr;
-	tls->myself = (uintptr_t)tls;
-	wrmsr(MSR_FSBASE, (uint64_t)tls);
+	volatile uint32_t waiting = 1;
+	timer_t timer;
+	uint64_t flags = irq_save();
+	timer_add(&timer, clock_ns() + (uint64_t)secs * NSEC_PER_SEC, wait_done, (void *)&waiting);
+	while (waiting)
+		cpu_idle(&waiting);
+	irq_restore(flags);
 }
 
 /*
@@ -282,24 +418,23 @@ void tls_init(information info)
  */
 void idt_init()
 {
+	this_cpu()->idt = idt; // The other cpus start with a copy, see smp.c.
 	idt_ptr.base = (uint64_t)idt;
 	idt_ptr.limit = sizeof(idt_entry_t) * IDT_TABLE_SIZE - 1;
 
-	for (int i = 0; i < NUM_CPU_EXCEPTIONS; i++) // Set the default handler pointer for the first 32 IDT entries.
+	for (int i = 0; i < IDT_TABLE_SIZE; i++) // Every vector has its own entry stub, see irq.h.
 	{
-		set_idt_entry(i, (uint64_t)default_interrupt_handler_ptr, (uint16_t)0x8, (uint8_t)0x8E);
+		set_idt_entry(i, (uint64_t)irq_stubs_ptr + i * IRQ_STUB_SIZE, (uint16_t)0x8, (uint8_t)0x8E);
 	}
+	idt[NMI_VECTOR].ist = IST_NMI;
+	idt[DOUBLE_FAULT_VECTOR].ist = IST_DOUBLE_FAULT;
+	idt[MACHINE_CHECK_VECTOR].ist = IST_MACHINE_CHECK;
 
-	for (int i = NUM_CPU_EXCEPTIONS; i < IDT_TABLE_SIZE; i++) // Initialize all other IDT entries to point to addr 0x0ULL.
-	{
-		set_idt_entry(i, (uint64_t)0x0ULL, (uint16_t)0x8, (uint8_t)0x8E);
-	}
-
-	// Initialize page fault handler. Comment this line out to handle page fault with default handler (Q3.2).
-	set_idt_entry(PAGE_FAULT_IDT_INDEX, (uint64_t)page_fault_handler_ptr, (uint16_t)0x8, (uint8_t)0x8E);
+	// Initialize page fault handler, it populates user pages on first touch.
+	irq_register(PAGE_FAULT_IDT_INDEX, page_fault_handler);
 
 	// Initializes the 32nd IDT entry to the apic handler.
-	set_idt_entry(APIC_INTERRUPT_ENTRY, (uint64_t)apic_handler_ptr, (uint16_t)0x8, (uint8_t)0x8E);
+	irq_register(APIC_INTERRUPT_ENTRY, apic_handler);
 
 	load_idt(&idt_ptr);
 }
@@ -315,92 +450,35 @@ void set_idt_entry(uint8_t entry_num, uint64_t addr, uint16_t selector, uint8_t
 	idt[entry_num].reserved = 0;
 }
 
-void default_interrupt_handler(uint64_t rsp)
+void page_fault_handler(trap_frame_t *frame)
 {
-	printf("An exception has occurred. %%rsp: %p\n", (void *)rsp);
-}
+	uint64_t error_code = frame->error_code;
+	uintptr_t addr = read_cr2();
+	if (current_mm != NULL && vm_handle_fault(current_mm, addr, error_code) == 0)
+		return;
 
-void page_fault_handler()
-{
-	printf("Page fault has occurred. Allocating a page to the address.\n");
-	uintptr_t u_pml4e_base = page_table_init_user(global_info, global_k_pml4e_base, 1); // Initialize user page tables with extra page.
-	write_cr3(u_pml4e_base);
+	printf("Segmentation fault at %p, error code: %lx\n", (void *)addr, error_code);
+	if ((error_code & PF_USER) && current_thread->mm != NULL)
+		thread_exit(); // Kill the faulting thread, the others keep running.
+	while (1) // A kernel bug, halt.
+	{
+		__asm__ __volatile__("cli; hlt");
+	}
 }
 
 /*
- * Sets the tss stack pointer rsp0.
+ * Sets the tss stack pointer rsp0 of the boot cpu.
  * Passes the gdt tss offset value for initialization. 
  */
 void tss_segment_init(information info)
 {
-	uint16_t tss_offset = 0x28;
 	tss_segment_t *tss_segment = (tss_segment_t *)info.tss_segment_buffer;
 	__builtin_memset((void *)tss_segment, 0x0, sizeof(tss_segment_t));
 	uint64_t tss_stack = (uint64_t)info.tss_stack_buffer;
 	tss_segment->rsp[0] = tss_stack;
 	tss_segment->iopb_base = sizeof(tss_segment_t);
-	load_tss_segment(tss_offset, tss_segment);
-}
-
-/*
- * Initialize 4-level page table to map top 1gb memory for the user-space and reuse bottom 4gb of kernel-space.
- * The only caveat is if user_stack + user_app size is > 2mb it will fail as we will need more than 512 ptes.
- * But for the purpose of the assignment, the logic works.
- */
-uintptr_t page_table_init_user(information info, uintptr_t k_pml4e, uint8_t redef)
-{
-	void *user_pt_base = (void *)info.user_pt_base;
-	uint64_t *kernel_pml4e = (uint64_t *)k_pml4e;
-
-	uint64_t *u_pte = (uint64_t *)user_pt_base;
-	for (unsigned int i = 0; i < info.num_user_stack_pages; i++)
-	{
-		u_pte[i] = (uint64_t)((0x1000 * i) + (info.user_stack_buffer - (info.num_user_stack_pages * 0x1000)) + 0x7);
-	}
-	for (unsigned int i = info.num_user_stack_pages; i < info.num_user_ptes; i++)
-	{
-		unsigned int temp = i - info.num_user_stack_pages;
-		u_pte[i] = (uint64_t)((0x1000 * temp) + info.user_app_buffer + 0x7);
-	}
-	for (unsigned int i = info.num_user_ptes; i < 512; i++) //Assuming num_user_ptes will be lesser than 512.
-	{
-		u_pte[i] = (uint64_t)0x0ULL;
-	}
-	u_pte[510] = (uint64_t)(info.tls_buffer + 0x7); // Mapping the tls buffer to user space.
-	if (redef == 1)
-	{
-		u_pte[511] = (uint64_t)(info.extra_page_for_exception + 0x7);
-	}
-
-	uint64_t *u_pde = (uint64_t *)(u_pte + 512);
-	uint64_t page_addr;
-	for (int j = 0; j < info.num_user_pdes; j++)
-	{
-		uint64_t *pte_start = u_pte + 512 * j;
-		page_addr = (uint64_t)pte_start;
-		u_pde[j] = page_addr + 0x7;
-	}
-	for (int j = info.num_user_pdes; j < 512; j++) // Assuming num_user_pdes will be lesser than 512.
-	{
-		u_pde[j] = 0x0ULL;
-	}
-
-	uint64_t *u_pdpe = (uint64_t *)(u_pde + 512);
-	for (int k = 0; k < 512 - info.num_user_pdpes; k++)
-	{
-		u_pdpe[k] = 0x0ULL;
-	}
-	u_pdpe[511] = (uint64_t)(u_pde) + 0x7; // Topmost entry here corresponds to last 1gb in virtual address space.
-
-	uint64_t *u_pml4e = (uint64_t *)(u_pdpe + 512);
-	u_pml4e[0] = *kernel_pml4e;
-	for (int m = 1; m < 512 - info.num_user_pml4es; m++)
-	{
-		u_pml4e[m] = 0x0ULL;
-	}
-	u_pml4e[511] = (uint64_t)(u_pdpe) + 0x7; // Topmost entry here corresponds to last 1gb in virtual address space.
-
-	return ((uintptr_t)u_pml4e);
+	this_cpu()->tss = tss_segment; // rsp[0] follows the running thread, see thread.c
+	load_tss_segment(this_cpu()->gdt, GDT_TSS, tss_segment);
 }
 
 /* 
@@ -448,7 +526,7 @@ uintptr_t page_table_init_kernel(information info)
 		page_addr = (uint64_t)pdpe_start;
 		pml4e[m] = page_addr + 0x3;
 	}
-	for (int m = num_pml4; m < 511; m++)
+	for (int m = num_pml4; m < 512; m++)
 	{
 		pml4e[m] = 0x0ULL;
 	}
@@ -1,30 +1,90 @@
-#include <kernel_syscall.h>
 #include <types.h>
+#include <kernel_syscall.h>
 #include <msr.h>
 #include <printf.h>
+#include <vm.h>
+#include <errno.h>
+#include <thread.h>
+#include <process.h>
+#include <timer.h>
+#include <irq.h>
+#include <bench.h>
+#include <smp.h>
 
-void *kernel_stack; /* Initialized in kernel_entry.S */
-void *user_stack = NULL; /* Initialized in kernel.c */
+uint64_t syscall_count;
 
 void *syscall_entry_ptr; /* Points to syscall_entry(), initialized in kernel_entry.S; use that rather than syscall_entry() when obtaining its address */
 
-long do_syscall_entry(long n, long a1, long a2, long a3, long a4, long a5)
+static long syscall_dispatch(long n, long a1, long a2, long a3, long a4, long a5)
 {
-	if (n == 0) // Handle only 0 for now which means write in our case.
+	switch (n)
 	{
+	case SYS_PRINT_MESSAGE:
 		printf((char *)a1);
-	}
-	else if (n == 1)
-	{
+		break;
+	case SYS_PRINT_VALUE:
 		printf("The passed variable has the following value: %d \n", a1);
-	}
-	else
-	{
-		return -1;
+		break;
+	case SYS_MMAP: // mmap(addr, len, prot, flags), anonymous memory only.
+		return (long)vm_mmap(current_mm, (uintptr_t)a1, (size_t)a2, (int)a3, (int)a4);
+	case SYS_MUNMAP:
+		return vm_munmap(current_mm, (uintptr_t)a1, (size_t)a2);
+	case SYS_BRK:
+		return (long)vm_brk(current_mm, (uintptr_t)a1);
+	case SYS_THREAD_CREATE: // thread_create(entry, stack, arg, clear_tid), returns the tid.
+		return sys_thread_create((uintptr_t)a1, (uintptr_t)a2, (uint64_t)a3, (uintptr_t)a4);
+	case SYS_THREAD_EXIT:
+		thread_exit();
+	case SYS_FUTEX: // futex(addr, op, val)
+		if (a2 == FUTEX_WAIT)
+			return futex_wait(current_mm, (uintptr_t)a1, (uint32_t)a3);
+		if (a2 == FUTEX_WAKE)
+			return futex_wake(current_mm, (uintptr_t)a1, (uint32_t)a3);
+		return -EINVAL;
+	case SYS_YIELD:
+		thread_yield();
+		break;
+	case SYS_SYSCALL_COUNT:
+		return (long)syscall_count;
+	case SYS_SCHED_STATS:
+		sched_stats_print();
+		break;
+	case SYS_IRQ_STATS:
+		irq_stats_print();
+		break;
+	case SYS_BENCH: // bench(op, samples, n)
+		return sys_bench(a1, (uintptr_t)a2, (uint32_t)a3);
+	case SYS_FORK:
+		return sys_fork();
+	case SYS_SPAWN: // spawn(name), name of a file in \EFI\BOOT\BIN
+		return sys_spawn((uintptr_t)a1);
+	case SYS_EXIT:
+		sys_exit((int)a1);
+	case SYS_WAIT:
+		return sys_wait(a1);
+	case SYS_GETPID:
+		return current_thread->process->pid;
+	case SYS_SLEEP_NS:
+		sleep_ns((uint64_t)a1);
+		break;
+	case SYS_CLOCK_NS:
+		return (long)clock_ns();
+	default:
+		return -ENOSYS;
 	}
 	return 0; /* Success */
 }
 
+long do_syscall_entry(long n, long a1, long a2, long a3, long a4, long a5)
+{
+	kernel_lock();
+	syscall_count++;
+	long ret = syscall_dispatch(n, a1, a2, a3, a4, a5);
+	process_check_exit(); // Another thread may have called exit() meanwhile.
+	kernel_unlock();
+	return ret;
+}
+
 void syscall_init(void)
 {
 	/* Enable SYSCALL/SYSRET */
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <types.h>
+
+/*
+ * The few ACPI tables the kernel reads, laid out as in the ACPI specification (the bootloader's
+ * copies are Include/IndustryStandard/Acpi*.h, which need the EDK2 base types).
+ */
+struct acpi_rsdp
+{
+	char signature[8]; // "RSD PTR "
+	uint8_t checksum;  // Over the first 20 bytes.
+	char oem_id[6];
+	uint8_t revision; // 0 for ACPI 1.0, which has no XSDT.
+	uint32_t rsdt_address;
+	uint32_t length;
+	uint64_t xsdt_address;
+	uint8_t extended_checksum;
+	uint8_t reserved[3];
+} __attribute__((packed));
+
+struct acpi_header
+{
+	char signature[4];
+	uint32_t length; // Including the header.
+	uint8_t revision;
+	uint8_t checksum;
+	char oem_id[6];
+	char oem_table_id[8];
+	uint32_t oem_revision;
+	uint32_t creator_id;
+	uint32_t creator_revision;
+} __attribute__((packed));
+
+/* Multiple APIC Description Table, signature "APIC" */
+struct acpi_madt
+{
+	struct acpi_header header;
+	uint32_t lapic_address;
+	uint32_t flags;
+	// Interrupt controller structures (struct acpi_madt_entry) follow.
+} __attribute__((packed));
+
+#define ACPI_MADT_LAPIC 0
+#define ACPI_MADT_X2APIC 9
+
+#define ACPI_MADT_ENABLED 0x1
+
+struct acpi_madt_entry
+{
+	uint8_t type;
+	uint8_t length;
+} __attribute__((packed));
+
+struct acpi_madt_lapic
+{
+	struct acpi_madt_entry entry;
+	uint8_t processor_id;
+	uint8_t apic_id;
+	uint32_t flags;
+} __attribute__((packed));
+
+struct acpi_madt_x2apic
+{
+	struct acpi_madt_entry entry;
+	uint16_t reserved;
+	uint32_t x2apic_id;
+	uint32_t flags;
+	uint32_t processor_uid;
+} __attribute__((packed));
+
+/* Generic Address Structure */
+struct acpi_gas
+{
+	uint8_t space_id; // ACPI_GAS_MEMORY, I/O ports, ...
+	uint8_t bit_width;
+	uint8_t bit_offset;
+	uint8_t access_size;
+	uint64_t address;
+} __attribute__((packed));
+
+#define ACPI_GAS_MEMORY 0
+
+/* High Precision Event Timer table, signature "HPET" */
+struct acpi_hpet
+{
+	struct acpi_header header;
+	uint32_t block_id;
+	struct acpi_gas base; // The registers.
+	uint8_t number;
+	uint16_t min_tick;
+	uint8_t page_protection;
+} __attribute__((packed));
+
+struct acpi_header *acpi_find_table(uintptr_t rsdp, const char *signature);
+int acpi_madt_cpus(uintptr_t rsdp, uint32_t *apic_ids, int max);
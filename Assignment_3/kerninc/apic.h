@@ -1,5 +1,7 @@
 #pragma once
 
+#include <types.h>
+
 #define X86_MSR_APIC			0x01BU
 #define X86_MSR_APIC_ENABLE		0x800U
 #define X86_MSR_APIC_X2APIC		0x400U
@@ -13,14 +15,35 @@
 #define X86_LAPIC_DFR			0x0EU
 #define X86_LAPIC_SVR			0x0FU
 #define X86_LAPIC_ICR			0x30U
+#define X86_LAPIC_ICR_HIGH		0x31U	/* xAPIC only, x2APIC has a single 64-bit ICR */
 
 #define X86_LAPIC_EOI			0x0BU
 #define X86_LAPIC_TIMER			0x32U
 #define X86_LAPIC_TIMER_INIT	0x38U
+#define X86_LAPIC_TIMER_CUR		0x39U
 #define X86_LAPIC_TIMER_DIVIDE	0x3EU
 
 #define APIC_INTERRUPT_ENTRY    0x20U
 
-extern void *apic_handler_ptr;
+struct trap_frame;
+void apic_handler(struct trap_frame *frame);
+
+#define X86_LAPIC_TIMER_MASKED		(0x1U << 16)
+#define X86_LAPIC_TIMER_PERIODIC	(0x1U << 17)
+#define X86_LAPIC_TIMER_TSC_DEADLINE	(0x2U << 17)
+#define X86_LAPIC_TIMER_DIV16		0x3U
+
+#define X86_MSR_TSC_DEADLINE	0x6E0U
+
+#define X86_LAPIC_ICR_ASSERT	(0x1U << 14)
+#define X86_LAPIC_ICR_SELF		(0x1U << 18)	/* destination shorthand: self */
+#define X86_LAPIC_ICR_INIT		(0x5U << 8)		/* delivery mode: INIT */
+#define X86_LAPIC_ICR_STARTUP	(0x6U << 8)		/* delivery mode: start-up, vector = page number */
 
 void x86_lapic_enable(void);
+void x86_lapic_timer_start(uint32_t count, uint32_t lvt);
+uint32_t x86_lapic_timer_count(void);
+void x86_lapic_eoi(void);
+void x86_lapic_self_ipi(uint8_t vector);
+void x86_lapic_send_ipi(uint32_t apic_id, uint32_t cmd);
+uint32_t x86_lapic_id(void);
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <types.h>
+
+/* Latency benchmarks, keep in sync with userinc/bench.h */
+#define BENCH_SYSCALL 0	   // Null system call round trip, measured in user mode.
+#define BENCH_PAGE_FAULT 1 // Minor (zero fill) page fault, measured in user mode.
+#define BENCH_SELF_IPI 2   // Self-IPI sent, handled and returned from.
+#define BENCH_TIMER_IRQ 3  // Timer deadline to timer_interrupt(), through the LAPIC and the Xen timer.
+#define BENCH_MUNMAP 4	   // munmap() of touched pages, measured in user mode.
+#define BENCH_FANOUT 5	   // Kernel work items fanned out to every cpu, see work.c.
+#define BENCH_GNTTAB 6	   // Grant ref allocation and freeing on every cpu at once, Xen only.
+#define BENCH_CLOCK 7	   // Cost of a read and warps across cpus of pvclock, the TSC and the HPET.
+#define BENCH_XRING 8	   // Checked messages through an xring from one cpu to another, see xring.c.
+
+#define BENCH_MAX_SAMPLES 1024
+#define BENCH_IPI_VECTOR 0xF0
+
+void bench_report(const char *name, uint64_t *samples, uint32_t n);
+long sys_bench(long op, uintptr_t user_samples, uint32_t n);
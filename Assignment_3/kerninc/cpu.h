@@ -0,0 +1,104 @@
+#pragma once
+
+#include <types.h>
+#include <interrupts.h>
+#include <tlb.h>
+#include <work.h>
+
+#define MAX_CPUS 16
+
+/* Offsets used by syscall_entry in kernel_asm.S */
+#define CPU_KERNEL_STACK 8
+#define CPU_USER_STACK 16
+
+#define CR0_MP (1ULL << 1)
+#define CR0_EM (1ULL << 2)
+#define CR0_TS (1ULL << 3)
+#define CR0_NE (1ULL << 5)
+#define CR4_OSFXSR (1ULL << 9)
+#define CR4_OSXMMEXCPT (1ULL << 10)
+#define CR4_PCIDE (1ULL << 17)
+#define CR4_OSXSAVE (1ULL << 18)
+
+#define GDT_ENTRIES 7 // See kernel_entry.S, the last two hold the TSS descriptor.
+#define GDT_TSS 0x28
+
+struct thread;
+struct mm;
+struct timer_wheel;
+struct vcpu_info;
+
+/*
+ * Per-cpu state, %gs points to it while in the kernel (user mode has its own %gs base,
+ * exchanged with swapgs on every entry and exit).
+ */
+struct cpu
+{
+	struct cpu *self; // %gs:0, see this_cpu().
+	uint64_t kernel_stack; // %gs:CPU_KERNEL_STACK, top of the running thread's kernel stack.
+	uint64_t user_stack;   // %gs:CPU_USER_STACK, the user %rsp while syscall_entry switches stacks.
+	struct thread *thread; // Running thread, see current_thread.
+	struct thread *idle_thread;
+	struct thread *rq_head; // Run queue, under the kernel lock like the rest of thread.c.
+	struct thread *rq_tail;
+	uint32_t rq_len;
+	uint64_t steals;	 // Threads taken from other cpus' run queues.
+	uint64_t migrations; // Threads that ran here after running elsewhere.
+	work_deque_t work;	 // Kernel work items, see work.c.
+	uint64_t work_done;
+	uint64_t work_stolen;
+	struct mm *mm; // The address space in cr3, NULL while on the kernel page table (see current_mm).
+	tss_segment_t *tss;
+	idt_entry_t *idt;
+	struct timer_wheel *wheel;
+	uint64_t *irq_counts; // Per vector, see irq.c.
+	struct thread *fpu_owner; // Whose FPU state is in this cpu's registers, NULL if nobody's.
+	int fpu_live;			  // The registers may differ from the owner's saved state, see fpu.c.
+	uint32_t id;
+	uint32_t apic_id;
+	volatile uint32_t online;
+	uint32_t start_state; // SMP_AP_*, settles the race between ap_main() and the startup timeout.
+	volatile uint32_t idle; // Halted in the idle loop, needs an IPI to notice new work.
+	tlb_batch_t *volatile tlb_request; // Another cpu's batch to flush here, see tlb.c.
+	tlb_batch_t tlb_batch;
+	tlb_stats_t tlb_stats;
+	struct vcpu_info *vcpu_info; // Xen's events and time for this vCPU, see xen_vcpu_init().
+	volatile struct pvclock_vcpu_time_info *pvclock; // Its time, read by pvclock_monotonic_read().
+	uint32_t xen_vcpu_id;
+	uint64_t gdt[GDT_ENTRIES] __attribute__((aligned(16)));
+};
+typedef struct cpu cpu_t;
+
+extern cpu_t cpus[MAX_CPUS];
+extern uint32_t num_cpus; // Online cpus, ids 0 to num_cpus - 1.
+
+static inline cpu_t *this_cpu(void)
+{
+	cpu_t *cpu;
+	__asm__ __volatile__("movq %%gs:0, %0" : "=r"(cpu));
+	return cpu;
+}
+
+static inline uint64_t read_cr0(void)
+{
+	uint64_t value;
+	__asm__ __volatile__("movq %%cr0, %0" : "=r"(value));
+	return value;
+}
+
+static inline void write_cr0(uint64_t value)
+{
+	__asm__ __volatile__("movq %0, %%cr0" : : "r"(value) : "memory");
+}
+
+static inline uint64_t read_cr4(void)
+{
+	uint64_t value;
+	__asm__ __volatile__("movq %%cr4, %0" : "=r"(value));
+	return value;
+}
+
+static inline void write_cr4(uint64_t value)
+{
+	__asm__ __volatile__("movq %0, %%cr4" : : "r"(value) : "memory");
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <types.h>
+#include <vm.h>
+
+/* The subset of the ELF64 format needed to load a static user executable. */
+
+#define EI_NIDENT 16
+#define ELFMAG0 0x7F
+#define ELFMAG1 'E'
+#define ELFMAG2 'L'
+#define ELFMAG3 'F'
+#define ELFCLASS64 2
+#define ELFDATA2LSB 1
+#define ET_EXEC 2
+#define EM_X86_64 62
+
+#define PT_NULL 0
+#define PT_LOAD 1
+#define PT_TLS 7
+
+#define PF_X 0x1
+#define PF_W 0x2
+#define PF_R 0x4
+
+struct elf64_ehdr
+{
+	unsigned char e_ident[EI_NIDENT];
+	uint16_t e_type;
+	uint16_t e_machine;
+	uint32_t e_version;
+	uint64_t e_entry;
+	uint64_t e_phoff;
+	uint64_t e_shoff;
+	uint32_t e_flags;
+	uint16_t e_ehsize;
+	uint16_t e_phentsize;
+	uint16_t e_phnum;
+	uint16_t e_shentsize;
+	uint16_t e_shnum;
+	uint16_t e_shstrndx;
+};
+typedef struct elf64_ehdr elf64_ehdr_t;
+
+struct elf64_phdr
+{
+	uint32_t p_type;
+	uint32_t p_flags;
+	uint64_t p_offset;
+	uint64_t p_vaddr;
+	uint64_t p_paddr;
+	uint64_t p_filesz;
+	uint64_t p_memsz;
+	uint64_t p_align;
+};
+typedef struct elf64_phdr elf64_phdr_t;
+
+int elf_load(mm_t *mm, uintptr_t image, size_t image_size);
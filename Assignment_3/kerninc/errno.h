@@ -0,0 +1,21 @@
+#pragma once
+
+/* Error numbers returned (negated) by system calls, same values as Linux. */
+#define EPERM 1
+#define ENOENT 2
+#define ESRCH 3
+#define EINTR 4
+#define EIO 5
+#define ENOEXEC 8
+#define ECHILD 10
+#define EAGAIN 11
+#define ENOMEM 12
+#define EACCES 13
+#define EFAULT 14
+#define EBUSY 16
+#define EEXIST 17
+#define EINVAL 22
+#define ENOSPC 28
+#define EDEADLK 35
+#define ENOSYS 38
+#define ETIMEDOUT 110
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <types.h>
+#include <hypercall.h>
+#include <event_channel.h>
+
+#define EVTCHN_VECTOR 0xF3 // The HVM callback vector Xen raises for pending events.
+
+#define EVTCHN_WORD_BITS (sizeof(xen_ulong_t) * 8)
+#define EVTCHN_MAX_PORTS 1024 // Xen hands out the lowest free port, ports above this stay masked.
+
+typedef void (*evtchn_handler_t)(evtchn_port_t port, void *arg);
+
+int evtchn_init(void);
+int evtchn_alloc_unbound(domid_t remote_dom, evtchn_port_t *port);
+int evtchn_bind_interdomain(domid_t remote_dom, evtchn_port_t remote_port, evtchn_port_t *local_port);
+int evtchn_bind_virq(uint32_t virq, uint32_t vcpu, evtchn_port_t *port);
+int evtchn_send(evtchn_port_t port);
+int evtchn_close(evtchn_port_t port);
+int evtchn_close_ports(const evtchn_port_t *ports, uint32_t count);
+int evtchn_bind(evtchn_port_t port, evtchn_handler_t handler, void *arg);
+void evtchn_unbind(evtchn_port_t port);
+void evtchn_mask(evtchn_port_t port);
+int evtchn_unmask(evtchn_port_t port);
+uint32_t evtchn_scan(shared_info_t *shared, vcpu_info_t *vcpu);
+int64_t evtchn_loopback(void);
+int evtchn_scan_test(void);
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <types.h>
+
+#define DEVICE_NOT_AVAILABLE_VECTOR 7 // #NM, raised on FPU/SSE/AVX use while CR0.TS is set.
+
+/* State components enabled in XCR0 */
+#define XSTATE_X87 (1ULL << 0)
+#define XSTATE_SSE (1ULL << 1)
+#define XSTATE_AVX (1ULL << 2)
+
+struct thread;
+
+void fpu_init(void);
+void fpu_cpu_init(void);
+void fpu_switch(struct thread *prev, struct thread *next);
+void fpu_fork(struct thread *child, struct thread *parent);
+void fpu_thread_release(struct thread *thread);
+
+/*
+ * In-kernel SIMD: the kernel is built without SSE (-mgeneral-regs-only), code between these
+ * may use the vector registers with inline assembly. Interrupts are off in between.
+ */
+uint64_t kernel_fpu_begin(void);
+void kernel_fpu_end(uint64_t flags);
+int kernel_fpu_usable(void);
+
+void *fpu_memcpy(void *dst, const void *src, size_t n);
@@ -3,16 +3,34 @@
 
 #include <hypercall.h>
 #include <grant_table.h>
+#include <gnttab_map.h>
+
+#define GNTTAB_MAX_FRAMES 64 /* table frames, more than GNTTABOP_query_size allows are not used */
+#define GNTTAB_MAX_REFS (GNTTAB_MAX_FRAMES * 512)
+
+struct gnttab_stats {
+    unsigned long in_use;
+    unsigned long peak;   /* most refs in use at once */
+    unsigned long failed; /* allocations refused with -ENOSPC */
+    unsigned int frames;
+};
+typedef struct gnttab_stats gnttab_stats_t;
 
 extern grant_entry_v1_t *gnttab_table;
 
-void init_gnttab(void);
+int init_gnttab(void);
+int gnttab_alloc_refs(grant_ref_t *refs, unsigned int count);
+void gnttab_free_refs(const grant_ref_t *refs, unsigned int count);
+void gnttab_get_stats(gnttab_stats_t *stats);
+void gnttab_stats_print(void);
 grant_ref_t gnttab_alloc_and_grant(void **map);
 grant_ref_t gnttab_grant_access(domid_t domid, unsigned long frame,
 				int readonly);
 grant_ref_t gnttab_grant_transfer(domid_t domid, unsigned long pfn);
 unsigned long gnttab_end_transfer(grant_ref_t gref);
 int gnttab_end_access(grant_ref_t ref);
+int gnttab_grant_pages(domid_t domid, unsigned long frame, unsigned int count, int readonly,
+                       grant_ref_t *refs);
 void fini_gnttab(void);
 
 #endif /* !__MINIOS_GNTTAB_H__ */
@@ -0,0 +1,24 @@
+#ifndef __GNTTAB_MAP_H__
+#define __GNTTAB_MAP_H__
+
+#include <hypercall.h>
+#include <grant_table.h>
+
+/* gnttab_map.c, built by both kernels. */
+
+#define GNTTAB_BATCH 32 /* ops per hypercall, on the caller's stack */
+#define GNTTAB_NO_HANDLE ((grant_handle_t) ~0U)
+#define GNTTAB_COPY_THRESHOLD 16384 /* bytes, gnttab_read() copies below and maps above */
+#define GNTTAB_DIRECT_MAP_END 0x100000000UL /* both kernels map the first 4gb 1:1 */
+
+extern unsigned long gnttab_copy_threshold;
+
+int gnttab_map_pages(domid_t domid, const grant_ref_t *refs, unsigned int count, unsigned long addr,
+                     int readonly, grant_handle_t *handles);
+int gnttab_unmap_pages(unsigned long addr, const grant_handle_t *handles, unsigned int count);
+int gnttab_copy(gnttab_copy_t *ops, unsigned int count);
+int gnttab_copy_from(domid_t domid, const grant_ref_t *refs, unsigned long len, void *dst);
+int gnttab_read(domid_t domid, const grant_ref_t *refs, unsigned long len, void *dst,
+                unsigned long window, unsigned int window_pages);
+
+#endif /* !__GNTTAB_MAP_H__ */
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <types.h>
+
+extern uint64_t hpet_hz; // Counter rate, 0 without an HPET.
+
+int hpet_init(uintptr_t rsdp);
+uint64_t hpet_read(void);
@@ -57,11 +57,13 @@ typedef struct hypervisor_entry hypervisor_entry_t;
 
 extern char _minios_hypercall_page[];
 extern char _minios_shared_info[];
+extern volatile unsigned long xen_hypercalls; /* every trap into Xen, see multicall.c */
 
 extern shared_info_t *xen_shared_info;
 
 #define _hypercall0(type, name)			\
 ({						\
+	__atomic_fetch_add(&xen_hypercalls, 1, __ATOMIC_RELAXED);	\
 	long __res;				\
 	asm volatile (				\
 		"call _minios_hypercall_page + ("STR(__HYPERVISOR_##name)" * 32)"\
@@ -73,6 +75,7 @@ extern shared_info_t *xen_shared_info;
 
 #define _hypercall1(type, name, a1)				\
 ({								\
+	__atomic_fetch_add(&xen_hypercalls, 1, __ATOMIC_RELAXED);	\
 	long __res, __ign1;					\
 	asm volatile (						\
 		"call _minios_hypercall_page + ("STR(__HYPERVISOR_##name)" * 32)"\
@@ -84,6 +87,7 @@ extern shared_info_t *xen_shared_info;
 
 #define _hypercall2(type, name, a1, a2)				\
 ({								\
+	__atomic_fetch_add(&xen_hypercalls, 1, __ATOMIC_RELAXED);	\
 	long __res, __ign1, __ign2;				\
 	asm volatile (						\
 		"call _minios_hypercall_page + ("STR(__HYPERVISOR_##name)" * 32)"\
@@ -95,6 +99,7 @@ extern shared_info_t *xen_shared_info;
 
 #define _hypercall3(type, name, a1, a2, a3)			\
 ({								\
+	__atomic_fetch_add(&xen_hypercalls, 1, __ATOMIC_RELAXED);	\
 	long __res, __ign1, __ign2, __ign3;			\
 	asm volatile (						\
 		"call _minios_hypercall_page + ("STR(__HYPERVISOR_##name)" * 32)"\
@@ -108,6 +113,7 @@ extern shared_info_t *xen_shared_info;
 
 #define _hypercall4(type, name, a1, a2, a3, a4)			\
 ({								\
+	__atomic_fetch_add(&xen_hypercalls, 1, __ATOMIC_RELAXED);	\
 	long __res, __ign1, __ign2, __ign3;			\
 	asm volatile (						\
 		"movq %7,%%r10; "				\
@@ -122,6 +128,7 @@ extern shared_info_t *xen_shared_info;
 
 #define _hypercall5(type, name, a1, a2, a3, a4, a5)		\
 ({								\
+	__atomic_fetch_add(&xen_hypercalls, 1, __ATOMIC_RELAXED);	\
 	long __res, __ign1, __ign2, __ign3;			\
 	asm volatile (						\
 		"movq %7,%%r10; movq %8,%%r8; "			\
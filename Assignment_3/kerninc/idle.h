@@ -0,0 +1,10 @@
+#pragma once
+
+#include <types.h>
+
+#define IDLE_HLT 0
+#define IDLE_MWAIT 1
+#define IDLE_XEN 2 // HLT, which Xen turns into blocking the vCPU
+
+void idle_init(int xen);
+void cpu_idle(volatile uint32_t *wait);
@@ -9,8 +9,6 @@
 
 /* GDT, see kernel_entry.S */
 extern uint64_t gdt[];
-extern void *default_interrupt_handler_ptr;
-extern void *page_fault_handler_ptr;
 
 /*
  * NOTE: When declaring the IDT table, make
@@ -49,9 +47,9 @@ struct idt_entry_struct {
 
 typedef struct idt_entry_struct idt_entry_t;
 
-idt_entry_t idt[IDT_TABLE_SIZE] __attribute__((aligned(16))); //IDT, declared in kernel entry
+extern idt_entry_t idt[IDT_TABLE_SIZE]; //IDT, defined in kernel.c
 
-idt_pointer_t idt_ptr; // The IDT pointer
+extern idt_pointer_t idt_ptr; // The IDT pointer
 
 static inline void load_idt(idt_pointer_t *idtp)
 {
@@ -61,9 +59,26 @@ static inline void load_idt(idt_pointer_t *idtp)
 	);
 }
 
+/* Disable interrupts and return the previous RFLAGS, for irq_restore() */
+static inline uint64_t irq_save(void)
+{
+	uint64_t flags;
+	__asm__ __volatile__ ("pushfq; popq %0; cli"
+		: "=r" (flags)
+		:
+		: "memory"
+	);
+	return flags;
+}
+
+static inline void irq_restore(uint64_t flags)
+{
+	if (flags & 0x200) /* IF */
+		__asm__ __volatile__ ("sti" ::: "memory");
+}
+
 void idt_init();
 void set_idt_entry(uint8_t, uint64_t, uint16_t, uint8_t);
-void default_interrupt_handler(uint64_t);
 
 /*
  * TSS segment, see also https://wiki.osdev.org/Task_State_Segment
@@ -72,7 +87,7 @@ struct tss_segment {
 	uint32_t reserved1;
 	uint64_t rsp[3]; /* rsp[0] is used, everything else not used */
 	uint64_t reserved2;
-	uint64_t ist[7]; /* not used, initialize to 0s */
+	uint64_t ist[7]; /* ist[n - 1] is the stack for IDT entries with IST n, see irq.h */
 	uint64_t reserved3;
 	uint16_t reserved4;
 	uint16_t iopb_base; /* must be sizeof(struct tss), I/O bitmap not used */
@@ -89,10 +104,10 @@ typedef struct tss_segment tss_segment_t;
  * TSS descriptor from GDT as the final step.
  *
  * You have to specify GDT's selector, the base address and _limit_
- * for the TSS segment.
+ * for the TSS segment. Every cpu has its own GDT and TSS, see cpu.h.
  */
 static inline
-void load_tss_segment(uint16_t selector, tss_segment_t *tss)
+void load_tss_segment(uint64_t *gdt_base, uint16_t selector, tss_segment_t *tss)
 {
 	uint64_t base = (uint64_t) tss;
 	uint16_t limit = sizeof(tss_segment_t) - 1;
@@ -101,7 +116,7 @@ void load_tss_segment(uint16_t selector, tss_segment_t *tss)
 	   https://www.amd.com/system/files/TechDocs/24593.pdf */
 
 	/* Initialize GDT's dummy entries */
-	uint64_t *tss_gdt = (void *) gdt + selector;
+	uint64_t *tss_gdt = (void *) gdt_base + selector;
 	/* Present=1, DPL=0, Type=9 (TSS), 16-bit limit, lower 32 bits of 'base' */
 	tss_gdt[0] = ((base & 0xFF000000ULL) << 32) | (1ULL << 47) | (0x9ULL << 40) | ((base & 0x00FFFFFFULL) << 16) | limit;
 	/* Upper 32 bits of 'base' */
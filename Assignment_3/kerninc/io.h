@@ -0,0 +1,25 @@
+#pragma once
+
+#include <types.h>
+
+/* x86 I/O ports */
+static inline uint8_t inb(uint16_t port)
+{
+	uint8_t val;
+
+	__asm__ __volatile__ ("inb %1, %0"
+		: "=a" (val)
+		: "Nd" (port)
+	);
+
+	return val;
+}
+
+static inline void outb(uint16_t port, uint8_t val)
+{
+	__asm__ __volatile__ ("outb %0, %1"
+		:
+		: "a" (val),
+		  "Nd" (port)
+	);
+}
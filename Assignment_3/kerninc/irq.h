@@ -0,0 +1,35 @@
+#pragma once
+
+#include <types.h>
+#include <interrupts.h>
+#include <thread.h>
+#include <cpu.h>
+
+/*
+ * Every vector has its own entry stub in kernel_asm.S, IRQ_STUB_SIZE bytes apart,
+ * which builds a trap frame and calls irq_dispatch().
+ */
+#define IRQ_STUB_SIZE 16
+
+#define NMI_VECTOR 2
+#define DOUBLE_FAULT_VECTOR 8
+#define MACHINE_CHECK_VECTOR 18
+#define SPURIOUS_VECTOR 0xFF // See x86_lapic_enable().
+
+/* Interrupt stack table slots, these run on a known good stack whatever the kernel was doing. */
+#define IST_NMI 1
+#define IST_DOUBLE_FAULT 2
+#define IST_MACHINE_CHECK 3
+#define IST_STACK_PAGES 2
+
+typedef void (*irq_handler_t)(trap_frame_t *frame);
+
+extern void *irq_stubs_ptr; // Initialized in kernel_entry.S.
+
+void irq_init(void);
+int irq_cpu_init(cpu_t *cpu);
+int irq_register(uint8_t vector, irq_handler_t handler);
+int irq_register_nolock(uint8_t vector, irq_handler_t handler);
+void irq_unregister(uint8_t vector);
+void irq_dispatch(trap_frame_t *frame);
+void irq_stats_print(void);
@@ -5,9 +5,27 @@ extern "C"
 {
 #endif
 
-    extern void *kernel_stack;  /* the kernel stack, must be allocated */
-    extern void *user_stack;    /* the user stack, must be allocated */
-    void user_jump(void *addr); /* an initial jump to user mode, addr is a VIRTUAL address of user's _start */
+/* System call numbers, keep in sync with userinc/syscall.h */
+#define SYS_PRINT_MESSAGE 0
+#define SYS_PRINT_VALUE 1
+#define SYS_MMAP 2
+#define SYS_MUNMAP 3
+#define SYS_BRK 4
+#define SYS_THREAD_CREATE 5
+#define SYS_THREAD_EXIT 6
+#define SYS_FUTEX 7
+#define SYS_YIELD 8
+#define SYS_SYSCALL_COUNT 9
+#define SYS_SCHED_STATS 10
+#define SYS_FORK 11
+#define SYS_SPAWN 12
+#define SYS_EXIT 13
+#define SYS_WAIT 14
+#define SYS_GETPID 15
+#define SYS_SLEEP_NS 16
+#define SYS_CLOCK_NS 17
+#define SYS_IRQ_STATS 18
+#define SYS_BENCH 19
 
     /*
  * A pointer to syscall_entry(),
@@ -21,6 +39,8 @@ extern "C"
     /* the system call handler */
     long do_syscall_entry(long n, long a1, long a2, long a3, long a4, long a5);
 
+    extern uint64_t syscall_count; /* number of system calls made so far */
+
     /* initialize system calls */
     void syscall_init(void);
 
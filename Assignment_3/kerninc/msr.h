@@ -6,7 +6,11 @@
 #define MSR_STAR	0xC0000081
 #define MSR_LSTAR	0xC0000082
 #define MSR_SFMASK	0xC0000084
+#define EFER_LMA	(1ULL << 10) /* Long mode active, read only */
+
 #define MSR_FSBASE 	0xC0000100
+#define MSR_GSBASE	0xC0000101
+#define MSR_KERNEL_GSBASE	0xC0000102 /* Swapped with MSR_GSBASE by swapgs */
 
 /* GDT entries, do not re-arrange those! */
 #define GDT_KERNEL_CODE	0x08
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <types.h>
+#include <hypercall.h>
+
+/*
+ * Hypercalls queued on this cpu and made together with one HYPERVISOR_multicall, see multicall.c:
+ *
+ *	uint64_t flags = mc_batch();
+ *	mc_queue(__HYPERVISOR_memory_op, XENMEM_add_to_physmap, (unsigned long)&xatp, 0, NULL);
+ *	...
+ *	int ret = mc_issue(flags);
+ *
+ * What the arguments point to has to stay put until mc_issue().
+ */
+#define MC_BATCH 32 // Calls per multicall, a full buffer is flushed on the next mc_queue().
+
+extern volatile unsigned long mc_calls; // Hypercalls made inside a multicall.
+
+int mc_init(void);
+uint64_t mc_batch(void);
+void mc_queue(unsigned long op, unsigned long a0, unsigned long a1, unsigned long a2, long *result);
+int mc_issue(uint64_t flags);
+void mc_stats_print(void);
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <types.h>
+
+#define PAGE_SIZE 0x1000ULL
+#define PAGE_SHIFT 12
+#define HUGE_PAGE_SIZE 0x200000ULL
+#define HUGE_PAGE_PAGES 512
+
+#define PAGE_ALIGN_DOWN(x) ((uintptr_t)(x) & ~(PAGE_SIZE - 1))
+#define PAGE_ALIGN_UP(x) (((uintptr_t)(x) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+
+/*
+ * Physical page pool handed over by the bootloader. The pool lies in the
+ * bottom 4gb, so a physical address is also a valid kernel virtual address.
+ */
+void palloc_init(uintptr_t pool_base, uint64_t num_pages);
+uintptr_t page_alloc(void);										 // Returns a physical page or 0 if the pool is exhausted.
+uintptr_t page_alloc_zeroed(void);								 // Same as above, but the page is cleared.
+uintptr_t page_alloc_contig(uint64_t num_pages, uint64_t align); // align is in pages, must be a power of 2.
+void page_free(uintptr_t page);									 // Drops a reference, the page is freed with the last one.
+void page_ref(uintptr_t page, uint64_t num_pages);
+uint32_t page_refcount(uintptr_t page); // 0 for pages outside the pool.
+void page_free_contig(uintptr_t page, uint64_t num_pages);
+int page_in_pool(uintptr_t page);
+uint64_t palloc_free_pages(void);
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <types.h>
+#include <vm.h>
+#include <thread.h>
+
+#define MAX_PROCESSES 16
+
+#define PROC_UNUSED 0
+#define PROC_RUNNING 1
+#define PROC_ZOMBIE 2 // All threads are gone, the exit code waits for the parent.
+
+struct process
+{
+	uint32_t pid;
+	uint32_t state;
+	uint32_t nthreads;
+	uint32_t exiting; // exit() was called, the remaining threads die on their next kernel entry.
+	int exit_code;
+	struct process *parent; // NULL once the parent is gone, nobody collects the exit code then.
+	thread_t *waiter;		// Parent thread blocked in wait().
+	mm_t mm;
+};
+typedef struct process process_t;
+
+void process_init(boot_module_t *modules, uint32_t num_modules);
+long process_spawn(const char *name);
+void process_thread_exited(process_t *process);
+void process_check_exit(void);
+int process_exiting(void);
+
+/* System call backends. */
+long sys_spawn(uintptr_t user_name);
+long sys_fork(void);
+long sys_wait(long pid);
+void sys_exit(int code) __attribute__((noreturn));
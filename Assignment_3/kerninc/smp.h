@@ -0,0 +1,43 @@
+#pragma once
+
+#include <types.h>
+#include <cpu.h>
+
+#define RESCHED_VECTOR 0xF1 // Makes a cpu enter the kernel: an idle one picks up work, a busy one sees exit().
+
+/*
+ * The trampoline page: real mode code at offset 0 (the startup IPI vector is its page number),
+ * this block at SMP_TRAMPOLINE_DATA, filled in by smp_init(). Mirrors smp_trampoline.S.
+ */
+#define SMP_TRAMPOLINE_DATA 0x80
+
+struct smp_trampoline_data
+{
+	uint64_t gdt[3];		 // null, 64-bit code, data
+	uint16_t gdt_limit;
+	uint32_t gdt_base;		 // Offset into the page until smp_init() adds the page address.
+	uint32_t entry64;		 // Far pointer to the 64-bit code, the same.
+	uint16_t entry64_cs;
+	uint32_t cr0;
+	uint32_t cr4;
+	uint32_t cr3;
+	uint64_t efer;
+	uint64_t stack;			 // Top of the cpu's idle thread stack.
+	uint64_t cpu;			 // cpu_t of the cpu, ap_main()'s argument.
+	uint64_t entry;			 // ap_main()
+} __attribute__((packed));
+
+extern void *smp_trampoline_ptr; // Initialized in kernel_entry.S.
+
+/*
+ * The kernel runs under one lock, held by a cpu rather than a thread: whoever switches
+ * threads hands it to the next one, which releases it on its way out of the kernel.
+ */
+void kernel_lock(void);
+void kernel_unlock(void);
+int kernel_lock_held(void);
+
+void smp_boot_cpu_init(void);
+void smp_init(uintptr_t rsdp, uintptr_t trampoline_page);
+void smp_resched(cpu_t *cpu);
+void smp_wake_idle(void);
@@ -38,3 +38,9 @@ static inline size_t strlen(const char *str)
 		cur++;
 	return (size_t) (cur - str);
 }
+
+/* string.c, also used by the compiler for struct copies and zeroing loops */
+void *memset(void *dst, int c, size_t n);
+void *memcpy(void *dst, const void *src, size_t n);
+void *memmove(void *dst, const void *src, size_t n);
+int memcmp(const void *a, const void *b, size_t n);
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <types.h>
+#include <vm.h>
+#include <cpu.h>
+
+#define MAX_THREADS 64
+#define KSTACK_PAGES 2
+
+#define THREAD_RUNNING 0
+#define THREAD_READY 1
+#define THREAD_BLOCKED 2
+#define THREAD_DEAD 3
+#define THREAD_UNUSED 4
+
+#define SCHED_SLICE_NS 20000000ULL // A thread runs 20ms before it is preempted, if anything else is runnable.
+
+/*
+ * Register state saved on the kernel stack on every entry from user mode,
+ * see PUSH_ALL in kernel_asm.S. Entries from user mode always start at the top
+ * of the thread's kernel stack.
+ */
+struct trap_frame
+{
+	uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+	uint64_t rbp, rdi, rsi, rdx, rcx, rbx, rax;
+	uint64_t vector;
+	uint64_t error_code;
+	uint64_t rip, cs, rflags, rsp, ss; // Pushed by the cpu (or by syscall_entry).
+};
+typedef struct trap_frame trap_frame_t;
+
+struct thread
+{
+	uint64_t rsp; // Kernel stack pointer while switched out, see context_switch.
+	uintptr_t kstack_base;
+	uintptr_t kstack_top;
+	uintptr_t fs_base; // Thread control block (tls_block_t) of a user thread.
+	uintptr_t tls_area; // TLS area allocated by thread_create, freed on exit.
+	uint64_t tls_size;
+	uintptr_t clear_tid; // User word cleared and futex-woken on exit (for joins).
+	mm_t *mm;			 // NULL for kernel threads.
+	struct process *process;
+	uint32_t tid;
+	uint32_t state;
+	uint32_t cpu; // The cpu it last ran on.
+	uint64_t slice_end;	  // clock_ns() time the current time slice ends at.
+	uintptr_t futex_addr; // Address waited on while blocked in futex_wait.
+	uint64_t run_start;	  // rdtsc when the thread was last switched in.
+	uint64_t cpu_cycles;  // Total time on the cpu, in rdtsc cycles.
+	uintptr_t fpu_area;	  // XSAVE area, allocated on first FPU use (see fpu.c).
+	struct thread *next;  // Run queue, futex queue or free list link.
+};
+typedef struct thread thread_t;
+
+#define current_thread (this_cpu()->thread)
+
+struct sched_stats
+{
+	uint64_t timer_interrupts;
+	uint64_t preemptions;
+	uint64_t switches;
+	uint64_t switch_cycles; // Sum over the switches below, from switch_to() in one thread to the other resuming.
+	uint64_t switch_cycles_min;
+	uint64_t switch_cycles_max;
+	uint64_t switch_samples;
+};
+typedef struct sched_stats sched_stats_t;
+
+extern sched_stats_t sched_stats;
+
+/* kernel_asm.S */
+void context_switch(uint64_t *prev_rsp, uint64_t next_rsp);
+extern void *user_thread_start_ptr;
+extern void *kthread_start_ptr;
+
+void thread_init(uintptr_t boot_stack_top);
+thread_t *thread_create_idle(void);
+struct process;
+thread_t *thread_create_user(struct process *process, uintptr_t entry, uintptr_t user_sp, uint64_t arg, uintptr_t tcb);
+thread_t *thread_fork(struct process *process, trap_frame_t *frame);
+thread_t *thread_create_kernel(void (*fn)(void *), void *arg);
+void thread_exit(void) __attribute__((noreturn));
+void thread_block(void);
+void thread_wakeup(thread_t *thread);
+void thread_wakeup_process(struct process *process);
+void thread_yield(void);
+void schedule(void);
+void sched_start(void) __attribute__((noreturn));
+void sched_timer(void);
+void sched_stats_print(void);
+
+static inline trap_frame_t *thread_frame(thread_t *thread)
+{
+	return (trap_frame_t *)(thread->kstack_top - sizeof(trap_frame_t));
+}
+
+/* System call backends. */
+long sys_thread_create(uintptr_t entry, uintptr_t stack, uint64_t arg, uintptr_t clear_tid);
+uintptr_t tls_setup(mm_t *mm, uintptr_t tcb);
+
+/* futex.c */
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+
+long futex_wait(mm_t *mm, uintptr_t addr, uint32_t val);
+long futex_wake(mm_t *mm, uintptr_t addr, uint32_t count);
+void futex_wake_all(mm_t *mm);
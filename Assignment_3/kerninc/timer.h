@@ -0,0 +1,48 @@
+#pragma once
+
+#include <types.h>
+
+/*
+ * Clock frequencies measured at boot by timer_init(). lapic_timer_hz is the rate the
+ * LAPIC timer counts down at (bus clock over its divider).
+ */
+extern uint64_t tsc_hz;
+extern uint64_t lapic_timer_hz;
+
+/* rdtsc cycles from the deadline of the last timer interrupt until it reached timer_interrupt(). */
+extern uint64_t timer_irq_latency;
+
+struct timer_wheel;
+
+/*
+ * A kernel timer, see timer_add(). The callback runs in the timer interrupt.
+ */
+struct timer
+{
+	uint64_t expires; // clock_ns() deadline.
+	void (*fn)(void *);
+	void *arg;
+	struct timer *next;
+	struct timer **pprev; // NULL unless pending.
+	struct timer_wheel *wheel; // Of the cpu it was added on.
+	uint8_t level;
+	uint8_t slot;
+};
+typedef struct timer timer_t;
+
+void timer_init(int use_pvclock);
+struct timer_wheel *timer_wheel_alloc(void);
+void timer_cpu_init(void);
+uint64_t clock_ns(void); // Monotonic nanoseconds since boot (pvclock under Xen, TSC otherwise).
+void timer_set_sched_deadline(uint64_t deadline); // One-shot mode, 0 disarms.
+void timer_interrupt(void);
+int timer_xen_init(void);
+int timer_set_xen(int on); // This cpu only.
+int timer_is_xen(void);
+int timer_xen_available(void);
+void timer_xen_interrupt(void);
+
+void timer_add(timer_t *timer, uint64_t expires, void (*fn)(void *), void *arg);
+int timer_cancel(timer_t *timer);
+void sleep_ns(uint64_t ns);
+void timer_bench(void);
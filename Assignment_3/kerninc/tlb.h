@@ -0,0 +1,60 @@
+#pragma once
+
+#include <types.h>
+
+#define TLB_FLUSH_VECTOR 0xF2 // Runs without the kernel lock, its sender holds it.
+
+#define TLB_BATCH_RANGES 16
+#define TLB_BATCH_PAGES 64		// Frames freed once the batch is flushed.
+#define TLB_FLUSH_THRESHOLD 32	// Pages, a larger batch reloads cr3 rather than invlpg each one.
+
+#define TLB_BATCH_FULL 0x1	  // Flush everything, too many pages or ranges.
+#define TLB_BATCH_RELEASE 0x2 // Also drop the address space, it is about to be freed.
+
+struct mm;
+
+struct tlb_range
+{
+	uintptr_t start;
+	uintptr_t end;
+};
+
+struct tlb_page
+{
+	uintptr_t addr;
+	uint64_t pages; // 1, or HUGE_PAGE_PAGES.
+};
+
+/*
+ * Invalidations of one address space collected on a cpu, see tlb.c. The other cpus read it
+ * while its owner waits for them.
+ */
+struct tlb_batch
+{
+	struct mm *mm;
+	uint32_t flags;
+	uint32_t num_ranges;
+	uint64_t pages; // In the ranges.
+	uint32_t num_free;
+	struct tlb_range ranges[TLB_BATCH_RANGES];
+	struct tlb_page free[TLB_BATCH_PAGES];
+};
+typedef struct tlb_batch tlb_batch_t;
+
+struct tlb_stats
+{
+	uint64_t shootdowns;   // Batches that had to go to other cpus.
+	uint64_t ipis;		   // Sent, at most one per cpu and batch.
+	uint64_t invlpg;	   // Pages invalidated one at a time, here and for other cpus.
+	uint64_t full_flushes; // cr3 reloads instead.
+};
+typedef struct tlb_stats tlb_stats_t;
+
+void tlb_init(void);
+void tlb_add_range(struct mm *mm, uintptr_t start, uintptr_t end);
+void tlb_free_page(struct mm *mm, uintptr_t addr, uint64_t pages);
+void tlb_flush_mm(struct mm *mm);
+void tlb_release_mm(struct mm *mm);
+void tlb_finish(void);
+void tlb_poll(void);
+void tlb_stats_print(void);
@@ -18,26 +18,32 @@ typedef unsigned long long uintptr_t;
 
 #define NULL ((void *)0)
 
+/*
+ * A file the bootloader loaded for the kernel: the user app ("user") and every file in \EFI\BOOT\BIN.
+ */
+struct boot_module
+{
+	char name[16]; // NUL terminated, as found on the boot volume.
+	uintptr_t base; // Page aligned.
+	uint64_t size;
+};
+typedef struct boot_module boot_module_t;
+
 struct information // This struct is used while passing information from bootloader to kernel.
 {
 	uintptr_t kernel_stack_buffer;
-	uintptr_t user_stack_buffer;
 	uintptr_t kernel_pt_base;
-	uintptr_t user_pt_base;
-	uintptr_t user_app_buffer;
+	uintptr_t modules; // boot_module_t array.
 	uintptr_t tss_stack_buffer;
 	uintptr_t tss_segment_buffer;
-	uintptr_t extra_page_for_exception;
-	uintptr_t tls_buffer;
 	uintptr_t shared_page;
 	uintptr_t gnt_table;
-	uint32_t num_user_ptes;
-	uint32_t num_user_pdes;
-	uint32_t num_user_pdpes;
-	uint32_t num_user_pml4es;
+	uintptr_t page_pool_base; // Physical pages for page tables and demand paging, below 4gb.
+	uintptr_t rsdp; // ACPI root pointer, 0 if the firmware has none.
+	uintptr_t trampoline_page; // Below 1mb for starting the other cpus, 0 if none could be had.
+	uint32_t num_page_pool_pages;
 	uint32_t num_kernel_stack_pages;
-	uint32_t num_user_stack_pages;
-	uint32_t num_user_binary_pages;
+	uint32_t num_modules;
 };
 typedef struct information information;
 
@@ -61,10 +67,13 @@ struct pvclock_vcpu_time_info {
 } __attribute__((__packed__));
 typedef struct pvclock_vcpu_time_info pvclock_vcpu_time_info_t; 
 
+#define PVCLOCK_TSC_STABLE_BIT (1 << 0) // flags: the TSCs of all vcpus agree.
+
 /* Xen/KVM wall clock ABI. */
 struct pvclock_wall_clock {
 	uint32_t version;
 	uint32_t sec;
 	uint32_t nsec;
+	uint32_t sec_hi; // Xen on x86_64: wc_sec_hi, the high word of sec. Not part of KVM's.
 } __attribute__((__packed__));
 typedef struct pvclock_wall_clock pvclock_wall_clock_t;
\ No newline at end of file
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <types.h>
+#include <palloc.h>
+#include <cpu.h>
+
+/* Page table entry bits. */
+#define PTE_P 0x1ULL
+#define PTE_W 0x2ULL
+#define PTE_U 0x4ULL
+#define PTE_PWT 0x8ULL
+#define PTE_PCD 0x10ULL
+#define PTE_A 0x20ULL
+#define PTE_D 0x40ULL
+#define PTE_PS 0x80ULL
+#define PTE_G 0x100ULL
+#define PTE_COW 0x200ULL // Software bit: read-only because it is shared after fork().
+#define PTE_NX (1ULL << 63)
+#define PTE_ADDR_MASK 0x000FFFFFFFFFF000ULL
+
+/* Page fault error code bits. */
+#define PF_PRESENT 0x1
+#define PF_WRITE 0x2
+#define PF_USER 0x4
+#define PF_INSTR 0x10
+
+#define EFER_NXE (1ULL << 11)
+
+/*
+ * User address space layout. All of it lives under the last pml4 entry,
+ * the first pml4 entry is the shared 1:1 kernel mapping.
+ */
+#define USER_MMAP_BASE 0xFFFFFF8000000000ULL // mmap() regions, first fit going upwards.
+#define USER_MMAP_END 0xFFFFFFFF80000000ULL
+#define USER_STACK_TOP 0xFFFFFFFFC0001000ULL // The stack sits right below the user app.
+#define USER_STACK_SIZE 0x40000ULL			 // Populated on demand below the first page.
+#define USER_IMAGE_BASE 0xFFFFFFFFC0001000ULL
+#define USER_TLS_BASE 0xFFFFFFFFC01FE000ULL // 510th user pte.
+#define USER_HEAP_BASE 0xFFFFFFFFC0200000ULL // brk() heap, grows up.
+#define USER_HEAP_END 0xFFFFFFFFE0000000ULL
+
+/* VMA flags, the low 3 bits match PROT_READ/PROT_WRITE/PROT_EXEC. */
+#define VMA_READ 0x1
+#define VMA_WRITE 0x2
+#define VMA_EXEC 0x4
+#define VMA_HUGE 0x8  // Back with 2mb pages where the range allows it.
+#define VMA_HEAP 0x10 // The brk() region.
+#define VMA_STACK 0x20
+#define VMA_FILE 0x40 // Backed by a loaded user image, see elf.c.
+
+/* mmap() arguments, same values as Linux. */
+#define PROT_NONE 0x0
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC 0x4
+#define MAP_SHARED 0x01
+#define MAP_PRIVATE 0x02
+#define MAP_FIXED 0x10
+#define MAP_ANONYMOUS 0x20
+#define MAP_HUGETLB 0x40000
+#define MAP_FAILED ((uintptr_t)-1)
+
+struct vma
+{
+	uintptr_t start; // Inclusive, page aligned.
+	uintptr_t end;	 // Exclusive, page aligned.
+	uint32_t flags;
+	uintptr_t file_base; // VMA_FILE: kernel address of the bytes that back vma->start.
+	uint64_t file_size;	 // VMA_FILE: bytes from vma->start on that come from the file, the rest is zero filled.
+	struct vma *next;	 // Sorted by start address.
+};
+typedef struct vma vma_t;
+
+struct mm
+{
+	uint64_t *pml4;
+	vma_t *vmas;
+	uintptr_t brk_start;
+	uintptr_t brk;
+	uintptr_t entry; // Entry point of the loaded user image.
+	uintptr_t tls_image; // PT_TLS initialization image (kernel address), see tls_init().
+	uint64_t tls_filesz;
+	uint64_t tls_memsz;
+	uint64_t tls_align;
+};
+typedef struct mm mm_t;
+
+struct vm_stats
+{
+	uint64_t faults;
+	uint64_t pages_populated;
+	uint64_t huge_pages_populated;
+	uint64_t file_pages_shared;
+	uint64_t pages_freed;
+	uint64_t cow_copies;
+};
+typedef struct vm_stats vm_stats_t;
+
+#define current_mm (this_cpu()->mm) // The address space in cr3, NULL while on the kernel page table.
+extern vm_stats_t vm_stats;
+
+void vm_init(uint64_t *kernel_pml4);
+int mm_init(mm_t *mm);
+int vm_fork(mm_t *child, mm_t *parent);
+void vm_mm_destroy(mm_t *mm);
+void vm_load_kernel_pml4(void);
+uint64_t *vm_walk(uint64_t *pml4, uintptr_t va, int create);
+int vm_map_page(uint64_t *pml4, uintptr_t va, uintptr_t pa, uint64_t flags);
+void vm_unmap_range(mm_t *mm, uintptr_t start, uintptr_t end);
+uint64_t vm_pte_flags(uint32_t vma_flags);
+
+vma_t *vma_find(mm_t *mm, uintptr_t addr);
+int vma_insert(mm_t *mm, uintptr_t start, uintptr_t end, uint32_t flags);
+int vma_insert_file(mm_t *mm, uintptr_t start, uintptr_t end, uint32_t flags, uintptr_t file_base, uint64_t file_size);
+int vma_remove_range(mm_t *mm, uintptr_t start, uintptr_t end);
+
+int vm_handle_fault(mm_t *mm, uintptr_t addr, uint64_t error_code);
+uintptr_t vm_user_to_phys(mm_t *mm, uintptr_t va, int write);
+int vm_copy_to_user(mm_t *mm, uintptr_t dst, const void *src, size_t len);
+
+/* System call backends. */
+uintptr_t vm_mmap(mm_t *mm, uintptr_t addr, size_t len, int prot, int flags);
+int vm_munmap(mm_t *mm, uintptr_t addr, size_t len);
+uintptr_t vm_brk(mm_t *mm, uintptr_t addr);
+
+void write_cr3(uintptr_t cr3_value); // kernel.c
+
+static inline void invlpg(uintptr_t va)
+{
+	__asm__ __volatile__("invlpg (%0)" ::"r"(va)
+						 : "memory");
+}
+
+static inline uintptr_t read_cr3(void)
+{
+	uintptr_t cr3;
+	__asm__ __volatile__("mov %%cr3, %0"
+						 : "=r"(cr3));
+	return cr3;
+}
+
+static inline uintptr_t read_cr2(void)
+{
+	uintptr_t cr2;
+	__asm__ __volatile__("mov %%cr2, %0"
+						 : "=r"(cr2));
+	return cr2;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <types.h>
+
+#define WORK_DEQUE_SIZE 256 // Power of 2.
+
+/*
+ * A kernel work item, run once by whichever cpu gets to it first. fn runs without the
+ * kernel lock and with interrupts enabled, so it may only touch what it owns.
+ */
+struct work
+{
+	void (*fn)(void *);
+	void *arg;
+};
+typedef struct work work_t;
+
+/*
+ * Chase-Lev work-stealing deque: the owning cpu pushes and pops at the bottom,
+ * the others steal from the top.
+ */
+struct work_deque
+{
+	volatile int64_t top;
+	volatile int64_t bottom;
+	work_t *volatile items[WORK_DEQUE_SIZE];
+};
+typedef struct work_deque work_deque_t;
+
+int work_queue(work_t *work);
+int work_run(void);
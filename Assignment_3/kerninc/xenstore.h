@@ -0,0 +1,44 @@
+#pragma once
+
+#include <types.h>
+#include <hypercall.h>
+#include <event_channel.h>
+#include <rdtsc.h>
+#include <io/xs_wire.h>
+
+/*
+ * Minimal XenStore client (xenstore.c) over the ring page and event channel the toolstack sets
+ * up for every guest, found with HVM_PARAM_STORE_PFN and HVM_PARAM_STORE_EVTCHN. One request is
+ * in flight at a time and callers take turns. Paths that do not start with '/' are relative to
+ * the domain's home, /local/domain/<domid>.
+ *
+ * Watch events that come in while a request waits for its reply are kept, up to XS_WATCH_QUEUE,
+ * until xs_wait_watch() hands them out. Xenstored fires every new watch once straight away.
+ */
+
+#define XS_PATH_MAX 128
+#define XS_WATCH_QUEUE 8
+#define XS_REPLY_TIMEOUT_NS (5ULL * NSEC_PER_SEC)
+
+/*
+ * How the caller waits: returns once port may have an event or clock() has passed deadline,
+ * early returns are fine. Assignment_3 binds the port and blocks its thread, guest2 polls.
+ */
+typedef void (*xs_wait_t)(evtchn_port_t port, uint64_t deadline);
+typedef uint64_t (*xs_clock_t)(void);
+
+int xs_init(xs_wait_t wait, xs_clock_t clock);
+void xs_attach(struct xenstore_domain_interface *intf, evtchn_port_t port, xs_wait_t wait, xs_clock_t clock);
+int xs_domain_path(char *path, uint32_t max, uint32_t domid, const char *rel);
+
+int xs_read(const char *path, char *value, uint32_t max);
+int xs_read_uint(const char *path, uint32_t *value);
+int xs_write(const char *path, const char *value);
+int xs_write_uint(const char *path, uint32_t value);
+int xs_rm(const char *path);
+int xs_set_perms(const char *path, const char *perms, uint32_t len);
+int xs_watch(const char *path, const char *token);
+int xs_unwatch(const char *path, const char *token);
+int xs_wait_watch(char *path, uint32_t max, uint64_t timeout_ns);
+
+int xs_loopback(void); // xenstore_loopback.c, Assignment_3 only.
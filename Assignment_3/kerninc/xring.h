@@ -0,0 +1,74 @@
+#pragma once
+
+#include <types.h>
+
+/*
+ * Single producer, single consumer ring of variable length messages in memory shared by two
+ * domains, after Xen's io/ring.h. Each side writes only its own cache line of xring_shared_t,
+ * the indices are free running byte counts and a side asks to be notified by setting the
+ * event index of the other one, see xring.c. Nothing here knows about Xen, the pages and the
+ * event channel are up to the caller.
+ */
+
+#define XRING_CACHE_LINE 64
+#define XRING_ALIGN 8	  // Messages start 8-byte aligned: a 4-byte length, then the data.
+#define XRING_PAD 0xFFFFFFFFU // Length of the filler before a message that would wrap.
+#define XRING_RECORD(len) (((len) + 4 + XRING_ALIGN - 1) & ~(uint32_t)(XRING_ALIGN - 1))
+
+#define XRING_MAX_PAGES 32
+#define XRING_MAGIC 0x474E4952 // "RING"
+
+struct xring_shared
+{
+	volatile uint32_t prod;		  // Bytes written so far. Producer's line.
+	volatile uint32_t cons_event; // The producer waits for room, notify it once cons passes this.
+	uint8_t pad0[XRING_CACHE_LINE - 8];
+	volatile uint32_t cons;		  // Bytes read so far. Consumer's line.
+	volatile uint32_t prod_event; // The consumer waits for data, notify it once prod passes this.
+	uint8_t pad1[XRING_CACHE_LINE - 8];
+};
+typedef struct xring_shared xring_shared_t;
+
+/*
+ * The first page of a ring shared between domains: the indices, then what the consumer needs to
+ * map the data pages and connect. The producer fills it in before it grants the page.
+ */
+struct xring_page
+{
+	xring_shared_t ring;
+	volatile uint32_t magic;	 // XRING_MAGIC
+	volatile uint32_t connected; // Set by the consumer once it is listening on its port.
+	uint32_t nr_pages;			 // Data pages, a power of 2.
+	uint32_t port;				 // Unbound event channel of the producer.
+	uint32_t refs[XRING_MAX_PAGES]; // Grant references of the data pages.
+};
+typedef struct xring_page xring_page_t;
+
+/*
+ * One side's view of the ring. prod_pvt and cons_pvt run ahead of the shared indices until
+ * xring_push() and xring_release() publish them, so several messages share one barrier
+ * and at most one notification.
+ */
+struct xring
+{
+	xring_shared_t *shared;
+	uint8_t *data;
+	uint32_t size; // Bytes, a power of 2.
+	uint32_t prod_pvt;
+	uint32_t cons_pvt;
+};
+typedef struct xring xring_t;
+
+void xring_init(xring_t *ring, xring_shared_t *shared, void *data, uint32_t size);
+void xring_attach(xring_t *ring, xring_shared_t *shared, void *data, uint32_t size);
+
+/* Producer */
+int xring_write(xring_t *ring, const void *msg, uint32_t len);
+int xring_push(xring_t *ring);
+uint32_t xring_need(xring_t *ring, uint32_t len);
+int xring_prepare_write(xring_t *ring, uint32_t bytes);
+
+/* Consumer */
+int xring_read(xring_t *ring, void *buf, uint32_t max);
+int xring_release(xring_t *ring);
+int xring_prepare_read(xring_t *ring);
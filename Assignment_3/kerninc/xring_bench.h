@@ -0,0 +1,40 @@
+#pragma once
+
+#include <types.h>
+
+/*
+ * What Assignment_3 (xring_bench.c) sends guest2 over the shared ring: runs of XRING_BENCH_DATA
+ * messages of one size, each closed by XRING_BENCH_END, then XRING_BENCH_PING messages one at a
+ * time and XRING_BENCH_DONE. sent_ns is Xen system time, the same in both domains.
+ */
+
+#define XRING_BENCH_DATA 0
+#define XRING_BENCH_END 1
+#define XRING_BENCH_PING 2
+#define XRING_BENCH_DONE 3
+
+#define XRING_BENCH_MAX_MSG 4096
+#define XRING_BENCH_HEADER_REF 511 // The first grant reference init_gnttab() hands out.
+
+/*
+ * With XenStore the two find each other instead of assuming domains 5 and 6 and reference 511.
+ * Assignment_3 makes XRING_XS_DIR in its home readable by every domain and XRING_XS_PEER
+ * writable too, and watches it. guest2 looks for the first other domain with that node, writes
+ * its own id there and watches XRING_XS_REF, which Assignment_3 writes after XRING_XS_PORT once
+ * it has granted the ring to that domain.
+ */
+#define XRING_XS_DIR "data/xring"
+#define XRING_XS_PEER "data/xring/peer"
+#define XRING_XS_PORT "data/xring/event-channel"
+#define XRING_XS_REF "data/xring/ring-ref"
+#define XRING_XS_TOKEN "xring"
+
+struct xring_bench_msg
+{
+	uint32_t type;
+	uint32_t size; // Of the messages in this run.
+	uint64_t sent_ns;
+};
+
+int xring_bench_start(uintptr_t header_page);	// Assignment_3, the producer.
+void xring_bench_consume(uintptr_t pages);		// guest2, the consumer.
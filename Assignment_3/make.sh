@@ -6,21 +6,52 @@ lld-link /dll /nodefaultlib /safeseh:no /machine:AMD64 /entry:efi_main boot.o /o
 ../fwimage/fwimage app boot.dll boot.efi
 
 # Compile the kernel
-gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c kernel_entry.S
-gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c apic.c
-gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c kernel.c
-gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c kernel_asm.S
-gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c kernel_syscall.c
-gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c printf.c
-gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c fb.c
-gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c ascii_font.c
-gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c gnttab.c
-ld --oformat=binary -T ./kernel.lds -nostdlib -melf_x86_64 -pie kernel_entry.o apic.o kernel.o kernel_asm.o kernel_syscall.o printf.o fb.o ascii_font.o gnttab.o -o kernel
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c kernel_entry.S
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c apic.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c kernel.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c kernel_asm.S
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c kernel_syscall.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c printf.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c fb.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c ascii_font.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c gnttab.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c gnttab_map.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c string.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c palloc.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c vm.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c elf.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c process.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c timer.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c thread.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c futex.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c irq.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c bench.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c fpu.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c acpi.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c smp.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c tlb.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c work.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c idle.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c evtchn.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c xring.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c xring_bench.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c hpet.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c multicall.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c xenstore.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c xenstore_loopback.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -mgeneral-regs-only -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c smp_trampoline.S
+ld --oformat=binary -T ./kernel.lds -nostdlib -melf_x86_64 -pie kernel_entry.o apic.o kernel.o kernel_asm.o kernel_syscall.o printf.o fb.o ascii_font.o gnttab.o gnttab_map.o string.o palloc.o vm.o elf.o thread.o futex.o process.o timer.o irq.o bench.o fpu.o acpi.o smp.o smp_trampoline.o tlb.o work.o idle.o evtchn.o xring.o xring_bench.o hpet.o multicall.o xenstore.o xenstore_loopback.o -o kernel
 
 # Comple the user application
-gcc -Wall -Wno-builtin-declaration-mismatch -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./userinc -pie -fno-zero-initialized-in-bss -c user_entry.S
-gcc -Wall -Wno-builtin-declaration-mismatch -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./userinc -pie -fno-zero-initialized-in-bss -c user.c
-ld --oformat=binary -T ./user.lds -nostdlib -melf_x86_64 -pie user_entry.o user.o -o user
+gcc -Wall -Wno-builtin-declaration-mismatch -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./userinc -fpie -c user_entry.S
+gcc -Wall -Wno-builtin-declaration-mismatch -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./userinc -fpie -c user.c
+ld -T ./user.lds -nostdlib -melf_x86_64 -static -z max-page-size=0x1000 -z noexecstack user_entry.o user.o -o user
+
+# Compile the programs the user app spawns
+gcc -Wall -Wno-builtin-declaration-mismatch -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./userinc -fpie -c true.c
+ld -T ./user.lds -nostdlib -melf_x86_64 -static -z max-page-size=0x1000 -z noexecstack user_entry.o true.o -o true
+gcc -Wall -Wno-builtin-declaration-mismatch -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./userinc -fpie -DPAD_SIZE=0x100000 -c true.c -o bigtrue.o
+ld -T ./user.lds -nostdlib -melf_x86_64 -static -z max-page-size=0x1000 -z noexecstack user_entry.o bigtrue.o -o bigtrue
 
 # Create a FAT image
 rm -rf ./uefi_fat_mnt
@@ -32,4 +63,7 @@ sudo mkdir -p ./uefi_fat_mnt/EFI/BOOT
 sudo cp boot.efi ./uefi_fat_mnt/EFI/BOOT/BOOTX64.EFI
 sudo cp kernel ./uefi_fat_mnt/EFI/BOOT/KERNEL
 sudo cp user ./uefi_fat_mnt/EFI/BOOT/USER
+sudo mkdir -p ./uefi_fat_mnt/EFI/BOOT/BIN
+sudo cp true ./uefi_fat_mnt/EFI/BOOT/BIN/TRUE
+sudo cp bigtrue ./uefi_fat_mnt/EFI/BOOT/BIN/BIGTRUE
 sudo umount ./uefi_fat_mnt
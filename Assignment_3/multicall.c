@@ -0,0 +1,107 @@
+/*
+ * Batched hypercalls. Every cpu has a buffer of multicall_entry_t, filled by mc_queue() between
+ * mc_batch() and mc_issue() with interrupts off, so an interrupt handler cannot add to a batch
+ * half way through. Xen runs the calls in order and leaves each one's return value in its entry,
+ * which goes to the caller's result and the first negative one to mc_issue(). Batches do not
+ * nest: one started inside another would flush the outer one's calls and take their errors.
+ */
+
+#include <types.h>
+#include <multicall.h>
+#include <cpu.h>
+#include <palloc.h>
+#include <interrupts.h>
+#include <string.h>
+#include <errno.h>
+#include <printf.h>
+
+struct mc_buffer
+{
+	uint32_t count;
+	int error; // First failure since mc_batch(), from a flush on a full buffer.
+	long *results[MC_BATCH];
+	multicall_entry_t calls[MC_BATCH];
+};
+
+#define MC_BUFFER_PAGES ((MAX_CPUS * sizeof(struct mc_buffer) + PAGE_SIZE - 1) / PAGE_SIZE)
+
+volatile unsigned long xen_hypercalls;
+volatile unsigned long mc_calls;
+static volatile unsigned long mc_multicalls;
+static struct mc_buffer *mc_buffers; // One per cpu id.
+
+/*
+ * Called before the first batch, once the page pool is up.
+ */
+int mc_init(void)
+{
+	mc_buffers = (struct mc_buffer *)page_alloc_contig(MC_BUFFER_PAGES, 1);
+	if (mc_buffers == NULL)
+		return -ENOMEM;
+	memset(mc_buffers, 0x0, MC_BUFFER_PAGES * PAGE_SIZE);
+	return 0;
+}
+
+static void mc_flush(struct mc_buffer *buffer)
+{
+	if (buffer->count == 0)
+		return;
+	int ret = HYPERVISOR_multicall(buffer->calls, buffer->count);
+	__atomic_fetch_add(&mc_multicalls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&mc_calls, buffer->count, __ATOMIC_RELAXED);
+	for (uint32_t i = 0; i < buffer->count; i++)
+	{
+		long result = ret != 0 ? ret : (long)buffer->calls[i].result; // Nothing ran if the multicall failed.
+		if (buffer->results[i] != NULL)
+			*buffer->results[i] = result;
+		if (result < 0 && buffer->error == 0)
+			buffer->error = (int)result;
+	}
+	buffer->count = 0;
+}
+
+/*
+ * Starts a batch on this cpu. Returns the interrupt flags for mc_issue().
+ */
+uint64_t mc_batch(void)
+{
+	uint64_t flags = irq_save();
+	mc_buffers[this_cpu()->id].error = 0;
+	return flags;
+}
+
+/*
+ * Adds hypercall op with up to three arguments to the batch, its return value goes to *result
+ * unless that is NULL.
+ */
+void mc_queue(unsigned long op, unsigned long a0, unsigned long a1, unsigned long a2, long *result)
+{
+	struct mc_buffer *buffer = &mc_buffers[this_cpu()->id];
+	if (buffer->count == MC_BATCH)
+		mc_flush(buffer);
+	multicall_entry_t *call = &buffer->calls[buffer->count];
+	call->op = op;
+	call->args[0] = a0;
+	call->args[1] = a1;
+	call->args[2] = a2;
+	buffer->results[buffer->count++] = result;
+}
+
+/*
+ * Makes the queued calls and ends the batch. Returns 0, the error of the multicall itself or the
+ * first negative return value of a call.
+ */
+int mc_issue(uint64_t flags)
+{
+	struct mc_buffer *buffer = &mc_buffers[this_cpu()->id];
+	mc_flush(buffer);
+	int error = buffer->error;
+	irq_restore(flags);
+	return error;
+}
+
+void mc_stats_print(void)
+{
+	printf("Hypercalls: %ld traps into Xen, %ld of them multicalls with %ld calls\n", xen_hypercalls, mc_multicalls,
+		   mc_calls);
+}
@@ -0,0 +1,158 @@
+/*
+ * A bitmap based physical page allocator.
+ * The bootloader allocates one contiguous pool of pages and the kernel hands them out one (or a
+ * naturally aligned run of them for huge pages) at a time. One bit per page, set means allocated.
+ * Pages shared copy-on-write between address spaces also carry a reference count.
+ */
+
+#include <types.h>
+#include <palloc.h>
+#include <printf.h>
+
+#define POOL_MAX_PAGES 65536 // 256mb worth of 4kb pages.
+
+static uintptr_t pool_base;
+static uint64_t pool_pages;
+static uint64_t pool_free;
+static uint64_t pool_hint; // Bitmap word to start the next single page search from.
+static uint64_t pool_bitmap[POOL_MAX_PAGES / 64];
+static uint16_t pool_refs[POOL_MAX_PAGES]; // Mappings of each allocated page, page_free() drops one.
+
+static inline int page_test(uint64_t idx)
+{
+	return (pool_bitmap[idx / 64] >> (idx % 64)) & 0x1;
+}
+
+static inline void page_set(uint64_t idx)
+{
+	pool_bitmap[idx / 64] |= 1ULL << (idx % 64);
+}
+
+static inline void page_clear(uint64_t idx)
+{
+	pool_bitmap[idx / 64] &= ~(1ULL << (idx % 64));
+}
+
+void palloc_init(uintptr_t base, uint64_t num_pages)
+{
+	if (num_pages > POOL_MAX_PAGES)
+		num_pages = POOL_MAX_PAGES;
+	pool_base = base;
+	pool_pages = num_pages;
+	pool_free = num_pages;
+	pool_hint = 0;
+	for (uint64_t i = 0; i < POOL_MAX_PAGES / 64; i++)
+		pool_bitmap[i] = 0x0ULL;
+	for (uint64_t i = num_pages; i < POOL_MAX_PAGES; i++) // Pages past the end of the pool are never handed out.
+		page_set(i);
+}
+
+uintptr_t page_alloc(void)
+{
+	uint64_t words = (pool_pages + 63) / 64;
+	for (uint64_t n = 0; n < words; n++)
+	{
+		uint64_t w = (pool_hint + n) % words;
+		if (pool_bitmap[w] == ~0x0ULL)
+			continue;
+		uint64_t bit = __builtin_ctzll(~pool_bitmap[w]);
+		uint64_t idx = w * 64 + bit;
+		page_set(idx);
+		pool_refs[idx] = 1;
+		pool_free--;
+		pool_hint = w;
+		return pool_base + (idx << PAGE_SHIFT);
+	}
+	return 0x0ULL;
+}
+
+uintptr_t page_alloc_zeroed(void)
+{
+	uintptr_t page = page_alloc();
+	if (page != 0x0ULL)
+		__builtin_memset((void *)page, 0x0, PAGE_SIZE);
+	return page;
+}
+
+/*
+ * First fit search for num_pages free pages whose physical address is aligned to align pages.
+ * Only used for huge pages and multi-page buffers, so a linear scan is good enough.
+ */
+uintptr_t page_alloc_contig(uint64_t num_pages, uint64_t align)
+{
+	uint64_t first = 0;
+	uint64_t misalign = (pool_base >> PAGE_SHIFT) & (align - 1);
+	if (misalign != 0)
+		first = align - misalign;
+
+	for (uint64_t idx = first; idx + num_pages <= pool_pages; idx += align)
+	{
+		uint64_t i;
+		for (i = 0; i < num_pages; i++)
+		{
+			if (page_test(idx + i))
+				break;
+		}
+		if (i != num_pages)
+			continue;
+		for (i = 0; i < num_pages; i++)
+		{
+			page_set(idx + i);
+			pool_refs[idx + i] = 1;
+		}
+		pool_free -= num_pages;
+		return pool_base + (idx << PAGE_SHIFT);
+	}
+	return 0x0ULL;
+}
+
+int page_in_pool(uintptr_t page)
+{
+	return page >= pool_base && page < pool_base + (pool_pages << PAGE_SHIFT);
+}
+
+void page_free(uintptr_t page)
+{
+	if (!page_in_pool(page))
+		return; // Bootloader provided pages (user image, stack) are never recycled.
+	uint64_t idx = (page - pool_base) >> PAGE_SHIFT;
+	if (!page_test(idx))
+	{
+		printf("page_free: double free of %p\n", (void *)page);
+		return;
+	}
+	if (--pool_refs[idx] != 0)
+		return; // Still mapped elsewhere.
+	page_clear(idx);
+	pool_free++;
+}
+
+/*
+ * Takes another reference on num_pages pages starting at page, for sharing them copy-on-write.
+ */
+void page_ref(uintptr_t page, uint64_t num_pages)
+{
+	if (!page_in_pool(page))
+		return;
+	uint64_t idx = (page - pool_base) >> PAGE_SHIFT;
+	for (uint64_t i = 0; i < num_pages; i++)
+		pool_refs[idx + i]++;
+}
+
+uint32_t page_refcount(uintptr_t page)
+{
+	if (!page_in_pool(page))
+		return 0;
+	return pool_refs[(page - pool_base) >> PAGE_SHIFT];
+}
+
+void page_free_contig(uintptr_t page, uint64_t num_pages)
+{
+	for (uint64_t i = 0; i < num_pages; i++)
+		page_free(page + (i << PAGE_SHIFT));
+}
+
+uint64_t palloc_free_pages(void)
+{
+	return pool_free;
+}
@@ -0,0 +1,287 @@
+/*
+ * User processes. A process is an address space (its own pml4, sharing the kernel mapping in entry 0)
+ * plus the threads running in it. New processes are started from the files the bootloader loaded
+ * (spawn) or as a copy-on-write copy of the caller (fork). A process stays around as a zombie once
+ * its last thread is gone, until the parent collects the exit code with wait().
+ */
+
+#include <types.h>
+#include <process.h>
+#include <thread.h>
+#include <vm.h>
+#include <elf.h>
+#include <errno.h>
+#include <smp.h>
+#include <printf.h>
+
+#define MODULE_NAME_MAX 16
+
+static process_t process_table[MAX_PROCESSES];
+static uint32_t next_pid;
+
+static boot_module_t *boot_modules;
+static uint32_t num_boot_modules;
+
+void process_init(boot_module_t *modules, uint32_t num_modules)
+{
+	boot_modules = modules;
+	num_boot_modules = num_modules;
+	next_pid = 1;
+	for (int i = 0; i < MAX_PROCESSES; i++)
+		process_table[i].state = PROC_UNUSED;
+
+	for (uint32_t i = 0; i < num_modules; i++)
+		printf("Boot module %s: %ld bytes\n", modules[i].name, modules[i].size);
+}
+
+/*
+ * File names on the boot volume (FAT) are not case sensitive.
+ */
+static int module_name_equal(const char *a, const char *b)
+{
+	for (int i = 0; i < MODULE_NAME_MAX; i++)
+	{
+		char ca = (a[i] >= 'A' && a[i] <= 'Z') ? a[i] - 'A' + 'a' : a[i];
+		char cb = (b[i] >= 'A' && b[i] <= 'Z') ? b[i] - 'A' + 'a' : b[i];
+		if (ca != cb)
+			return 0;
+		if (ca == '\0')
+			return 1;
+	}
+	return 1;
+}
+
+static boot_module_t *module_find(const char *name)
+{
+	for (uint32_t i = 0; i < num_boot_modules; i++)
+	{
+		if (module_name_equal(boot_modules[i].name, name))
+			return &boot_modules[i];
+	}
+	return NULL;
+}
+
+static process_t *process_alloc(void)
+{
+	for (int i = 0; i < MAX_PROCESSES; i++)
+	{
+		process_t *process = &process_table[i];
+		if (process->state != PROC_UNUSED)
+			continue;
+		__builtin_memset(process, 0x0, sizeof(process_t));
+		process->pid = next_pid++;
+		process->state = PROC_RUNNING;
+		return process;
+	}
+	return NULL;
+}
+
+static void process_release(process_t *process)
+{
+	process->state = PROC_UNUSED;
+}
+
+static process_t *process_find(long pid)
+{
+	for (int i = 0; i < MAX_PROCESSES; i++)
+	{
+		if (process_table[i].state != PROC_UNUSED && process_table[i].pid == pid)
+			return &process_table[i];
+	}
+	return NULL;
+}
+
+/*
+ * Sets up the TLS area of the main thread with its thread control block at tcb (page aligned).
+ * Threads created later get theirs from sys_thread_create().
+ */
+static uintptr_t process_tls_init(mm_t *mm, uintptr_t tcb)
+{
+	uint64_t align = mm->tls_align;
+	uint64_t block = (mm->tls_memsz + align - 1) & ~(align - 1);
+
+	if (vma_insert(mm, PAGE_ALIGN_DOWN(tcb - block), tcb + sizeof(tls_block_t), VMA_READ | VMA_WRITE) != 0)
+		return 0x0ULL;
+	return tls_setup(mm, tcb);
+}
+
+/*
+ * Starts the boot module name as a new process. The image is not copied, its segments become
+ * file backed VMAs, so the cost does not depend on the size of the image.
+ * Returns the pid or a negative error number.
+ */
+long process_spawn(const char *name)
+{
+	boot_module_t *module = module_find(name);
+	if (module == NULL)
+		return -ENOENT;
+	process_t *process = process_alloc();
+	if (process == NULL)
+		return -EAGAIN;
+
+	mm_t *mm = &process->mm;
+	long ret = mm_init(mm);
+	if (ret != 0)
+	{
+		process_release(process);
+		return ret;
+	}
+	ret = vma_insert(mm, USER_STACK_TOP - USER_STACK_SIZE, USER_STACK_TOP, VMA_READ | VMA_WRITE | VMA_STACK);
+	if (ret == 0)
+		ret = elf_load(mm, module->base, PAGE_ALIGN_UP(module->size)); // The bootloader loads whole pages.
+	uintptr_t tcb = 0x0ULL;
+	if (ret == 0)
+	{
+		tcb = process_tls_init(mm, USER_TLS_BASE);
+		if (tcb == 0x0ULL)
+			ret = -ENOMEM;
+	}
+	if (ret == 0 && thread_create_user(process, mm->entry, USER_STACK_TOP, 0, tcb) == NULL)
+		ret = -EAGAIN;
+	if (ret != 0)
+	{
+		vm_mm_destroy(mm);
+		process_release(process);
+		return ret;
+	}
+
+	if (current_thread->process != NULL)
+		process->parent = current_thread->process;
+	return process->pid;
+}
+
+/*
+ * Called for every reaped thread. The last one takes the address space with it and turns
+ * the process into a zombie for the parent to wait() on.
+ */
+void process_thread_exited(process_t *process)
+{
+	if (--process->nthreads != 0)
+		return;
+
+	vm_mm_destroy(&process->mm);
+	for (int i = 0; i < MAX_PROCESSES; i++) // Orphans, nobody will wait for them.
+	{
+		process_t *child = &process_table[i];
+		if (child->state == PROC_UNUSED || child->parent != process)
+			continue;
+		child->parent = NULL;
+		if (child->state == PROC_ZOMBIE)
+			process_release(child);
+	}
+
+	if (process->parent == NULL)
+	{
+		process_release(process);
+		return;
+	}
+	process->state = PROC_ZOMBIE;
+	if (process->waiter != NULL)
+		thread_wakeup(process->waiter);
+}
+
+/*
+ * Threads of a process that called exit() end up here on their next entry to the kernel.
+ */
+void process_check_exit(void)
+{
+	process_t *process = current_thread->process;
+	if (process != NULL && process->exiting)
+		thread_exit();
+}
+
+/*
+ * Whether the calling thread belongs to a process that called exit(), so whatever it waits for
+ * it should stop waiting.
+ */
+int process_exiting(void)
+{
+	process_t *process = current_thread->process;
+	return process != NULL && process->exiting;
+}
+
+long sys_spawn(uintptr_t user_name)
+{
+	char name[MODULE_NAME_MAX];
+	for (int i = 0; i < MODULE_NAME_MAX; i++)
+	{
+		uintptr_t pa = vm_user_to_phys(current_mm, user_name + i, 0);
+		if (pa == 0x0ULL)
+			return -EFAULT;
+		name[i] = *(char *)pa;
+		if (name[i] == '\0')
+			return process_spawn(name);
+	}
+	return -ENOENT;
+}
+
+/*
+ * Only the calling thread is copied into the child, as with POSIX fork().
+ */
+long sys_fork(void)
+{
+	process_t *parent = current_thread->process;
+	process_t *child = process_alloc();
+	if (child == NULL)
+		return -EAGAIN;
+
+	int ret = vm_fork(&child->mm, &parent->mm);
+	if (ret != 0)
+	{
+		process_release(child);
+		return ret;
+	}
+	if (thread_fork(child, thread_frame(current_thread)) == NULL)
+	{
+		vm_mm_destroy(&child->mm);
+		process_release(child);
+		return -EAGAIN;
+	}
+	child->parent = parent;
+	return child->pid;
+}
+
+/*
+ * Waits for the child pid to exit and returns its exit code.
+ */
+long sys_wait(long pid)
+{
+	process_t *child = process_find(pid);
+	if (child == NULL || child->parent != current_thread->process)
+		return -ECHILD;
+	if (child->waiter != NULL)
+		return -EBUSY;
+
+	while (child->state != PROC_ZOMBIE)
+	{
+		if (process_exiting())
+		{
+			child->waiter = NULL;
+			return -EINTR;
+		}
+		child->waiter = current_thread;
+		thread_block();
+	}
+	int code = child->exit_code;
+	process_release(child);
+	return code;
+}
+
+void sys_exit(int code)
+{
+	process_t *process = current_thread->process;
+	if (!process->exiting)
+	{
+		process->exiting = 1;
+		process->exit_code = code;
+		futex_wake_all(&process->mm); // Off the futex queues first.
+		thread_wakeup_process(process); // Every blocked thread wakes up and exits.
+		cpu_t *self = this_cpu();
+		for (uint32_t i = 0; i < num_cpus; i++) // Threads running elsewhere exit on the IPI.
+		{
+			if (&cpus[i] != self && cpus[i].thread->process == process)
+				smp_resched(&cpus[i]);
+		}
+	}
+	thread_exit();
+}
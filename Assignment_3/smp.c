@@ -0,0 +1,299 @@
+/*
+ * Multiprocessor support. The boot cpu finds the others in the ACPI MADT and starts them one
+ * at a time with INIT-SIPI-SIPI through a real mode trampoline below 1mb (smp_trampoline.S).
+ * Every cpu gets its own GDT, TSS, IDT, IST stacks, idle thread, timer wheel and LAPIC timer,
+ * and reaches its cpu_t through %gs.
+ *
+ * The kernel itself runs under one big lock (kernel_lock()): user code runs in parallel, kernel
+ * code one cpu at a time. The only exception are TLB flush IPIs (tlb.c), which are answered
+ * without the lock because their sender holds it and waits.
+ */
+
+#include <types.h>
+#include <smp.h>
+#include <cpu.h>
+#include <tlb.h>
+#include <acpi.h>
+#include <apic.h>
+#include <msr.h>
+#include <irq.h>
+#include <thread.h>
+#include <timer.h>
+#include <fpu.h>
+#include <vm.h>
+#include <palloc.h>
+#include <rdtsc.h>
+#include <kernel_syscall.h>
+#include <printf.h>
+
+/* kernel.c */
+void xen_vcpu_init(cpu_t *cpu);
+
+#define SMP_INIT_DELAY_NS 10000000ULL	  // 10ms between INIT and the first SIPI.
+#define SMP_SIPI_DELAY_NS 200000ULL		  // 200us before the second SIPI.
+#define SMP_ONLINE_TIMEOUT_NS 100000000ULL // Give up on a cpu after 100ms.
+#define SMP_LOW_MEMORY 0x100000ULL		  // Startup IPIs can only reach the first 1mb.
+#define SMP_MAX_CR3 0x100000000ULL		  // The trampoline loads cr3 in 32-bit mode.
+
+#define SMP_AP_WAITING 0   // Started, not yet in ap_main().
+#define SMP_AP_STARTED 1   // In ap_main(), the boot cpu waits for it to come online.
+#define SMP_AP_ABANDONED 2 // Timed out, the boot cpu has moved on without it.
+
+cpu_t cpus[MAX_CPUS];
+uint32_t num_cpus;
+void *smp_trampoline_ptr;
+
+static volatile uint32_t kernel_lock_word;
+static volatile uint32_t kernel_lock_owner; // cpu id + 1, 0 if free.
+
+/*
+ * Spins with interrupts as they are. A cpu waiting here still answers TLB flushes, the
+ * holder may be waiting for it in tlb_finish() with interrupts off.
+ */
+void kernel_lock(void)
+{
+	cpu_t *cpu = this_cpu();
+	while (__atomic_exchange_n(&kernel_lock_word, 1, __ATOMIC_ACQUIRE) != 0)
+	{
+		while (kernel_lock_word != 0)
+		{
+			tlb_poll();
+			__asm__ __volatile__("pause");
+		}
+	}
+	kernel_lock_owner = cpu->id + 1;
+}
+
+void kernel_unlock(void)
+{
+	kernel_lock_owner = 0;
+	__atomic_store_n(&kernel_lock_word, 0, __ATOMIC_RELEASE);
+}
+
+int kernel_lock_held(void)
+{
+	return kernel_lock_owner == this_cpu()->id + 1;
+}
+
+/*
+ * Nothing to do, the point is the kernel entry: irq_dispatch() kills the thread if its
+ * process is exiting, and an idle cpu goes round its loop looking for work.
+ */
+static void smp_resched_interrupt(trap_frame_t *frame)
+{
+	x86_lapic_eoi();
+}
+
+void smp_resched(cpu_t *cpu)
+{
+	x86_lapic_send_ipi(cpu->apic_id, X86_LAPIC_ICR_ASSERT | RESCHED_VECTOR);
+}
+
+/*
+ * Called when a thread becomes ready. The running cpu picks it up at its next schedule()
+ * if it is idle, otherwise one halted cpu is woken for it.
+ */
+void smp_wake_idle(void)
+{
+	cpu_t *self = this_cpu();
+	if (self->thread == self->idle_thread)
+		return;
+	for (uint32_t i = 0; i < num_cpus; i++)
+	{
+		cpu_t *cpu = &cpus[i];
+		if (cpu != self && cpu->idle)
+		{
+			cpu->idle = 0; // Only one wakeup per idle cpu.
+			smp_resched(cpu);
+			return;
+		}
+	}
+}
+
+/*
+ * Loads cpu's copy of the GDT and points %gs at cpu.
+ */
+static void cpu_load(cpu_t *cpu)
+{
+	__builtin_memcpy(cpu->gdt, gdt, sizeof(cpu->gdt));
+	struct
+	{
+		uint16_t limit;
+		uint64_t base;
+	} __attribute__((packed)) gdt_ptr = {sizeof(cpu->gdt) - 1, (uint64_t)cpu->gdt};
+
+	__asm__ __volatile__("lgdt %0\n\t"
+						 "movl $0x10, %%eax\n\t"
+						 "movl %%eax, %%ds\n\t"
+						 "movl %%eax, %%es\n\t"
+						 "movl %%eax, %%ss\n\t"
+						 "pushq $0x08\n\t"
+						 "leaq 1f(%%rip), %%rax\n\t"
+						 "pushq %%rax\n\t"
+						 "lretq\n" // Reload %cs.
+						 "1:"
+						 :
+						 : "m"(gdt_ptr)
+						 : "rax", "memory");
+	wrmsr(MSR_GSBASE, (uint64_t)cpu);
+	wrmsr(MSR_KERNEL_GSBASE, 0x0ULL); // The user %gs base, swapped in on the way out.
+}
+
+/*
+ * The boot cpu becomes cpu 0 and takes the kernel lock, which it keeps through boot.
+ */
+void smp_boot_cpu_init(void)
+{
+	cpu_t *cpu = &cpus[0];
+	__builtin_memset(cpus, 0x0, sizeof(cpus));
+	cpu->self = cpu;
+	cpu->id = 0;
+	cpu->online = 1;
+	num_cpus = 1;
+	cpu_load(cpu);
+	kernel_lock();
+}
+
+static int smp_cpu_alloc(cpu_t *cpu, uint32_t id, uint32_t apic_id)
+{
+	cpu->self = cpu;
+	cpu->id = id;
+	cpu->apic_id = apic_id;
+	cpu->tss = (tss_segment_t *)page_alloc_zeroed();
+	cpu->idt = (idt_entry_t *)page_alloc();
+	cpu->wheel = timer_wheel_alloc();
+	cpu->idle_thread = thread_create_idle();
+	if (cpu->tss == NULL || cpu->idt == NULL || cpu->wheel == NULL || cpu->idle_thread == NULL)
+		return -1;
+	__builtin_memcpy(cpu->idt, idt, sizeof(idt_entry_t) * IDT_TABLE_SIZE);
+	if (irq_cpu_init(cpu) != 0)
+		return -1;
+	cpu->tss->rsp[0] = cpu->idle_thread->kstack_top;
+	cpu->tss->iopb_base = sizeof(tss_segment_t);
+	return 0;
+}
+
+/*
+ * First C code of another cpu, on its idle thread's stack with the kernel page table.
+ */
+static void __attribute__((noreturn)) ap_main(cpu_t *cpu)
+{
+	uint32_t waiting = SMP_AP_WAITING;
+	if (!__atomic_compare_exchange_n(&cpu->start_state, &waiting, SMP_AP_STARTED, 0, __ATOMIC_ACQ_REL,
+									 __ATOMIC_ACQUIRE))
+	{
+		// Too late, the boot cpu gave up on this cpu and does not count it in num_cpus. The
+		// INIT it sent usually resets the cpu before it gets this far.
+		for (;;)
+			__asm__ __volatile__("cli; hlt");
+	}
+	cpu_load(cpu);
+	xen_vcpu_init(cpu); // Its own vcpu_info and time, before anything reads the clock.
+	load_tss_segment(cpu->gdt, GDT_TSS, cpu->tss);
+	idt_pointer_t idtp = {sizeof(idt_entry_t) * IDT_TABLE_SIZE - 1, (uint64_t)cpu->idt};
+	__asm__ __volatile__("lidt %0" : : "m"(idtp)); // Interrupts stay off until the idle loop.
+
+	syscall_init();
+	x86_lapic_enable();
+	cpu->apic_id = x86_lapic_id();
+	fpu_cpu_init();
+	timer_cpu_init();
+	cpu->thread = cpu->idle_thread;
+	cpu->thread->run_start = rdtsc();
+	__atomic_store_n(&cpu->online, 1, __ATOMIC_RELEASE);
+
+	kernel_lock();
+	sched_start();
+}
+
+static void smp_delay(uint64_t ns)
+{
+	uint64_t deadline = clock_ns() + ns;
+	while (clock_ns() < deadline)
+		__asm__ __volatile__("pause");
+}
+
+static int smp_start_cpu(cpu_t *cpu, struct smp_trampoline_data *data, uintptr_t page)
+{
+	data->stack = cpu->idle_thread->kstack_top;
+	data->cpu = (uint64_t)cpu;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	uint64_t start = clock_ns();
+	x86_lapic_send_ipi(cpu->apic_id, X86_LAPIC_ICR_INIT | X86_LAPIC_ICR_ASSERT);
+	smp_delay(SMP_INIT_DELAY_NS);
+	uint64_t sipi = clock_ns();
+	for (int i = 0; i < 2 && !cpu->online; i++)
+	{
+		x86_lapic_send_ipi(cpu->apic_id, X86_LAPIC_ICR_STARTUP | (page >> 12));
+		smp_delay(SMP_SIPI_DELAY_NS);
+	}
+	while (!cpu->online && clock_ns() - sipi < SMP_ONLINE_TIMEOUT_NS)
+		__asm__ __volatile__("pause");
+
+	/*
+	 * A cpu that has not reached ap_main() is abandoned: INIT puts it back in wait-for-SIPI
+	 * and, should it still get there, ap_main() sees the flag and halts. One that has is
+	 * only running our own setup code and is waited for.
+	 */
+	uint32_t waiting = SMP_AP_WAITING;
+	if (!cpu->online && __atomic_compare_exchange_n(&cpu->start_state, &waiting, SMP_AP_ABANDONED, 0,
+													 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		x86_lapic_send_ipi(cpu->apic_id, X86_LAPIC_ICR_INIT | X86_LAPIC_ICR_ASSERT);
+		printf("CPU %d (APIC id %d) did not start!\n", cpu->id, cpu->apic_id);
+		return -1;
+	}
+	while (!cpu->online)
+		__asm__ __volatile__("pause");
+
+	uint64_t end = clock_ns();
+	printf("CPU %d (APIC id %d) online in %ld us (%ld us after the SIPI)\n", cpu->id, cpu->apic_id,
+		   (end - start) / 1000, (end - sipi) / 1000);
+	return 0;
+}
+
+/*
+ * Starts every cpu the MADT lists. rsdp and trampoline_page come from the bootloader, which
+ * reserved the page below 1mb. Called by the boot cpu after the LAPIC timer is calibrated.
+ */
+void smp_init(uintptr_t rsdp, uintptr_t trampoline_page)
+{
+	cpus[0].apic_id = x86_lapic_id();
+	irq_register(RESCHED_VECTOR, smp_resched_interrupt);
+
+	uint32_t apic_ids[MAX_CPUS];
+	int count = acpi_madt_cpus(rsdp, apic_ids, MAX_CPUS);
+	uintptr_t cr3 = read_cr3();
+	if (count <= 1 || trampoline_page == 0x0ULL || trampoline_page >= SMP_LOW_MEMORY || cr3 >= SMP_MAX_CR3)
+	{
+		printf("1 cpu online%s\n", count > 1 ? ", cannot start the others" : "");
+		return;
+	}
+
+	struct smp_trampoline_data *data = (struct smp_trampoline_data *)(trampoline_page + SMP_TRAMPOLINE_DATA);
+	__builtin_memcpy((void *)trampoline_page, smp_trampoline_ptr, SMP_TRAMPOLINE_DATA + sizeof(*data));
+	data->gdt_base += trampoline_page;
+	data->entry64 += trampoline_page;
+	data->cr0 = read_cr0() & ~CR0_TS;
+	data->cr4 = read_cr4() & ~CR4_PCIDE; // PCIDE cannot be set outside long mode.
+	data->cr3 = cr3;
+	data->efer = rdmsr(MSR_EFER) & ~EFER_LMA;
+	data->entry = (uint64_t)ap_main;
+
+	for (int i = 0; i < count && num_cpus < MAX_CPUS; i++)
+	{
+		if (apic_ids[i] == cpus[0].apic_id)
+			continue;
+		cpu_t *cpu = &cpus[num_cpus];
+		if (smp_cpu_alloc(cpu, num_cpus, apic_ids[i]) != 0)
+		{
+			printf("Could not allocate cpu %d!\n", num_cpus);
+			break;
+		}
+		if (smp_start_cpu(cpu, data, trampoline_page) != 0)
+			break;
+		num_cpus++;
+	}
+	printf("%d cpus online\n", num_cpus);
+}
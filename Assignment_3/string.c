@@ -0,0 +1,53 @@
+/*
+ * Minimal memory routines. gcc may emit calls to these for struct copies
+ * and loops it recognizes, even with -nostdinc, so they must always exist.
+ */
+
+#include <types.h>
+#include <string.h>
+
+void *memset(void *dst, int c, size_t n)
+{
+	void *ret = dst;
+	__asm__ __volatile__("rep stosb"
+						 : "+D"(dst), "+c"(n)
+						 : "a"(c)
+						 : "memory");
+	return ret;
+}
+
+void *memcpy(void *dst, const void *src, size_t n)
+{
+	void *ret = dst;
+	__asm__ __volatile__("rep movsb"
+						 : "+D"(dst), "+S"(src), "+c"(n)
+						 :
+						 : "memory");
+	return ret;
+}
+
+void *memmove(void *dst, const void *src, size_t n)
+{
+	unsigned char *d = dst;
+	const unsigned char *s = src;
+	if (d <= s || d >= s + n)
+		return memcpy(dst, src, n);
+	d += n - 1; // Overlapping with dst above src, copy backwards.
+	s += n - 1;
+	__asm__ __volatile__("std; rep movsb; cld"
+						 : "+D"(d), "+S"(s), "+c"(n)
+						 :
+						 : "memory");
+	return dst;
+}
+
+int memcmp(const void *a, const void *b, size_t n)
+{
+	const unsigned char *x = a, *y = b;
+	for (size_t i = 0; i < n; i++)
+	{
+		if (x[i] != y[i])
+			return x[i] - y[i];
+	}
+	return 0;
+}
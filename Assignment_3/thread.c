@@ -0,0 +1,577 @@
+/*
+ * Kernel and user threads.
+ * Every thread has its own kernel stack. A user thread enters the kernel at the top of that stack
+ * (syscall_entry and the TSS rsp0 both point there), so switching threads is just switching kernel
+ * stacks with context_switch and updating the per-thread cpu state (rsp0, FS base, cr3).
+ * Every cpu has an idle thread, on the boot cpu that is the boot context, and its own run queue.
+ * A cpu that runs out of threads steals one from the longest queue, and the timer tick pulls
+ * work over from a cpu that has much more queued.
+ *
+ * Everything here is under the kernel lock, run queues included, so scheduling decisions are
+ * still made one cpu at a time. The lock is held across context_switch() and the thread switched
+ * to carries on in kernel code under it, so a lock per queue would not let two cpus schedule at
+ * once without taking the rest of the kernel off the big lock first. What the queues buy is that
+ * threads stay on their cpu (and its caches) unless another one runs dry. What runs on all cpus
+ * at once is user code and kernel work items (work.c), which need neither the lock nor a queue.
+ */
+
+#include <types.h>
+#include <thread.h>
+#include <process.h>
+#include <vm.h>
+#include <palloc.h>
+#include <msr.h>
+#include <errno.h>
+#include <interrupts.h>
+#include <kernel_syscall.h>
+#include <printf.h>
+#include <rdtsc.h>
+#include <timer.h>
+#include <fpu.h>
+#include <smp.h>
+#include <work.h>
+#include <idle.h>
+
+sched_stats_t sched_stats;
+
+void *user_thread_start_ptr; /* Points to user_thread_start(), initialized in kernel_entry.S */
+void *kthread_start_ptr;	 /* Points to kthread_start(), initialized in kernel_entry.S */
+
+static thread_t thread_pool[MAX_THREADS];
+static thread_t *thread_free_list;
+static thread_t *zombie_list; // Exited threads whose kernel stack can be freed once we are off it.
+static uint32_t next_tid;
+static uint64_t switch_start; // rdtsc right before the last context_switch.
+
+static void runqueue_push(cpu_t *cpu, thread_t *thread)
+{
+	thread->next = NULL;
+	if (cpu->rq_tail != NULL)
+		cpu->rq_tail->next = thread;
+	else
+		cpu->rq_head = thread;
+	cpu->rq_tail = thread;
+	cpu->rq_len++;
+}
+
+static thread_t *runqueue_pop(cpu_t *cpu)
+{
+	thread_t *thread = cpu->rq_head;
+	if (thread != NULL)
+	{
+		cpu->rq_head = thread->next;
+		if (cpu->rq_head == NULL)
+			cpu->rq_tail = NULL;
+		cpu->rq_len--;
+		thread->next = NULL;
+	}
+	return thread;
+}
+
+/*
+ * Takes the thread that has waited longest on the cpu with the longest queue, if that queue is
+ * at least min long. The thread's FPU state was saved when it was switched out.
+ */
+static thread_t *sched_steal(cpu_t *cpu, uint32_t min)
+{
+	cpu_t *busiest = NULL;
+	for (uint32_t i = 0; i < num_cpus; i++)
+	{
+		if (&cpus[i] != cpu && cpus[i].rq_len >= min && (busiest == NULL || cpus[i].rq_len > busiest->rq_len))
+			busiest = &cpus[i];
+	}
+	if (busiest == NULL)
+		return NULL;
+	cpu->steals++;
+	return runqueue_pop(busiest);
+}
+
+/*
+ * The kernel is tickless: the timer is only armed for the end of the running thread's time slice,
+ * and only if another thread is waiting for the cpu.
+ */
+static void sched_arm_timer(void)
+{
+	if (this_cpu()->rq_head != NULL && current_thread != this_cpu()->idle_thread)
+		timer_set_sched_deadline(current_thread->slice_end);
+	else
+		timer_set_sched_deadline(0); // Nothing to preempt for, the cpu can sleep undisturbed.
+}
+
+static thread_t *thread_alloc(void)
+{
+	thread_t *thread = thread_free_list;
+	if (thread == NULL)
+		return NULL;
+	thread_free_list = thread->next;
+	__builtin_memset(thread, 0x0, sizeof(thread_t));
+	thread->tid = next_tid++;
+	thread->cpu = this_cpu()->id;
+	return thread;
+}
+
+static void thread_release(thread_t *thread)
+{
+	if (thread->kstack_base != 0x0ULL)
+		page_free_contig(thread->kstack_base, KSTACK_PAGES);
+	fpu_thread_release(thread);
+	thread->state = THREAD_UNUSED;
+	thread->next = thread_free_list;
+	thread_free_list = thread;
+}
+
+static int thread_alloc_kstack(thread_t *thread)
+{
+	thread->kstack_base = page_alloc_contig(KSTACK_PAGES, 1);
+	if (thread->kstack_base == 0x0ULL)
+		return -ENOMEM;
+	thread->kstack_top = thread->kstack_base + KSTACK_PAGES * PAGE_SIZE;
+	return 0;
+}
+
+/*
+ * Prepares the stack so that the first context_switch to the thread pops zeroed callee-saved
+ * registers (r12/r13 are given) and returns to ret_addr.
+ */
+static void thread_init_stack(thread_t *thread, uint64_t *sp, void *ret_addr, uint64_t r12, uint64_t r13)
+{
+	*--sp = (uint64_t)ret_addr;
+	*--sp = 0; // rbp
+	*--sp = 0; // rbx
+	*--sp = r12;
+	*--sp = r13;
+	*--sp = 0; // r14
+	*--sp = 0; // r15
+	thread->rsp = (uint64_t)sp;
+}
+
+void thread_init(uintptr_t boot_stack_top)
+{
+	thread_free_list = NULL;
+	for (int i = MAX_THREADS - 1; i >= 0; i--)
+	{
+		thread_pool[i].state = THREAD_UNUSED;
+		thread_pool[i].next = thread_free_list;
+		thread_free_list = &thread_pool[i];
+	}
+	zombie_list = NULL;
+	next_tid = 0;
+
+	thread_t *idle = thread_alloc(); // tid 0, runs on the boot stack.
+	idle->kstack_top = boot_stack_top;
+	idle->state = THREAD_RUNNING;
+	idle->run_start = rdtsc();
+	this_cpu()->idle_thread = idle;
+	current_thread = idle;
+
+	__builtin_memset(&sched_stats, 0x0, sizeof(sched_stats_t));
+	sched_stats.switch_cycles_min = ~0x0ULL;
+}
+
+/*
+ * Idle thread of another cpu, which starts out on its stack (see ap_main()).
+ */
+thread_t *thread_create_idle(void)
+{
+	thread_t *thread = thread_alloc();
+	if (thread == NULL)
+		return NULL;
+	if (thread_alloc_kstack(thread) != 0)
+	{
+		thread_release(thread);
+		return NULL;
+	}
+	thread->state = THREAD_RUNNING;
+	return thread;
+}
+
+/*
+ * Queues a new or woken thread and makes sure some cpu notices it. A woken thread goes back to
+ * the cpu it ran on if that one is idle, otherwise it is queued here and an idle cpu may steal it.
+ */
+static void thread_make_ready(thread_t *thread)
+{
+	cpu_t *self = this_cpu();
+	cpu_t *cpu = &cpus[thread->cpu];
+	if (cpu->online && cpu->idle && cpu != self)
+	{
+		thread->state = THREAD_READY;
+		runqueue_push(cpu, thread);
+		cpu->idle = 0;
+		smp_resched(cpu);
+		return;
+	}
+	thread->state = THREAD_READY;
+	runqueue_push(self, thread);
+	self->idle = 0; // Woken from an interrupt in the idle loop, do not halt.
+	sched_arm_timer();
+	smp_wake_idle();
+}
+
+static thread_t *thread_alloc_user(process_t *process, trap_frame_t *frame, uintptr_t tcb)
+{
+	thread_t *thread = thread_alloc();
+	if (thread == NULL)
+		return NULL;
+	if (thread_alloc_kstack(thread) != 0)
+	{
+		thread_release(thread);
+		return NULL;
+	}
+	thread->process = process;
+	thread->mm = &process->mm;
+	thread->fs_base = tcb;
+	process->nthreads++;
+
+	*thread_frame(thread) = *frame;
+	thread_init_stack(thread, (uint64_t *)thread_frame(thread), user_thread_start_ptr, 0, 0);
+
+	uint64_t flags = irq_save();
+	thread_make_ready(thread);
+	irq_restore(flags);
+	return thread;
+}
+
+/*
+ * Creates a user thread in process that starts at entry with %rdi = arg.
+ */
+thread_t *thread_create_user(process_t *process, uintptr_t entry, uintptr_t user_sp, uint64_t arg, uintptr_t tcb)
+{
+	trap_frame_t frame;
+	__builtin_memset(&frame, 0x0, sizeof(trap_frame_t));
+	frame.rip = entry;
+	frame.cs = GDT_USER_CODE | 0x3;
+	frame.rflags = 0x202; // IF
+	frame.rsp = user_sp;
+	frame.ss = GDT_USER_DATA | 0x3;
+	frame.rdi = arg;
+	return thread_alloc_user(process, &frame, tcb);
+}
+
+/*
+ * Creates the child side of fork(): it resumes from the parent's system call with a return value of 0.
+ */
+thread_t *thread_fork(process_t *process, trap_frame_t *frame)
+{
+	thread_t *parent = current_thread;
+	thread_t *thread = thread_alloc_user(process, frame, parent->fs_base);
+	if (thread == NULL)
+		return NULL;
+	thread_frame(thread)->rax = 0;
+	thread->tls_area = parent->tls_area; // Same addresses in the copied address space.
+	thread->tls_size = parent->tls_size;
+	fpu_fork(thread, parent);
+	return thread;
+}
+
+thread_t *thread_create_kernel(void (*fn)(void *), void *arg)
+{
+	thread_t *thread = thread_alloc();
+	if (thread == NULL)
+		return NULL;
+	if (thread_alloc_kstack(thread) != 0)
+	{
+		thread_release(thread);
+		return NULL;
+	}
+	thread_init_stack(thread, (uint64_t *)thread->kstack_top, kthread_start_ptr, (uint64_t)fn, (uint64_t)arg);
+
+	uint64_t flags = irq_save();
+	thread_make_ready(thread);
+	irq_restore(flags);
+	return thread;
+}
+
+static void thread_reap(void)
+{
+	while (zombie_list != NULL)
+	{
+		thread_t *thread = zombie_list;
+		zombie_list = thread->next;
+		process_t *process = thread->process;
+		thread_release(thread);
+		if (process != NULL)
+			process_thread_exited(process); // May free the address space, we are no longer on it.
+	}
+}
+
+static void switch_to(thread_t *next)
+{
+	cpu_t *cpu = this_cpu();
+	thread_t *prev = cpu->thread;
+	if (next == prev)
+		return;
+
+	uint64_t now = rdtsc();
+	prev->cpu_cycles += now - prev->run_start;
+	next->run_start = now;
+	next->slice_end = clock_ns() + SCHED_SLICE_NS;
+	sched_stats.switches++;
+	if (next->cpu != cpu->id)
+	{
+		cpu->migrations++;
+		next->cpu = cpu->id;
+	}
+
+	cpu->thread = next;
+	cpu->idle = 0;
+	next->state = THREAD_RUNNING;
+	if (next->mm != NULL) // Kernel threads run on whatever address space is loaded.
+	{
+		if (next->mm != cpu->mm)
+		{
+			cpu->mm = next->mm;
+			write_cr3((uintptr_t)next->mm->pml4);
+		}
+		cpu->kernel_stack = next->kstack_top;
+		cpu->tss->rsp[0] = next->kstack_top;
+		wrmsr(MSR_FSBASE, next->fs_base);
+	}
+	sched_arm_timer();
+	fpu_switch(prev, next);
+	switch_start = rdtsc();
+	context_switch(&prev->rsp, next->rsp);
+
+	// Resumed, possibly on another cpu. The switch that brought us back started in another thread.
+	// Switches into new threads do not come through here and are not sampled.
+	uint64_t cycles = rdtsc() - switch_start;
+	sched_stats.switch_cycles += cycles;
+	sched_stats.switch_samples++;
+	if (cycles < sched_stats.switch_cycles_min)
+		sched_stats.switch_cycles_min = cycles;
+	if (cycles > sched_stats.switch_cycles_max)
+		sched_stats.switch_cycles_max = cycles;
+
+	thread_reap(); // Back on our own stack, the previous thread's one can go.
+}
+
+/*
+ * Picks the next thread to run. The current thread goes to the back of the run queue
+ * if it is still runnable. A cpu about to go idle steals from the others first.
+ * Called with interrupts disabled.
+ */
+void schedule(void)
+{
+	cpu_t *cpu = this_cpu();
+	int runnable = current_thread->state == THREAD_RUNNING && current_thread != cpu->idle_thread;
+	thread_t *next = runqueue_pop(cpu);
+	if (next == NULL && !runnable)
+		next = sched_steal(cpu, 1);
+	if (next == NULL)
+	{
+		if (current_thread->state == THREAD_RUNNING)
+			return;
+		next = cpu->idle_thread;
+	}
+	if (runnable)
+	{
+		current_thread->state = THREAD_READY;
+		runqueue_push(cpu, current_thread);
+	}
+	switch_to(next);
+}
+
+void thread_yield(void)
+{
+	uint64_t flags = irq_save();
+	schedule();
+	irq_restore(flags);
+}
+
+void thread_block(void)
+{
+	uint64_t flags = irq_save();
+	current_thread->state = THREAD_BLOCKED;
+	schedule();
+	irq_restore(flags);
+}
+
+void thread_wakeup(thread_t *thread)
+{
+	uint64_t flags = irq_save();
+	if (thread->state == THREAD_BLOCKED)
+		thread_make_ready(thread);
+	irq_restore(flags);
+}
+
+/*
+ * Wakes every blocked thread of process, for exit(). Each one sees process->exiting where it
+ * blocked and leaves through process_check_exit() on its way out of the kernel.
+ */
+void thread_wakeup_process(struct process *process)
+{
+	for (int i = 0; i < MAX_THREADS; i++)
+	{
+		if (thread_pool[i].process == process && thread_pool[i].state == THREAD_BLOCKED)
+			thread_wakeup(&thread_pool[i]);
+	}
+}
+
+/*
+ * Load balancing on the timer tick: pulls a thread over from a cpu with at least two more
+ * queued than this one, and wakes an idle cpu if this one still has threads waiting.
+ */
+static void sched_balance(cpu_t *cpu)
+{
+	thread_t *thread = sched_steal(cpu, cpu->rq_len + 2);
+	if (thread != NULL)
+		runqueue_push(cpu, thread);
+	if (cpu->rq_len > 0)
+		smp_wake_idle();
+}
+
+/*
+ * Called from the timer interrupt: preempts the running thread once its time slice is used up
+ * and something else is runnable.
+ */
+void sched_timer(void)
+{
+	sched_stats.timer_interrupts++;
+	sched_balance(this_cpu());
+	if (this_cpu()->rq_head != NULL && (current_thread == this_cpu()->idle_thread || clock_ns() >= current_thread->slice_end))
+	{
+		sched_stats.preemptions++;
+		schedule(); // Arms the timer for the next thread.
+		return;
+	}
+	sched_arm_timer();
+}
+
+void sched_stats_print(void)
+{
+	uint64_t flags = irq_save();
+	uint64_t now = rdtsc();
+	current_thread->cpu_cycles += now - current_thread->run_start;
+	current_thread->run_start = now;
+
+	printf("Scheduler: %ld timer interrupts, %ld preemptions, %ld switches\n",
+		   sched_stats.timer_interrupts, sched_stats.preemptions, sched_stats.switches);
+	if (sched_stats.switch_samples != 0)
+		printf("Context switch cycles: avg %ld, min %ld, max %ld\n",
+			   sched_stats.switch_cycles / sched_stats.switch_samples,
+			   sched_stats.switch_cycles_min, sched_stats.switch_cycles_max);
+	for (int i = 0; i < MAX_THREADS; i++)
+	{
+		thread_t *thread = &thread_pool[i];
+		if (thread->state == THREAD_UNUSED || thread->state == THREAD_DEAD)
+			continue;
+		int idle_cpu = -1;
+		for (uint32_t c = 0; c < num_cpus; c++)
+		{
+			if (cpus[c].idle_thread == thread)
+				idle_cpu = c;
+		}
+		if (idle_cpu >= 0)
+			printf("Thread %d: %ld cycles (idle, cpu %d)\n", thread->tid, thread->cpu_cycles, idle_cpu);
+		else
+			printf("Thread %d: %ld cycles (cpu %d)\n", thread->tid, thread->cpu_cycles, thread->cpu);
+	}
+	for (uint32_t c = 0; c < num_cpus; c++)
+	{
+		cpu_t *cpu = &cpus[c];
+		printf("CPU %d: %d queued, %ld steals, %ld migrations, %ld work items run (%ld stolen)\n",
+			   c, cpu->rq_len, cpu->steals, cpu->migrations, cpu->work_done, cpu->work_stolen);
+	}
+	irq_restore(flags);
+}
+
+void thread_exit(void)
+{
+	__asm__ __volatile__("cli");
+	thread_t *thread = current_thread;
+
+	if (thread->clear_tid != 0x0ULL)
+	{
+		uint32_t zero = 0;
+		vm_copy_to_user(thread->mm, thread->clear_tid, &zero, sizeof(zero));
+		futex_wake(thread->mm, thread->clear_tid, 1);
+	}
+	if (thread->tls_area != 0x0ULL)
+		vm_munmap(thread->mm, thread->tls_area, thread->tls_size);
+
+	thread->state = THREAD_DEAD;
+	thread->next = zombie_list;
+	zombie_list = thread;
+	schedule();
+
+	while (1) // Not reached.
+	{
+	};
+}
+
+/*
+ * Switches from the boot context of a cpu to the first runnable thread. The boot context carries on
+ * as the idle thread: it runs kernel work items, its own or stolen, and halts once there are none
+ * until an interrupt or another cpu makes something runnable.
+ * Called with the kernel lock held, it is dropped while idle.
+ */
+void sched_start(void)
+{
+	__asm__ __volatile__("cli");
+	cpu_t *cpu = this_cpu();
+	while (1)
+	{
+		schedule();
+		if (cpu->rq_head != NULL)
+			continue;
+		cpu->idle = 1; // smp_wake_idle() clears it and sends an IPI, which also ends cpu_idle().
+		kernel_unlock();
+		__asm__ __volatile__("sti" ::: "memory");
+		while (work_run())
+			;
+		__asm__ __volatile__("cli" ::: "memory");
+		cpu_idle(&cpu->idle); // HLT or MWAIT, see idle.c.
+		kernel_lock();
+		cpu->idle = 0;
+	}
+}
+
+/*
+ * Fills the TLS area of a user thread, the VMA around tcb must exist already.
+ * The PT_TLS block sits right below the control block (x86-64 variant II layout), its .tdata part
+ * is copied from the image and .tbss is left to the zero filled pages of the VMA.
+ */
+uintptr_t tls_setup(mm_t *mm, uintptr_t tcb)
+{
+	uint64_t align = mm->tls_align;
+	uint64_t block = (mm->tls_memsz + align - 1) & ~(align - 1);
+	if (vm_copy_to_user(mm, tcb - block, (void *)mm->tls_image, mm->tls_filesz) != 0)
+		return 0x0ULL;
+	if (vm_copy_to_user(mm, tcb, &tcb, sizeof(uintptr_t)) != 0) // tls_block_t.myself
+		return 0x0ULL;
+	return tcb;
+}
+
+/*
+ * thread_create(entry, stack, arg, clear_tid): the new thread gets its own TLS area and starts at
+ * entry(arg) on the given stack. clear_tid (optional) is zeroed and woken when the thread exits.
+ */
+long sys_thread_create(uintptr_t entry, uintptr_t stack, uint64_t arg, uintptr_t clear_tid)
+{
+	process_t *process = current_thread->process;
+	mm_t *mm = &process->mm;
+	uint64_t align = mm->tls_align;
+	uint64_t tls_size = PAGE_ALIGN_UP((mm->tls_memsz + align - 1) & ~(align - 1)) + PAGE_SIZE;
+
+	uintptr_t tls_area = vm_mmap(mm, 0x0ULL, tls_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS);
+	if ((intptr_t)tls_area < 0 && (intptr_t)tls_area > -4096)
+		return (long)tls_area;
+	uintptr_t tcb = tls_area + tls_size - PAGE_SIZE;
+	if (tls_setup(mm, tcb) == 0x0ULL)
+	{
+		vm_munmap(mm, tls_area, tls_size);
+		return -EFAULT;
+	}
+
+	// Enter as if called: the stack is 16 byte aligned before the (absent) return address.
+	thread_t *thread = thread_create_user(process, entry, (stack & ~0xFULL) - 8, arg, tcb);
+	if (thread == NULL)
+	{
+		vm_munmap(mm, tls_area, tls_size);
+		return -ENOMEM;
+	}
+	thread->tls_area = tls_area;
+	thread->tls_size = tls_size;
+	thread->clear_tid = clear_tid;
+	return thread->tid;
+}
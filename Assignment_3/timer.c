@@ -0,0 +1,591 @@
+/*
+ * Clocks and the LAPIC timer.
+ * The LAPIC timer runs off the bus clock, which differs between machines and hypervisors, so its rate is
+ * measured at boot against a reference clock: pvclock under Xen, otherwise the TSC, itself calibrated
+ * against the PIT (whose 1.193182 MHz input is fixed).
+ * The kernel is tickless: the timer is armed one-shot for the earliest pending deadline, with
+ * TSC-deadline mode where the cpu supports it and a LAPIC countdown otherwise.
+ *
+ * Kernel timers live in a hierarchical timing wheel: TW_LEVELS levels of TW_SIZE slots, each level
+ * 64 times coarser than the one below, with a bitmap of non-empty slots per level. Adding and
+ * cancelling a timer is a list insert/unlink. A timer is moved (cascaded) to a finer level when the
+ * clock reaches its slot, and runs from level 0 once its exact nanosecond deadline has passed.
+ * Every cpu has its own wheel and timer deadline, a timer runs on the cpu it was added on.
+ *
+ * Under Xen the deadline is set with VCPUOP_set_singleshot_timer instead, in Xen system time
+ * (which clock_ns() is there), and the timer interrupt comes as VIRQ_TIMER on an event channel
+ * bound to the vCPU rather than through the emulated LAPIC.
+ */
+
+#include <types.h>
+#include <timer.h>
+#include <apic.h>
+#include <io.h>
+#include <rdtsc.h>
+#include <printf.h>
+#include <cpuid.h>
+#include <msr.h>
+#include <thread.h>
+#include <process.h>
+#include <interrupts.h>
+#include <palloc.h>
+#include <cpu.h>
+#include <evtchn.h>
+#include <vcpu.h>
+
+#define PIT_HZ 1193182ULL
+#define PIT_CH2 0x42
+#define PIT_CMD 0x43
+#define PIT_GATE 0x61 // Bit 0: channel 2 gate, bit 1: speaker, bit 5: channel 2 output.
+
+#define CALIBRATE_NS 10000000ULL // 10ms
+
+uint64_t tsc_hz;
+uint64_t lapic_timer_hz;
+uint64_t timer_irq_latency;
+
+static int clock_pvclock; // Read pvclock rather than scaling the TSC.
+static uint32_t tsc_ns_mul; // ns = ((tsc << tsc_ns_shift) * tsc_ns_mul) >> 32, as in pvclock.
+static int8_t tsc_ns_shift;
+
+static int timer_tsc_deadline; // IA32_TSC_DEADLINE is available.
+static int timer_xen_default; // Every cpu uses the Xen timer, see timer_set_xen().
+
+#define TW_TICK_SHIFT 10 // Level 0 slots are 1.024us wide.
+#define TW_BITS 6
+#define TW_SIZE (1 << TW_BITS)
+#define TW_LEVELS 6 // 2^36 ticks, about 19 hours per turn of the top level.
+#define TW_TURN_MASK ((1ULL << (TW_BITS * TW_LEVELS)) - 1)
+
+struct timer_wheel
+{
+	uint64_t deadline;		 // Armed one-shot deadline, 0 if none.
+	uint64_t deadline_tsc;	 // The same in rdtsc time.
+	uint64_t sched_deadline; // End of the running time slice, 0 if nothing is waiting to run.
+	uint32_t xen_port;		 // VIRQ_TIMER of this vCPU, 0 until bound.
+	uint8_t xen;			 // Armed through Xen rather than the LAPIC.
+	volatile uint8_t xen_fired;
+	uint64_t tick; // Every slot before this tick has been run or cascaded.
+	uint64_t pending[TW_LEVELS]; // Bit n: slot n of the level is not empty.
+	timer_t *slots[TW_LEVELS][TW_SIZE];
+};
+typedef struct timer_wheel timer_wheel_t;
+
+static timer_wheel_t boot_wheel;
+
+static inline timer_wheel_t *this_wheel(void)
+{
+	return this_cpu()->wheel;
+}
+
+/* kernel.c */
+uint64_t pvclock_monotonic_read();
+extern volatile pvclock_vcpu_time_info_t *pvclock_ti;
+
+/*
+ * Times a 10ms one-shot countdown of PIT channel 2 with the TSC.
+ */
+static uint64_t pit_calibrate_tsc(void)
+{
+	uint16_t latch = (uint16_t)(PIT_HZ * CALIBRATE_NS / NSEC_PER_SEC);
+
+	outb(PIT_GATE, (inb(PIT_GATE) & ~0x02) | 0x01); // Gate on, speaker off.
+	outb(PIT_CMD, 0xB0);							// Channel 2, lobyte/hibyte, mode 0.
+	outb(PIT_CH2, latch & 0xFF);
+	outb(PIT_CH2, latch >> 8);
+
+	uint64_t start = rdtsc();
+	while (!(inb(PIT_GATE) & 0x20)) // Output goes high at terminal count.
+	{
+	};
+	return (rdtsc() - start) * (NSEC_PER_SEC / CALIBRATE_NS);
+}
+
+/*
+ * Picks mul/shift so that ((cycles << shift) * mul) >> 32 converts cycles at hz to nanoseconds.
+ */
+static void clock_scale(uint64_t hz, uint32_t *mul, int8_t *shift)
+{
+	int8_t s = 0;
+	while (hz <= NSEC_PER_SEC) // mul has to fit in 32 bits.
+	{
+		hz <<= 1;
+		s++;
+	}
+	*mul = (uint32_t)((NSEC_PER_SEC << 32) / hz);
+	*shift = s;
+}
+
+uint64_t clock_ns(void)
+{
+	if (clock_pvclock)
+		return pvclock_monotonic_read();
+	uint64_t delta = rdtsc();
+	if (tsc_ns_shift < 0)
+		delta >>= -tsc_ns_shift;
+	else
+		delta <<= tsc_ns_shift;
+	return mul64_32(delta, tsc_ns_mul);
+}
+
+/*
+ * Converts ns to cycles of a clock running at hz without overflowing 64 bits.
+ */
+static uint64_t ns_to_cycles(uint64_t ns, uint64_t hz)
+{
+	return (ns / NSEC_PER_SEC) * hz + (ns % NSEC_PER_SEC) * hz / NSEC_PER_SEC;
+}
+
+/*
+ * Measures the TSC and LAPIC timer rates, call with the LAPIC enabled.
+ */
+void timer_init(int use_pvclock)
+{
+	if (use_pvclock)
+	{
+		// pvclock scales the TSC by tsc_to_system_mul/tsc_shift, which gives its rate directly.
+		uint64_t hz = (NSEC_PER_SEC << 32) / pvclock_ti->tsc_to_system_mul;
+		tsc_hz = pvclock_ti->tsc_shift < 0 ? hz << -pvclock_ti->tsc_shift : hz >> pvclock_ti->tsc_shift;
+		clock_pvclock = 1;
+	}
+	else
+	{
+		tsc_hz = pit_calibrate_tsc();
+		clock_pvclock = 0;
+	}
+	clock_scale(tsc_hz, &tsc_ns_mul, &tsc_ns_shift);
+
+	// Let the (masked) timer count down from the top for 10ms of the reference clock.
+	uint64_t start = clock_ns();
+	x86_lapic_timer_start(0xFFFFFFFFU, X86_LAPIC_TIMER_MASKED);
+	uint64_t now;
+	do
+	{
+		now = clock_ns();
+	} while (now - start < CALIBRATE_NS);
+	uint32_t counted = 0xFFFFFFFFU - x86_lapic_timer_count();
+	lapic_timer_hz = (uint64_t)counted * NSEC_PER_SEC / (now - start);
+
+	printf("TSC: %ld kHz, LAPIC timer: %ld kHz\n", tsc_hz / 1000, lapic_timer_hz / 1000);
+
+	uint32_t eax, ebx, ecx, edx;
+	x86_cpuid(0x1, &eax, &ebx, &ecx, &edx);
+	timer_tsc_deadline = (ecx >> 24) & 0x1;
+	this_cpu()->wheel = &boot_wheel;
+	timer_cpu_init();
+	printf("Tickless timer, %s\n", timer_tsc_deadline ? "TSC-deadline mode" : "LAPIC one-shot mode");
+}
+
+/*
+ * A wheel for another cpu, which sets it up with timer_cpu_init().
+ */
+struct timer_wheel *timer_wheel_alloc(void)
+{
+	return (timer_wheel_t *)page_alloc(); // sizeof(timer_wheel_t) < PAGE_SIZE
+}
+
+/*
+ * Starts this cpu's timer in the mode and at the rate timer_init() found on the boot cpu.
+ */
+void timer_cpu_init(void)
+{
+	timer_wheel_t *wheel = this_wheel();
+	__builtin_memset(wheel, 0x0, sizeof(timer_wheel_t));
+	wheel->tick = clock_ns() >> TW_TICK_SHIFT;
+	if (timer_tsc_deadline)
+		x86_lapic_timer_start(0, X86_LAPIC_TIMER_TSC_DEADLINE);
+	else
+		x86_lapic_timer_start(0, 0); // One-shot, a zero count stops it.
+	if (timer_xen_default && timer_set_xen(1) != 0)
+		printf("cpu %d: no Xen timer, using the LAPIC\n", this_cpu()->id);
+}
+
+/*
+ * Arms a single timer interrupt at deadline (clock_ns() time), 0 disarms it.
+ * A deadline that has already passed fires right away.
+ */
+static void timer_program(timer_wheel_t *wheel, uint64_t deadline)
+{
+	if (deadline == wheel->deadline)
+		return;
+	wheel->deadline = deadline;
+
+	if (wheel->xen)
+	{
+		uint32_t vcpu = this_cpu()->xen_vcpu_id;
+		if (deadline == 0)
+		{
+			HYPERVISOR_vcpu_op(VCPUOP_stop_singleshot_timer, vcpu, NULL);
+			return;
+		}
+		vcpu_set_singleshot_timer_t single;
+		single.timeout_abs_ns = deadline;
+		single.flags = 0; // A deadline that has passed fires right away.
+		uint64_t now = clock_ns();
+		wheel->deadline_tsc = rdtsc() + ns_to_cycles(deadline > now ? deadline - now : 0, tsc_hz);
+		HYPERVISOR_vcpu_op(VCPUOP_set_singleshot_timer, vcpu, &single);
+		return;
+	}
+
+	if (deadline == 0)
+	{
+		if (timer_tsc_deadline)
+			wrmsr(X86_MSR_TSC_DEADLINE, 0);
+		else
+			x86_lapic_timer_start(0, 0);
+		return;
+	}
+
+	uint64_t now = clock_ns();
+	uint64_t delta = deadline > now ? deadline - now : 0;
+	wheel->deadline_tsc = rdtsc() + ns_to_cycles(delta, tsc_hz);
+	if (timer_tsc_deadline)
+	{
+		wrmsr(X86_MSR_TSC_DEADLINE, wheel->deadline_tsc);
+		return;
+	}
+	uint64_t count = ns_to_cycles(delta, lapic_timer_hz);
+	if (count == 0)
+		count = 1;
+	if (count > 0xFFFFFFFFULL)
+		count = 0xFFFFFFFFULL; // About a minute at least, it is re-armed on expiry.
+	x86_lapic_timer_start((uint32_t)count, 0);
+}
+
+static inline uint64_t tw_level_shift(int level)
+{
+	return TW_BITS * level;
+}
+
+static void tw_enqueue(timer_wheel_t *wheel, timer_t *timer)
+{
+	uint64_t expires = timer->expires >> TW_TICK_SHIFT;
+	if (expires < wheel->tick)
+		expires = wheel->tick; // Already due, runs with the current tick.
+	if ((expires & ~TW_TURN_MASK) != (wheel->tick & ~TW_TURN_MASK))
+		expires = wheel->tick | TW_TURN_MASK; // Out of range, parked at the end of the turn and re-queued from there.
+
+	// The lowest level on which the deadline is still within the current turn of the level above.
+	int level = 0;
+	while (level < TW_LEVELS - 1 &&
+		   (expires >> tw_level_shift(level + 1)) != (wheel->tick >> tw_level_shift(level + 1)))
+		level++;
+	unsigned int slot = (expires >> tw_level_shift(level)) & (TW_SIZE - 1);
+
+	timer->wheel = wheel;
+	timer->level = level;
+	timer->slot = slot;
+	timer->next = wheel->slots[level][slot];
+	if (timer->next != NULL)
+		timer->next->pprev = &timer->next;
+	timer->pprev = &wheel->slots[level][slot];
+	wheel->slots[level][slot] = timer;
+	wheel->pending[level] |= 1ULL << slot;
+}
+
+static void tw_dequeue(timer_wheel_t *wheel, timer_t *timer)
+{
+	*timer->pprev = timer->next;
+	if (timer->next != NULL)
+		timer->next->pprev = timer->pprev;
+	if (wheel->slots[timer->level][timer->slot] == NULL)
+		wheel->pending[timer->level] &= ~(1ULL << timer->slot);
+	timer->pprev = NULL;
+}
+
+/*
+ * First tick at which something is due, a level 0 slot to run or a higher level slot to cascade.
+ * Slots of a level at or before the current position are empty, so the first pending one after it
+ * is the next event of that level, and a lower level always comes first.
+ */
+static uint64_t tw_next_tick(timer_wheel_t *wheel)
+{
+	for (int level = 0; level < TW_LEVELS; level++)
+	{
+		uint64_t shift = tw_level_shift(level);
+		unsigned int pos = (wheel->tick >> shift) & (TW_SIZE - 1);
+		uint64_t pending = wheel->pending[level] & (~0x0ULL << pos);
+		if (level != 0)
+			pending &= ~(1ULL << pos);
+		if (pending == 0)
+			continue;
+		uint64_t turn = wheel->tick & ~((1ULL << (shift + TW_BITS)) - 1);
+		return turn + ((uint64_t)__builtin_ctzll(pending) << shift);
+	}
+	return ~0x0ULL;
+}
+
+/*
+ * Earliest deadline in the wheel in nanoseconds, 0 if it is empty. Cascades are woken up for
+ * at the start of their slot.
+ */
+static uint64_t tw_next_deadline(timer_wheel_t *wheel)
+{
+	uint64_t tick = tw_next_tick(wheel);
+	if (tick == ~0x0ULL)
+		return 0;
+	uint64_t deadline = tick << TW_TICK_SHIFT;
+	if ((tick & ~(TW_SIZE - 1ULL)) == (wheel->tick & ~(TW_SIZE - 1ULL)) && wheel->slots[0][tick & (TW_SIZE - 1)] != NULL)
+	{
+		deadline = ~0x0ULL;
+		for (timer_t *timer = wheel->slots[0][tick & (TW_SIZE - 1)]; timer != NULL; timer = timer->next)
+		{
+			if (timer->expires < deadline)
+				deadline = timer->expires;
+		}
+	}
+	return deadline != 0 ? deadline : 1;
+}
+
+/*
+ * Queues the timers of a slot again relative to the current tick.
+ */
+static void tw_requeue(timer_wheel_t *wheel, int level, unsigned int slot)
+{
+	timer_t *timer = wheel->slots[level][slot];
+	wheel->slots[level][slot] = NULL;
+	wheel->pending[level] &= ~(1ULL << slot);
+	while (timer != NULL)
+	{
+		timer_t *next = timer->next;
+		tw_enqueue(wheel, timer);
+		timer = next;
+	}
+}
+
+/*
+ * Runs every timer whose deadline is at or before now.
+ */
+static void tw_run(timer_wheel_t *wheel, uint64_t now)
+{
+	uint64_t now_tick = now >> TW_TICK_SHIFT;
+	while (1)
+	{
+		uint64_t tick = tw_next_tick(wheel);
+		if (tick > now_tick)
+		{
+			if (now_tick > wheel->tick)
+				wheel->tick = now_tick;
+			return;
+		}
+		wheel->tick = tick;
+
+		// Reaching the start of a slot on a higher level moves its timers down.
+		for (int level = TW_LEVELS - 1; level > 0; level--)
+		{
+			if ((tick & ((1ULL << tw_level_shift(level)) - 1)) == 0)
+				tw_requeue(wheel, level, (tick >> tw_level_shift(level)) & (TW_SIZE - 1));
+		}
+
+		// The slot is taken off the wheel first, callbacks may add and cancel timers.
+		unsigned int slot = tick & (TW_SIZE - 1);
+		timer_t *list = wheel->slots[0][slot];
+		wheel->slots[0][slot] = NULL;
+		wheel->pending[0] &= ~(1ULL << slot);
+		if (list != NULL)
+			list->pprev = &list;
+		while (list != NULL)
+		{
+			timer_t *timer = list;
+			list = timer->next;
+			if (list != NULL)
+				list->pprev = &list;
+			timer->pprev = NULL;
+			if (timer->expires > now)
+				tw_enqueue(wheel, timer); // Later within this tick, or parked.
+			else
+				timer->fn(timer->arg);
+		}
+
+		if (wheel->slots[0][slot] != NULL && tick == now_tick)
+			return; // Not due yet.
+		wheel->tick = tick + 1;
+		if (wheel->slots[0][slot] != NULL)
+			tw_requeue(wheel, 0, slot);
+	}
+}
+
+static void timer_reprogram(timer_wheel_t *wheel)
+{
+	uint64_t deadline = tw_next_deadline(wheel);
+	if (wheel->sched_deadline != 0 && (deadline == 0 || wheel->sched_deadline < deadline))
+		deadline = wheel->sched_deadline;
+	timer_program(wheel, deadline);
+}
+
+/*
+ * Arms this cpu's timer for the end of the running time slice, 0 if there is nothing to preempt for.
+ */
+void timer_set_sched_deadline(uint64_t deadline)
+{
+	timer_wheel_t *wheel = this_wheel();
+	wheel->sched_deadline = deadline;
+	timer_reprogram(wheel);
+}
+
+/*
+ * Calls fn(arg) from the timer interrupt once clock_ns() reaches expires. The timer must not
+ * be pending already.
+ */
+void timer_add(timer_t *timer, uint64_t expires, void (*fn)(void *), void *arg)
+{
+	uint64_t flags = irq_save();
+	timer_wheel_t *wheel = this_wheel();
+	timer->expires = expires;
+	timer->fn = fn;
+	timer->arg = arg;
+	tw_enqueue(wheel, timer);
+	if (wheel->deadline == 0 || expires < wheel->deadline)
+		timer_reprogram(wheel);
+	irq_restore(flags);
+}
+
+/*
+ * Returns 1 if the timer was still pending, 0 if it has run already. The timer may be on another
+ * cpu's wheel, whose hardware timer is left alone: at worst it fires for nothing.
+ */
+int timer_cancel(timer_t *timer)
+{
+	uint64_t flags = irq_save();
+	int pending = timer->pprev != NULL;
+	if (pending)
+		tw_dequeue(timer->wheel, timer);
+	irq_restore(flags);
+	return pending;
+}
+
+static void sleep_wakeup(void *arg)
+{
+	thread_wakeup((thread_t *)arg);
+}
+
+/*
+ * Blocks the calling thread for ns nanoseconds, or until its process exits.
+ */
+void sleep_ns(uint64_t ns)
+{
+	timer_t timer;
+	uint64_t flags = irq_save();
+	timer_add(&timer, clock_ns() + ns, sleep_wakeup, current_thread);
+	while (timer.pprev != NULL && !process_exiting())
+		thread_block();
+	timer_cancel(&timer);
+	irq_restore(flags);
+}
+
+/*
+ * Timer interrupt, whichever mode the timer is in.
+ */
+void timer_interrupt(void)
+{
+	timer_wheel_t *wheel = this_wheel();
+	timer_irq_latency = rdtsc() - wheel->deadline_tsc;
+	wheel->deadline = 0; // A one-shot timer is disarmed once it fires.
+	tw_run(wheel, clock_ns());
+	sched_timer(); // Re-arms the timer, possibly after switching threads.
+}
+
+static void timer_xen_event(evtchn_port_t port, void *arg)
+{
+	this_wheel()->xen_fired = 1;
+}
+
+/*
+ * Runs the timer interrupt if VIRQ_TIMER came in, called by the event channel interrupt once it
+ * has handled every event: timer_interrupt() may switch away and only come back much later.
+ */
+void timer_xen_interrupt(void)
+{
+	timer_wheel_t *wheel = this_wheel();
+	if (wheel == NULL || !wheel->xen_fired)
+		return;
+	wheel->xen_fired = 0;
+	timer_interrupt();
+}
+
+/*
+ * Moves this cpu's timer to Xen's singleshot timer, or back to the LAPIC with on 0, keeping the
+ * armed deadline. The first time binds VIRQ_TIMER of the vCPU and stops the periodic timer Xen
+ * may run. Returns 0, or the error binding it.
+ */
+int timer_set_xen(int on)
+{
+	uint64_t flags = irq_save();
+	timer_wheel_t *wheel = this_wheel();
+	if (on && wheel->xen_port == 0)
+	{
+		evtchn_port_t port;
+		uint32_t vcpu = this_cpu()->xen_vcpu_id;
+		int ret = evtchn_bind_virq(VIRQ_TIMER, vcpu, &port);
+		if (ret == 0)
+		{
+			ret = evtchn_bind(port, timer_xen_event, NULL);
+			if (ret != 0)
+				evtchn_close(port);
+		}
+		if (ret != 0)
+		{
+			irq_restore(flags);
+			return ret;
+		}
+		wheel->xen_port = port;
+		HYPERVISOR_vcpu_op(VCPUOP_stop_periodic_timer, vcpu, NULL);
+	}
+	uint64_t deadline = wheel->deadline;
+	timer_program(wheel, 0);
+	wheel->xen = on != 0;
+	timer_program(wheel, deadline);
+	irq_restore(flags);
+	return 0;
+}
+
+/*
+ * Makes the Xen timer the default on every cpu, the others switch in timer_cpu_init(). Called
+ * once event channels work.
+ */
+int timer_xen_init(void)
+{
+	int ret = timer_set_xen(1);
+	if (ret != 0)
+	{
+		printf("No Xen timer: %d\n", ret);
+		return ret;
+	}
+	timer_xen_default = 1;
+	printf("Tickless timer, Xen singleshot timer on event channel %d\n", this_wheel()->xen_port);
+	return 0;
+}
+
+int timer_is_xen(void)
+{
+	return this_wheel()->xen;
+}
+
+int timer_xen_available(void)
+{
+	return timer_xen_default;
+}
+
+/*
+ * Average cycles of timer_add() and timer_cancel() over deadlines spread across all levels.
+ */
+void timer_bench(void)
+{
+	static timer_t timers[256];
+	uint64_t now = clock_ns();
+	uint64_t flags = irq_save();
+
+	uint64_t start = rdtsc();
+	for (int i = 0; i < 256; i++)
+		timer_add(&timers[i], now + (1ULL << (i % 40)) + i, sleep_wakeup, NULL);
+	uint64_t add_cycles = rdtsc() - start;
+
+	start = rdtsc();
+	for (int i = 0; i < 256; i++)
+		timer_cancel(&timers[i]);
+	uint64_t cancel_cycles = rdtsc() - start;
+	timer_reprogram(this_wheel());
+	irq_restore(flags);
+
+	printf("Timer wheel: timer_add %ld cycles, timer_cancel %ld cycles\n", add_cycles / 256, cancel_cycles / 256);
+}
@@ -0,0 +1,205 @@
+/*
+ * TLB shootdown. Page table changes of an address space are collected in a per-cpu batch
+ * (the ranges to invalidate and the frames to free afterwards) and flushed together with
+ * tlb_finish(): this cpu and every other cpu with the address space in cr3 invalidate the
+ * ranges, with invlpg for up to TLB_FLUSH_THRESHOLD pages and a cr3 reload above that.
+ * Each of the others gets one IPI per batch, and the frames are only freed once all of
+ * them are done, so no cpu can reach a page after it was handed out again.
+ *
+ * Everything but the IPI handler runs under the kernel lock, so no cpu loads the address
+ * space while a batch is flushed; one that loads it later reloads cr3 and has nothing stale.
+ */
+
+#include <types.h>
+#include <tlb.h>
+#include <cpu.h>
+#include <smp.h>
+#include <apic.h>
+#include <irq.h>
+#include <vm.h>
+#include <palloc.h>
+#include <printf.h>
+
+static void tlb_apply(tlb_batch_t *batch, tlb_stats_t *stats)
+{
+	if (batch->flags & TLB_BATCH_RELEASE)
+	{
+		vm_load_kernel_pml4();
+		stats->full_flushes++;
+	}
+	else if (batch->flags & TLB_BATCH_FULL)
+	{
+		write_cr3(read_cr3());
+		stats->full_flushes++;
+	}
+	else
+	{
+		for (uint32_t i = 0; i < batch->num_ranges; i++)
+		{
+			for (uintptr_t va = batch->ranges[i].start; va < batch->ranges[i].end; va += PAGE_SIZE)
+				invlpg(va);
+		}
+		stats->invlpg += batch->pages;
+	}
+}
+
+/*
+ * Handles a batch another cpu sent here, if any. Also called by kernel_lock() while it spins,
+ * the sender holds the lock and waits.
+ */
+void tlb_poll(void)
+{
+	cpu_t *cpu = this_cpu();
+	if (cpu->tlb_request == NULL)
+		return;
+	uint64_t flags = irq_save(); // Not twice, the IPI may be on its way.
+	tlb_batch_t *batch = cpu->tlb_request;
+	if (batch != NULL)
+	{
+		tlb_apply(batch, &cpu->tlb_stats);
+		__atomic_store_n(&cpu->tlb_request, NULL, __ATOMIC_RELEASE);
+	}
+	irq_restore(flags);
+}
+
+static void tlb_interrupt(trap_frame_t *frame)
+{
+	tlb_poll();
+	x86_lapic_eoi();
+}
+
+void tlb_init(void)
+{
+	irq_register_nolock(TLB_FLUSH_VECTOR, tlb_interrupt);
+}
+
+/*
+ * The batch of this cpu, flushed first if it holds another address space.
+ */
+static tlb_batch_t *tlb_batch(struct mm *mm)
+{
+	tlb_batch_t *batch = &this_cpu()->tlb_batch;
+	if (batch->mm != mm)
+	{
+		tlb_finish();
+		batch->mm = mm;
+	}
+	return batch;
+}
+
+/*
+ * Queues [start, end) of mm for invalidation, the page table entries are already changed.
+ */
+void tlb_add_range(struct mm *mm, uintptr_t start, uintptr_t end)
+{
+	tlb_batch_t *batch = tlb_batch(mm);
+	batch->pages += (end - start) / PAGE_SIZE;
+	if (batch->flags & TLB_BATCH_FULL)
+		return;
+
+	struct tlb_range *last = batch->num_ranges > 0 ? &batch->ranges[batch->num_ranges - 1] : NULL;
+	if (batch->pages > TLB_FLUSH_THRESHOLD)
+		batch->flags |= TLB_BATCH_FULL;
+	else if (last != NULL && last->end == start)
+		last->end = end;
+	else if (batch->num_ranges == TLB_BATCH_RANGES)
+		batch->flags |= TLB_BATCH_FULL;
+	else
+		batch->ranges[batch->num_ranges++] = (struct tlb_range){start, end};
+}
+
+/*
+ * Frees a frame that was mapped in mm once the TLBs are flushed. Queue its range first.
+ */
+void tlb_free_page(struct mm *mm, uintptr_t addr, uint64_t pages)
+{
+	tlb_batch_t *batch = tlb_batch(mm);
+	if (batch->num_free == TLB_BATCH_PAGES)
+	{
+		tlb_finish();
+		batch->mm = mm;
+	}
+	batch->free[batch->num_free++] = (struct tlb_page){addr, pages};
+}
+
+/*
+ * Flushes all of mm, after changes all over it (fork() write protecting everything).
+ */
+void tlb_flush_mm(struct mm *mm)
+{
+	tlb_batch(mm)->flags |= TLB_BATCH_FULL;
+	tlb_finish();
+}
+
+/*
+ * Makes every cpu, this one included, switch from mm to the kernel page table before mm is freed.
+ */
+void tlb_release_mm(struct mm *mm)
+{
+	tlb_batch(mm)->flags |= TLB_BATCH_RELEASE;
+	tlb_finish();
+}
+
+/*
+ * Flushes the batch of this cpu everywhere and frees its frames. Called with the kernel lock.
+ */
+void tlb_finish(void)
+{
+	cpu_t *self = this_cpu();
+	tlb_batch_t *batch = &self->tlb_batch;
+	if (batch->mm == NULL)
+		return;
+
+	if (batch->num_ranges != 0 || batch->flags != 0)
+	{
+		uint32_t sent = 0;
+		for (uint32_t i = 0; i < num_cpus; i++)
+		{
+			cpu_t *cpu = &cpus[i];
+			if (cpu == self || cpu->mm != batch->mm)
+				continue;
+			__atomic_store_n(&cpu->tlb_request, batch, __ATOMIC_RELEASE);
+			x86_lapic_send_ipi(cpu->apic_id, X86_LAPIC_ICR_ASSERT | TLB_FLUSH_VECTOR);
+			sent++;
+		}
+		if (self->mm == batch->mm) // Meanwhile.
+			tlb_apply(batch, &self->tlb_stats);
+		if (sent != 0)
+		{
+			self->tlb_stats.shootdowns++;
+			self->tlb_stats.ipis += sent;
+			for (uint32_t i = 0; i < num_cpus; i++)
+			{
+				while (cpus[i].tlb_request == batch)
+					__asm__ __volatile__("pause");
+			}
+		}
+	}
+
+	for (uint32_t i = 0; i < batch->num_free; i++)
+	{
+		if (batch->free[i].pages == 1)
+			page_free(batch->free[i].addr);
+		else
+			page_free_contig(batch->free[i].addr, batch->free[i].pages);
+	}
+	batch->mm = NULL;
+	batch->flags = 0;
+	batch->num_ranges = 0;
+	batch->pages = 0;
+	batch->num_free = 0;
+}
+
+void tlb_stats_print(void)
+{
+	tlb_stats_t total = {0};
+	for (uint32_t i = 0; i < num_cpus; i++)
+	{
+		total.shootdowns += cpus[i].tlb_stats.shootdowns;
+		total.ipis += cpus[i].tlb_stats.ipis;
+		total.invlpg += cpus[i].tlb_stats.invlpg;
+		total.full_flushes += cpus[i].tlb_stats.full_flushes;
+	}
+	printf("TLB shootdowns: %ld batches, %ld IPIs, %ld pages invalidated with invlpg, %ld full flushes\n",
+		   total.shootdowns, total.ipis, total.invlpg, total.full_flushes);
+}
@@ -0,0 +1,17 @@
+/*
+ * true.c - a user program that exits right away, spawned by the user app
+ * to measure process creation. Built with PAD_SIZE it carries that many bytes
+ * of read-only data to show that the image size does not matter.
+ */
+
+#include <syscall.h>
+#include <process.h>
+
+#ifdef PAD_SIZE
+__attribute__((used)) static const char pad[PAD_SIZE] = { 1 };
+#endif
+
+void user_start(void)
+{
+	exit(0);
+}
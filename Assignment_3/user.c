@@ -4,9 +4,216 @@
  */
 
 #include <syscall.h>
+#include <mman.h>
+#include <thread.h>
+#include <rdtsc.h>
+#include <process.h>
+#include <time.h>
+#include <bench.h>
 
 __thread int a[100];
 
+#define NUM_WORKERS 2
+#define WORKER_ITERATIONS 10000
+#define BENCH_ITERATIONS 1000000
+#define SPAWN_ITERATIONS 100
+#define SLEEP_ITERATIONS 100
+#define SLEEP_NS 100000 // 100us
+#define LATENCY_SAMPLES 256
+#define FPU_ITERATIONS 100000
+#define NUM_SPINNERS 3 // Up to 4 cpus with the address space loaded, see code-hvm.cfg.
+#define MUNMAP_PAGES 16
+#define NUM_FANOUT 4
+#define FANOUT_ITERATIONS 40000000
+#define FANOUT_SAMPLES 16
+
+static mutex_t counter_lock = MUTEX_INITIALIZER;
+static long counter;
+static char worker_stacks[NUM_WORKERS][0x4000] __attribute__((aligned(16)));
+static uint64_t latency_samples[LATENCY_SAMPLES];
+static double fpu_results[NUM_WORKERS];
+static char spinner_stacks[NUM_SPINNERS][0x4000] __attribute__((aligned(16)));
+static volatile int spinners_running;
+static volatile int spinners_stop;
+static char fanout_stacks[NUM_FANOUT][0x4000] __attribute__((aligned(16)));
+static volatile long fanout_results[NUM_FANOUT];
+
+// Prints the average cycles to spawn the program name and wait for it to exit, or why it failed.
+static void spawn_bench(const char *name)
+{
+	uint64_t start = rdtsc();
+	for (int i = 0; i < SPAWN_ITERATIONS; i++)
+	{
+		long pid = spawn(name);
+		if (pid < 0)
+		{
+			__syscall1(SYS_PRINT_MESSAGE, (long)"Spawn failed:\n");
+			__syscall1(SYS_PRINT_VALUE, pid);
+			return;
+		}
+		wait(pid);
+	}
+	__syscall1(SYS_PRINT_VALUE, (long)((rdtsc() - start) / SPAWN_ITERATIONS));
+}
+
+// How late sleep_ns() wakes up, min, average and max in ns.
+static void sleep_jitter(void)
+{
+	uint64_t min = ~0x0ULL, max = 0, sum = 0;
+	for (int i = 0; i < SLEEP_ITERATIONS; i++)
+	{
+		uint64_t start = clock_ns();
+		sleep_ns(SLEEP_NS);
+		uint64_t late = clock_ns() - start - SLEEP_NS;
+		sum += late;
+		if (late < min)
+			min = late;
+		if (late > max)
+			max = late;
+	}
+	__syscall1(SYS_PRINT_MESSAGE, (long)"Sleep 100us, wakeup lateness min/avg/max in ns:\n");
+	__syscall1(SYS_PRINT_VALUE, (long)min);
+	__syscall1(SYS_PRINT_VALUE, (long)(sum / SLEEP_ITERATIONS));
+	__syscall1(SYS_PRINT_VALUE, (long)max);
+}
+
+// Cycles of the kernel entry paths, the kernel prints the distributions.
+static void latency_bench(void)
+{
+	for (int i = 0; i < LATENCY_SAMPLES; i++)
+	{
+		uint64_t start = rdtsc();
+		syscall_count();
+		latency_samples[i] = rdtscp() - start;
+	}
+	bench(BENCH_SYSCALL, latency_samples, LATENCY_SAMPLES);
+
+	char *pages = mmap(NULL, LATENCY_SAMPLES * 0x1000, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS);
+	if (pages != MAP_FAILED)
+	{
+		for (int i = 0; i < LATENCY_SAMPLES; i++)
+		{
+			uint64_t start = rdtsc();
+			pages[i * 0x1000] = 1;
+			latency_samples[i] = rdtscp() - start;
+		}
+		munmap(pages, LATENCY_SAMPLES * 0x1000);
+		bench(BENCH_PAGE_FAULT, latency_samples, LATENCY_SAMPLES);
+	}
+
+	bench(BENCH_SELF_IPI, NULL, LATENCY_SAMPLES);
+	bench(BENCH_TIMER_IRQ, NULL, LATENCY_SAMPLES);
+}
+
+// Keeps the address space loaded on another cpu, so munmap() has to shoot its TLB down.
+static void spinner(void *arg)
+{
+	__atomic_fetch_add(&spinners_running, 1, __ATOMIC_SEQ_CST);
+	while (!spinners_stop)
+		__asm__ __volatile__("pause");
+}
+
+// Cycles to munmap() MUNMAP_PAGES touched pages with 0 to NUM_SPINNERS other threads running.
+static void munmap_bench(void)
+{
+	thread_t spinners[NUM_SPINNERS];
+	int started = 0;
+	spinners_stop = 0;
+	spinners_running = 0;
+	while (1)
+	{
+		int n = 0;
+		for (; n < LATENCY_SAMPLES; n++)
+		{
+			char *pages = mmap(NULL, MUNMAP_PAGES * 0x1000, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS);
+			if (pages == MAP_FAILED)
+				break;
+			for (int p = 0; p < MUNMAP_PAGES; p++)
+				pages[p * 0x1000] = 1;
+			uint64_t start = rdtsc();
+			munmap(pages, MUNMAP_PAGES * 0x1000);
+			latency_samples[n] = rdtscp() - start;
+		}
+		if (n != 0)
+			bench(BENCH_MUNMAP, latency_samples, n);
+
+		if (started == NUM_SPINNERS)
+			break;
+		thread_create(&spinners[started], spinner, NULL, spinner_stacks[started], sizeof(spinner_stacks[started]));
+		started++;
+		while (spinners_running != started)
+			thread_yield();
+	}
+	spinners_stop = 1;
+	for (int i = 0; i < started; i++)
+		thread_join(&spinners[i]);
+}
+
+// Integer work that never enters the kernel.
+static void fanout_worker(void *arg)
+{
+	long i = (long)arg;
+	uint64_t x = i + 1;
+	for (long n = 0; n < FANOUT_ITERATIONS / NUM_FANOUT; n++)
+		x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+	fanout_results[i] = (long)x;
+}
+
+// The same work split over 1, 2 and 4 threads, which idle cpus steal, then kernel work items.
+static void fanout_bench(void)
+{
+	thread_t threads[NUM_FANOUT];
+	__syscall1(SYS_PRINT_MESSAGE, (long)"Cycles for the same work in 1, 2 and 4 threads:\n");
+	for (int k = 1; k <= NUM_FANOUT; k *= 2)
+	{
+		uint64_t start = rdtsc();
+		for (int round = 0; round < NUM_FANOUT / k; round++)
+		{
+			for (long i = 0; i < k; i++)
+				thread_create(&threads[i], fanout_worker, (void *)i, fanout_stacks[i], sizeof(fanout_stacks[i]));
+			for (int i = 0; i < k; i++)
+				thread_join(&threads[i]);
+		}
+		__syscall1(SYS_PRINT_VALUE, (long)(rdtsc() - start));
+	}
+	bench(BENCH_FANOUT, NULL, FANOUT_SAMPLES);
+	bench(BENCH_GNTTAB, NULL, FANOUT_SAMPLES); // Only does something on Xen.
+	bench(BENCH_CLOCK, NULL, LATENCY_SAMPLES);	// Read cost of each clock source, then reads from every cpu.
+	bench(BENCH_XRING, NULL, FANOUT_SAMPLES);	// Fails if a message or a notification gets lost.
+	sched_stats(); // Steals, migrations and queue lengths per cpu.
+}
+
+// Floating point work that yields a lot, the kernel must keep every thread's SSE registers.
+static double fpu_compute(double seed, int yield)
+{
+	double x = seed;
+	for (int i = 0; i < FPU_ITERATIONS; i++)
+	{
+		x = x * 0.999999 + seed;
+		if (yield && (i & 0xFF) == 0)
+			thread_yield();
+	}
+	return x;
+}
+
+static void fpu_worker(void *arg)
+{
+	long i = (long)arg;
+	fpu_results[i] = fpu_compute((double)(i + 1), 1);
+}
+
+static void worker(void *arg)
+{
+	for (int i = 0; i < WORKER_ITERATIONS; i++)
+	{
+		mutex_lock(&counter_lock);
+		counter++;
+		if ((i & 0xFF) == 0)
+			thread_yield(); // Let the other worker run into the held lock.
+		mutex_unlock(&counter_lock);
+	}
+}
+
 void user_start(void)
 {
 	const long call_type_print_message = 0; // 0 = print string associated with arg passed.
@@ -20,13 +227,93 @@ void user_start(void)
 	__syscall1(call_type_print_message, (long)message1);
 	__syscall1(call_type_print_value, (long)temp);
 
-	*((char *)0xFFFFFFFFC01FF000ULL) = 0; // Inducing a page fault. Address corresponds to 511th offset of PTE which will be set to 0x0ULL.
+	// Reserve 1mb, only the pages that are touched get backed by memory (each touch is a page fault).
+	char *buf = mmap(NULL, 0x100000, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS);
+	if (buf != MAP_FAILED)
+	{
+		buf[0] = 1;
+		buf[0x80000] = 2;
+		__syscall1(call_type_print_message, (long)"mmap region populated on first touch.\n");
+		munmap(buf, 0x100000);
+	}
+
+	// Grow the heap by 64kb and use it.
+	int *heap = sbrk(0x10000);
+	if (heap != MAP_FAILED)
+	{
+		for (int i = 0; i < 0x10000 / sizeof(int); i += 1024)
+			heap[i] = i;
+		__syscall1(call_type_print_value, (long)heap[1024]);
+	}
 
-	const char *message2 = "Page fault handled. Extra page allocated to the location.\n";
-	__syscall1(call_type_print_message, (long)message2);
+	// A 2mb region with the huge page hint is populated with a single fault.
+	char *huge = mmap(NULL, 0x200000, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB);
+	if (huge != MAP_FAILED)
+	{
+		huge[0x1FFFFF] = 3;
+		__syscall1(call_type_print_message, (long)"Huge page region populated.\n");
+	}
 
-	/* Never exit */
-	while (1)
+	// Two threads bump a shared counter under a futex based mutex.
+	thread_t workers[NUM_WORKERS];
+	for (int i = 0; i < NUM_WORKERS; i++)
+		thread_create(&workers[i], worker, NULL, worker_stacks[i], sizeof(worker_stacks[i]));
+	for (int i = 0; i < NUM_WORKERS; i++)
+		thread_join(&workers[i]);
+	__syscall1(call_type_print_value, counter); // NUM_WORKERS * WORKER_ITERATIONS
+
+	// The same floating point work in two threads, switched back and forth all the time.
+	for (long i = 0; i < NUM_WORKERS; i++)
+		thread_create(&workers[i], fpu_worker, (void *)i, worker_stacks[i], sizeof(worker_stacks[i]));
+	for (int i = 0; i < NUM_WORKERS; i++)
+		thread_join(&workers[i]);
+	long fpu_ok = 1;
+	for (long i = 0; i < NUM_WORKERS; i++)
+		fpu_ok &= fpu_results[i] == fpu_compute((double)(i + 1), 0);
+	__syscall1(call_type_print_message, (long)"FPU state kept across switches (1 = yes):\n");
+	__syscall1(call_type_print_value, fpu_ok);
+
+	// An uncontended lock/unlock pair never enters the kernel.
+	mutex_t bench_lock = MUTEX_INITIALIZER;
+	long calls = syscall_count();
+	uint64_t start = rdtsc();
+	for (int i = 0; i < BENCH_ITERATIONS; i++)
+	{
+		mutex_lock(&bench_lock);
+		mutex_unlock(&bench_lock);
+	}
+	uint64_t cycles = rdtsc() - start;
+	long syscalls = syscall_count() - calls - 1; // Minus the second syscall_count() itself.
+	__syscall1(call_type_print_message, (long)"Uncontended lock/unlock, cycles per pair and syscalls made:\n");
+	__syscall1(call_type_print_value, (long)(cycles / BENCH_ITERATIONS));
+	__syscall1(call_type_print_value, syscalls);
+
+	sched_stats();
+
+	// fork() shares the address space copy-on-write, the child's writes stay private.
+	counter = 1;
+	long pid = fork();
+	if (pid == 0)
+	{
+		counter = 2;
+		exit((int)counter);
+	}
+	if (pid > 0)
 	{
-	};
+		__syscall1(call_type_print_value, wait(pid)); // 2
+		__syscall1(call_type_print_value, counter);	  // Still 1.
+	}
+
+	// Process creation maps the image instead of copying it, so a 1mb bigger image costs about the same.
+	__syscall1(call_type_print_message, (long)"Cycles per spawn+exit of true and bigtrue:\n");
+	spawn_bench("true");
+	spawn_bench("bigtrue");
+
+	sleep_jitter();
+	latency_bench();
+	munmap_bench();
+	fanout_bench();
+	irq_stats();
+
+	exit(0); // Every cpu goes idle, nothing runs until the domain is destroyed.
 }
\ No newline at end of file
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <types.h>
+#include <syscall.h>
+
+/* Latency benchmarks, keep in sync with kerninc/bench.h */
+#define BENCH_SYSCALL 0	   /* samples measured by the caller */
+#define BENCH_PAGE_FAULT 1 /* samples measured by the caller */
+#define BENCH_SELF_IPI 2
+#define BENCH_TIMER_IRQ 3
+#define BENCH_MUNMAP 4 /* samples measured by the caller */
+#define BENCH_FANOUT 5
+#define BENCH_GNTTAB 6 /* -ENOSYS without Xen grant tables */
+#define BENCH_CLOCK 7
+#define BENCH_XRING 8 /* -ENOSYS on one cpu */
+
+#define BENCH_MAX_SAMPLES 1024
+
+/*
+ * Has the kernel print min, median, p99 and max of n samples (in cycles) on the console.
+ * The kernel takes the samples itself for BENCH_SELF_IPI, BENCH_TIMER_IRQ, BENCH_FANOUT,
+ * BENCH_GNTTAB, BENCH_CLOCK and BENCH_XRING, samples can be NULL.
+ */
+static __inline long bench(int op, uint64_t *samples, unsigned int n)
+{
+	return __syscall3(SYS_BENCH, op, (long) samples, n);
+}
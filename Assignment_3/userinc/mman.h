@@ -0,0 +1,46 @@
+#pragma once
+
+#include <types.h>
+#include <syscall.h>
+
+/* Same values as Linux, see kerninc/vm.h */
+#define PROT_NONE 0x0
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC 0x4
+#define MAP_SHARED 0x01
+#define MAP_PRIVATE 0x02
+#define MAP_FIXED 0x10
+#define MAP_ANONYMOUS 0x20
+#define MAP_HUGETLB 0x40000 /* A hint, 2mb pages are used where the range allows it */
+#define MAP_FAILED ((void *) -1)
+
+/* Errors are returned as -errno, the pointer wrappers map them to MAP_FAILED */
+static __inline void *mmap(void *addr, size_t len, int prot, int flags)
+{
+	long ret = __syscall4(SYS_MMAP, (long) addr, (long) len, prot, flags);
+	if (ret < 0 && ret > -4096)
+		return MAP_FAILED;
+	return (void *) ret;
+}
+
+static __inline int munmap(void *addr, size_t len)
+{
+	return (int) __syscall2(SYS_MUNMAP, (long) addr, (long) len);
+}
+
+/* Returns the new break, or the old one if it cannot be moved */
+static __inline void *brk(void *addr)
+{
+	return (void *) __syscall1(SYS_BRK, (long) addr);
+}
+
+static __inline void *sbrk(intptr_t increment)
+{
+	char *old = brk(NULL);
+	if (increment == 0)
+		return old;
+	if ((char *) brk(old + increment) != old + increment)
+		return MAP_FAILED;
+	return old;
+}
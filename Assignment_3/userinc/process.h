@@ -0,0 +1,35 @@
+#pragma once
+
+#include <types.h>
+#include <syscall.h>
+
+/* Processes, errors are returned as -errno */
+
+static __inline long fork(void)
+{
+	return __syscall0(SYS_FORK);
+}
+
+/* Starts a program from \EFI\BOOT\BIN on the boot volume, returns its pid */
+static __inline long spawn(const char *name)
+{
+	return __syscall1(SYS_SPAWN, (long) name);
+}
+
+/* Waits for a child process and returns its exit code */
+static __inline long wait(long pid)
+{
+	return __syscall1(SYS_WAIT, pid);
+}
+
+static __inline long getpid(void)
+{
+	return __syscall0(SYS_GETPID);
+}
+
+/* Ends the whole process, all of its threads */
+static __inline __attribute__((noreturn)) void exit(int code)
+{
+	__syscall1(SYS_EXIT, code);
+	__builtin_unreachable();
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <types.h>
+
+/* Time stamp counter, for measuring in cycles (see also kerninc/rdtsc.h) */
+static __inline uint64_t rdtsc(void)
+{
+	uint32_t eax, edx;
+	__asm__ __volatile__ ("rdtsc" : "=a"(eax), "=d"(edx));
+	return ((uint64_t) edx << 32) | eax;
+}
+
+/* Waits for earlier instructions to complete, for the end of a measured interval */
+static __inline uint64_t rdtscp(void)
+{
+	uint32_t eax, edx, ecx;
+	__asm__ __volatile__ ("rdtscp" : "=a"(eax), "=d"(edx), "=c"(ecx));
+	return ((uint64_t) edx << 32) | eax;
+}
@@ -17,6 +17,28 @@
  * instead, other parameters are off by one register consequently.
  */
 
+/* System call numbers, keep in sync with kerninc/kernel_syscall.h */
+#define SYS_PRINT_MESSAGE 0
+#define SYS_PRINT_VALUE 1
+#define SYS_MMAP 2
+#define SYS_MUNMAP 3
+#define SYS_BRK 4
+#define SYS_THREAD_CREATE 5
+#define SYS_THREAD_EXIT 6
+#define SYS_FUTEX 7
+#define SYS_YIELD 8
+#define SYS_SYSCALL_COUNT 9
+#define SYS_SCHED_STATS 10
+#define SYS_FORK 11
+#define SYS_SPAWN 12
+#define SYS_EXIT 13
+#define SYS_WAIT 14
+#define SYS_GETPID 15
+#define SYS_SLEEP_NS 16
+#define SYS_CLOCK_NS 17
+#define SYS_IRQ_STATS 18
+#define SYS_BENCH 19
+
 static __inline long __syscall0(long n)
 {
 	unsigned long ret;
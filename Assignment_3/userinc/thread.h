@@ -0,0 +1,166 @@
+#pragma once
+
+#include <types.h>
+#include <syscall.h>
+
+/* System call numbers and futex operations, see kerninc/kernel_syscall.h and kerninc/thread.h */
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+
+static __inline long futex_wait(volatile uint32_t *addr, uint32_t val)
+{
+	return __syscall3(SYS_FUTEX, (long) addr, FUTEX_WAIT, val);
+}
+
+static __inline long futex_wake(volatile uint32_t *addr, uint32_t count)
+{
+	return __syscall3(SYS_FUTEX, (long) addr, FUTEX_WAKE, count);
+}
+
+static __inline void thread_yield(void)
+{
+	__syscall0(SYS_YIELD);
+}
+
+static __inline __attribute__((noreturn)) void thread_exit(void)
+{
+	__syscall0(SYS_THREAD_EXIT);
+	__builtin_unreachable();
+}
+
+/* Number of system calls the kernel has handled so far, itself included */
+static __inline long syscall_count(void)
+{
+	return __syscall0(SYS_SYSCALL_COUNT);
+}
+
+/* Prints scheduler statistics and the cpu time of every thread */
+static __inline void sched_stats(void)
+{
+	__syscall0(SYS_SCHED_STATS);
+}
+
+/* Prints how many interrupts the kernel took on every vector */
+static __inline void irq_stats(void)
+{
+	__syscall0(SYS_IRQ_STATS);
+}
+
+/*
+ * Threads. The start routine and its argument are kept at the top of the
+ * new thread's stack, the kernel starts __thread_start() with a pointer to them.
+ * 'id' stays non-zero while the thread runs, the kernel clears it and wakes up
+ * any futex waiters on exit, which is what thread_join() waits for.
+ */
+struct thread
+{
+	volatile uint32_t id;
+};
+typedef struct thread thread_t;
+
+struct __thread_start_args
+{
+	void (*fn)(void *);
+	void *arg;
+};
+
+static void __thread_start(struct __thread_start_args *args)
+{
+	args->fn(args->arg);
+	thread_exit();
+}
+
+static __inline int thread_create(thread_t *thread, void (*fn)(void *), void *arg, void *stack, size_t stack_size)
+{
+	struct __thread_start_args *args = (struct __thread_start_args *)
+		(((uintptr_t) stack + stack_size - sizeof(*args)) & ~0xFULL);
+	args->fn = fn;
+	args->arg = arg;
+	thread->id = ~0U; /* set before the thread can possibly exit */
+	long ret = __syscall4(SYS_THREAD_CREATE, (long) __thread_start, (long) args,
+						  (long) args, (long) &thread->id);
+	if (ret < 0) {
+		thread->id = 0;
+		return (int) ret;
+	}
+	return 0;
+}
+
+static __inline void thread_join(thread_t *thread)
+{
+	uint32_t id;
+	while ((id = thread->id) != 0)
+		futex_wait(&thread->id, id);
+}
+
+/*
+ * Mutex, see U. Drepper, "Futexes Are Tricky" (mutex3).
+ * 0: unlocked, 1: locked, 2: locked and there may be waiters.
+ * lock/unlock stay in user space unless the mutex is contended.
+ */
+struct mutex
+{
+	volatile uint32_t state;
+};
+typedef struct mutex mutex_t;
+
+#define MUTEX_INITIALIZER { 0 }
+
+static __inline void mutex_lock(mutex_t *m)
+{
+	uint32_t c = 0;
+	if (__atomic_compare_exchange_n(&m->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return;
+	if (c != 2)
+		c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+	while (c != 0) {
+		futex_wait(&m->state, 2);
+		c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+	}
+}
+
+static __inline int mutex_trylock(mutex_t *m)
+{
+	uint32_t c = 0;
+	return __atomic_compare_exchange_n(&m->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static __inline void mutex_unlock(mutex_t *m)
+{
+	if (__atomic_fetch_sub(&m->state, 1, __ATOMIC_RELEASE) != 1) {
+		__atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+		futex_wake(&m->state, 1);
+	}
+}
+
+/*
+ * Condition variable: waiters sleep on a sequence number that every
+ * signal bumps, so a signal between unlock and futex_wait is not lost.
+ */
+struct cond
+{
+	volatile uint32_t seq;
+};
+typedef struct cond cond_t;
+
+#define COND_INITIALIZER { 0 }
+
+static __inline void cond_wait(cond_t *c, mutex_t *m)
+{
+	uint32_t seq = c->seq;
+	mutex_unlock(m);
+	futex_wait(&c->seq, seq);
+	mutex_lock(m);
+}
+
+static __inline void cond_signal(cond_t *c)
+{
+	__atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+	futex_wake(&c->seq, 1);
+}
+
+static __inline void cond_broadcast(cond_t *c)
+{
+	__atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+	futex_wake(&c->seq, ~0U);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <types.h>
+#include <syscall.h>
+
+/* Monotonic clock in nanoseconds, the same one kernel timers use */
+static __inline uint64_t clock_ns(void)
+{
+	return (uint64_t)__syscall0(SYS_CLOCK_NS);
+}
+
+/* Blocks the calling thread for at least ns nanoseconds */
+static __inline void sleep_ns(uint64_t ns)
+{
+	__syscall1(SYS_SLEEP_NS, (long)ns);
+}
@@ -0,0 +1,681 @@
+/*
+ * User virtual memory: page table helpers, a sorted VMA list per address space,
+ * mmap/munmap/brk and demand paging from the page fault handler.
+ * Pages of an anonymous VMA are only allocated when the user touches them.
+ * fork() shares all pages copy-on-write, a write fault copies the page unless it is the last reference.
+ */
+
+#include <types.h>
+#include <vm.h>
+#include <palloc.h>
+#include <msr.h>
+#include <tlb.h>
+#include <errno.h>
+#include <printf.h>
+
+#define MAX_VMAS 256
+
+static vma_t vma_pool[MAX_VMAS];
+static vma_t *vma_free_list;
+
+static uint64_t *kernel_pml4;
+vm_stats_t vm_stats;
+
+static inline unsigned int pml4_index(uintptr_t va) { return (va >> 39) & 0x1FF; }
+static inline unsigned int pdpt_index(uintptr_t va) { return (va >> 30) & 0x1FF; }
+static inline unsigned int pd_index(uintptr_t va) { return (va >> 21) & 0x1FF; }
+static inline unsigned int pt_index(uintptr_t va) { return (va >> 12) & 0x1FF; }
+
+void vm_init(uint64_t *k_pml4)
+{
+	kernel_pml4 = k_pml4;
+	current_mm = NULL;
+	vma_free_list = NULL;
+	for (int i = MAX_VMAS - 1; i >= 0; i--)
+	{
+		vma_pool[i].next = vma_free_list;
+		vma_free_list = &vma_pool[i];
+	}
+	wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_NXE); // Allow PTE_NX on user mappings.
+}
+
+static vma_t *vma_alloc(void)
+{
+	vma_t *vma = vma_free_list;
+	if (vma != NULL)
+		vma_free_list = vma->next;
+	return vma;
+}
+
+static void vma_release(vma_t *vma)
+{
+	vma->next = vma_free_list;
+	vma_free_list = vma;
+}
+
+/*
+ * Creates an empty user address space which shares the 1:1 kernel mapping (pml4 entry 0).
+ */
+int mm_init(mm_t *mm)
+{
+	uint64_t *pml4 = (uint64_t *)page_alloc_zeroed();
+	if (pml4 == NULL)
+		return -ENOMEM;
+	pml4[0] = kernel_pml4[0];
+	mm->pml4 = pml4;
+	mm->vmas = NULL;
+	mm->brk_start = USER_HEAP_BASE;
+	mm->brk = USER_HEAP_BASE;
+	return 0;
+}
+
+/*
+ * Copies the user part of a page table level for fork(). Writable leaves become read-only and
+ * copy-on-write in both tables, every mapped page gets one more reference.
+ */
+static int vm_fork_table(uint64_t *dst, uint64_t *src, int level)
+{
+	for (int i = 0; i < 512; i++)
+	{
+		uint64_t entry = src[i];
+		if (!(entry & PTE_P) || (level == 4 && i == 0)) // pml4 entry 0 is the shared kernel mapping.
+			continue;
+		if (level == 1 || (entry & PTE_PS))
+		{
+			if (entry & (PTE_W | PTE_COW))
+			{
+				entry = (entry & ~PTE_W) | PTE_COW;
+				src[i] = entry;
+			}
+			page_ref(entry & PTE_ADDR_MASK, (entry & PTE_PS) ? HUGE_PAGE_PAGES : 1);
+			dst[i] = entry;
+			continue;
+		}
+		uintptr_t table = page_alloc_zeroed();
+		if (table == 0x0ULL)
+			return -ENOMEM;
+		dst[i] = table | (entry & ~PTE_ADDR_MASK);
+		int ret = vm_fork_table((uint64_t *)table, (uint64_t *)(entry & PTE_ADDR_MASK), level - 1);
+		if (ret != 0)
+			return ret;
+	}
+	return 0;
+}
+
+/*
+ * Makes child a copy-on-write copy of parent. Nothing is copied but the VMAs and the page tables.
+ */
+int vm_fork(mm_t *child, mm_t *parent)
+{
+	int ret = mm_init(child);
+	if (ret != 0)
+		return ret;
+	child->brk_start = parent->brk_start;
+	child->brk = parent->brk;
+	child->entry = parent->entry;
+	child->tls_image = parent->tls_image;
+	child->tls_filesz = parent->tls_filesz;
+	child->tls_memsz = parent->tls_memsz;
+	child->tls_align = parent->tls_align;
+
+	for (vma_t *vma = parent->vmas; vma != NULL; vma = vma->next)
+	{
+		ret = vma_insert_file(child, vma->start, vma->end, vma->flags, vma->file_base, vma->file_size);
+		if (ret != 0)
+			goto fail;
+	}
+	ret = vm_fork_table(child->pml4, parent->pml4, 4);
+	tlb_flush_mm(parent); // The parent lost write access to its pages, wherever its threads run.
+	if (ret == 0)
+		return 0;
+fail:
+	vm_mm_destroy(child);
+	return ret;
+}
+
+static void vm_free_table(uint64_t *table, int level)
+{
+	for (int i = 0; i < 512; i++)
+	{
+		uint64_t entry = table[i];
+		if (!(entry & PTE_P) || (level == 4 && i == 0))
+			continue;
+		uintptr_t addr = entry & PTE_ADDR_MASK;
+		if (level == 1 || (entry & PTE_PS))
+		{
+			uint64_t pages = (entry & PTE_PS) ? HUGE_PAGE_PAGES : 1;
+			page_free_contig(addr, pages);
+			vm_stats.pages_freed += pages;
+			continue;
+		}
+		vm_free_table((uint64_t *)addr, level - 1);
+		page_free(addr);
+	}
+}
+
+void vm_load_kernel_pml4(void)
+{
+	write_cr3((uintptr_t)kernel_pml4);
+	current_mm = NULL;
+}
+
+/*
+ * Frees every page, page table and VMA of mm. If mm is still in cr3 (its last thread just exited),
+ * the kernel page table is loaded first, here and on any other cpu that has it loaded.
+ */
+void vm_mm_destroy(mm_t *mm)
+{
+	tlb_release_mm(mm);
+	vm_free_table(mm->pml4, 4);
+	page_free((uintptr_t)mm->pml4);
+	mm->pml4 = NULL;
+	while (mm->vmas != NULL)
+	{
+		vma_t *vma = mm->vmas;
+		mm->vmas = vma->next;
+		vma_release(vma);
+	}
+}
+
+static uint64_t *vm_next_level(uint64_t *table, unsigned int index, int create)
+{
+	if (!(table[index] & PTE_P))
+	{
+		if (!create)
+			return NULL;
+		uintptr_t page = page_alloc_zeroed();
+		if (page == 0x0ULL)
+			return NULL;
+		table[index] = page | PTE_P | PTE_W | PTE_U; // Leaf entries decide the real permissions.
+	}
+	return (uint64_t *)(table[index] & PTE_ADDR_MASK);
+}
+
+/*
+ * Turns a 2mb mapping into 512 4kb mappings of the same frames, so that part of it can be changed.
+ */
+static int vm_split_huge(uint64_t *pde)
+{
+	uint64_t *pt = (uint64_t *)page_alloc();
+	if (pt == NULL)
+		return -ENOMEM;
+	uintptr_t base = *pde & PTE_ADDR_MASK;
+	uint64_t flags = *pde & ~(PTE_ADDR_MASK | PTE_PS);
+	for (int i = 0; i < 512; i++)
+		pt[i] = (base + ((uint64_t)i << PAGE_SHIFT)) | flags;
+	*pde = (uintptr_t)pt | PTE_P | PTE_W | PTE_U;
+	return 0;
+}
+
+/*
+ * Returns the address of the leaf entry for va. For a 2mb mapping the pde itself is returned
+ * (check PTE_PS) unless create is set, in which case the mapping is split first.
+ */
+uint64_t *vm_walk(uint64_t *pml4, uintptr_t va, int create)
+{
+	uint64_t *pdpt = vm_next_level(pml4, pml4_index(va), create);
+	if (pdpt == NULL)
+		return NULL;
+	uint64_t *pd = vm_next_level(pdpt, pdpt_index(va), create);
+	if (pd == NULL)
+		return NULL;
+	uint64_t *pde = &pd[pd_index(va)];
+	if ((*pde & PTE_P) && (*pde & PTE_PS))
+	{
+		if (!create)
+			return pde;
+		if (vm_split_huge(pde) != 0)
+			return NULL;
+	}
+	uint64_t *pt = vm_next_level(pd, pd_index(va), create);
+	if (pt == NULL)
+		return NULL;
+	return &pt[pt_index(va)];
+}
+
+int vm_map_page(uint64_t *pml4, uintptr_t va, uintptr_t pa, uint64_t flags)
+{
+	uint64_t *pte = vm_walk(pml4, va, 1);
+	if (pte == NULL)
+		return -ENOMEM;
+	*pte = (pa & PTE_ADDR_MASK) | flags | PTE_P;
+	return 0;
+}
+
+static int vm_map_huge_page(uint64_t *pml4, uintptr_t va, uintptr_t pa, uint64_t flags)
+{
+	uint64_t *pdpt = vm_next_level(pml4, pml4_index(va), 1);
+	if (pdpt == NULL)
+		return -ENOMEM;
+	uint64_t *pd = vm_next_level(pdpt, pdpt_index(va), 1);
+	if (pd == NULL)
+		return -ENOMEM;
+	if (pd[pd_index(va)] & PTE_P)
+		return -EEXIST; // Part of the 2mb range is already mapped with 4kb pages.
+	pd[pd_index(va)] = (pa & PTE_ADDR_MASK) | flags | PTE_PS | PTE_P;
+	return 0;
+}
+
+uint64_t vm_pte_flags(uint32_t vma_flags)
+{
+	uint64_t flags = PTE_U;
+	if (vma_flags & VMA_WRITE)
+		flags |= PTE_W;
+	if (!(vma_flags & VMA_EXEC))
+		flags |= PTE_NX;
+	return flags;
+}
+
+/*
+ * Removes the mappings in [start, end) and returns pool frames to the allocator once no TLB
+ * has them any more. Page table pages themselves are kept around for later reuse.
+ */
+void vm_unmap_range(mm_t *mm, uintptr_t start, uintptr_t end)
+{
+	uintptr_t va = start;
+	while (va < end)
+	{
+		uint64_t *pte = vm_walk(mm->pml4, va, 0);
+		if (pte == NULL || !(*pte & PTE_P))
+		{
+			va += PAGE_SIZE;
+			continue;
+		}
+		if (*pte & PTE_PS)
+		{
+			uintptr_t huge_va = va & ~(HUGE_PAGE_SIZE - 1);
+			if (huge_va == va && va + HUGE_PAGE_SIZE <= end)
+			{
+				uintptr_t page = *pte & PTE_ADDR_MASK;
+				*pte = 0x0ULL;
+				tlb_add_range(mm, va, va + HUGE_PAGE_SIZE);
+				tlb_free_page(mm, page, HUGE_PAGE_PAGES);
+				vm_stats.pages_freed += HUGE_PAGE_PAGES;
+				va += HUGE_PAGE_SIZE;
+				continue;
+			}
+			// Partial unmap, fall back to 4kb pages. Invalidating one of them drops the 2mb TLB entry.
+			pte = vm_walk(mm->pml4, va, 1);
+			if (pte == NULL)
+				break;
+		}
+		uintptr_t page = *pte & PTE_ADDR_MASK;
+		*pte = 0x0ULL;
+		tlb_add_range(mm, va, va + PAGE_SIZE);
+		tlb_free_page(mm, page, 1);
+		vm_stats.pages_freed++;
+		va += PAGE_SIZE;
+	}
+	tlb_finish();
+}
+
+vma_t *vma_find(mm_t *mm, uintptr_t addr)
+{
+	for (vma_t *vma = mm->vmas; vma != NULL && vma->start <= addr; vma = vma->next)
+	{
+		if (addr < vma->end)
+			return vma;
+	}
+	return NULL;
+}
+
+/*
+ * Inserts a new VMA keeping the list sorted. The range must not overlap an existing VMA.
+ */
+int vma_insert(mm_t *mm, uintptr_t start, uintptr_t end, uint32_t flags)
+{
+	return vma_insert_file(mm, start, end, flags, 0x0ULL, 0);
+}
+
+int vma_insert_file(mm_t *mm, uintptr_t start, uintptr_t end, uint32_t flags, uintptr_t file_base, uint64_t file_size)
+{
+	vma_t **link = &mm->vmas;
+	while (*link != NULL && (*link)->end <= start)
+		link = &(*link)->next;
+	if (*link != NULL && (*link)->start < end)
+		return -EEXIST;
+
+	vma_t *vma = vma_alloc();
+	if (vma == NULL)
+		return -ENOMEM;
+	vma->start = start;
+	vma->end = end;
+	vma->flags = flags;
+	vma->file_base = file_base;
+	vma->file_size = file_size;
+	vma->next = *link;
+	*link = vma;
+	return 0;
+}
+
+static void vma_trim_head(vma_t *vma, uintptr_t start)
+{
+	uint64_t skip = start - vma->start;
+	if (vma->flags & VMA_FILE)
+	{
+		vma->file_base += skip;
+		vma->file_size = vma->file_size > skip ? vma->file_size - skip : 0;
+	}
+	vma->start = start;
+}
+
+/*
+ * Removes [start, end) from the VMA list, trimming or splitting VMAs that straddle the range.
+ * The page tables are not touched.
+ */
+int vma_remove_range(mm_t *mm, uintptr_t start, uintptr_t end)
+{
+	vma_t **link = &mm->vmas;
+	while (*link != NULL && (*link)->start < end)
+	{
+		vma_t *vma = *link;
+		if (vma->end <= start)
+		{
+			link = &vma->next;
+			continue;
+		}
+		if (vma->start < start && vma->end > end) // Hole in the middle, split.
+		{
+			vma_t *tail = vma_alloc();
+			if (tail == NULL)
+				return -ENOMEM;
+			*tail = *vma;
+			vma_trim_head(tail, end);
+			vma->end = start;
+			vma->next = tail;
+			return 0;
+		}
+		if (vma->start < start)
+		{
+			vma->end = start;
+			link = &vma->next;
+		}
+		else if (vma->end > end)
+		{
+			vma_trim_head(vma, end);
+			return 0;
+		}
+		else
+		{
+			*link = vma->next;
+			vma_release(vma);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Write to a page shared by fork(). The last reference just gets write access back,
+ * otherwise the page is copied. A shared 2mb page is split first and copied 4kb at a time.
+ */
+static int vm_cow_fault(mm_t *mm, uintptr_t addr)
+{
+	uint64_t *pte = vm_walk(mm->pml4, addr, 1);
+	if (pte == NULL)
+		return -ENOMEM;
+	if (!(*pte & PTE_COW))
+		return -EFAULT;
+
+	uintptr_t old = *pte & PTE_ADDR_MASK;
+	uint64_t flags = (*pte & ~(PTE_ADDR_MASK | PTE_COW)) | PTE_W;
+	if (page_refcount(old) == 1)
+	{
+		*pte = old | flags;
+	}
+	else
+	{
+		uintptr_t page = page_alloc();
+		if (page == 0x0ULL)
+			return -ENOMEM;
+		__builtin_memcpy((void *)page, (void *)old, PAGE_SIZE);
+		*pte = page | flags;
+		page_free(old);
+		vm_stats.cow_copies++;
+	}
+	invlpg(PAGE_ALIGN_DOWN(addr));
+	return 0;
+}
+
+/*
+ * Demand paging. Returns 0 if the faulting access is now possible.
+ */
+int vm_handle_fault(mm_t *mm, uintptr_t addr, uint64_t error_code)
+{
+	vm_stats.faults++;
+
+	vma_t *vma = vma_find(mm, addr);
+	if (vma == NULL)
+		return -EFAULT;
+	if (!(vma->flags & VMA_READ))
+		return -EFAULT; // PROT_NONE, e.g. a guard region: never mapped present.
+	if ((error_code & PF_WRITE) && !(vma->flags & VMA_WRITE))
+		return -EFAULT;
+	if ((error_code & PF_INSTR) && !(vma->flags & VMA_EXEC))
+		return -EFAULT;
+
+	// Another cpu may have handled the same fault, only the TLB of this one is out of date.
+	uint64_t *pte = vm_walk(mm->pml4, addr, 0);
+	if (pte != NULL && (*pte & PTE_P) && (!(error_code & PF_WRITE) || (*pte & PTE_W)))
+	{
+		invlpg(PAGE_ALIGN_DOWN(addr));
+		return 0;
+	}
+
+	if (error_code & PF_PRESENT)
+	{
+		if ((error_code & PF_WRITE) && (vma->flags & VMA_WRITE))
+			return vm_cow_fault(mm, addr);
+		return -EFAULT; // Protection violation on a populated page.
+	}
+
+	uint64_t flags = vm_pte_flags(vma->flags);
+
+	if (vma->flags & VMA_HUGE)
+	{
+		uintptr_t huge_va = addr & ~(HUGE_PAGE_SIZE - 1);
+		if (huge_va >= vma->start && huge_va + HUGE_PAGE_SIZE <= vma->end)
+		{
+			uintptr_t huge = page_alloc_contig(HUGE_PAGE_PAGES, HUGE_PAGE_PAGES);
+			if (huge != 0x0ULL)
+			{
+				__builtin_memset((void *)huge, 0x0, HUGE_PAGE_SIZE);
+				if (vm_map_huge_page(mm->pml4, huge_va, huge, flags) == 0)
+				{
+					vm_stats.huge_pages_populated++;
+					return 0;
+				}
+				page_free_contig(huge, HUGE_PAGE_PAGES);
+			}
+			// No aligned 2mb run left or the range is partially populated, use a 4kb page.
+		}
+	}
+
+	uintptr_t va = PAGE_ALIGN_DOWN(addr);
+	uintptr_t page;
+	if (vma->flags & VMA_FILE)
+	{
+		uint64_t off = va - vma->start;
+		uint64_t from_file = off < vma->file_size ? vma->file_size - off : 0;
+		if (from_file > PAGE_SIZE)
+			from_file = PAGE_SIZE;
+
+		// Read-only pages that are entirely file data map the loaded image itself, so they are shared.
+		if (!(vma->flags & VMA_WRITE) && from_file == PAGE_SIZE)
+		{
+			if (vm_map_page(mm->pml4, va, vma->file_base + off, flags) != 0)
+				return -ENOMEM;
+			vm_stats.file_pages_shared++;
+			return 0;
+		}
+		page = page_alloc();
+		if (page == 0x0ULL)
+			return -ENOMEM;
+		__builtin_memcpy((void *)page, (void *)(vma->file_base + off), from_file);
+		__builtin_memset((void *)(page + from_file), 0x0, PAGE_SIZE - from_file); // bss tail.
+	}
+	else
+	{
+		page = page_alloc_zeroed();
+		if (page == 0x0ULL)
+			return -ENOMEM;
+	}
+	if (vm_map_page(mm->pml4, va, page, flags) != 0)
+	{
+		page_free(page);
+		return -ENOMEM;
+	}
+	vm_stats.pages_populated++;
+	return 0;
+}
+
+/*
+ * Translates a user address to a physical (= kernel) address, populating the page if needed.
+ * Lets the kernel fill memory of an address space that is not the active one.
+ */
+uintptr_t vm_user_to_phys(mm_t *mm, uintptr_t va, int write)
+{
+	uint64_t *pte = vm_walk(mm->pml4, va, 0);
+	if (pte == NULL || !(*pte & PTE_P))
+	{
+		if (vm_handle_fault(mm, va, write ? PF_WRITE : 0) != 0)
+			return 0x0ULL;
+		pte = vm_walk(mm->pml4, va, 0);
+	}
+	if (write && !(*pte & PTE_W))
+	{
+		if (!(*pte & PTE_COW) || vm_cow_fault(mm, va) != 0)
+			return 0x0ULL;
+		pte = vm_walk(mm->pml4, va, 0);
+	}
+	if (*pte & PTE_PS)
+		return (*pte & PTE_ADDR_MASK & ~(HUGE_PAGE_SIZE - 1)) + (va & (HUGE_PAGE_SIZE - 1));
+	return (*pte & PTE_ADDR_MASK) + (va & (PAGE_SIZE - 1));
+}
+
+int vm_copy_to_user(mm_t *mm, uintptr_t dst, const void *src, size_t len)
+{
+	const char *from = src;
+	while (len != 0)
+	{
+		size_t chunk = PAGE_SIZE - (dst & (PAGE_SIZE - 1));
+		if (chunk > len)
+			chunk = len;
+		uintptr_t pa = vm_user_to_phys(mm, dst, 1);
+		if (pa == 0x0ULL)
+			return -EFAULT;
+		__builtin_memcpy((void *)pa, from, chunk);
+		dst += chunk;
+		from += chunk;
+		len -= chunk;
+	}
+	return 0;
+}
+
+static int vm_range_free(mm_t *mm, uintptr_t start, uintptr_t end)
+{
+	for (vma_t *vma = mm->vmas; vma != NULL && vma->start < end; vma = vma->next)
+	{
+		if (vma->end > start)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * First fit search of the mmap area for a hole of len bytes aligned to align.
+ */
+static uintptr_t vm_find_hole(mm_t *mm, size_t len, uintptr_t align)
+{
+	uintptr_t start = USER_MMAP_BASE;
+	for (vma_t *vma = mm->vmas; vma != NULL; vma = vma->next)
+	{
+		if (vma->end <= start)
+			continue;
+		if (vma->start >= start + len)
+			break;
+		start = (vma->end + align - 1) & ~(align - 1);
+	}
+	if (start + len > USER_MMAP_END || start + len < start)
+		return MAP_FAILED;
+	return start;
+}
+
+uintptr_t vm_mmap(mm_t *mm, uintptr_t addr, size_t len, int prot, int flags)
+{
+	if (len == 0 || !(flags & MAP_ANONYMOUS) || (flags & MAP_SHARED))
+		return (uintptr_t)-EINVAL; // Only private anonymous memory for now.
+	if (len > USER_MMAP_END - USER_MMAP_BASE)
+		return (uintptr_t)-ENOMEM; // Also keeps PAGE_ALIGN_UP() from wrapping to 0.
+	len = PAGE_ALIGN_UP(len);
+
+	uint32_t vma_flags = prot & (VMA_READ | VMA_WRITE | VMA_EXEC);
+	if (vma_flags & (VMA_WRITE | VMA_EXEC))
+		vma_flags |= VMA_READ; // A present x86 page is always readable.
+	uintptr_t align = PAGE_SIZE;
+	if (flags & MAP_HUGETLB)
+	{
+		vma_flags |= VMA_HUGE;
+		align = HUGE_PAGE_SIZE;
+	}
+
+	// len <= USER_MMAP_END - USER_MMAP_BASE, so the bound cannot wrap where addr + len could.
+	int fits = !(addr & (align - 1)) && addr >= USER_MMAP_BASE && addr <= USER_MMAP_END - len;
+	if (flags & MAP_FIXED)
+	{
+		if (!fits)
+			return (uintptr_t)-EINVAL;
+		vm_munmap(mm, addr, len);
+	}
+	else if (addr == 0x0ULL || !fits || !vm_range_free(mm, addr, addr + len))
+	{
+		addr = vm_find_hole(mm, len, align); // The hint cannot be used.
+		if (addr == MAP_FAILED)
+			return (uintptr_t)-ENOMEM;
+	}
+
+	if (vma_insert(mm, addr, addr + len, vma_flags) != 0)
+		return (uintptr_t)-ENOMEM;
+	return addr; // Nothing is populated until the first access.
+}
+
+int vm_munmap(mm_t *mm, uintptr_t addr, size_t len)
+{
+	if ((addr & (PAGE_SIZE - 1)) || len == 0)
+		return -EINVAL;
+	if (addr < USER_MMAP_BASE || addr > USER_MMAP_END || len > USER_MMAP_END - addr)
+		return -EINVAL; // Checked before addr + len can wrap.
+	uintptr_t end = PAGE_ALIGN_UP(addr + len);
+	int ret = vma_remove_range(mm, addr, end);
+	if (ret != 0)
+		return ret;
+	vm_unmap_range(mm, addr, end);
+	return 0;
+}
+
+/*
+ * brk(0) returns the current break. Otherwise the heap VMA is grown or shrunk to the new break
+ * and the new break is returned; on failure the old break is returned, as on Linux.
+ */
+uintptr_t vm_brk(mm_t *mm, uintptr_t addr)
+{
+	if (addr == 0x0ULL || addr < mm->brk_start || addr > USER_HEAP_END)
+		return mm->brk;
+
+	uintptr_t old_end = PAGE_ALIGN_UP(mm->brk);
+	uintptr_t new_end = PAGE_ALIGN_UP(addr);
+	if (new_end > old_end)
+	{
+		vma_t *heap = vma_find(mm, mm->brk_start);
+		if (heap != NULL && heap->end == old_end && (heap->next == NULL || heap->next->start >= new_end))
+			heap->end = new_end;
+		else if (heap != NULL || vma_insert(mm, old_end, new_end, VMA_READ | VMA_WRITE | VMA_HEAP) != 0)
+			return mm->brk;
+	}
+	else if (new_end < old_end)
+	{
+		vma_remove_range(mm, new_end, old_end);
+		vm_unmap_range(mm, new_end, old_end);
+	}
+	mm->brk = addr;
+	return mm->brk;
+}
@@ -0,0 +1,99 @@
+/*
+ * Kernel work items. Every cpu has a Chase-Lev deque (Chase and Lev, "Dynamic Circular
+ * Work-Stealing Deque", SPAA 2005, with the C11 orderings of Le et al., PPoPP 2013): work is
+ * queued on the cpu that creates it and run by that cpu or stolen by an idle one, all without
+ * the kernel lock. Idle cpus run work in their idle loop (sched_start()).
+ */
+
+#include <types.h>
+#include <work.h>
+#include <cpu.h>
+#include <smp.h>
+#include <interrupts.h>
+#include <errno.h>
+
+#define WORK_DEQUE_MASK (WORK_DEQUE_SIZE - 1)
+
+/* Owner only. */
+static int work_push(work_deque_t *deque, work_t *work)
+{
+	int64_t b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+	int64_t t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	if (b - t >= WORK_DEQUE_SIZE)
+		return -EBUSY;
+	__atomic_store_n(&deque->items[b & WORK_DEQUE_MASK], work, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* Owner only, races with the thieves for the last item. */
+static work_t *work_pop(work_deque_t *deque)
+{
+	int64_t b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+	__atomic_store_n(&deque->bottom, b, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	int64_t t = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+	if (t > b) // Empty.
+	{
+		__atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	work_t *work = __atomic_load_n(&deque->items[b & WORK_DEQUE_MASK], __ATOMIC_RELAXED);
+	if (t == b)
+	{
+		if (!__atomic_compare_exchange_n(&deque->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			work = NULL; // A thief got it.
+		__atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+	}
+	return work;
+}
+
+/* Any cpu. Returns NULL if the deque is empty or another cpu won the race. */
+static work_t *work_steal(work_deque_t *deque)
+{
+	int64_t t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	int64_t b = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+	if (t >= b)
+		return NULL;
+	work_t *work = __atomic_load_n(&deque->items[t & WORK_DEQUE_MASK], __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&deque->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return NULL;
+	return work;
+}
+
+/*
+ * Queues work on this cpu and wakes an idle cpu to steal it. Returns -EBUSY if the deque is full.
+ */
+int work_queue(work_t *work)
+{
+	uint64_t flags = irq_save(); // The idle loop pops with interrupts on.
+	int ret = work_push(&this_cpu()->work, work);
+	irq_restore(flags);
+	if (ret == 0)
+		smp_wake_idle();
+	return ret;
+}
+
+/*
+ * Runs one work item, this cpu's own or one stolen from another cpu. Returns 0 if there was none.
+ */
+int work_run(void)
+{
+	cpu_t *cpu = this_cpu();
+	uint64_t flags = irq_save();
+	work_t *work = work_pop(&cpu->work);
+	irq_restore(flags);
+	for (uint32_t i = 1; work == NULL && i < num_cpus; i++)
+	{
+		work = work_steal(&cpus[(cpu->id + i) % num_cpus].work);
+		if (work != NULL)
+			cpu->work_stolen++;
+	}
+	if (work == NULL)
+		return 0;
+	work->fn(work->arg);
+	cpu->work_done++;
+	return 1;
+}
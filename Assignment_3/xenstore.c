@@ -0,0 +1,420 @@
+/*
+ * XenStore client, see kerninc/xenstore.h. A message is a struct xsd_sockmsg and hdr.len bytes of
+ * payload, strings ended by '\0': a request goes into the req ring of the shared page, replies
+ * and watch events come back on the rsp ring. Both rings are 1kb with free running indices, and
+ * a side notifies the other over the event channel after it moves one.
+ *
+ * Requests and the replies kept share xs_msg, so a reply longer than XS_MSG_MAX is read and
+ * dropped. If xenstored does not answer within XS_REPLY_TIMEOUT_NS, or the rings make no sense,
+ * the connection is given up on and every later call returns -EIO.
+ */
+
+#include <types.h>
+#include <xenstore.h>
+#include <evtchn.h>
+#include <hvm/params.h>
+#include <hvm/hvm_op.h>
+#include <string.h>
+#include <printf.h>
+#include <errno.h>
+
+#define XS_MSG_MAX 256
+
+static struct xenstore_domain_interface *xs_intf; // NULL before xs_init() and after a failure.
+static evtchn_port_t xs_port;
+static xs_wait_t xs_wait;
+static xs_clock_t xs_clock;
+static uint32_t xs_req_id;
+static char xs_msg[XS_MSG_MAX + 1];
+
+/* Paths of the watch events not handed out yet, a ring of XS_WATCH_QUEUE. */
+static char xs_events[XS_WATCH_QUEUE][XS_PATH_MAX];
+static uint32_t xs_event_head;
+static uint32_t xs_event_count;
+
+static int xs_fail(int err)
+{
+	xs_intf = NULL;
+	return err;
+}
+
+/*
+ * Copies len bytes into the request ring, waiting for room while xenstored catches up.
+ */
+static int xs_ring_write(const void *data, uint32_t len, uint64_t deadline)
+{
+	const uint8_t *src = (const uint8_t *)data;
+	while (len != 0)
+	{
+		XENSTORE_RING_IDX prod = xs_intf->req_prod;
+		XENSTORE_RING_IDX cons = __atomic_load_n(&xs_intf->req_cons, __ATOMIC_ACQUIRE);
+		uint32_t room = XENSTORE_RING_SIZE - (prod - cons);
+		if (room > XENSTORE_RING_SIZE)
+			return -EIO;
+		if (room == 0)
+		{
+			if (xs_clock() >= deadline)
+				return -ETIMEDOUT;
+			xs_wait(xs_port, deadline);
+			continue;
+		}
+
+		uint32_t off = MASK_XENSTORE_IDX(prod);
+		uint32_t chunk = XENSTORE_RING_SIZE - off;
+		chunk = chunk < room ? chunk : room;
+		chunk = chunk < len ? chunk : len;
+		memcpy(xs_intf->req + off, src, chunk);
+		__atomic_store_n(&xs_intf->req_prod, prod + chunk, __ATOMIC_RELEASE);
+		evtchn_send(xs_port);
+		src += chunk;
+		len -= chunk;
+	}
+	return 0;
+}
+
+/*
+ * Takes len bytes off the response ring, into data unless it is NULL.
+ */
+static int xs_ring_read(void *data, uint32_t len, uint64_t deadline)
+{
+	uint8_t *dst = (uint8_t *)data;
+	while (len != 0)
+	{
+		XENSTORE_RING_IDX cons = xs_intf->rsp_cons;
+		XENSTORE_RING_IDX prod = __atomic_load_n(&xs_intf->rsp_prod, __ATOMIC_ACQUIRE);
+		uint32_t avail = prod - cons;
+		if (avail > XENSTORE_RING_SIZE)
+			return -EIO;
+		if (avail == 0)
+		{
+			if (xs_clock() >= deadline)
+				return -ETIMEDOUT;
+			xs_wait(xs_port, deadline);
+			continue;
+		}
+
+		uint32_t off = MASK_XENSTORE_IDX(cons);
+		uint32_t chunk = XENSTORE_RING_SIZE - off;
+		chunk = chunk < avail ? chunk : avail;
+		chunk = chunk < len ? chunk : len;
+		if (dst != NULL)
+		{
+			memcpy(dst, xs_intf->rsp + off, chunk);
+			dst += chunk;
+		}
+		__atomic_store_n(&xs_intf->rsp_cons, cons + chunk, __ATOMIC_RELEASE); // After the copy.
+		evtchn_send(xs_port);
+		len -= chunk;
+	}
+	return 0;
+}
+
+/*
+ * A full queue drops the new event: the ones queued already make the caller read the nodes again.
+ */
+static void xs_queue_event(void)
+{
+	if (xs_event_count == XS_WATCH_QUEUE)
+		return;
+	char *path = xs_events[(xs_event_head + xs_event_count) % XS_WATCH_QUEUE];
+	uint32_t n = strlen(xs_msg); // The path, the token follows.
+	n = n < XS_PATH_MAX - 1 ? n : XS_PATH_MAX - 1;
+	memcpy(path, xs_msg, n);
+	path[n] = '\0';
+	xs_event_count++;
+}
+
+/*
+ * Reads the next message into hdr and xs_msg, with a '\0' after the payload. A payload longer
+ * than XS_MSG_MAX is dropped with -ENOSPC. Watch events are queued here.
+ */
+static int xs_recv(struct xsd_sockmsg *hdr, uint64_t deadline)
+{
+	int ret = xs_ring_read(hdr, sizeof(*hdr), deadline);
+	if (ret != 0)
+		return ret;
+	if (hdr->len > XENSTORE_PAYLOAD_MAX)
+		return -EIO;
+	if (hdr->len > XS_MSG_MAX)
+	{
+		ret = xs_ring_read(NULL, hdr->len, deadline);
+		return ret != 0 ? ret : -ENOSPC;
+	}
+	ret = xs_ring_read(xs_msg, hdr->len, deadline);
+	if (ret != 0)
+		return ret;
+	xs_msg[hdr->len] = '\0';
+	if (hdr->type == XS_WATCH_EVENT)
+		xs_queue_event();
+	return 0;
+}
+
+/*
+ * The errno names xenstored sends back in XS_ERROR replies.
+ */
+static int xs_error(const char *name)
+{
+	if (memcmp(name, "ENOENT", 7) == 0)
+		return -ENOENT;
+	if (memcmp(name, "EACCES", 7) == 0)
+		return -EACCES;
+	if (memcmp(name, "EEXIST", 7) == 0)
+		return -EEXIST;
+	if (memcmp(name, "EINVAL", 7) == 0)
+		return -EINVAL;
+	if (memcmp(name, "ENOSPC", 7) == 0)
+		return -ENOSPC;
+	if (memcmp(name, "EAGAIN", 7) == 0)
+		return -EAGAIN;
+	return -EIO;
+}
+
+/*
+ * Sends a request of type with the len bytes in xs_msg and waits for its reply, which replaces
+ * them. Returns the length of the reply or the error xenstored sent.
+ */
+static int xs_request(uint32_t type, uint32_t len)
+{
+	if (xs_intf == NULL)
+		return -EIO;
+	uint64_t deadline = xs_clock() + XS_REPLY_TIMEOUT_NS;
+	struct xsd_sockmsg hdr;
+	hdr.type = type;
+	hdr.req_id = ++xs_req_id;
+	hdr.tx_id = 0;
+	hdr.len = len;
+	int ret = xs_ring_write(&hdr, sizeof(hdr), deadline);
+	if (ret == 0)
+		ret = xs_ring_write(xs_msg, len, deadline);
+	if (ret != 0)
+		return xs_fail(ret);
+
+	for (;;)
+	{
+		struct xsd_sockmsg reply;
+		ret = xs_recv(&reply, deadline);
+		if (ret == -ENOSPC && reply.type != XS_WATCH_EVENT && reply.req_id == hdr.req_id)
+			return -ENOSPC;
+		if (ret == -ENOSPC)
+			continue;
+		if (ret != 0)
+			return xs_fail(ret);
+		if (reply.type == XS_WATCH_EVENT || reply.req_id != hdr.req_id)
+			continue;
+		if (reply.type == XS_ERROR)
+			return xs_error(xs_msg);
+		return (int)reply.len;
+	}
+}
+
+/*
+ * Appends n bytes to the request being built in xs_msg.
+ */
+static int xs_put(uint32_t *len, const void *data, uint32_t n)
+{
+	if (*len + n > XS_MSG_MAX)
+		return -EINVAL;
+	memcpy(xs_msg + *len, data, n);
+	*len += n;
+	return 0;
+}
+
+static int xs_put_str(uint32_t *len, const char *s)
+{
+	return xs_put(len, s, strlen(s) + 1);
+}
+
+/*
+ * Finds the ring and its port, wait and clock are how to wait for events. Nothing is sent yet,
+ * so this is fine under the kernel lock. Returns -ENOENT if the toolstack gave this domain no
+ * XenStore.
+ */
+int xs_init(xs_wait_t wait, xs_clock_t clock)
+{
+	struct xen_hvm_param param;
+	param.domid = DOMID_SELF;
+	param.index = HVM_PARAM_STORE_PFN;
+	int ret = (int)HYPERVISOR_hvm_op(HVMOP_get_param, &param);
+	if (ret != 0)
+		return ret;
+	if (param.value == 0)
+		return -ENOENT;
+	uint64_t pfn = param.value;
+	param.index = HVM_PARAM_STORE_EVTCHN;
+	ret = (int)HYPERVISOR_hvm_op(HVMOP_get_param, &param);
+	if (ret != 0)
+		return ret;
+
+	xs_attach((struct xenstore_domain_interface *)(pfn << 12), (evtchn_port_t)param.value, wait, clock); // Guest RAM, mapped 1:1.
+	return 0;
+}
+
+/*
+ * Talks to whatever serves intf and port from now on, dropping queued watch events. A NULL intf
+ * disconnects. xs_init() attaches to xenstored, the loopback self-test to a fake one.
+ */
+void xs_attach(struct xenstore_domain_interface *intf, evtchn_port_t port, xs_wait_t wait, xs_clock_t clock)
+{
+	xs_port = port;
+	xs_wait = wait;
+	xs_clock = clock;
+	xs_event_head = xs_event_count = 0;
+	xs_intf = intf;
+}
+
+/*
+ * /local/domain/<domid>/<rel>, the path of rel in the home of another domain.
+ */
+int xs_domain_path(char *path, uint32_t max, uint32_t domid, const char *rel)
+{
+	return snprintf(path, max, "/local/domain/%d/%s", domid, rel) < max ? 0 : -ENOSPC;
+}
+
+/*
+ * Copies the value of path to value with a '\0' after it. Returns its length.
+ */
+int xs_read(const char *path, char *value, uint32_t max)
+{
+	uint32_t len = 0;
+	int ret = xs_put_str(&len, path);
+	if (ret == 0)
+		ret = xs_request(XS_READ, len);
+	if (ret < 0)
+		return ret;
+	if ((uint32_t)ret >= max)
+		return -ENOSPC;
+	memcpy(value, xs_msg, ret);
+	value[ret] = '\0';
+	return ret;
+}
+
+/*
+ * A node holding a decimal number, as the toolstack writes them ("domid" is this domain's id).
+ */
+int xs_read_uint(const char *path, uint32_t *value)
+{
+	char buf[12];
+	int len = xs_read(path, buf, sizeof(buf));
+	if (len < 0)
+		return len;
+	if (len == 0)
+		return -EINVAL;
+	uint64_t n = 0;
+	for (int i = 0; i < len; i++)
+	{
+		if (buf[i] < '0' || buf[i] > '9')
+			return -EINVAL;
+		n = n * 10 + (buf[i] - '0');
+	}
+	if (n > 0xFFFFFFFFULL)
+		return -EINVAL;
+	*value = (uint32_t)n;
+	return 0;
+}
+
+/*
+ * Creates path, and any missing parents, or replaces its value.
+ */
+int xs_write(const char *path, const char *value)
+{
+	uint32_t len = 0;
+	int ret = xs_put_str(&len, path);
+	if (ret == 0)
+		ret = xs_put(&len, value, strlen(value)); // The value has no '\0'.
+	if (ret == 0)
+		ret = xs_request(XS_WRITE, len);
+	return ret < 0 ? ret : 0;
+}
+
+int xs_write_uint(const char *path, uint32_t value)
+{
+	char buf[12];
+	snprintf(buf, sizeof(buf), "%d", value);
+	return xs_write(path, buf);
+}
+
+/*
+ * Removes path and everything below it.
+ */
+int xs_rm(const char *path)
+{
+	uint32_t len = 0;
+	int ret = xs_put_str(&len, path);
+	if (ret == 0)
+		ret = xs_request(XS_RM, len);
+	return ret < 0 ? ret : 0;
+}
+
+/*
+ * perms is len bytes of '\0' terminated entries: the owner first, e.g. "r5" for domain 5 with
+ * read access for everyone else, then one per domain granted more, e.g. "b6" for read and write.
+ */
+int xs_set_perms(const char *path, const char *perms, uint32_t len)
+{
+	uint32_t n = 0;
+	int ret = xs_put_str(&n, path);
+	if (ret == 0)
+		ret = xs_put(&n, perms, len);
+	if (ret == 0)
+		ret = xs_request(XS_SET_PERMS, n);
+	return ret < 0 ? ret : 0;
+}
+
+/*
+ * Asks for an event whenever path or anything below it changes, starting with one right away.
+ */
+int xs_watch(const char *path, const char *token)
+{
+	uint32_t len = 0;
+	int ret = xs_put_str(&len, path);
+	if (ret == 0)
+		ret = xs_put_str(&len, token);
+	if (ret == 0)
+		ret = xs_request(XS_WATCH, len);
+	return ret < 0 ? ret : 0;
+}
+
+int xs_unwatch(const char *path, const char *token)
+{
+	uint32_t len = 0;
+	int ret = xs_put_str(&len, path);
+	if (ret == 0)
+		ret = xs_put_str(&len, token);
+	if (ret == 0)
+		ret = xs_request(XS_UNWATCH, len);
+	return ret < 0 ? ret : 0;
+}
+
+/*
+ * Waits up to timeout_ns for a watch event and copies the path that changed to path. Returns
+ * -ETIMEDOUT if none came, this also works as a sleep that ends early on events.
+ */
+int xs_wait_watch(char *path, uint32_t max, uint64_t timeout_ns)
+{
+	if (xs_intf == NULL)
+		return -EIO;
+	uint64_t deadline = xs_clock() + timeout_ns;
+	while (xs_event_count == 0)
+	{
+		if (xs_intf->rsp_cons == __atomic_load_n(&xs_intf->rsp_prod, __ATOMIC_ACQUIRE))
+		{
+			if (xs_clock() >= deadline)
+				return -ETIMEDOUT;
+			xs_wait(xs_port, deadline);
+			continue;
+		}
+		struct xsd_sockmsg hdr; // Once a message has started the rest follows shortly.
+		int ret = xs_recv(&hdr, xs_clock() + XS_REPLY_TIMEOUT_NS);
+		if (ret != 0 && ret != -ENOSPC)
+			return xs_fail(ret);
+	}
+
+	const char *event = xs_events[xs_event_head];
+	xs_event_head = (xs_event_head + 1) % XS_WATCH_QUEUE;
+	xs_event_count--;
+	uint32_t len = strlen(event);
+	if (len >= max)
+		return -ENOSPC;
+	memcpy(path, event, len + 1);
+	return (int)len;
+}
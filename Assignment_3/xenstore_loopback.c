@@ -0,0 +1,354 @@
+/*
+ * Boot-time self-test of the XenStore client (xenstore.c) against a fake xenstored. The fake
+ * runs inside the client's wait callback: each call takes whole requests off the req ring and
+ * moves at most XS_FAKE_CHUNK bytes of replies onto the rsp ring, so every header and payload is
+ * read in pieces. Before each reply it sends an XS_ERROR with another req_id, which the client
+ * has to skip, and it sends watch events ahead of the reply of the write that fired them.
+ *
+ * The clock is fake as well and moves XS_FAKE_TICK_NS per read, so timeouts come after a fixed
+ * number of waits and do not depend on how fast the machine is. The ring indices start just
+ * below 2^32 and wrap during the test.
+ */
+
+#include <types.h>
+#include <xenstore.h>
+#include <evtchn.h>
+#include <palloc.h>
+#include <string.h>
+#include <errno.h>
+#include <printf.h>
+
+#define XS_FAKE_CHUNK 7
+#define XS_FAKE_TICK_NS 1000ULL
+#define XS_FAKE_NODES 8
+#define XS_FAKE_VALUE 32
+#define XS_FAKE_TOKEN 16
+#define XS_FAKE_BIG "data/big" // Reads back XS_FAKE_BIG_LEN bytes, more than the client keeps.
+#define XS_FAKE_BIG_LEN 300
+#define XS_FAKE_START 0xFFFFFF00U // Of all four ring indices.
+#define XS_FAKE_REQUEST_MAX 256 // The client sends no more, see XS_MSG_MAX.
+#define XS_LOOPBACK_WRAPS 200
+
+struct xs_fake
+{
+	struct xenstore_domain_interface *intf;
+	int mute; // Stops answering, so the client times out.
+	char paths[XS_FAKE_NODES][XS_PATH_MAX];
+	char values[XS_FAKE_NODES][XS_FAKE_VALUE];
+	uint32_t used[XS_FAKE_NODES];
+	char watch[XS_PATH_MAX]; // Empty when there is no watch.
+	char token[XS_FAKE_TOKEN];
+	uint8_t in[sizeof(struct xsd_sockmsg) + XS_FAKE_REQUEST_MAX]; // Request read so far.
+	uint32_t in_len;
+	uint8_t out[1536]; // Replies and events not on the rsp ring yet.
+	uint32_t out_len;
+	uint32_t out_pos;
+	int overflow;
+};
+
+static struct xs_fake *xs_fake; // Lives in a page of its own during xs_loopback().
+static uint64_t xs_fake_now;
+
+static uint64_t xs_fake_clock(void)
+{
+	xs_fake_now += XS_FAKE_TICK_NS;
+	return xs_fake_now;
+}
+
+/*
+ * Queues a message for the rsp ring, its payload is a and then b.
+ */
+static void xs_fake_send(uint32_t type, uint32_t req_id, const void *a, uint32_t a_len, const void *b, uint32_t b_len)
+{
+	struct xs_fake *fake = xs_fake;
+	struct xsd_sockmsg hdr;
+	hdr.type = type;
+	hdr.req_id = req_id;
+	hdr.tx_id = 0;
+	hdr.len = a_len + b_len;
+	if (fake->out_pos != 0)
+	{
+		memmove(fake->out, fake->out + fake->out_pos, fake->out_len - fake->out_pos);
+		fake->out_len -= fake->out_pos;
+		fake->out_pos = 0;
+	}
+	if (fake->out_len + sizeof(hdr) + hdr.len > sizeof(fake->out))
+	{
+		fake->overflow = 1;
+		return;
+	}
+	memcpy(fake->out + fake->out_len, &hdr, sizeof(hdr));
+	memcpy(fake->out + fake->out_len + sizeof(hdr), a, a_len);
+	memcpy(fake->out + fake->out_len + sizeof(hdr) + a_len, b, b_len);
+	fake->out_len += sizeof(hdr) + hdr.len;
+}
+
+static void xs_fake_reply(uint32_t type, uint32_t req_id, const void *data, uint32_t len)
+{
+	xs_fake_send(XS_ERROR, req_id - 1, "EINVAL", 7, NULL, 0); // Stale, for someone else.
+	xs_fake_send(type, req_id, data, len, NULL, 0);
+}
+
+static void xs_fake_reply_str(uint32_t type, uint32_t req_id, const char *s)
+{
+	xs_fake_reply(type, req_id, s, strlen(s) + 1);
+}
+
+static int xs_fake_same(const char *a, const char *b)
+{
+	uint32_t len = strlen(a);
+	return len == strlen(b) && memcmp(a, b, len) == 0;
+}
+
+/*
+ * The node at path, or with a NULL path a free one.
+ */
+static int xs_fake_find(const char *path)
+{
+	for (int i = 0; i < XS_FAKE_NODES; i++)
+	{
+		if (path == NULL ? xs_fake->used[i] == 0 : xs_fake->used[i] != 0 && xs_fake_same(xs_fake->paths[i], path))
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Fires the watch for path, which counts if it is the watched node or below it.
+ */
+static void xs_fake_fire(const char *path)
+{
+	struct xs_fake *fake = xs_fake;
+	uint32_t len = strlen(fake->watch);
+	if (len == 0 || memcmp(path, fake->watch, len) != 0 || (path[len] != '\0' && path[len] != '/'))
+		return;
+	xs_fake_send(XS_WATCH_EVENT, 0, path, strlen(path) + 1, fake->token, strlen(fake->token) + 1);
+}
+
+static void xs_fake_request(struct xsd_sockmsg *hdr, char *payload)
+{
+	struct xs_fake *fake = xs_fake;
+	payload[hdr->len] = '\0'; // Every request starts with a path.
+	if (strlen(payload) >= hdr->len)
+	{
+		xs_fake_reply_str(XS_ERROR, hdr->req_id, "EINVAL");
+		return;
+	}
+	const char *arg = payload + strlen(payload) + 1; // Whatever follows the path.
+	uint32_t arg_len = hdr->len - (arg - payload);
+	int node = xs_fake_find(payload);
+	switch (hdr->type)
+	{
+	case XS_READ:
+		if (xs_fake_same(payload, XS_FAKE_BIG))
+		{
+			char big[XS_FAKE_BIG_LEN];
+			memset(big, 'b', sizeof(big));
+			xs_fake_reply(XS_READ, hdr->req_id, big, sizeof(big));
+		}
+		else if (node < 0)
+			xs_fake_reply_str(XS_ERROR, hdr->req_id, "ENOENT");
+		else
+			xs_fake_reply(XS_READ, hdr->req_id, fake->values[node], fake->used[node] - 1);
+		return;
+	case XS_WRITE:
+		if (node < 0)
+			node = xs_fake_find(NULL);
+		if (node < 0 || strlen(payload) >= XS_PATH_MAX || arg_len >= XS_FAKE_VALUE)
+		{
+			xs_fake_reply_str(XS_ERROR, hdr->req_id, "ENOSPC");
+			return;
+		}
+		memcpy(fake->paths[node], payload, strlen(payload) + 1);
+		memcpy(fake->values[node], arg, arg_len);
+		fake->used[node] = arg_len + 1;
+		xs_fake_fire(payload);
+		xs_fake_reply_str(XS_WRITE, hdr->req_id, "OK");
+		return;
+	case XS_RM:
+		if (node >= 0)
+		{
+			fake->paths[node][0] = '\0';
+			fake->used[node] = 0;
+			xs_fake_fire(payload);
+		}
+		xs_fake_reply_str(XS_RM, hdr->req_id, "OK");
+		return;
+	case XS_SET_PERMS:
+		xs_fake_reply_str(node < 0 ? XS_ERROR : XS_SET_PERMS, hdr->req_id, node < 0 ? "ENOENT" : "OK");
+		return;
+	case XS_WATCH:
+		if (strlen(payload) >= XS_PATH_MAX || strlen(arg) >= XS_FAKE_TOKEN)
+		{
+			xs_fake_reply_str(XS_ERROR, hdr->req_id, "EINVAL");
+			return;
+		}
+		memcpy(fake->watch, payload, strlen(payload) + 1);
+		memcpy(fake->token, arg, strlen(arg) + 1);
+		xs_fake_reply_str(XS_WATCH, hdr->req_id, "OK");
+		xs_fake_fire(payload); // Straight away, as xenstored does.
+		return;
+	case XS_UNWATCH:
+		fake->watch[0] = '\0';
+		xs_fake_reply_str(XS_UNWATCH, hdr->req_id, "OK");
+		return;
+	default:
+		xs_fake_reply_str(XS_ERROR, hdr->req_id, "EINVAL");
+		return;
+	}
+}
+
+/*
+ * xs_wait_t of the test: one step of the fake xenstored.
+ */
+static void xs_fake_wait(evtchn_port_t port, uint64_t deadline)
+{
+	struct xs_fake *fake = xs_fake;
+	struct xenstore_domain_interface *intf = fake->intf;
+	if (fake->mute)
+		return;
+
+	XENSTORE_RING_IDX cons = intf->req_cons;
+	XENSTORE_RING_IDX prod = __atomic_load_n(&intf->req_prod, __ATOMIC_ACQUIRE);
+	while (cons != prod && fake->in_len < sizeof(fake->in))
+		fake->in[fake->in_len++] = intf->req[MASK_XENSTORE_IDX(cons++)];
+	__atomic_store_n(&intf->req_cons, cons, __ATOMIC_RELEASE);
+
+	struct xsd_sockmsg hdr;
+	while (fake->in_len >= sizeof(hdr))
+	{
+		memcpy(&hdr, fake->in, sizeof(hdr));
+		if (fake->in_len < sizeof(hdr) + hdr.len)
+			break;
+		char payload[XS_FAKE_REQUEST_MAX + 1];
+		uint32_t len = sizeof(hdr) + hdr.len;
+		if (hdr.len < sizeof(payload))
+		{
+			memcpy(payload, fake->in + sizeof(hdr), hdr.len);
+			xs_fake_request(&hdr, payload);
+		}
+		else
+			xs_fake_reply_str(XS_ERROR, hdr.req_id, "EINVAL");
+		memmove(fake->in, fake->in + len, fake->in_len - len);
+		fake->in_len -= len;
+	}
+
+	prod = intf->rsp_prod;
+	cons = __atomic_load_n(&intf->rsp_cons, __ATOMIC_ACQUIRE);
+	uint32_t n = fake->out_len - fake->out_pos;
+	n = n < XS_FAKE_CHUNK ? n : XS_FAKE_CHUNK;
+	n = n < XENSTORE_RING_SIZE - (prod - cons) ? n : XENSTORE_RING_SIZE - (prod - cons);
+	for (uint32_t i = 0; i < n; i++)
+		intf->rsp[MASK_XENSTORE_IDX(prod++)] = fake->out[fake->out_pos++];
+	__atomic_store_n(&intf->rsp_prod, prod, __ATOMIC_RELEASE);
+}
+
+static int xs_loopback_fail(const char *step, int err)
+{
+	printf("XenStore loopback: %s failed: %d\n", step, err);
+	return err < 0 ? err : -EIO;
+}
+
+static int xs_loopback_steps(void)
+{
+	char buf[XS_PATH_MAX];
+	uint32_t value = 0;
+	int ret = xs_write_uint("data/n", 42);
+	if (ret == 0)
+		ret = xs_read_uint("data/n", &value);
+	if (ret != 0 || value != 42)
+		return xs_loopback_fail("write and read", ret);
+	ret = xs_read("data/none", buf, sizeof(buf));
+	if (ret != -ENOENT)
+		return xs_loopback_fail("missing node", ret);
+	ret = xs_read(XS_FAKE_BIG, buf, sizeof(buf));
+	if (ret != -ENOSPC)
+		return xs_loopback_fail("oversized reply", ret);
+	ret = xs_read("data/n", buf, sizeof(buf)); // The stream must be in step after the drop.
+	if (ret != 2 || !xs_fake_same(buf, "42"))
+		return xs_loopback_fail("read after oversized reply", ret);
+
+	ret = xs_watch("data", "loopback");
+	if (ret == 0)
+		ret = xs_wait_watch(buf, sizeof(buf), XS_REPLY_TIMEOUT_NS);
+	if (ret != 4 || !xs_fake_same(buf, "data"))
+		return xs_loopback_fail("first watch event", ret);
+	ret = xs_write("data/peer", "6"); // Its event comes in before the reply.
+	if (ret == 0)
+		ret = xs_wait_watch(buf, sizeof(buf), XS_REPLY_TIMEOUT_NS);
+	if (ret != 9 || !xs_fake_same(buf, "data/peer"))
+		return xs_loopback_fail("watch event", ret);
+	ret = xs_unwatch("data", "loopback");
+	if (ret == 0)
+		ret = xs_write("data/peer", "7");
+	if (ret != 0)
+		return xs_loopback_fail("unwatch", ret);
+	ret = xs_wait_watch(buf, sizeof(buf), 1000 * XS_FAKE_TICK_NS);
+	if (ret != -ETIMEDOUT)
+		return xs_loopback_fail("event after unwatch", ret);
+
+	ret = xs_set_perms("data/peer", "r5\0b6", 6);
+	if (ret == 0)
+		ret = xs_rm("data/peer");
+	if (ret != 0)
+		return xs_loopback_fail("set perms and rm", ret);
+	ret = xs_set_perms("data/peer", "r5", 3);
+	if (ret != -ENOENT)
+		return xs_loopback_fail("set perms after rm", ret);
+
+	for (uint32_t i = 0; i < XS_LOOPBACK_WRAPS; i++) // Around both rings and past 2^32 many times.
+	{
+		ret = xs_write_uint("data/n", i);
+		if (ret == 0)
+			ret = xs_read_uint("data/n", &value);
+		if (ret != 0 || value != i)
+			return xs_loopback_fail("ring wrap", ret);
+	}
+
+	xs_fake->mute = 1;
+	ret = xs_read("data/n", buf, sizeof(buf));
+	if (ret != -ETIMEDOUT)
+		return xs_loopback_fail("timeout", ret);
+	ret = xs_read("data/n", buf, sizeof(buf)); // The connection is given up on.
+	if (ret != -EIO)
+		return xs_loopback_fail("after timeout", ret);
+	return xs_fake->overflow ? xs_loopback_fail("fake xenstored", -ENOSPC) : 0;
+}
+
+/*
+ * Runs the client against the fake xenstored and leaves it disconnected, xs_init() connects it
+ * to the real one. The port is unbound, so the client's EVTCHNOP_send goes nowhere. Returns 0 or
+ * the error of the first step that failed, which it prints.
+ */
+int xs_loopback(void)
+{
+	evtchn_port_t port;
+	int ret = evtchn_alloc_unbound(DOMID_SELF, &port);
+	if (ret != 0)
+		return ret;
+	uintptr_t intf_page = page_alloc_zeroed();
+	uintptr_t fake_page = page_alloc_zeroed();
+	if (intf_page == 0x0ULL || fake_page == 0x0ULL)
+	{
+		if (intf_page != 0x0ULL)
+			page_free(intf_page);
+		if (fake_page != 0x0ULL)
+			page_free(fake_page);
+		evtchn_close(port);
+		return -ENOMEM;
+	}
+
+	struct xenstore_domain_interface *intf = (struct xenstore_domain_interface *)intf_page;
+	intf->req_cons = intf->req_prod = intf->rsp_cons = intf->rsp_prod = XS_FAKE_START;
+	xs_fake = (struct xs_fake *)fake_page;
+	xs_fake->intf = intf;
+	xs_fake_now = 0;
+	xs_attach(intf, port, xs_fake_wait, xs_fake_clock);
+	ret = xs_loopback_steps();
+	xs_attach(NULL, 0, NULL, NULL);
+	xs_fake = NULL;
+	page_free(fake_page);
+	page_free(intf_page);
+	evtchn_close(port);
+	return ret;
+}
@@ -0,0 +1,163 @@
+/*
+ * Shared memory ring, see kerninc/xring.h. A message is its length, its data and padding up to
+ * XRING_ALIGN. One that would run over the end of the ring is put at the start instead, after a
+ * XRING_PAD record filling the rest, so every message can be read in place.
+ *
+ * Notifications follow io/ring.h: a side that is about to wait sets the other one's event index
+ * to the index it waits for and checks once more, and the other side notifies after publishing
+ * only if its update went past that index. A side that is not waiting costs nothing.
+ *
+ * Only the memory given to xring_init()/xring_attach() is used, so both ends can run in two
+ * threads of one process as well as in two domains.
+ */
+
+#include <types.h>
+#include <xring.h>
+#include <string.h>
+#include <errno.h>
+
+static inline uint32_t xring_load(volatile uint32_t *index)
+{
+	return __atomic_load_n(index, __ATOMIC_ACQUIRE);
+}
+
+static inline void xring_store(volatile uint32_t *index, uint32_t value)
+{
+	__atomic_store_n(index, value, __ATOMIC_RELEASE);
+}
+
+/*
+ * Set up by the producer, the shared indices start at 0.
+ */
+void xring_init(xring_t *ring, xring_shared_t *shared, void *data, uint32_t size)
+{
+	memset(shared, 0x0, sizeof(*shared));
+	xring_attach(ring, shared, data, size);
+}
+
+/*
+ * Either side. size must be a power of 2.
+ */
+void xring_attach(xring_t *ring, xring_shared_t *shared, void *data, uint32_t size)
+{
+	ring->shared = shared;
+	ring->data = (uint8_t *)data;
+	ring->size = size;
+	ring->prod_pvt = xring_load(&shared->prod);
+	ring->cons_pvt = xring_load(&shared->cons);
+}
+
+/*
+ * Bytes a message of len takes at the current position, its filler included.
+ */
+uint32_t xring_need(xring_t *ring, uint32_t len)
+{
+	uint32_t record = XRING_RECORD(len);
+	uint32_t contig = ring->size - (ring->prod_pvt & (ring->size - 1));
+	return record + (contig < record ? contig : 0);
+}
+
+/*
+ * Copies a message into the ring, the consumer sees it after xring_push(). Returns -EAGAIN if
+ * there is no room and -EINVAL for messages longer than half the ring.
+ */
+int xring_write(xring_t *ring, const void *msg, uint32_t len)
+{
+	uint32_t record = XRING_RECORD(len);
+	if (len >= XRING_PAD || record > ring->size / 2)
+		return -EINVAL;
+	uint32_t need = xring_need(ring, len);
+	if (ring->prod_pvt - xring_load(&ring->shared->cons) + need > ring->size)
+		return -EAGAIN;
+
+	uint32_t off = ring->prod_pvt & (ring->size - 1);
+	if (need != record)
+	{
+		*(uint32_t *)(ring->data + off) = XRING_PAD;
+		ring->prod_pvt += need - record;
+		off = 0;
+	}
+	*(uint32_t *)(ring->data + off) = len;
+	memcpy(ring->data + off + 4, msg, len);
+	ring->prod_pvt += record;
+	return 0;
+}
+
+/*
+ * Publishes the messages written so far. Returns 1 if the consumer waits for them and has to be
+ * notified.
+ */
+int xring_push(xring_t *ring)
+{
+	xring_shared_t *shared = ring->shared;
+	uint32_t old = shared->prod;
+	uint32_t new = ring->prod_pvt;
+	xring_store(&shared->prod, new);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST); // prod before prod_event, or a consumer going to sleep is missed.
+	return (uint32_t)(new - shared->prod_event) < (uint32_t)(new - old);
+}
+
+/*
+ * Asks to be notified once bytes of the ring are free, ring->size for all of it. Returns 1 if
+ * they already are, then there is nothing to wait for.
+ */
+int xring_prepare_write(xring_t *ring, uint32_t bytes)
+{
+	xring_shared_t *shared = ring->shared;
+	shared->cons_event = ring->prod_pvt - ring->size + bytes;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return ring->prod_pvt - xring_load(&shared->cons) + bytes <= ring->size;
+}
+
+/*
+ * Copies the next message to buf. Returns its length, -EAGAIN if there is none, -ENOSPC if it is
+ * longer than max (it stays in the ring) and -EINVAL if the producer wrote garbage.
+ */
+int xring_read(xring_t *ring, void *buf, uint32_t max)
+{
+	uint32_t prod = xring_load(&ring->shared->prod);
+	while (ring->cons_pvt != prod)
+	{
+		uint32_t off = ring->cons_pvt & (ring->size - 1);
+		uint32_t len = *(volatile uint32_t *)(ring->data + off);
+		if (len == XRING_PAD)
+		{
+			ring->cons_pvt += ring->size - off;
+			continue;
+		}
+		if (len > ring->size / 2 || XRING_RECORD(len) > prod - ring->cons_pvt)
+			return -EINVAL;
+		if (len > max)
+			return -ENOSPC;
+		memcpy(buf, ring->data + off + 4, len);
+		ring->cons_pvt += XRING_RECORD(len);
+		return (int)len;
+	}
+	return -EAGAIN;
+}
+
+/*
+ * Hands the space of the messages read so far back to the producer. Returns 1 if the producer
+ * waits for it and has to be notified.
+ */
+int xring_release(xring_t *ring)
+{
+	xring_shared_t *shared = ring->shared;
+	uint32_t old = shared->cons;
+	uint32_t new = ring->cons_pvt;
+	xring_store(&shared->cons, new);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return (uint32_t)(new - shared->cons_event) < (uint32_t)(new - old);
+}
+
+/*
+ * Asks to be notified of the next message. Returns 1 if one came in meanwhile, then there is
+ * nothing to wait for.
+ */
+int xring_prepare_read(xring_t *ring)
+{
+	xring_shared_t *shared = ring->shared;
+	shared->prod_event = ring->cons_pvt + 1;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return xring_load(&shared->prod) != ring->cons_pvt;
+}
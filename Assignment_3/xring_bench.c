@@ -0,0 +1,343 @@
+/*
+ * Streams messages to guest2 over a shared ring (xring.c) and measures throughput and latency.
+ * The ring header goes in the shared page the bootloader set aside; it lists the grants of the
+ * data pages and the event channel to bind to. With XenStore a kernel thread waits for guest2
+ * to ask for the ring there (see xring_bench.h) and grants it to that domain, without it the
+ * ring is granted at boot to XRING_PEER_DOMID, header first so guest2 finds it at
+ * XRING_BENCH_HEADER_REF. The thread then waits for guest2 to connect, sends XRING_BENCH_BYTES
+ * in messages of each size and then XRING_BENCH_PINGS single messages. It only sleeps when the
+ * ring is full, and guest2 only notifies it then.
+ */
+
+#include <types.h>
+#include <xring.h>
+#include <xring_bench.h>
+#include <evtchn.h>
+#include <gnttab.h>
+#include <xenstore.h>
+#include <smp.h>
+#include <thread.h>
+#include <timer.h>
+#include <rdtsc.h>
+#include <palloc.h>
+#include <interrupts.h>
+#include <string.h>
+#include <errno.h>
+#include <printf.h>
+
+#define XRING_PEER_DOMID 6 // guest2, without XenStore.
+#define XRING_PAGES 16
+#define XRING_BENCH_BYTES (256ULL << 20) // Per message size.
+#define XRING_BENCH_BATCH 16			 // Messages per xring_push().
+#define XRING_BENCH_PINGS 1000
+#define XRING_BENCH_PING_GAP_NS 100000ULL // Long enough for guest2 to go back to waiting.
+#define XRING_XS_WAIT_NS (60ULL * NSEC_PER_SEC)
+
+static const uint32_t xring_bench_sizes[] = {64, 256, 1024, 4096};
+
+static xring_t xring_tx;
+static xring_page_t *xring_page;
+static uintptr_t xring_data;
+static domid_t xring_peer;
+static evtchn_port_t xring_port;
+static int xring_xs; // xs_init() worked, the peer comes from XenStore.
+static int xring_xs_bound;
+static volatile int xring_xs_pending;
+static thread_t *xring_thread;
+static uint8_t xring_msg[XRING_BENCH_MAX_MSG];
+
+static void xring_event(evtchn_port_t port, void *arg)
+{
+	if (xring_thread != NULL)
+		thread_wakeup(xring_thread);
+}
+
+static void xring_xs_event(evtchn_port_t port, void *arg)
+{
+	xring_xs_pending = 1;
+	if (xring_thread != NULL)
+		thread_wakeup(xring_thread);
+}
+
+static void xring_xs_timeout(void *arg)
+{
+	thread_wakeup((thread_t *)arg);
+}
+
+/*
+ * xs_wait_t of the thread: sleeps until xenstored sends an event or deadline passes, checking
+ * under the kernel lock with interrupts off like xring_wait_room(). The port is bound on first
+ * use, an event that came in before that is raised when it is unmasked.
+ */
+static void xring_xs_wait(evtchn_port_t port, uint64_t deadline)
+{
+	kernel_lock();
+	uint64_t flags = irq_save();
+	if (!xring_xs_bound)
+		xring_xs_bound = evtchn_bind(port, xring_xs_event, NULL) == 0;
+	timer_t timer;
+	timer_add(&timer, deadline, xring_xs_timeout, current_thread);
+	while (!xring_xs_pending && timer.pprev != NULL)
+		thread_block();
+	timer_cancel(&timer);
+	xring_xs_pending = 0;
+	irq_restore(flags);
+	kernel_unlock();
+}
+
+/*
+ * Sleeps until bytes of the ring are free. The check runs under the kernel lock with interrupts
+ * off, so the event handler cannot wake the thread between the check and thread_block().
+ */
+static void xring_wait_room(uint32_t bytes)
+{
+	kernel_lock();
+	uint64_t flags = irq_save();
+	while (!xring_prepare_write(&xring_tx, bytes))
+		thread_block();
+	irq_restore(flags);
+	kernel_unlock();
+}
+
+static void xring_push_notify(void)
+{
+	if (xring_push(&xring_tx))
+		evtchn_send(xring_port);
+}
+
+static void xring_send(uint32_t size)
+{
+	while (xring_write(&xring_tx, xring_msg, size) == -EAGAIN)
+	{
+		xring_push_notify();
+		xring_wait_room(xring_need(&xring_tx, size));
+	}
+}
+
+static void xring_bench_run(uint32_t size)
+{
+	struct xring_bench_msg *msg = (struct xring_bench_msg *)xring_msg;
+	uint64_t count = XRING_BENCH_BYTES / size;
+	msg->type = XRING_BENCH_DATA;
+	msg->size = size;
+	uint64_t start = clock_ns();
+	for (uint64_t i = 0; i < count; i++)
+	{
+		xring_send(size);
+		if (i % XRING_BENCH_BATCH == XRING_BENCH_BATCH - 1)
+			xring_push_notify();
+	}
+	msg->type = XRING_BENCH_END;
+	xring_send(sizeof(*msg));
+	xring_push_notify();
+	xring_wait_room(xring_tx.size); // Until guest2 has read everything.
+	uint64_t ns = clock_ns() - start;
+
+	uint64_t bytes_per_sec = count * size * NSEC_PER_SEC / ns;
+	kernel_lock();
+	printf("Ring to domain %d: %d byte messages, %ld.%02ld GB/s, %ld messages/s\n", xring_peer, size,
+		   bytes_per_sec / 1000000000, bytes_per_sec / 10000000 % 100, count * NSEC_PER_SEC / ns);
+	kernel_unlock();
+}
+
+/*
+ * One message at a time, with guest2 waiting for each: send to notification back.
+ */
+static void xring_bench_ping(void)
+{
+	struct xring_bench_msg *msg = (struct xring_bench_msg *)xring_msg;
+	uint64_t min = ~0ULL, max = 0, sum = 0;
+	msg->type = XRING_BENCH_PING;
+	msg->size = sizeof(*msg);
+	for (uint32_t i = 0; i < XRING_BENCH_PINGS; i++)
+	{
+		msg->sent_ns = clock_ns();
+		xring_send(sizeof(*msg));
+		xring_push_notify();
+		xring_wait_room(xring_tx.size);
+		uint64_t ns = clock_ns() - msg->sent_ns;
+		min = ns < min ? ns : min;
+		max = ns > max ? ns : max;
+		sum += ns;
+
+		kernel_lock();
+		sleep_ns(XRING_BENCH_PING_GAP_NS);
+		kernel_unlock();
+	}
+	kernel_lock();
+	printf("Ring round trip to domain %d: min %ld ns, avg %ld ns, max %ld ns\n", xring_peer, min,
+		   sum / XRING_BENCH_PINGS, max);
+	kernel_unlock();
+}
+
+/*
+ * Grants the ring to peer and opens the event channel it binds to, header first. Returns the
+ * grant of the header.
+ */
+static int xring_offer(domid_t peer, grant_ref_t *header_ref)
+{
+	int ret = evtchn_alloc_unbound(peer, &xring_port);
+	if (ret != 0)
+	{
+		page_free_contig(xring_data, XRING_PAGES);
+		return ret;
+	}
+	grant_ref_t ref = gnttab_grant_access(peer, (uintptr_t)xring_page >> PAGE_SHIFT, 0);
+	if (ref == 0 || gnttab_grant_pages(peer, xring_data >> PAGE_SHIFT, XRING_PAGES, 0, xring_page->refs) != 0)
+	{
+		if (ref != 0)
+			gnttab_end_access(ref);
+		evtchn_close(xring_port);
+		page_free_contig(xring_data, XRING_PAGES);
+		return -ENOSPC;
+	}
+	xring_page->nr_pages = XRING_PAGES;
+	xring_page->port = xring_port;
+	__atomic_store_n(&xring_page->magic, XRING_MAGIC, __ATOMIC_RELEASE);
+
+	ret = evtchn_bind(xring_port, xring_event, NULL);
+	if (ret != 0)
+	{
+		evtchn_close(xring_port); // The grants stay, guest2 finds nothing to connect to.
+		return ret;
+	}
+	xring_peer = peer;
+	*header_ref = ref;
+	printf("Ring for domain %d: %d pages, grant %d, event channel %d\n", peer, XRING_PAGES, ref, xring_port);
+	return 0;
+}
+
+/*
+ * Publishes XRING_XS_PEER for guest2 and waits for a domain id in it. Runs without the kernel
+ * lock, xring_xs_wait() takes it.
+ */
+static int xring_discover(domid_t *peer)
+{
+	uint32_t self, domid;
+	int ret = xs_read_uint("domid", &self);
+	if (ret != 0)
+		return ret;
+	char perms[12];
+	uint32_t len = snprintf(perms, sizeof(perms), "r%d", self) + 1; // Owner, everyone else reads.
+	ret = xs_write(XRING_XS_PEER, "");
+	if (ret == 0)
+		ret = xs_set_perms(XRING_XS_DIR, perms, len);
+	perms[0] = 'b'; // And writes.
+	if (ret == 0)
+		ret = xs_set_perms(XRING_XS_PEER, perms, len);
+	if (ret == 0)
+		ret = xs_watch(XRING_XS_PEER, XRING_XS_TOKEN);
+	if (ret != 0)
+		return ret;
+
+	char path[XS_PATH_MAX];
+	for (;;)
+	{
+		ret = xs_wait_watch(path, sizeof(path), XRING_XS_WAIT_NS); // Fires once right away.
+		if (ret == -ETIMEDOUT)
+			continue;
+		if (ret < 0)
+			break;
+		ret = xs_read_uint(XRING_XS_PEER, &domid);
+		if (ret == 0 && domid != self && domid < DOMID_FIRST_RESERVED)
+		{
+			*peer = (domid_t)domid;
+			break;
+		}
+	}
+	xs_unwatch(XRING_XS_PEER, XRING_XS_TOKEN);
+	return ret;
+}
+
+/*
+ * Tells guest2 where the ring is, the reference last since that is what it waits for.
+ */
+static int xring_publish(grant_ref_t ref)
+{
+	int ret = xs_write_uint(XRING_XS_PORT, xring_port);
+	if (ret == 0)
+		ret = xs_write_uint(XRING_XS_REF, ref);
+	return ret;
+}
+
+static void xring_bench_thread(void *arg)
+{
+	if (xring_xs)
+	{
+		domid_t peer;
+		grant_ref_t ref;
+		kernel_unlock();
+		int ret = xring_discover(&peer);
+		kernel_lock();
+		if (ret == 0)
+			ret = xring_offer(peer, &ref);
+		if (ret == 0)
+		{
+			kernel_unlock();
+			ret = xring_publish(ref);
+			kernel_lock();
+			if (ret != 0)
+				evtchn_close(xring_port);
+		}
+		if (ret != 0)
+		{
+			printf("Could not offer the ring through XenStore: %d\n", ret);
+			xring_thread = NULL;
+			return;
+		}
+	}
+
+	uint64_t flags = irq_save();
+	while (!xring_page->connected)
+		thread_block();
+	irq_restore(flags);
+	printf("Ring: domain %d connected\n", xring_peer);
+
+	kernel_unlock(); // Only printing and sleeping need it.
+	for (uint32_t i = 0; i < sizeof(xring_bench_sizes) / sizeof(xring_bench_sizes[0]); i++)
+		xring_bench_run(xring_bench_sizes[i]);
+	xring_bench_ping();
+	((struct xring_bench_msg *)xring_msg)->type = XRING_BENCH_DONE;
+	xring_send(sizeof(struct xring_bench_msg));
+	xring_push_notify();
+	kernel_lock();
+
+	evtchn_close(xring_port);
+	xring_thread = NULL;
+}
+
+/*
+ * Sets up the ring in header_page and the data pages and starts the benchmark thread, which
+ * offers it through XenStore. Without XenStore they are granted to XRING_PEER_DOMID here. Called
+ * at boot once event channels work.
+ */
+int xring_bench_start(uintptr_t header_page)
+{
+	xring_data = page_alloc_contig(XRING_PAGES, 1);
+	if (xring_data == 0x0ULL)
+		return -ENOMEM;
+	xring_page = (xring_page_t *)header_page;
+	memset(xring_page, 0x0, PAGE_SIZE);
+	xring_init(&xring_tx, &xring_page->ring, (void *)xring_data, XRING_PAGES * PAGE_SIZE);
+
+	grant_ref_t ref;
+	xring_xs = xs_init(xring_xs_wait, clock_ns) == 0;
+	if (!xring_xs)
+	{
+		int ret = xring_offer(XRING_PEER_DOMID, &ref);
+		if (ret != 0)
+			return ret;
+	}
+
+	xring_thread = thread_create_kernel(xring_bench_thread, NULL);
+	if (xring_thread == NULL)
+	{
+		if (!xring_xs)
+			evtchn_close(xring_port); // The grants stay, guest2 finds nothing to connect to.
+		else
+			page_free_contig(xring_data, XRING_PAGES);
+		printf("Could not start the ring benchmark: %d\n", -ENOMEM);
+		return -ENOMEM;
+	}
+	return 0;
+}
@@ -457,7 +457,7 @@ efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE *systemTable)
 		return efi_status;
 	}
 
-	efi_status = AllocatePages(AllocateAnyPages, EfiBootServicesData, 1, &shared_page_base); // Allocate 4kb alignmed memory for shared page.
+	efi_status = AllocatePages(AllocateAnyPages, EfiBootServicesData, 33, &shared_page_base); // Shared ring: its header page, room for up to 16 data pages and 16 pages to copy them to (xring_bench.c).
 	if (EFI_ERROR(efi_status))
 	{
 		BootServices->Stall(5 * 1000000); // 5 seconds
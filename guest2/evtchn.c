@@ -0,0 +1,62 @@
+/*
+ * Xen event channels without an upcall: ports stay masked and the guest blocks in the hypervisor
+ * with SCHEDOP_poll until one is pending.
+ */
+
+#include <types.h>
+#include <evtchn.h>
+
+#define EVTCHN_WORD_BITS (sizeof(xen_ulong_t) * 8)
+
+/*
+ * Connects a new local port to the unbound remote_port of remote_dom, masked.
+ */
+int evtchn_bind_interdomain(domid_t remote_dom, evtchn_port_t remote_port, evtchn_port_t *local_port)
+{
+	evtchn_bind_interdomain_t op;
+	op.remote_dom = remote_dom;
+	op.remote_port = remote_port;
+	int ret = HYPERVISOR_event_channel_op(EVTCHNOP_bind_interdomain, &op);
+	if (ret != 0)
+		return ret;
+	*local_port = op.local_port;
+	__atomic_fetch_or(&xen_shared_info->evtchn_mask[op.local_port / EVTCHN_WORD_BITS],
+					  (xen_ulong_t)1 << (op.local_port % EVTCHN_WORD_BITS), __ATOMIC_SEQ_CST);
+	return 0;
+}
+
+int evtchn_send(evtchn_port_t port)
+{
+	evtchn_send_t op;
+	op.port = port;
+	return HYPERVISOR_event_channel_op(EVTCHNOP_send, &op);
+}
+
+int evtchn_close(evtchn_port_t port)
+{
+	evtchn_close_t op;
+	op.port = port;
+	return HYPERVISOR_event_channel_op(EVTCHNOP_close, &op);
+}
+
+/*
+ * Blocks until port is pending, then clears it. Returns at once if it already was.
+ */
+void evtchn_poll(evtchn_port_t port)
+{
+	evtchn_poll_until(port, 0);
+}
+
+/*
+ * The same, but returns by deadline in Xen system time (pvclock) even if nothing came, 0 for none.
+ */
+void evtchn_poll_until(evtchn_port_t port, uint64_t deadline)
+{
+	sched_poll_t poll;
+	set_xen_guest_handle(poll.ports, &port);
+	poll.nr_ports = 1;
+	poll.timeout = deadline;
+	HYPERVISOR_sched_op(SCHEDOP_poll, &poll);
+	__atomic_fetch_and(&xen_shared_info->evtchn_pending[port / EVTCHN_WORD_BITS],
+					   ~((xen_ulong_t)1 << (port % EVTCHN_WORD_BITS)), __ATOMIC_SEQ_CST);
+}
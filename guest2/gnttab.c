@@ -20,6 +20,7 @@
 #include <memory.h>
 #include <printf.h>
 #include <os.h>
+#include <string.h>
 
 #define GNTTAB_PAGE_SIZE 4096U
 #define GNTTAB_PAGE_SHIFT 12U
@@ -0,0 +1,70 @@
+/*
+ * Where copying granted data with GNTTABOP_copy stops being cheaper than mapping it: reads
+ * pages another domain granted both ways at growing sizes, then sets gnttab_copy_threshold to
+ * the first size at which mapping won, so gnttab_read() picks the faster path from then on.
+ */
+
+#include <types.h>
+#include <gnttab.h>
+#include <rdtsc.h>
+#include <printf.h>
+
+#define GNTTAB_BENCH_REPS 100
+#define GNTTAB_BENCH_PAGE_SIZE 0x1000UL
+
+uint64_t pvclock_monotonic_read();
+
+static const unsigned long gnttab_bench_sizes[] = {256, 1024, 4096, 8192, 16384, 32768, 65536};
+
+/*
+ * Average ns of a gnttab_read() of len bytes, by copy or by map.
+ */
+static int64_t gnttab_bench_read(domid_t domid, const grant_ref_t *refs, unsigned long len, int map,
+								 unsigned long window, unsigned int window_pages, void *buf)
+{
+	gnttab_copy_threshold = map ? 0 : ~0UL;
+	uint64_t start = pvclock_monotonic_read();
+	for (int i = 0; i < GNTTAB_BENCH_REPS; i++)
+	{
+		int rc = gnttab_read(domid, refs, len, buf, window, window_pages);
+		if (rc != 0)
+			return rc;
+	}
+	return (int64_t)((pvclock_monotonic_read() - start) / GNTTAB_BENCH_REPS);
+}
+
+/*
+ * refs are nr_pages granted by domid, window is room to map them at and buf holds as much.
+ */
+void gnttab_bench(domid_t domid, const grant_ref_t *refs, unsigned int nr_pages, unsigned long window, void *buf)
+{
+	unsigned long crossover = 0;
+	for (uint32_t i = 0; i < sizeof(gnttab_bench_sizes) / sizeof(gnttab_bench_sizes[0]); i++)
+	{
+		unsigned long len = gnttab_bench_sizes[i];
+		if (len > nr_pages * GNTTAB_BENCH_PAGE_SIZE)
+			break;
+		int64_t copy_ns = gnttab_bench_read(domid, refs, len, 0, window, nr_pages, buf);
+		int64_t map_ns = gnttab_bench_read(domid, refs, len, 1, window, nr_pages, buf);
+		if (copy_ns < 0 || map_ns < 0)
+		{
+			printf("Grant read of %ld bytes failed: %ld\n", len, copy_ns < 0 ? copy_ns : map_ns);
+			gnttab_copy_threshold = GNTTAB_COPY_THRESHOLD;
+			return;
+		}
+		printf("Grant read of %ld bytes: copy %ld ns, map %ld ns\n", len, copy_ns, map_ns);
+		if (crossover == 0 && map_ns < copy_ns)
+			crossover = len;
+	}
+
+	if (crossover != 0)
+	{
+		gnttab_copy_threshold = crossover;
+		printf("Grant reads map from %ld bytes on, copy below\n", crossover);
+	}
+	else
+	{
+		gnttab_copy_threshold = ~0UL;
+		printf("Grant reads copy at every size measured\n");
+	}
+}
@@ -18,6 +18,7 @@
 #include <version.h>
 #include <rdtsc.h>
 #include <xen.h>
+#include <xring_bench.h>
 
 // Declare the methods.
 uintptr_t page_table_init_kernel(information);
@@ -105,21 +106,7 @@ void kernel_start(void *kernel_stack_buffer, unsigned int *framebuffer, unsigned
 			printf("PV Clock Monotonic after busy wait: %ldns\n", time_now);
 			printf("PV Clock Wall Clock after busy wait: %ldns\n", wall_clock_offset + time_now);
 
-			struct gnttab_map_grant_ref op;
-			int rc;
-			op.ref = (grant_ref_t)511;
-			op.dom = (domid_t)5;
-			op.host_addr = (uint64_t)info->shared_page;
-			op.flags = GNTMAP_host_map;
-			rc = HYPERVISOR_grant_table_op(GNTTABOP_map_grant_ref, &op, 1);
-			if (rc != 0 || op.status != GNTST_okay)
-			{
-				printf("GNTTABOP_map_grant_ref failed, return value:%d, status:%d\n", rc, op.status);
-			}
-			else
-			{
-				printf("Message read from shared memory: %s\n", (char *)op.host_addr);
-			}
+			xring_bench_consume(info->shared_page); // Until Assignment_3 is done sending.
 		}
 		else
 		{
@@ -219,27 +206,35 @@ void pvclock_init()
 	pvclock_wc = (pvclock_wall_clock_t *)&xen_shared_info->wc_version;
 }
 
+/*
+ * Xen system time: the TSC, scaled by tsc_to_system_mul and tsc_shift, since tsc_timestamp. Xen
+ * makes version odd while it updates the fields, so they are copied out between two reads of
+ * the same even version. x86 does not reorder loads with other loads, a compiler barrier keeps
+ * the copy between the version reads and lfence keeps rdtsc from running ahead of it.
+ */
 uint64_t pvclock_monotonic_read()
 {
-	uint32_t version;
-	uint64_t delta, time_now;
+	uint32_t version, mul;
+	uint64_t tsc, tsc_timestamp, system_time;
+	int8_t shift;
 	do
 	{
 		version = pvclock_ti->version;
-		__asm__("mfence" ::
-					: "memory");
-		delta = rdtsc() - pvclock_ti->tsc_timestamp;
-		if (pvclock_ti->tsc_shift < 0)
-			delta >>= -pvclock_ti->tsc_shift;
-		else
-			delta <<= pvclock_ti->tsc_shift;
-		time_now = mul64_32(delta, pvclock_ti->tsc_to_system_mul) +
-				   pvclock_ti->system_time;
-		__asm__("mfence" ::
-					: "memory");
-	} while ((pvclock_ti->version & 1) || (pvclock_ti->version != version));
-
-	return (uint64_t)time_now; // current time in nano seconds.
+		__asm__ __volatile__("" ::: "memory");
+		tsc_timestamp = pvclock_ti->tsc_timestamp;
+		system_time = pvclock_ti->system_time;
+		mul = pvclock_ti->tsc_to_system_mul;
+		shift = pvclock_ti->tsc_shift;
+		tsc = rdtsc_ordered();
+		__asm__ __volatile__("" ::: "memory");
+	} while ((version & 1) || pvclock_ti->version != version);
+
+	uint64_t delta = tsc - tsc_timestamp;
+	if (shift < 0)
+		delta >>= -shift;
+	else
+		delta <<= shift;
+	return mul64_32(delta, mul) + system_time; // current time in nano seconds.
 }
 
 uint64_t pvclock_wc_read()
@@ -252,7 +247,7 @@ uint64_t pvclock_wc_read()
 		version = pvclock_wc->version;
 		__asm__("mfence" ::
 					: "memory");
-		wc_boot = pvclock_wc->sec * NSEC_PER_SEC;
+		wc_boot = (((uint64_t)pvclock_wc->sec_hi << 32) | pvclock_wc->sec) * NSEC_PER_SEC;
 		wc_boot += pvclock_wc->nsec;
 		__asm__("mfence" ::
 					: "memory");
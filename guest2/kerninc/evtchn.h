@@ -0,0 +1,14 @@
+#pragma once
+
+#include <types.h>
+#include <hypercall.h>
+#include <event_channel.h>
+
+/*
+ * This guest takes no interrupts from Xen, it waits for events with SCHEDOP_poll.
+ */
+int evtchn_bind_interdomain(domid_t remote_dom, evtchn_port_t remote_port, evtchn_port_t *local_port);
+int evtchn_send(evtchn_port_t port);
+int evtchn_close(evtchn_port_t port);
+void evtchn_poll(evtchn_port_t port);
+void evtchn_poll_until(evtchn_port_t port, uint64_t deadline);
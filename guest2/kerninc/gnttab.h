@@ -3,6 +3,7 @@
 
 #include <hypercall.h>
 #include <grant_table.h>
+#include <gnttab_map.h>
 
 extern grant_entry_v1_t *gnttab_table;
 
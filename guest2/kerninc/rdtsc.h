@@ -9,6 +9,16 @@ rdtsc(void)
 	return ((uint64_t)edx << 32) | eax;
 }
 
+/* Not executed before earlier loads, for reading the TSC along with data that goes with it. */
+static inline uint64_t
+rdtsc_ordered(void)
+{
+	uint32_t eax, edx;
+	__asm__ __volatile__("lfence; rdtsc"
+						 : "=a"(eax), "=d"(edx)::"memory");
+	return ((uint64_t)edx << 32) | eax;
+}
+
 static inline uint64_t
 mul64_32(uint64_t a, uint32_t b)
 {
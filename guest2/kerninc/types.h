@@ -64,5 +64,6 @@ struct pvclock_wall_clock {
 	uint32_t version;
 	uint32_t sec;
 	uint32_t nsec;
+	uint32_t sec_hi; // Xen on x86_64: wc_sec_hi, the high word of sec. Not part of KVM's.
 } __attribute__((__packed__));
 typedef struct pvclock_wall_clock pvclock_wall_clock_t;
\ No newline at end of file
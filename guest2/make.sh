@@ -5,17 +5,25 @@ clang -m64 -O2 -fshort-wchar -I ../Include -I ../Include/X64 -mcmodel=small -mno
 lld-link /dll /nodefaultlib /safeseh:no /machine:AMD64 /entry:efi_main boot.o /out:boot.dll
 ../fwimage/fwimage app boot.dll boot.efi
 
-# Compile the kernel
-gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c kernel_entry.S
-gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c apic.c
-gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c kernel.c
-gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c kernel_asm.S
-gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c kernel_syscall.c
-gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c printf.c
-gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c fb.c
-gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c ascii_font.c
-gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c gnttab.c
-ld --oformat=binary -T ./kernel.lds -nostdlib -melf_x86_64 -pie kernel_entry.o apic.o kernel.o kernel_asm.o kernel_syscall.o printf.o fb.o ascii_font.o gnttab.o -o kernel
+# Compile the kernel, with the ring, XenStore, grant mapping and string code of Assignment_3
+# and its headers for those guest2 has no copy of
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I ../Assignment_3/kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c kernel_entry.S
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I ../Assignment_3/kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c apic.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I ../Assignment_3/kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c kernel.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I ../Assignment_3/kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c kernel_asm.S
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I ../Assignment_3/kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c kernel_syscall.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I ../Assignment_3/kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c printf.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I ../Assignment_3/kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c fb.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I ../Assignment_3/kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c ascii_font.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I ../Assignment_3/kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c gnttab.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I ../Assignment_3/kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c ../Assignment_3/gnttab_map.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I ../Assignment_3/kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c ../Assignment_3/string.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I ../Assignment_3/kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c evtchn.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I ../Assignment_3/kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c ../Assignment_3/xring.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I ../Assignment_3/kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c xring_bench.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I ../Assignment_3/kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c gnttab_bench.c
+gcc -Wall -Wno-builtin-declaration-mismatch -D__XEN_INTERFACE_VERSION__=0x040601 -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./kerninc -I ../Assignment_3/kerninc -I/usr/include/xen -pie -fno-zero-initialized-in-bss -c ../Assignment_3/xenstore.c
+ld --oformat=binary -T ./kernel.lds -nostdlib -melf_x86_64 -pie kernel_entry.o apic.o kernel.o kernel_asm.o kernel_syscall.o printf.o fb.o ascii_font.o gnttab.o gnttab_map.o string.o evtchn.o xring.o xring_bench.o gnttab_bench.o xenstore.o -o kernel
 
 # Comple the user application
 gcc -Wall -Wno-builtin-declaration-mismatch -O2 -mno-red-zone -nostdinc -fno-stack-protector -I ./userinc -pie -fno-zero-initialized-in-bss -c user_entry.S
@@ -0,0 +1,234 @@
+/*
+ * Receives the ring benchmark of Assignment_3 (its xring_bench.c): finds it through XenStore
+ * (see xring_bench.h), or assumes domain XRING_PEER_DOMID and XRING_BENCH_HEADER_REF without,
+ * maps the ring header and the data pages listed there, binds to its event channel and reads
+ * until XRING_BENCH_DONE. Space is handed back in batches and either side only gets an event
+ * when it sleeps, this one in SCHEDOP_poll.
+ */
+
+#include <types.h>
+#include <xring.h>
+#include <xring_bench.h>
+#include <evtchn.h>
+#include <gnttab.h>
+#include <xenstore.h>
+#include <rdtsc.h>
+#include <errno.h>
+#include <printf.h>
+
+#define XRING_PEER_DOMID 5 // Assignment_3, without XenStore.
+#define XRING_LOCAL_PAGES 16 // Data pages the bootloader left room for after the header, then as much memory.
+#define XRING_MAP_TIMEOUT_NS (30ULL * NSEC_PER_SEC)
+#define XRING_PAGE_SIZE 0x1000ULL
+#define XRING_XS_MAX_DOMID 64 // Domains looked at for XRING_XS_PEER.
+#define XRING_XS_SCAN_NS (100ULL * 1000000)
+
+uint64_t pvclock_monotonic_read();
+void gnttab_bench(domid_t domid, const grant_ref_t *refs, unsigned int nr_pages, unsigned long window, void *buf);
+
+static uint8_t xring_buf[XRING_BENCH_MAX_MSG];
+static grant_handle_t xring_handles[XRING_LOCAL_PAGES + 1];
+static domid_t xring_peer = XRING_PEER_DOMID;
+
+/*
+ * Looks for Assignment_3 in XenStore until deadline: the first other domain with XRING_XS_PEER,
+ * readable now or once it has booted. Writes this domain's id there and waits for the grant of
+ * the ring header and the event channel.
+ */
+static int xring_discover(grant_ref_t *ref, evtchn_port_t *port, uint64_t deadline)
+{
+	uint32_t self, domid = 0, value;
+	char path[XS_PATH_MAX];
+	int ret = xs_read_uint("domid", &self);
+	while (ret == 0)
+	{
+		for (domid = 1; domid < XRING_XS_MAX_DOMID; domid++)
+		{
+			char peer[12];
+			if (domid != self && xs_domain_path(path, sizeof(path), domid, XRING_XS_PEER) == 0 &&
+				xs_read(path, peer, sizeof(peer)) >= 0)
+				break;
+		}
+		if (domid < XRING_XS_MAX_DOMID)
+			break;
+		if (pvclock_monotonic_read() >= deadline)
+			return -ETIMEDOUT;
+		ret = xs_wait_watch(path, sizeof(path), XRING_XS_SCAN_NS); // Nothing is watched, a sleep.
+		ret = ret == -ETIMEDOUT ? 0 : ret;
+	}
+	if (ret == 0)
+		ret = xs_write_uint(path, self);
+	if (ret == 0)
+		ret = xs_domain_path(path, sizeof(path), domid, XRING_XS_REF);
+	if (ret == 0)
+		ret = xs_watch(path, XRING_XS_TOKEN);
+	if (ret != 0)
+		return ret;
+
+	char event[XS_PATH_MAX];
+	while ((ret = xs_read_uint(path, &value)) == -ENOENT || ret == -EINVAL) // Until it is written.
+	{
+		uint64_t now = pvclock_monotonic_read();
+		if (now >= deadline)
+		{
+			ret = -ETIMEDOUT;
+			break;
+		}
+		ret = xs_wait_watch(event, sizeof(event), deadline - now);
+		if (ret < 0 && ret != -ETIMEDOUT)
+			break;
+	}
+	xs_unwatch(path, XRING_XS_TOKEN);
+	if (ret != 0)
+		return ret;
+	*ref = value;
+	ret = xs_domain_path(path, sizeof(path), domid, XRING_XS_PORT);
+	if (ret == 0)
+		ret = xs_read_uint(path, &value);
+	if (ret != 0)
+		return ret;
+	*port = value;
+	xring_peer = (domid_t)domid;
+	return 0;
+}
+
+/*
+ * The header, once Assignment_3 has granted it: it may boot after this guest. port is its event
+ * channel.
+ */
+static xring_page_t *xring_connect(uintptr_t pages, evtchn_port_t *port)
+{
+	grant_ref_t ref = XRING_BENCH_HEADER_REF;
+	uint64_t start = pvclock_monotonic_read();
+	int rc;
+	*port = 0;
+	if (xs_init(evtchn_poll_until, pvclock_monotonic_read) == 0)
+	{
+		rc = xring_discover(&ref, port, start + XRING_MAP_TIMEOUT_NS);
+		if (rc != 0)
+		{
+			printf("No ring in XenStore: %d\n", rc);
+			return NULL;
+		}
+		printf("Ring: domain %d in XenStore, grant %d, event channel %d\n", xring_peer, ref, *port);
+	}
+	while ((rc = gnttab_map_pages(xring_peer, &ref, 1, pages, 0, xring_handles)) != 0)
+	{
+		if (pvclock_monotonic_read() - start > XRING_MAP_TIMEOUT_NS)
+		{
+			printf("Could not map the ring header of domain %d: %d\n", xring_peer, rc);
+			return NULL;
+		}
+		HYPERVISOR_sched_op(SCHEDOP_yield, NULL);
+	}
+
+	xring_page_t *page = (xring_page_t *)pages;
+	if (__atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) != XRING_MAGIC || page->nr_pages > XRING_LOCAL_PAGES ||
+		(page->nr_pages & (page->nr_pages - 1)) != 0)
+	{
+		printf("No ring in the shared page of domain %d!\n", xring_peer);
+		gnttab_unmap_pages(pages, xring_handles, 1);
+		return NULL;
+	}
+	rc = gnttab_map_pages(xring_peer, page->refs, page->nr_pages, pages + XRING_PAGE_SIZE, 0,
+						  xring_handles + 1); // One hypercall for all of them.
+	if (rc != 0)
+	{
+		printf("Could not map the ring of domain %d: %d\n", xring_peer, rc);
+		gnttab_unmap_pages(pages, xring_handles, 1);
+		return NULL;
+	}
+	if (*port == 0)
+		*port = page->port;
+	return page;
+}
+
+/*
+ * pages is the ring header, room for XRING_LOCAL_PAGES data pages and XRING_LOCAL_PAGES pages of
+ * memory. Once the ring is done, the data pages are read again to compare copying with mapping.
+ */
+void xring_bench_consume(uintptr_t pages)
+{
+	evtchn_port_t remote, port;
+	xring_page_t *page = xring_connect(pages, &remote);
+	if (page == NULL)
+		return;
+	int rc = evtchn_bind_interdomain(xring_peer, remote, &port);
+	if (rc != 0)
+	{
+		printf("Could not bind to event channel %d of domain %d: %d\n", remote, xring_peer, rc);
+		gnttab_unmap_pages(pages, xring_handles, page->nr_pages + 1);
+		return;
+	}
+	xring_t ring;
+	xring_attach(&ring, &page->ring, (void *)(pages + XRING_PAGE_SIZE), page->nr_pages * XRING_PAGE_SIZE);
+	__atomic_store_n(&page->connected, 1, __ATOMIC_RELEASE);
+	evtchn_send(port);
+	printf("Ring: connected to domain %d, %d pages\n", xring_peer, page->nr_pages);
+
+	uint64_t start = 0, bytes = 0, msgs = 0;
+	uint64_t lat_min = ~0ULL, lat_max = 0, lat_sum = 0, lat_count = 0;
+	for (;;)
+	{
+		int len = xring_read(&ring, xring_buf, sizeof(xring_buf));
+		if (len == -EAGAIN)
+		{
+			if (xring_release(&ring))
+				evtchn_send(port);
+			if (!xring_prepare_read(&ring))
+				evtchn_poll(port);
+			continue;
+		}
+		if (len < (int)sizeof(struct xring_bench_msg))
+		{
+			printf("Bad message on the ring: %d\n", len);
+			break;
+		}
+
+		struct xring_bench_msg *msg = (struct xring_bench_msg *)xring_buf;
+		uint64_t now = pvclock_monotonic_read();
+		if (msg->type == XRING_BENCH_DATA)
+		{
+			if (msgs++ == 0)
+				start = now;
+			bytes += len;
+			if (ring.cons_pvt - page->ring.cons >= ring.size / 4 && xring_release(&ring)) // Batched.
+				evtchn_send(port);
+			continue;
+		}
+		if (xring_release(&ring)) // Anything else, Assignment_3 waits for it to be read.
+			evtchn_send(port);
+		if (msg->type == XRING_BENCH_END && msgs > 1)
+		{
+			uint64_t ns = now - start;
+			uint64_t bytes_per_sec = bytes * NSEC_PER_SEC / ns;
+			printf("Ring from domain %d: %d byte messages, %ld.%02ld GB/s, %ld messages/s\n", xring_peer,
+				   msg->size, bytes_per_sec / 1000000000, bytes_per_sec / 10000000 % 100, msgs * NSEC_PER_SEC / ns);
+			bytes = msgs = 0;
+		}
+		else if (msg->type == XRING_BENCH_PING)
+		{
+			uint64_t ns = now - msg->sent_ns;
+			lat_min = ns < lat_min ? ns : lat_min;
+			lat_max = ns > lat_max ? ns : lat_max;
+			lat_sum += ns;
+			lat_count++;
+		}
+		else if (msg->type == XRING_BENCH_DONE)
+		{
+			if (lat_count != 0)
+				printf("Ring latency from domain %d: min %ld ns, avg %ld ns, max %ld ns\n", xring_peer,
+					   lat_min, lat_sum / lat_count, lat_max);
+			break;
+		}
+	}
+	evtchn_close(port);
+
+	grant_ref_t refs[XRING_LOCAL_PAGES];
+	uint32_t nr_pages = page->nr_pages;
+	for (uint32_t i = 0; i < nr_pages; i++)
+		refs[i] = page->refs[i];
+	gnttab_unmap_pages(pages, xring_handles, nr_pages + 1);
+	gnttab_bench(xring_peer, refs, nr_pages, pages + XRING_PAGE_SIZE,
+				 (void *)(pages + (XRING_LOCAL_PAGES + 1) * XRING_PAGE_SIZE));
+}